@@ -0,0 +1,602 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "grades.h"
+
+// bench <what> <records> <filename>: fills <filename> with generated records and times the
+// storage paths on it. Overwrites <filename>, so give it a scratch file.
+
+#define BENCH_WRITE_BUFFER (1024 * 1024)
+#define BENCH_LOOKUPS 100000
+#define BENCH_ADDS 10000
+#define BENCH_FORKS 200
+#define BENCH_SERVED 20000
+#define BENCH_SYNC_LINES 2000 // fdatasync per line is slow, fewer of them
+
+static const char *benchGrades[] = { "AA", "BA", "BB", "CB", "CC", "DC", "DD", "FF" };
+
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t benchRandom(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void benchName(char *name, size_t size, long i) {
+    snprintf(name, size, "Student%07ld Surname%ld", i, i % 977);
+}
+
+// Write records generated names 0 .. records-1 to filename, in a scrambled order when shuffled,
+// returns its size or -1
+static off_t benchFill(const char *filename, long records, int shuffled) {
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    char *buffer = malloc(BENCH_WRITE_BUFFER);
+    if (fd == -1 || buffer == NULL) {
+        perror("bench");
+        free(buffer);
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    size_t used = 0;
+    off_t size = 0;
+    char name[MAX_NAME_LENGTH];
+    for (long i = 0; i < records; i++) {
+        if (used + MAX_LINE_LENGTH > BENCH_WRITE_BUFFER) {
+            write(fd, buffer, used);
+            size += used;
+            used = 0;
+        }
+        // 2654435761 is prime, so i -> i * 2654435761 % records visits every name once
+        long n = shuffled ? (long)((uint64_t)i * 2654435761ULL % records) : i;
+        benchName(name, sizeof(name), n);
+        used += snprintf(buffer + used, MAX_LINE_LENGTH, "%s, %s\n", name, benchGrades[n % 8]);
+    }
+    write(fd, buffer, used);
+    size += used;
+    close(fd);
+    free(buffer);
+    return size;
+}
+
+// searchStudent before the index: one read() per byte up to the record
+static int byteScanFind(const char *filename, const char *inputName) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    char name[MAX_NAME_LENGTH];
+    int nameIndex = 0;
+    char c;
+    while (read(fd, &c, 1) > 0) {
+        if (c == ',') {
+            name[nameIndex] = '\0';
+            if (strcmp(name, inputName) == 0) {
+                close(fd);
+                return 1;
+            }
+            nameIndex = 0;
+        } else if (c == '\n') {
+            nameIndex = 0;
+        } else if (nameIndex < MAX_NAME_LENGTH - 1) {
+            name[nameIndex++] = c;
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+static void benchIndex(long records, const char *filename) {
+    double start = nowSeconds();
+    off_t size = benchFill(filename, records, 0);
+    if (size == -1) {
+        return;
+    }
+    printf("%ld records, %.1f MB written in %.3f s\n", records, size / 1e6, nowSeconds() - start);
+
+    char indexPath[MAX_LINE_LENGTH + sizeof(INDEX_SUFFIX)];
+    snprintf(indexPath, sizeof(indexPath), "%s%s", filename, INDEX_SUFFIX);
+    unlink(indexPath);
+    start = nowSeconds();
+    gradeIndex *index = indexOpen(filename, 1);
+    if (index == NULL) {
+        perror("bench: index");
+        return;
+    }
+    indexClose(index);
+    printf("%-28s %12.3f ms\n", "index build", (nowSeconds() - start) * 1e3);
+
+    start = nowSeconds();
+    for (int i = 0; i < 100; i++) {
+        indexClose(indexOpen(filename, 0));
+    }
+    printf("%-28s %12.3f ms\n", "open, index up to date", (nowSeconds() - start) * 1e3 / 100);
+
+    index = indexOpen(filename, 1);
+    uint64_t state = 88172645463325252ULL;
+    char name[MAX_NAME_LENGTH];
+    char grade[MAX_GRADE_LENGTH + 1];
+    long found = 0;
+    start = nowSeconds();
+    for (int i = 0; i < BENCH_LOOKUPS; i++) {
+        long n = benchRandom(&state) % records;
+        benchName(name, sizeof(name), n);
+        found += indexFind(index, name, grade, sizeof(grade)) == 1 && strcmp(grade, benchGrades[n % 8]) == 0;
+    }
+    printf("%-28s %12.3f us  (%ld of %d found)\n", "search, indexed", (nowSeconds() - start) * 1e6 / BENCH_LOOKUPS,
+           found, BENCH_LOOKUPS);
+
+    found = 0;
+    start = nowSeconds();
+    for (int i = 0; i < BENCH_LOOKUPS; i++) {
+        benchName(name, sizeof(name), records + benchRandom(&state) % records);
+        found += indexFind(index, name, NULL, 0) == 1;
+    }
+    printf("%-28s %12.3f us  (%ld found)\n", "search absent, indexed", (nowSeconds() - start) * 1e6 / BENCH_LOOKUPS, found);
+
+    start = nowSeconds();
+    for (long i = 0; i < BENCH_ADDS; i++) {
+        benchName(name, sizeof(name), records + i);
+        if (indexFind(index, name, NULL, 0) != 0 || indexAppend(index, name, benchGrades[i % 8]) == -1) {
+            printf("add of %s failed\n", name);
+            break;
+        }
+    }
+    printf("%-28s %12.3f us\n", "add with duplicate check", (nowSeconds() - start) * 1e6 / BENCH_ADDS);
+    indexClose(index);
+
+    // The old path reads byte by byte, one lookup in the middle of the file is enough to see it
+    benchName(name, sizeof(name), records / 2);
+    start = nowSeconds();
+    int scanFound = byteScanFind(filename, name);
+    printf("%-28s %12.3f ms  (%s)\n", "search, byte at a time", (nowSeconds() - start) * 1e3,
+           scanFound == 1 ? "found" : "not found");
+}
+
+// bench sort: sortAll by name and by grade, in memory and with an eighth of the file as budget
+static void benchSort(long records, const char *filename) {
+    off_t size = benchFill(filename, records, 1);
+    if (size == -1) {
+        return;
+    }
+    printf("%ld records, %.1f MB\n", records, size / 1e6);
+    FILE *out = fopen("/dev/null", "w");
+    if (out == NULL) {
+        perror("bench");
+        return;
+    }
+    size_t budgets[] = { SORT_DEFAULT_MEMORY > (size_t)size * 4 ? SORT_DEFAULT_MEMORY : (size_t)size * 4, (size_t)size / 8 };
+    printf("%-8s %12s %6s %12s\n", "key", "budget MB", "runs", "seconds");
+    for (int byGrade = 0; byGrade < 2; byGrade++) {
+        for (int b = 0; b < 2; b++) {
+            int runCount = 0;
+            double start = nowSeconds();
+            long sorted = sortGrades(filename, byGrade, budgets[b], 1, out, &runCount);
+            double seconds = nowSeconds() - start;
+            if (sorted != records) {
+                printf("sort failed (%ld records)\n", sorted);
+            }
+            printf("%-8s %12.1f %6d %12.3f\n", byGrade ? "grade" : "name", budgets[b] / 1048576.0, runCount, seconds);
+        }
+    }
+    fclose(out);
+}
+
+// bench psort: in memory sortAll on 1, 2, 4 ... threads up to twice the CPUs (at least 8),
+// speedup against one
+static void benchParallelSort(long records, const char *filename) {
+    off_t size = benchFill(filename, records, 1);
+    if (size == -1) {
+        return;
+    }
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    long maxThreads = 2 * cpus > 8 ? 2 * cpus : 8;
+    printf("%ld records, %.1f MB, %ld CPUs\n", records, size / 1e6, cpus);
+    FILE *out = fopen("/dev/null", "w");
+    if (out == NULL) {
+        perror("bench");
+        return;
+    }
+    size_t budget = SORT_DEFAULT_MEMORY > (size_t)size * 6 ? SORT_DEFAULT_MEMORY : (size_t)size * 6;
+    printf("%-8s %8s %12s %9s\n", "key", "threads", "seconds", "speedup");
+    for (int byGrade = 0; byGrade < 2; byGrade++) {
+        double single = 0;
+        for (int threads = 1; threads <= SORT_MAX_THREADS && threads <= maxThreads; threads *= 2) {
+            double start = nowSeconds();
+            long sorted = sortGrades(filename, byGrade, budget, threads, out, NULL);
+            double seconds = nowSeconds() - start;
+            if (sorted != records) {
+                printf("sort failed (%ld records)\n", sorted);
+            }
+            if (threads == 1) {
+                single = seconds;
+            }
+            printf("%-8s %8d %12.3f %8.2fx\n", byGrade ? "grade" : "name", threads, seconds, single / seconds);
+        }
+    }
+    fclose(out);
+}
+
+// bench serve: a search per command the way the prompt runs it, a child each, against searches
+// and adds answered by serve from memory. Both log every command.
+static void benchServe(long records, const char *filename) {
+    off_t size = benchFill(filename, records, 0);
+    FILE *out = fopen("/dev/null", "w");
+    if (size == -1 || out == NULL) {
+        perror("bench");
+        if (out != NULL) {
+            fclose(out);
+        }
+        return;
+    }
+    printf("%ld records, %.1f MB\n", records, size / 1e6);
+    char indexPath[MAX_LINE_LENGTH + sizeof(INDEX_SUFFIX)];
+    snprintf(indexPath, sizeof(indexPath), "%s%s", filename, INDEX_SUFFIX);
+    unlink(indexPath);
+    indexClose(indexOpen(filename, 1));
+
+    uint64_t state = 88172645463325252ULL;
+    char name[MAX_NAME_LENGTH];
+    double start = nowSeconds();
+    int forks = 0;
+    for (; forks < BENCH_FORKS; forks++) {
+        benchName(name, sizeof(name), benchRandom(&state) % records);
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == -1) {
+            perror("bench: fork");
+            break;
+        }
+        if (pid == 0) {
+            dup2(fileno(out), STDOUT_FILENO);
+            searchStudent(filename, name);
+            exit(0);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    printf("%-28s %12.3f us\n", "search, child per command", (nowSeconds() - start) * 1e6 / forks);
+
+    residentGrades grades;
+    start = nowSeconds();
+    if (residentOpen(&grades, filename) == -1) {
+        perror("bench: serve");
+        fclose(out);
+        return;
+    }
+    printf("%-28s %12.3f ms\n", "serve, load", (nowSeconds() - start) * 1e3);
+
+    char line[3 * MAX_LINE_LENGTH];
+    start = nowSeconds();
+    for (int i = 0; i < BENCH_SERVED; i++) {
+        benchName(name, sizeof(name), benchRandom(&state) % records);
+        snprintf(line, sizeof(line), "searchStudent \"%s\" \"%s\"", name, filename);
+        serveCommand(&grades, line, out);
+    }
+    printf("%-28s %12.3f us\n", "search, served", (nowSeconds() - start) * 1e6 / BENCH_SERVED);
+
+    start = nowSeconds();
+    for (int i = 0; i < BENCH_SERVED; i++) {
+        benchName(name, sizeof(name), records + i);
+        snprintf(line, sizeof(line), "addStudentGrade \"%s\" \"%s\" \"%s\"", name, benchGrades[i % 8], filename);
+        serveCommand(&grades, line, out);
+    }
+    printf("%-28s %12.3f us  (%zu records now)\n", "add, served", (nowSeconds() - start) * 1e6 / BENCH_SERVED,
+           grades.store.count);
+    residentClose(&grades);
+    fclose(out);
+}
+
+// logTaskCompletion before tasklog.c: open, format and close for every line
+static void legacyLog(const char *taskName) {
+    FILE *logFile = fopen(LOG_FILE, "a");
+    if (logFile == NULL) {
+        return;
+    }
+    time_t currentTime;
+    time(&currentTime);
+    fprintf(logFile, "[%s] Task completed: %s\n", strtok(ctime(&currentTime), "\n"), taskName);
+    fclose(logFile);
+}
+
+// bench log: bulk insert through serve, every add logs a line, with each durability level
+// against the logger it replaced. The log alone is timed as well.
+static void benchLog(long records, const char *filename) {
+    static const char *levels[] = { "open per line", "batch", "line", "sync" };
+    FILE *out = fopen("/dev/null", "w");
+    if (out == NULL) {
+        perror("bench");
+        return;
+    }
+    char name[MAX_NAME_LENGTH];
+    char line[3 * MAX_LINE_LENGTH];
+    printf("%-14s %8s %12s %12s\n", "log", "records", "log us", "add us");
+    for (int level = 0; level < 4; level++) {
+        long count = level == 3 && records > BENCH_SYNC_LINES ? BENCH_SYNC_LINES : records;
+        if (level > 0) {
+            logSetDurability(level == 1 ? LOG_BATCH : level == 2 ? LOG_LINE : LOG_SYNC);
+        }
+        double start = nowSeconds();
+        for (long i = 0; i < count; i++) {
+            benchName(name, sizeof(name), i);
+            snprintf(line, sizeof(line), "Add Student Grade: %s, %s", name, benchGrades[i % 8]);
+            if (level == 0) {
+                legacyLog(line);
+            }
+            else {
+                logTaskCompletion(line);
+            }
+        }
+        logFlush();
+        double logSeconds = nowSeconds() - start;
+
+        // The adds log through logTaskCompletion, the old logger is timed by calling it on top
+        if (benchFill(filename, 0, 0) == -1) {
+            break;
+        }
+        residentGrades grades;
+        if (residentOpen(&grades, filename) == -1) {
+            perror("bench: serve");
+            break;
+        }
+        if (level == 0) {
+            logSetDurability(LOG_BATCH);
+        }
+        start = nowSeconds();
+        for (long i = 0; i < count; i++) {
+            benchName(name, sizeof(name), i);
+            snprintf(line, sizeof(line), "addStudentGrade \"%s\" \"%s\" \"%s\"", name, benchGrades[i % 8], filename);
+            serveCommand(&grades, line, out);
+            if (level == 0) {
+                snprintf(line, sizeof(line), "Add Student Grade: %s, %s", name, benchGrades[i % 8]);
+                legacyLog(line);
+            }
+        }
+        logFlush();
+        double addSeconds = nowSeconds() - start;
+        residentClose(&grades);
+        printf("%-14s %8ld %12.3f %12.3f\n", levels[level], count, logSeconds * 1e6 / count, addSeconds * 1e6 / count);
+    }
+    logSetDurability(LOG_BATCH);
+    fclose(out);
+}
+
+// A child that reads and drops whatever comes through a pipe, so output is paid for the way a
+// terminal or a pipe pays for it; /dev/null would not even touch the bytes. Returns the write end.
+static int benchDrain(pid_t *pid) {
+    int fds[2];
+    if (pipe(fds) == -1) {
+        return -1;
+    }
+    fflush(stdout);
+    *pid = fork();
+    if (*pid == -1) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (*pid == 0) {
+        close(fds[1]);
+        char buffer[64 * 1024];
+        while (read(fds[0], buffer, sizeof(buffer)) > 0) {
+        }
+        _exit(0);
+    }
+    close(fds[0]);
+    return fds[1];
+}
+
+// searchStudent's scan with stdio, a line at a time
+static int fgetsScanFind(const char *filename, const char *inputName) {
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    size_t len = strlen(inputName);
+    char line[MAX_LINE_LENGTH];
+    while (fgets(line, sizeof(line), file)) {
+        if (strncmp(line, inputName, len) == 0 && line[len] == ',') {
+            fclose(file);
+            return 1;
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+// bench read: showAll with fgets and printf against the mapping and writev, into a pipe, and
+// searchStudent by scanning with stdio, by scanning the mapping and through the index
+static void benchRead(long records, const char *filename) {
+    off_t size = benchFill(filename, records, 0);
+    if (size == -1) {
+        return;
+    }
+    printf("%ld records, %.1f MB\n", records, size / 1e6);
+
+    for (int mapped = 0; mapped < 2; mapped++) {
+        pid_t pid;
+        int fd = benchDrain(&pid);
+        if (fd == -1) {
+            perror("bench");
+            return;
+        }
+        double start = nowSeconds();
+        if (mapped) {
+            mappedGrades map;
+            if (mapOpen(&map, filename) == 0) {
+                lineBatch batch;
+                batchInit(&batch, fd);
+                batchAdd(&batch, map.data, map.size);
+                batchFlush(&batch);
+                mapClose(&map);
+            }
+            close(fd);
+        }
+        else {
+            FILE *out = fdopen(fd, "w");
+            FILE *file = fopen(filename, "r");
+            char line[MAX_LINE_LENGTH];
+            while (file != NULL && fgets(line, sizeof(line), file)) {
+                fprintf(out, "%s", line);
+            }
+            if (file != NULL) {
+                fclose(file);
+            }
+            fclose(out);
+        }
+        waitpid(pid, NULL, 0);
+        double seconds = nowSeconds() - start;
+        printf("%-28s %12.3f ms  %8.1f MB/s\n", mapped ? "showAll, mmap and writev" : "showAll, fgets and printf",
+               seconds * 1e3, size / 1e6 / seconds);
+    }
+
+    char middle[MAX_NAME_LENGTH];
+    char absent[MAX_NAME_LENGTH];
+    char grade[MAX_GRADE_LENGTH + 1];
+    benchName(middle, sizeof(middle), records / 2);
+    benchName(absent, sizeof(absent), records);
+    for (int i = 0; i < 2; i++) {
+        const char *name = i == 0 ? middle : absent;
+        double start = nowSeconds();
+        int found = fgetsScanFind(filename, name);
+        printf("%-28s %12.3f ms  (%s)\n", i == 0 ? "search middle, fgets" : "search absent, fgets",
+               (nowSeconds() - start) * 1e3, found == 1 ? "found" : "not found");
+        start = nowSeconds();
+        mappedGrades map;
+        found = mapOpen(&map, filename) == 0 ? mapFind(&map, name, grade, sizeof(grade)) : -1;
+        mapClose(&map);
+        printf("%-28s %12.3f ms  (%s)\n", i == 0 ? "search middle, mmap scan" : "search absent, mmap scan",
+               (nowSeconds() - start) * 1e3, found == 1 ? "found" : "not found");
+    }
+
+    char indexPath[MAX_LINE_LENGTH + sizeof(INDEX_SUFFIX)];
+    snprintf(indexPath, sizeof(indexPath), "%s%s", filename, INDEX_SUFFIX);
+    unlink(indexPath);
+    double start = nowSeconds();
+    indexClose(indexOpen(filename, 1));
+    printf("%-28s %12.3f ms\n", "index build", (nowSeconds() - start) * 1e3);
+    start = nowSeconds();
+    gradeIndex *index = indexOpen(filename, 0);
+    int found = index != NULL ? indexFind(index, middle, grade, sizeof(grade)) : -1;
+    indexClose(index);
+    printf("%-28s %12.3f ms  (%s)\n", "search middle, indexed", (nowSeconds() - start) * 1e3,
+           found == 1 ? "found" : "not found");
+}
+
+// What showAll piped into grep does for a query: every line read, the matching ones printed
+static long grepScan(const char *filename, int kind, const char *from, FILE *out) {
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    size_t len = strlen(from);
+    long found = 0;
+    char line[MAX_LINE_LENGTH];
+    while (fgets(line, sizeof(line), file)) {
+        char *comma = strchr(line, ',');
+        if (comma == NULL) {
+            continue;
+        }
+        char *grade = comma + 1 + strspn(comma + 1, " ");
+        if (kind == QUERY_PREFIX ? strncmp(line, from, len) == 0
+                                 : strncmp(grade, from, len) == 0 && grade[len] == '\n') {
+            fputs(line, out);
+            found++;
+        }
+    }
+    fclose(file);
+    return found;
+}
+
+// bench query: prefix and grade queries through the query index against a scan of the file
+static void benchQuery(long records, const char *filename) {
+    off_t size = benchFill(filename, records, 1);
+    FILE *out = fopen("/dev/null", "w");
+    if (size == -1 || out == NULL) {
+        perror("bench");
+        if (out != NULL) {
+            fclose(out);
+        }
+        return;
+    }
+    printf("%ld records, %.1f MB\n", records, size / 1e6);
+    char indexPath[MAX_LINE_LENGTH + sizeof(QUERY_SUFFIX)];
+    snprintf(indexPath, sizeof(indexPath), "%s%s", filename, QUERY_SUFFIX);
+    unlink(indexPath);
+
+    // A prefix that matches a hundred names, the first of them on the first query
+    char prefix[MAX_NAME_LENGTH];
+    benchName(prefix, sizeof(prefix), records / 2);
+    prefix[strlen("Student") + 5] = '\0';
+    struct {
+        const char *what;
+        int kind;
+        const char *from;
+    } queries[] = {
+        { "prefix, index build", QUERY_PREFIX, prefix },
+        { "prefix", QUERY_PREFIX, prefix },
+        { "grade", QUERY_GRADE, "AA" },
+        { "grade, rare", QUERY_GRADE, "ZZ" },
+    };
+    printf("%-22s %10s %14s %14s\n", "query", "found", "indexed ms", "scan ms");
+    for (size_t q = 0; q < sizeof(queries) / sizeof(queries[0]); q++) {
+        double start = nowSeconds();
+        long found = queryGrades(filename, queries[q].kind, queries[q].from, NULL, fileno(out));
+        double indexed = nowSeconds() - start;
+        start = nowSeconds();
+        long scanned = grepScan(filename, queries[q].kind, queries[q].from, out);
+        double scan = nowSeconds() - start;
+        printf("%-22s %10ld %14.3f %14.3f%s\n", queries[q].what, found, indexed * 1e3, scan * 1e3,
+               found == scanned ? "" : "  (scan found a different number)");
+    }
+    fclose(out);
+}
+
+void runBenchmark(char **args, int numArgs) {
+    long records = atol(args[2]);
+    if (numArgs != 4 || records <= 0) {
+        printf("Usage: bench <what> <records> <filename>\n");
+        return;
+    }
+    if (strcmp(args[1], "index") == 0) {
+        benchIndex(records, args[3]);
+    }
+    else if (strcmp(args[1], "sort") == 0) {
+        benchSort(records, args[3]);
+    }
+    else if (strcmp(args[1], "psort") == 0) {
+        benchParallelSort(records, args[3]);
+    }
+    else if (strcmp(args[1], "serve") == 0) {
+        benchServe(records, args[3]);
+    }
+    else if (strcmp(args[1], "log") == 0) {
+        benchLog(records, args[3]);
+    }
+    else if (strcmp(args[1], "read") == 0) {
+        benchRead(records, args[3]);
+    }
+    else if (strcmp(args[1], "query") == 0) {
+        benchQuery(records, args[3]);
+    }
+    else {
+        printf("Unknown benchmark %s, available: index, sort, psort, serve, log, read, query\n", args[1]);
+        return;
+    }
+    char logline[MAX_LINE_LENGTH + 50];
+    snprintf(logline, sizeof(logline), "Benchmark %s (%ld records)", args[1], records);
+    logTaskCompletion(logline);
+}
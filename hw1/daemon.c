@@ -0,0 +1,643 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "grades.h"
+
+// serve <grades file> [socket]: loads the grades file into a gradeStore once and answers the
+// commands from there, in this process, instead of forking a child that opens and reads the file
+// again for each one. Commands come a line each from stdin and, given a socket path, from any
+// number of clients of a Unix socket; answers go back where the command came from.
+//
+// The grades file is the append log of the store: an added record is appended to it under the
+// same flock the index takes, and the next start loads it back. Before every command a stat tells
+// whether other processes changed the file, their appended records are loaded, a file that was
+// replaced, cut or rewritten is loaded again.
+
+#define SERVE_MAX_CLIENTS 64
+#define SERVE_LINE_BUFFER (4 * MAX_LINE_LENGTH)
+#define SERVE_LOAD_BUFFER (256 * 1024)
+
+typedef struct {
+    int fd;
+    FILE *out;
+    char buffer[SERVE_LINE_BUFFER];  // Received bytes not yet a whole command
+    size_t used;
+} serveClient;
+
+static volatile sig_atomic_t serveStop = 0;
+
+// What serve read from stdin past its exit, the commands for the shell after it
+static char stdinLeft[SERVE_LINE_BUFFER];
+static size_t stdinLeftAt;
+static size_t stdinLeftUsed;
+
+static void handleServeStop(int sig) {
+    (void)sig;
+    serveStop = 1;
+}
+
+// Add the lines of the grades file from offset from on to the store. A last line without its
+// newline is added as well and marks the file partial.
+static int residentLoad(residentGrades *grades, off_t from) {
+    char *buffer = malloc(SERVE_LOAD_BUFFER);
+    if (buffer == NULL) {
+        return -1;
+    }
+    off_t offset = from;  // File offset of buffer[0]
+    size_t used = 0;
+    while (1) {
+        ssize_t got = pread(grades->fd, buffer + used, SERVE_LOAD_BUFFER - used, offset + used);
+        if (got == -1 && errno == EINTR) {
+            continue;
+        }
+        if (got == -1) {
+            free(buffer);
+            return -1;
+        }
+        if (got == 0) {
+            break;
+        }
+        used += got;
+
+        char *line = buffer;
+        char *end = buffer + used;
+        char *newline;
+        while ((newline = memchr(line, '\n', end - line)) != NULL) {
+            if (storeAdd(&grades->store, line, newline - line) == -1) {
+                free(buffer);
+                return -1;
+            }
+            line = newline + 1;
+        }
+        if (line == buffer && used == SERVE_LOAD_BUFFER) {
+            // A full buffer without a newline is no grades line
+            free(buffer);
+            errno = EINVAL;
+            return -1;
+        }
+        offset += line - buffer;
+        used = end - line;
+        memmove(buffer, line, used);
+    }
+    grades->partial = used > 0;
+    int result = used > 0 && storeAdd(&grades->store, buffer, used) == -1 ? -1 : 0;
+    grades->stamp.indexedSize = offset + used;
+    free(buffer);
+    return result;
+}
+
+// Stamp what was loaded with the mtime in st, the stat taken before loading: a change while
+// loading shows as an mtime that differs and loads again
+static int residentStamp(residentGrades *grades, const struct stat *st) {
+    if (stampRecord(&grades->stamp, grades->fd, grades->stamp.indexedSize) == -1) {
+        return -1;
+    }
+    grades->stamp.dataMtimeSec = st->st_mtim.tv_sec;
+    grades->stamp.dataMtimeNsec = st->st_mtim.tv_nsec;
+    return 0;
+}
+
+// Everything again from the start
+static int residentReload(residentGrades *grades) {
+    struct stat st;
+    if (fstat(grades->fd, &st) == -1) {
+        return -1;
+    }
+    storeFree(&grades->store);
+    if (storeIndexNames(&grades->store) == -1 || residentLoad(grades, 0) == -1) {
+        return -1;
+    }
+    return residentStamp(grades, &st);
+}
+
+static int residentRefresh(residentGrades *grades) {
+    struct stat st;
+    if (stat(grades->filename, &st) == -1) {
+        return -1;
+    }
+    if ((uint64_t)st.st_dev != grades->stamp.dataDev || (uint64_t)st.st_ino != grades->stamp.dataIno) {
+        int fd = open(grades->filename, O_RDWR | O_APPEND | O_CLOEXEC);
+        if (fd == -1) {
+            return -1;
+        }
+        close(grades->fd);
+        grades->fd = fd;
+        return residentReload(grades);
+    }
+    // Rewritten, even into a larger file, or the last line the store has was completed
+    uint64_t loaded = grades->stamp.indexedSize;
+    if (!stampIsCurrent(&grades->stamp, grades->fd, &st) || (grades->partial && (uint64_t)st.st_size != loaded)) {
+        return residentReload(grades);
+    }
+    if ((uint64_t)st.st_size == loaded) {
+        return 0;
+    }
+    // Appended to, the new lines are all there is to load
+    if (residentLoad(grades, loaded) == -1) {
+        return -1;
+    }
+    return residentStamp(grades, &st);
+}
+
+int residentOpen(residentGrades *grades, const char *filename) {
+    memset(grades, 0, sizeof(*grades));
+    storeInit(&grades->store);
+    grades->filename = strdup(filename);
+    grades->fd = open(filename, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+    if (grades->filename == NULL || grades->fd == -1 || residentReload(grades) == -1) {
+        residentClose(grades);
+        return -1;
+    }
+    return 0;
+}
+
+void residentClose(residentGrades *grades) {
+    if (grades->fd != -1) {
+        close(grades->fd);
+    }
+    free(grades->filename);
+    storeFree(&grades->store);
+    grades->fd = -1;
+    grades->filename = NULL;
+}
+
+// Take the lock of the grades file and catch up with it, for changes that must not miss a record
+// another process added
+int residentLock(residentGrades *grades) {
+    if (flock(grades->fd, LOCK_EX) == -1) {
+        return -1;
+    }
+    if (residentRefresh(grades) == -1) {
+        flock(grades->fd, LOCK_UN);
+        return -1;
+    }
+    return 0;
+}
+
+// The page file of listSome follows the changes before the lock goes
+void residentUnlock(residentGrades *grades) {
+    pagesUpdate(grades->filename, grades->fd);
+    flock(grades->fd, LOCK_UN);
+}
+
+// Append len bytes of whole lines under the lock, their records are in the store already. When
+// that fails the bytes written of them are cut off again, the store holds records the file does
+// not and is loaded again on the next refresh.
+int residentAppend(residentGrades *grades, const char *data, size_t len) {
+    struct stat st;
+    if (fstat(grades->fd, &st) == -1) {
+        grades->stamp.dataIno = 0;
+        return -1;
+    }
+    off_t before = st.st_size;
+    if (grades->partial) {
+        // Finish the last line first
+        if (write(grades->fd, "\n", 1) != 1) {
+            grades->stamp.dataIno = 0;
+            return -1;
+        }
+        grades->partial = 0;
+    }
+    while (len > 0) {
+        ssize_t written = write(grades->fd, data, len);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written == -1) {
+            grades->stamp.dataIno = 0;
+            if (ftruncate(grades->fd, before) == -1) {
+                perror("serve: ftruncate");
+            }
+            return -1;
+        }
+        data += written;
+        len -= written;
+    }
+    // Under the lock the file holds what was loaded and these records, nothing else
+    if (fstat(grades->fd, &st) == -1 || stampRecord(&grades->stamp, grades->fd, st.st_size) == -1) {
+        grades->stamp.dataIno = 0;
+        return -1;
+    }
+    return 0;
+}
+
+// Append "name, grade" unless the name is there. Returns 1 when added, 0 when it was there and
+// -1 on error.
+static int residentAdd(residentGrades *grades, const char *name, const char *grade) {
+    if (residentLock(grades) == -1) {
+        return -1;
+    }
+    if (storeFind(&grades->store, name, strlen(name)) != -1) {
+        residentUnlock(grades);
+        return 0;
+    }
+    char line[MAX_LINE_LENGTH + 1];
+    int len = snprintf(line, sizeof(line), "%s, %s\n", name, grade);
+    int result = storeAdd(&grades->store, line, len - 1) == -1 || residentAppend(grades, line, len) == -1 ? -1 : 1;
+    residentUnlock(grades);
+    return result;
+}
+
+static void serveUsage(FILE *out) {
+    fprintf(out, "Commands while serving:\n");
+    fprintf(out, "  addStudentGrade \"Name Surname\" \"Grade\" \"grades.txt\"\n");
+    fprintf(out, "  searchStudent \"Name Surname\" \"grades.txt\"\n");
+    fprintf(out, "  sortAll \"grades.txt\" [\"memoryMB\" [\"threads\"]] name|grade\n");
+    fprintf(out, "  showAll \"grades.txt\"\n");
+    fprintf(out, "  listGrades \"grades.txt\"\n");
+    fprintf(out, "  listSome \"numofEntries\" \"pageNumber\" \"grades.txt\"\n");
+    fprintf(out, "  importGrades \"students.csv\" \"grades.txt\"\n");
+    fprintf(out, "  searchPrefix \"prefix\" \"grades.txt\"\n");
+    fprintf(out, "  searchRange \"from\" \"to\" \"grades.txt\"\n");
+    fprintf(out, "  listByGrade \"grade\" \"grades.txt\"\n");
+    fprintf(out, "  exit\n");
+}
+
+static void serveAdd(residentGrades *grades, const char *name, const char *grade, FILE *out) {
+    char logline[MAX_LINE_LENGTH + 50];
+    if (strlen(name) >= MAX_NAME_LENGTH || strlen(grade) >= MAX_GRADE_LENGTH) {
+        fprintf(out, "Error: Unable to add student.\n");
+        logTaskCompletion("Error: Unable to add student.");
+        return;
+    }
+    int added = residentAdd(grades, name, grade);
+    if (added == 0) {
+        fprintf(out, "Error: Student already exists.\n");
+        snprintf(logline, sizeof(logline), "Error: Student %s already exists.", name);
+        logTaskCompletion(logline);
+    }
+    else if (added == -1) {
+        fprintf(out, "Error: Unable to add student.\n");
+        logTaskCompletion("Error: Unable to add student.");
+    }
+    else {
+        snprintf(logline, sizeof(logline), "Add Student Grade: %s, %s", name, grade);
+        logTaskCompletion(logline);
+    }
+}
+
+static void serveSearch(residentGrades *grades, const char *name, FILE *out) {
+    char logline[MAX_LINE_LENGTH + 80];
+    long i = storeFind(&grades->store, name, strlen(name));
+    if (i == -1) {
+        fprintf(out, "Student %s not found.\n", name);
+        snprintf(logline, sizeof(logline), "Student Student %s not found.\n not found. ", name);
+        logTaskCompletion(logline);
+        return;
+    }
+    // The grade as searchStudent reads it: behind the comma and its spaces, at most
+    // MAX_GRADE_LENGTH bytes
+    const gradeTail *tail = &grades->store.tails[grades->store.tail[i]];
+    int gradeLen = tail->len - tail->keyStart;
+    if (gradeLen > MAX_GRADE_LENGTH) {
+        gradeLen = MAX_GRADE_LENGTH;
+    }
+    fprintf(out, "Student %s's grade: %.*s\n", name, gradeLen, tail->text + tail->keyStart);
+    snprintf(logline, sizeof(logline), "Student searchedStudent %s's grade: %.*s\n", name, gradeLen,
+             tail->text + tail->keyStart);
+    logTaskCompletion(logline);
+}
+
+// sortAll with the arguments of the fork per command path, the memory budget does not matter
+// here. There is no one to ask for the key, it must be given.
+static void serveSort(residentGrades *grades, int byGrade, int threads, FILE *out) {
+    if (byGrade == SORT_ASK) {
+        fprintf(out, "Error: sortAll needs name or grade while serving.\n");
+        return;
+    }
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (cpus < SORT_MAX_THREADS ? (int)cpus : SORT_MAX_THREADS) : 1;
+    }
+    long number = 0;
+    if (sortStore(&grades->store, byGrade, threads, out, &number) == -1) {
+        fprintf(out, "Error sorting file: %s\n", strerror(errno));
+        logTaskCompletion("Error: sort failed.");
+        return;
+    }
+    logTaskCompletion(byGrade ? "Sort All (by Grade)" : "Sort All (by Name)");
+}
+
+// Records first .. end-1 in file order
+static void serveList(residentGrades *grades, size_t first, size_t end, FILE *out) {
+    const gradeStore *store = &grades->store;
+    for (size_t i = first; i < end && i < store->count; i++) {
+        const gradeTail *tail = &store->tails[store->tail[i]];
+        fwrite(store->names + store->nameOffset[i], 1, store->nameLen[i], out);
+        fwrite(tail->text, 1, tail->len, out);
+        fputc('\n', out);
+    }
+}
+
+// The command in line, answered to out. Returns 1 for exit, 0 otherwise.
+int serveCommand(residentGrades *grades, char *line, FILE *out) {
+    char **tokens = split_command(line);
+    if (tokens == NULL) {
+        return 0;
+    }
+    int count = 0;
+    while (tokens[count] != NULL) {
+        count++;
+    }
+    // The grades file each command names, NULL for commands there are not
+    const char *command = tokens[0];
+    const char *filename = NULL;
+    size_t sortMemory;
+    int sortThreads = 0;
+    int sortKey = -1;
+    if ((strcmp(command, "addStudentGrade") == 0 && count == 4) || (strcmp(command, "searchStudent") == 0 && count == 3) ||
+        (strcmp(command, "showAll") == 0 && count == 2) || (strcmp(command, "listGrades") == 0 && count == 2) ||
+        (strcmp(command, "listSome") == 0 && count == 4) || (strcmp(command, "searchPrefix") == 0 && count == 3) ||
+        (strcmp(command, "searchRange") == 0 && count == 4) || (strcmp(command, "listByGrade") == 0 && count == 3)) {
+        filename = tokens[count - 1];
+    }
+    else if (strcmp(command, "sortAll") == 0 && count >= 2 &&
+             (sortKey = sortArguments(tokens + 2, count - 2, &sortMemory, &sortThreads)) != -1) {
+        filename = tokens[1];
+    }
+    else if (strcmp(command, "importGrades") == 0 && count == 3) {
+        filename = tokens[2];
+    }
+    int stop = strcmp(command, "exit") == 0;
+
+    if (stop || (count == 1 && command[0] == '\0')) {
+        // Nothing to answer
+    }
+    else if (filename == NULL) {
+        serveUsage(out);
+    }
+    else if (strcmp(filename, grades->filename) != 0) {
+        fprintf(out, "Error: serving %s only.\n", grades->filename);
+    }
+    else if (residentRefresh(grades) == -1) {
+        fprintf(out, "Error: Unable to open file.\n");
+        logTaskCompletion("Error: file not found.");
+    }
+    else if (strcmp(command, "addStudentGrade") == 0) {
+        serveAdd(grades, tokens[1], tokens[2], out);
+    }
+    else if (strcmp(command, "searchStudent") == 0) {
+        serveSearch(grades, tokens[1], out);
+    }
+    else if (strcmp(command, "sortAll") == 0) {
+        serveSort(grades, sortKey, sortThreads, out);
+    }
+    else if (strcmp(command, "showAll") == 0) {
+        serveList(grades, 0, grades->store.count, out);
+        logTaskCompletion("Show All");
+    }
+    else if (strcmp(command, "listGrades") == 0) {
+        serveList(grades, 0, 5, out);
+        logTaskCompletion("List Grades (First 5)");
+    }
+    else if (strcmp(command, "importGrades") == 0) {
+        importGrades(grades, tokens[1], out);
+    }
+    else if (strcmp(command, "searchPrefix") == 0) {
+        queryStudents(grades->filename, QUERY_PREFIX, tokens[1], NULL, out);
+    }
+    else if (strcmp(command, "searchRange") == 0) {
+        queryStudents(grades->filename, QUERY_RANGE, tokens[1], tokens[2], out);
+    }
+    else if (strcmp(command, "listByGrade") == 0) {
+        queryStudents(grades->filename, QUERY_GRADE, tokens[1], NULL, out);
+    }
+    else {
+        int numEntries = atoi(tokens[1]);
+        int pageNumber = atoi(tokens[2]);
+        if (numEntries > 0 && pageNumber > 0) {
+            serveList(grades, (size_t)(pageNumber - 1) * numEntries, (size_t)pageNumber * numEntries, out);
+        }
+        char logline[MAX_LINE_LENGTH];
+        snprintf(logline, sizeof(logline), "List Some (numEntries %d, pageNumber %d)", numEntries, pageNumber);
+        logTaskCompletion(logline);
+    }
+    for (int i = 0; i < count; i++) {
+        free(tokens[i]);
+    }
+    free(tokens);
+    fflush(out);
+    return stop;
+}
+
+static void clientClose(serveClient *client) {
+    if (client->out != NULL) {
+        fclose(client->out);
+    }
+    else if (client->fd != -1) {
+        close(client->fd);
+    }
+    client->fd = -1;
+    client->out = NULL;
+    client->used = 0;
+}
+
+// Answer the whole lines the client sent up to exit, what follows stays in its buffer. Returns 1
+// after exit and 0 otherwise.
+static int clientLines(residentGrades *grades, serveClient *client) {
+    char *line = client->buffer;
+    char *end = client->buffer + client->used;
+    char *newline;
+    int done = 0;
+    while (!done && (newline = memchr(line, '\n', end - line)) != NULL) {
+        *newline = '\0';
+        if (newline > line && newline[-1] == '\r') {
+            newline[-1] = '\0';
+        }
+        done = serveCommand(grades, line, client->out);
+        line = newline + 1;
+    }
+    if (line == client->buffer && client->used == sizeof(client->buffer)) {
+        fprintf(client->out, "Error: command too long.\n");
+        fflush(client->out);
+        line = end;
+    }
+    client->used = end - line;
+    memmove(client->buffer, line, client->used);
+    return done;
+}
+
+// Read what the client sent and answer its whole lines. Returns 1 after exit, -1 at the end of
+// its input and 0 otherwise.
+static int clientServe(residentGrades *grades, serveClient *client) {
+    ssize_t got = read(client->fd, client->buffer + client->used, sizeof(client->buffer) - client->used);
+    if (got == -1 && errno == EINTR) {
+        return 0;
+    }
+    if (got <= 0) {
+        return -1;
+    }
+    client->used += got;
+    return clientLines(grades, client);
+}
+
+// The next byte serve read from stdin but did not answer, readInput takes these before reading
+// stdin again. 0 when there is none.
+int serveUnread(char *c) {
+    if (stdinLeftAt == stdinLeftUsed) {
+        return 0;
+    }
+    *c = stdinLeft[stdinLeftAt++];
+    return 1;
+}
+
+static int serveListen(const char *socketPath) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(address.sun_path, socketPath);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    unlink(socketPath);
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) == -1 || listen(fd, SOMAXCONN) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Serve filename until exit on stdin, the end of stdin without a socket, or SIGINT/SIGTERM
+void serveGrades(const char *filename, const char *socketPath) {
+    residentGrades grades;
+    if (residentOpen(&grades, filename) == -1) {
+        printf("Error: Unable to open file.\n");
+        logTaskCompletion("Error: file not found.");
+        return;
+    }
+    int listenFd = -1;
+    if (socketPath != NULL && (listenFd = serveListen(socketPath)) == -1) {
+        perror("serve");
+        residentClose(&grades);
+        return;
+    }
+
+    struct sigaction stopAction, oldInt, oldTerm, oldPipe;
+    memset(&stopAction, 0, sizeof(stopAction));
+    stopAction.sa_handler = handleServeStop;  // No SA_RESTART, poll returns on the signal
+    sigemptyset(&stopAction.sa_mask);
+    sigaction(SIGINT, &stopAction, &oldInt);
+    sigaction(SIGTERM, &stopAction, &oldTerm);
+    stopAction.sa_handler = SIG_IGN;  // A client gone mid-answer is closed on its next read
+    sigaction(SIGPIPE, &stopAction, &oldPipe);
+    serveStop = 0;
+
+    printf("Serving %s, %zu records%s%s\n", filename, grades.store.count, socketPath != NULL ? ", socket " : "",
+           socketPath != NULL ? socketPath : "");
+    fflush(stdout);
+
+    // clients[0] is stdin
+    static serveClient clients[SERVE_MAX_CLIENTS + 1];
+    int clientCount = 1;
+    clients[0].fd = STDIN_FILENO;
+    clients[0].out = stdout;
+    // Commands the shell read no further than serve are answered first
+    clients[0].used = stdinLeftUsed - stdinLeftAt;
+    memcpy(clients[0].buffer, stdinLeft + stdinLeftAt, clients[0].used);
+    stdinLeftAt = stdinLeftUsed = 0;
+    if (clients[0].used > 0 && clientLines(&grades, &clients[0]) == 1) {
+        serveStop = 1;
+    }
+    clients[0].out = NULL;
+    int interactive = isatty(STDIN_FILENO);
+    struct pollfd fds[SERVE_MAX_CLIENTS + 2];
+    while (!serveStop) {
+        if (interactive && clients[0].fd != -1 && clients[0].used == 0) {
+            write(STDOUT_FILENO, "serve> ", strlen("serve> "));
+        }
+        // Clients first, fds[i] is clients[i]; stdin polls as -1 once it ended, poll skips it
+        int count = 0;
+        for (int i = 0; i < clientCount; i++) {
+            fds[count].fd = clients[i].fd;
+            fds[count++].events = POLLIN;
+        }
+        if (listenFd != -1) {
+            fds[count].fd = listenFd;
+            fds[count++].events = POLLIN;
+        }
+        // Awake for the batch of log lines when one is due
+        int ready = poll(fds, count, logFlushDelay());
+        if (ready == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ready == -1) {
+            perror("serve: poll");
+            break;
+        }
+        if (logFlushDelay() == 0) {
+            logFlush();
+        }
+        for (int i = 0; i < clientCount; i++) {
+            if (fds[i].fd < 0 || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+            if (i == 0) {
+                clients[0].out = stdout;
+                int done = clientServe(&grades, &clients[0]);
+                clients[0].out = NULL;
+                if (done != 0) {
+                    // Without a socket there is no one left to serve at the end of stdin
+                    clients[0].fd = -1;
+                    serveStop = serveStop || done == 1 || listenFd == -1;
+                }
+            }
+            else if (clientServe(&grades, &clients[i]) != 0) {
+                clientClose(&clients[i]);
+            }
+        }
+        int kept = 1;
+        for (int i = 1; i < clientCount; i++) {
+            if (clients[i].fd != -1) {
+                clients[kept++] = clients[i];
+            }
+        }
+        clientCount = kept;
+        if (listenFd != -1 && (fds[count - 1].revents & POLLIN)) {
+            int fd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+            FILE *out = fd != -1 && clientCount <= SERVE_MAX_CLIENTS ? fdopen(fd, "w") : NULL;
+            if (out != NULL) {
+                clients[clientCount].fd = fd;
+                clients[clientCount].out = out;
+                clients[clientCount++].used = 0;
+            }
+            else if (fd != -1) {
+                close(fd);
+            }
+        }
+    }
+
+    for (int i = 1; i < clientCount; i++) {
+        clientClose(&clients[i]);
+    }
+    // Piped commands after exit belong to the shell
+    memcpy(stdinLeft, clients[0].buffer, clients[0].used);
+    stdinLeftUsed = clients[0].used;
+    if (listenFd != -1) {
+        close(listenFd);
+        unlink(socketPath);
+    }
+    residentClose(&grades);
+    sigaction(SIGINT, &oldInt, NULL);
+    sigaction(SIGTERM, &oldTerm, NULL);
+    sigaction(SIGPIPE, &oldPipe, NULL);
+    printf("Stopped serving %s\n", filename);
+    fflush(stdout);
+    logTaskCompletion("Serve");
+    logFlush();
+}
@@ -0,0 +1,693 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "grades.h"
+
+// sortAll for files of any size: records are sorted in memory while they fit in the budget,
+// beyond that every budget's worth is sorted and written to a run file, and the runs are merged
+// with a heap, SORT_MERGE_FANIN at a time. The sort is stable, records with the same key keep
+// their order in the file.
+//
+// In memory the records live in a gradeStore and are sorted as 8 byte handles: the record's
+// index in the low bits, as few as the batch needs, and a key in the bits above. Index order is
+// file order, so no two handles are equal and comparing them keeps the sort stable. By grade the
+// key is the rank of the grade and one counting pass sorts. By name it is the start of the name
+// bytes behind the prefix all names share, only handles with the same key look at the names.
+//
+// With threads > 1 the handles are cut into one chunk per thread, the chunks are sorted at the
+// same time and merged pairwise in rounds. Every round splits its merges into pieces so all
+// threads stay busy while the number of pairs goes down.
+
+#define SORT_MIN_MEMORY (1024 * 1024)
+#define SORT_MERGE_FANIN 64
+#define SORT_MIN_RUN_BUFFER (16 * 1024)
+#define SORT_READ_BUFFER (256 * 1024)
+#define SORT_PARALLEL_MIN 65536 // Fewer records are sorted on one thread
+#define SORT_RADIX_MIN 64       // Fewer handles are sorted by comparing them
+#define SORT_RADIX_MAX_DEPTH 16 // Names still equal after this many keys are compared whole
+#define SORT_PREFETCH 8         // Records fetched ahead of the one in use when they lie scattered
+
+// The name is everything before the first comma, the grade what follows ", "
+static void recordKey(const char *line, size_t len, int byGrade, uint32_t *keyStart, uint32_t *keyLen) {
+    const char *comma = memchr(line, ',', len);
+    if (!byGrade) {
+        *keyStart = 0;
+        *keyLen = comma != NULL ? comma - line : len;
+        return;
+    }
+    size_t start = comma != NULL ? comma - line + 1 : len;
+    while (start < len && line[start] == ' ') {
+        start++;
+    }
+    *keyStart = start;
+    *keyLen = len - start;
+}
+
+static int keyCompare(const char *a, size_t aLen, const char *b, size_t bLen) {
+    int result = memcmp(a, b, aLen < bLen ? aLen : bLen);
+    if (result != 0) {
+        return result;
+    }
+    return aLen < bLen ? -1 : aLen > bLen;
+}
+
+// How the handles of a batch are made
+typedef struct {
+    const gradeStore *store;
+    unsigned indexBits;
+} handleLayout;
+
+static uint32_t handleIndex(uint64_t handle, const handleLayout *layout) {
+    return handle & ((1ULL << layout->indexBits) - 1);
+}
+
+// Name handles: the keys decide unless they are equal, then the rest of the names, then the
+// indexes
+static int handleCompare(uint64_t a, uint64_t b, const handleLayout *layout) {
+    if (a >> layout->indexBits != b >> layout->indexBits) {
+        return a < b ? -1 : 1;
+    }
+    const gradeStore *store = layout->store;
+    uint32_t x = handleIndex(a, layout);
+    uint32_t y = handleIndex(b, layout);
+    size_t prefix = store->prefixLen;
+    int result = keyCompare(store->names + store->nameOffset[x] + prefix, store->nameLen[x] - prefix,
+                            store->names + store->nameOffset[y] + prefix, store->nameLen[y] - prefix);
+    if (result != 0) {
+        return result;
+    }
+    return x < y ? -1 : x > y;
+}
+
+static int handleQsortCompare(const void *a, const void *b, void *layout) {
+    return handleCompare(*(const uint64_t *)a, *(const uint64_t *)b, layout);
+}
+
+// One thread's share: sort handles[0, count) with dst as scratch, or merge src[aStart, aEnd) and
+// src[bStart, bEnd) into dst from out on
+typedef struct {
+    const handleLayout *layout;
+    uint64_t *handles;
+    size_t count;
+    const uint64_t *src;
+    uint64_t *dst;
+    size_t aStart, aEnd, bStart, bEnd, out;
+} sortTask;
+
+// Radix sort name handles, in index order on entry, whose keys hold the name bytes from offset
+// on behind the common prefix. A pass per key byte, skipping bytes all keys share. The sort is
+// stable, so handles with the same key are left in index order and only need the names that
+// follow: they get keys of the next bytes and are sorted again, then get their key back.
+static void radixSortHandles(uint64_t *handles, uint64_t *scratch, size_t count, const handleLayout *layout,
+                             size_t offset, int depth) {
+    if (count < SORT_RADIX_MIN || depth == SORT_RADIX_MAX_DEPTH) {
+        qsort_r(handles, count, sizeof(uint64_t), handleQsortCompare, (void *)layout);
+        return;
+    }
+    unsigned shift = layout->indexBits;
+    unsigned passes = (64 - shift + 7) / 8;
+    size_t histogram[8][256];
+    memset(histogram, 0, sizeof(histogram));
+    for (size_t i = 0; i < count; i++) {
+        uint64_t key = handles[i] >> shift;
+        for (unsigned p = 0; p < passes; p++) {
+            histogram[p][(key >> 8 * p) & 255]++;
+        }
+    }
+    uint64_t *src = handles;
+    uint64_t *dst = scratch;
+    for (unsigned p = 0; p < passes; p++) {
+        unsigned byteShift = shift + 8 * p;
+        if (histogram[p][(src[0] >> byteShift) & 255] == count) {
+            continue;
+        }
+        size_t next[256];
+        size_t sum = 0;
+        for (int b = 0; b < 256; b++) {
+            next[b] = sum;
+            sum += histogram[p][b];
+        }
+        for (size_t i = 0; i < count; i++) {
+            dst[next[(src[i] >> byteShift) & 255]++] = src[i];
+        }
+        uint64_t *swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src != handles) {
+        memcpy(handles, src, count * sizeof(uint64_t));
+    }
+
+    const gradeStore *store = layout->store;
+    size_t step = (64 - shift) / 8;  // Name bytes a key holds whole
+    for (size_t start = 0, end; start < count; start = end) {
+        for (end = start + 1; end < count && handles[end] >> shift == handles[start] >> shift; end++) {
+        }
+        if (end - start == 1) {
+            continue;
+        }
+        // The next keys go to scratch, free again after the passes
+        int longer = 0;
+        for (size_t i = start; i < end; i++) {
+            if (i + 2 * SORT_PREFETCH < end) {
+                uint32_t ahead = handleIndex(handles[i + 2 * SORT_PREFETCH], layout);
+                __builtin_prefetch(&store->nameOffset[ahead]);
+                __builtin_prefetch(&store->nameLen[ahead]);
+            }
+            if (i + SORT_PREFETCH < end) {
+                uint32_t ahead = handleIndex(handles[i + SORT_PREFETCH], layout);
+                __builtin_prefetch(store->names + store->nameOffset[ahead] + store->prefixLen + offset + step);
+            }
+            uint32_t index = handleIndex(handles[i], layout);
+            longer |= store->nameLen[index] > store->prefixLen + offset + step;
+            scratch[i] = storeNameKey(store, index, offset + step) >> shift << shift | index;
+        }
+        if (!longer) {
+            // The same names, unless one holds a zero byte where another ends
+            qsort_r(handles + start, end - start, sizeof(uint64_t), handleQsortCompare, (void *)layout);
+            continue;
+        }
+        uint64_t key = handles[start] >> shift << shift;
+        memcpy(handles + start, scratch + start, (end - start) * sizeof(uint64_t));
+        radixSortHandles(handles + start, scratch + start, end - start, layout, offset + step, depth + 1);
+        for (size_t i = start; i < end; i++) {
+            handles[i] = key | handleIndex(handles[i], layout);
+        }
+    }
+}
+
+static void *sortChunkThread(void *arg) {
+    sortTask *task = arg;
+    radixSortHandles(task->handles, task->dst, task->count, task->layout, 0, 0);
+    return NULL;
+}
+
+static void *mergeThread(void *arg) {
+    sortTask *task = arg;
+    const uint64_t *src = task->src;
+    size_t a = task->aStart;
+    size_t b = task->bStart;
+    size_t out = task->out;
+    while (a < task->aEnd && b < task->bEnd) {
+        task->dst[out++] = handleCompare(src[b], src[a], task->layout) < 0 ? src[b++] : src[a++];
+    }
+    memcpy(task->dst + out, src + a, (task->aEnd - a) * sizeof(uint64_t));
+    out += task->aEnd - a;
+    memcpy(task->dst + out, src + b, (task->bEnd - b) * sizeof(uint64_t));
+    return NULL;
+}
+
+// Run every task on its own thread, the calling thread takes the first. A task whose thread
+// cannot be started runs here as well.
+static void runTasks(void *(*function)(void *), sortTask *tasks, int taskCount) {
+    pthread_t threads[SORT_MAX_THREADS];
+    int started[SORT_MAX_THREADS] = {0};
+    for (int i = 1; i < taskCount; i++) {
+        started[i] = pthread_create(&threads[i], NULL, function, &tasks[i]) == 0;
+        if (!started[i]) {
+            function(&tasks[i]);
+        }
+    }
+    function(&tasks[0]);
+    for (int i = 1; i < taskCount; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+}
+
+// First position in src[low, high) that sorts after key
+static size_t lowerBound(const uint64_t *src, size_t low, size_t high, uint64_t key, const handleLayout *layout) {
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (handleCompare(src[middle], key, layout) < 0) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Sort count name handles on up to threads threads, scratch holds as many handles. Returns the
+// array the sorted handles ended up in, handles or scratch.
+static uint64_t *sortHandles(uint64_t *handles, uint64_t *scratch, size_t count, int threads, const handleLayout *layout) {
+    if (threads > SORT_MAX_THREADS) {
+        threads = SORT_MAX_THREADS;
+    }
+    if (threads <= 1 || count < SORT_PARALLEL_MIN) {
+        radixSortHandles(handles, scratch, count, layout, 0, 0);
+        return handles;
+    }
+    sortTask tasks[SORT_MAX_THREADS];
+    size_t bounds[SORT_MAX_THREADS + 1];
+    int runs = threads;
+    for (int i = 0; i <= runs; i++) {
+        bounds[i] = count * i / runs;
+    }
+    for (int i = 0; i < runs; i++) {
+        tasks[i].layout = layout;
+        tasks[i].handles = handles + bounds[i];
+        tasks[i].dst = scratch + bounds[i];
+        tasks[i].count = bounds[i + 1] - bounds[i];
+    }
+    runTasks(sortChunkThread, tasks, runs);
+
+    uint64_t *src = handles;
+    uint64_t *dst = scratch;
+    while (runs > 1) {
+        int pairs = runs / 2;
+        int pieces = threads / pairs > 0 ? threads / pairs : 1;
+        int taskCount = 0;
+        for (int p = 0; p < pairs; p++) {
+            size_t a0 = bounds[2 * p], a1 = bounds[2 * p + 1], b1 = bounds[2 * p + 2];
+            size_t aLen = a1 - a0;
+            size_t prevA = a0, prevB = a1;
+            for (int piece = 0; piece < pieces; piece++) {
+                // The piece ends where the next one starts: at a fraction of the left run and
+                // at the first handle of the right run that sorts after it
+                size_t nextA = piece == pieces - 1 ? a1 : a0 + aLen * (piece + 1) / pieces;
+                size_t nextB = nextA == a1 ? b1 : lowerBound(src, a1, b1, src[nextA], layout);
+                sortTask *task = &tasks[taskCount++];
+                task->layout = layout;
+                task->src = src;
+                task->dst = dst;
+                task->aStart = prevA;
+                task->aEnd = nextA;
+                task->bStart = prevB;
+                task->bEnd = nextB;
+                task->out = a0 + (prevA - a0) + (prevB - a1);
+                prevA = nextA;
+                prevB = nextB;
+            }
+        }
+        if (runs % 2 == 1) {
+            // The odd run out is copied over unchanged
+            memcpy(dst + bounds[runs - 1], src + bounds[runs - 1], (count - bounds[runs - 1]) * sizeof(uint64_t));
+        }
+        runTasks(mergeThread, tasks, taskCount);
+        for (int i = 0; 2 * i < runs; i++) {
+            bounds[i] = bounds[2 * i];
+        }
+        runs = (runs + 1) / 2;
+        bounds[runs] = count;
+        uint64_t *swap = src;
+        src = dst;
+        dst = swap;
+    }
+    return src;
+}
+
+// The store's records in order of their handles: by grade rank with a counting sort, by name
+// with sortHandles. Returns the sorted handles, NULL when out of memory.
+static uint64_t *orderStore(const handleLayout *layout, int byGrade, int threads, uint64_t *handles, uint64_t *scratch) {
+    gradeStore *store = (gradeStore *)layout->store;
+    size_t count = store->count;
+    if (byGrade) {
+        long rankCount = storeRank(store);
+        size_t *next = rankCount >= 0 ? calloc(rankCount + 1, sizeof(size_t)) : NULL;
+        if (next == NULL) {
+            return NULL;
+        }
+        for (size_t i = 0; i < count; i++) {
+            next[store->tails[store->tail[i]].rank + 1]++;
+        }
+        for (long r = 1; r < rankCount; r++) {
+            next[r] += next[r - 1];
+        }
+        for (size_t i = 0; i < count; i++) {
+            uint64_t rank = store->tails[store->tail[i]].rank;
+            handles[next[rank]++] = rank << layout->indexBits | i;
+        }
+        free(next);
+        return handles;
+    }
+    // The key keeps the top bits of the name bytes, cutting them off keeps the order
+    for (size_t i = 0; i < count; i++) {
+        handles[i] = (storeNameKey(store, i, 0) >> layout->indexBits) << layout->indexBits | i;
+    }
+    return sortHandles(handles, scratch, count, threads, layout);
+}
+
+// Sorted output is numbered like the listing of sortAll, runs hold the plain lines
+static void emitLine(FILE *out, long *number, const char *line, size_t len) {
+    if (number != NULL) {
+        fprintf(out, "%ld. ", ++*number);
+    }
+    fwrite(line, 1, len, out);
+    fputc('\n', out);
+}
+
+// A record of the store is its name and its tail, the line it was read from
+static void emitRecord(FILE *out, long *number, const gradeStore *store, uint32_t i) {
+    const gradeTail *tail = &store->tails[store->tail[i]];
+    if (number != NULL) {
+        fprintf(out, "%ld. ", ++*number);
+    }
+    fwrite(store->names + store->nameOffset[i], 1, store->nameLen[i], out);
+    fwrite(tail->text, 1, tail->len, out);
+    fputc('\n', out);
+}
+
+// Write the store's records in the order of the handles. The names lie scattered over the arena,
+// the records a few handles ahead are fetched while one is written.
+static void emitRecords(FILE *out, long *number, const gradeStore *store, const uint64_t *sorted, size_t count,
+                        const handleLayout *layout) {
+    for (size_t i = 0; i < count; i++) {
+        if (i + 2 * SORT_PREFETCH < count) {
+            uint32_t ahead = handleIndex(sorted[i + 2 * SORT_PREFETCH], layout);
+            __builtin_prefetch(&store->nameOffset[ahead]);
+            __builtin_prefetch(&store->nameLen[ahead]);
+            __builtin_prefetch(&store->tail[ahead]);
+        }
+        if (i + SORT_PREFETCH < count) {
+            __builtin_prefetch(store->names + store->nameOffset[handleIndex(sorted[i + SORT_PREFETCH], layout)]);
+        }
+        emitRecord(out, number, store, handleIndex(sorted[i], layout));
+    }
+}
+
+// Unnamed scratch file next to the sorted file, it goes away with its descriptor
+static FILE *runCreate(const char *filename) {
+    const char *slash = strrchr(filename, '/');
+    int dirLen = slash != NULL ? (int)(slash - filename) + 1 : 0;
+    size_t size = dirLen + 32;
+    char *path = malloc(size);
+    if (path == NULL) {
+        return NULL;
+    }
+    snprintf(path, size, "%.*s.sortrun.XXXXXX", dirLen, filename);
+    int fd = mkstemp(path);
+    if (fd != -1) {
+        unlink(path);
+    }
+    free(path);
+    FILE *run = fd != -1 ? fdopen(fd, "w+") : NULL;
+    if (run == NULL && fd != -1) {
+        close(fd);
+    }
+    return run;
+}
+
+typedef struct {
+    FILE *file;
+    char *line;
+    size_t capacity;
+    ssize_t len;
+    uint32_t keyStart;
+    uint32_t keyLen;
+    int order;          // Position of the run, earlier runs hold earlier records
+} runReader;
+
+static int readerNext(runReader *reader, int byGrade) {
+    reader->len = getline(&reader->line, &reader->capacity, reader->file);
+    if (reader->len == -1) {
+        return 0;
+    }
+    if (reader->len > 0 && reader->line[reader->len - 1] == '\n') {
+        reader->len--;
+    }
+    recordKey(reader->line, reader->len, byGrade, &reader->keyStart, &reader->keyLen);
+    return 1;
+}
+
+static int readerLess(const runReader *a, const runReader *b) {
+    int result = keyCompare(a->line + a->keyStart, a->keyLen, b->line + b->keyStart, b->keyLen);
+    return result < 0 || (result == 0 && a->order < b->order);
+}
+
+static void heapSiftDown(runReader **heap, int count, int i) {
+    while (1) {
+        int smallest = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < count && readerLess(heap[left], heap[smallest])) {
+            smallest = left;
+        }
+        if (right < count && readerLess(heap[right], heap[smallest])) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            return;
+        }
+        runReader *swap = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = swap;
+        i = smallest;
+    }
+}
+
+// Merge runCount runs into out, numbered when number is not NULL
+static int mergeRuns(FILE **runs, int runCount, int byGrade, size_t bufferSize, FILE *out, long *number) {
+    runReader *readers = calloc(runCount, sizeof(runReader));
+    runReader **heap = malloc(runCount * sizeof(runReader *));
+    if (readers == NULL || heap == NULL) {
+        free(readers);
+        free(heap);
+        return -1;
+    }
+    int count = 0;
+    for (int i = 0; i < runCount; i++) {
+        readers[i].file = runs[i];
+        readers[i].order = i;
+        fflush(runs[i]);
+        rewind(runs[i]);
+        setvbuf(runs[i], NULL, _IOFBF, bufferSize);
+        if (readerNext(&readers[i], byGrade)) {
+            heap[count++] = &readers[i];
+        }
+    }
+    for (int i = count / 2 - 1; i >= 0; i--) {
+        heapSiftDown(heap, count, i);
+    }
+    while (count > 0) {
+        runReader *top = heap[0];
+        emitLine(out, number, top->line, top->len);
+        if (!readerNext(top, byGrade)) {
+            heap[0] = heap[--count];
+        }
+        heapSiftDown(heap, count, 0);
+    }
+    int failed = 0;
+    for (int i = 0; i < runCount; i++) {
+        failed |= ferror(runs[i]);
+        free(readers[i].line);
+    }
+    free(readers);
+    free(heap);
+    return failed || ferror(out) ? -1 : 0;
+}
+
+// Sort the store's records into handles, which the caller frees along with scratch. Returns the
+// sorted handles, NULL when out of memory.
+static uint64_t *storeHandles(gradeStore *store, int byGrade, int threads, handleLayout *layout, uint64_t **handles,
+                              uint64_t **scratch) {
+    size_t count = store->count;
+    *handles = malloc(count * sizeof(uint64_t) + 1);
+    *scratch = !byGrade ? malloc(count * sizeof(uint64_t) + 1) : NULL;
+    layout->store = store;
+    layout->indexBits = 1;
+    while (layout->indexBits < 32 && count > 1ULL << layout->indexBits) {
+        layout->indexBits++;
+    }
+    if (*handles == NULL || (!byGrade && *scratch == NULL)) {
+        return NULL;
+    }
+    return orderStore(layout, byGrade, threads, *handles, *scratch);
+}
+
+// Print the records in store sorted by name or grade to out, numbered from *number on when
+// number is not NULL. Returns the number of records or -1.
+long sortStore(gradeStore *store, int byGrade, int threads, FILE *out, long *number) {
+    handleLayout layout;
+    uint64_t *handles;
+    uint64_t *scratch;
+    uint64_t *sorted = storeHandles(store, byGrade, threads, &layout, &handles, &scratch);
+    if (sorted != NULL) {
+        emitRecords(out, number, store, sorted, store->count, &layout);
+    }
+    free(handles);
+    free(scratch);
+    return sorted != NULL ? (long)store->count : -1;
+}
+
+// The store's record indexes in name or grade order into order, for the query index. Returns 0
+// or -1.
+int storeOrder(gradeStore *store, int byGrade, int threads, uint32_t *order) {
+    handleLayout layout;
+    uint64_t *handles;
+    uint64_t *scratch;
+    uint64_t *sorted = storeHandles(store, byGrade, threads, &layout, &handles, &scratch);
+    if (sorted != NULL) {
+        for (size_t i = 0; i < store->count; i++) {
+            order[i] = handleIndex(sorted[i], &layout);
+        }
+    }
+    free(handles);
+    free(scratch);
+    return sorted != NULL ? 0 : -1;
+}
+
+// Print the records of filename sorted by name or grade to out, numbered from 1, using about
+// memoryBudget bytes and up to threads threads. Returns the number of records or -1, *runCount
+// is the number of runs written to disk (0 when the file was sorted in memory).
+long sortGrades(const char *filename, int byGrade, size_t memoryBudget, int threads, FILE *out, int *runCount) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    if (memoryBudget < SORT_MIN_MEMORY) {
+        memoryBudget = SORT_MIN_MEMORY;
+    }
+    // Handles for every record, twice over for the radix passes and merges of a name sort
+    size_t handleBytes = (byGrade ? 1 : 2) * sizeof(uint64_t);
+    char *buffer = malloc(SORT_READ_BUFFER);
+    gradeStore store;
+    storeInit(&store);
+    FILE **runs = NULL;
+    int runsUsed = 0;
+    int runsCapacity = 0;
+    long number = 0;
+    long total = 0;
+    int failed = buffer == NULL;
+
+    size_t used = 0;    // Bytes in buffer
+    size_t parsed = 0;  // Bytes of buffer added to the store
+    int eof = 0;
+    while (!failed) {
+        int full = 0;
+        while (!full && parsed < used) {
+            char *line = buffer + parsed;
+            char *newline = memchr(line, '\n', used - parsed);
+            if (newline == NULL && !eof) {
+                break;
+            }
+            size_t len = newline != NULL ? (size_t)(newline - line) : used - parsed;
+            if (storeAdd(&store, line, len) == -1) {
+                failed = 1;
+                break;
+            }
+            parsed += len + (newline != NULL);
+            full = storeBytes(&store) + store.count * handleBytes >= memoryBudget;
+        }
+        if (failed) {
+            break;
+        }
+        if (!full && !eof) {
+            memmove(buffer, buffer + parsed, used - parsed);
+            used -= parsed;
+            parsed = 0;
+            if (used == SORT_READ_BUFFER) {
+                // A full buffer without a newline is no grades line
+                errno = EINVAL;
+                failed = 1;
+                break;
+            }
+            ssize_t got = read(fd, buffer + used, SORT_READ_BUFFER - used);
+            if (got == -1 && errno == EINTR) {
+                continue;
+            }
+            if (got == -1) {
+                failed = 1;
+                break;
+            }
+            eof = got == 0;
+            used += got;
+            continue;
+        }
+
+        int last = eof && parsed == used;
+        FILE *run = NULL;
+        if (last && runsUsed == 0) {
+            run = out;
+        }
+        else {
+            if (runsUsed == runsCapacity) {
+                runsCapacity = runsCapacity == 0 ? 16 : runsCapacity * 2;
+                FILE **grown = realloc(runs, runsCapacity * sizeof(FILE *));
+                if (grown != NULL) {
+                    runs = grown;
+                }
+                failed = grown == NULL;
+            }
+            run = !failed ? runCreate(filename) : NULL;
+            if (run != NULL) {
+                runs[runsUsed++] = run;
+            }
+            failed = run == NULL;
+        }
+        long sorted = !failed ? sortStore(&store, byGrade, threads, run, run == out ? &number : NULL) : -1;
+        if (sorted == -1 || ferror(run)) {
+            failed = 1;
+            break;
+        }
+        total += sorted;
+        if (last) {
+            break;
+        }
+        storeReset(&store);
+    }
+    close(fd);
+    free(buffer);
+    storeFree(&store);
+    if (runCount != NULL) {
+        *runCount = runsUsed;
+    }
+
+    // The buffers are free again, the merge gets the budget for its readers
+    size_t bufferSize = memoryBudget / (SORT_MERGE_FANIN + 1);
+    if (bufferSize < SORT_MIN_RUN_BUFFER) {
+        bufferSize = SORT_MIN_RUN_BUFFER;
+    }
+    while (!failed && runsUsed > SORT_MERGE_FANIN) {
+        // Earliest runs first, their merge takes their place so ties stay in file order
+        FILE *merged = runCreate(filename);
+        if (merged == NULL || mergeRuns(runs, SORT_MERGE_FANIN, byGrade, bufferSize, merged, NULL) == -1) {
+            if (merged != NULL) {
+                fclose(merged);
+            }
+            failed = 1;
+            break;
+        }
+        for (int i = 0; i < SORT_MERGE_FANIN; i++) {
+            fclose(runs[i]);
+        }
+        runs[0] = merged;
+        memmove(runs + 1, runs + SORT_MERGE_FANIN, (runsUsed - SORT_MERGE_FANIN) * sizeof(FILE *));
+        runsUsed -= SORT_MERGE_FANIN - 1;
+    }
+    if (!failed && runsUsed > 0 && mergeRuns(runs, runsUsed, byGrade, bufferSize, out, &number) == -1) {
+        failed = 1;
+    }
+    for (int i = 0; i < runsUsed; i++) {
+        fclose(runs[i]);
+    }
+    free(runs);
+    fflush(out);
+    return failed ? -1 : total;
+}
+
+// The arguments of sortAll after its grades file, args[0, count): ["memoryMB" ["threads"]]
+// [name|grade]. Both the fork per command path and serve take them. Returns 1 to sort by grade,
+// 0 by name, SORT_ASK when the key is not given and -1 for more arguments than these.
+int sortArguments(char **args, int count, size_t *memoryBudget, int *threads) {
+    int byGrade = SORT_ASK;
+    if (count > 0 && (strcmp(args[count - 1], "name") == 0 || strcmp(args[count - 1], "grade") == 0)) {
+        byGrade = strcmp(args[count - 1], "grade") == 0;
+        count--;
+    }
+    if (count > 2) {
+        return -1;
+    }
+    *memoryBudget = count >= 1 ? (size_t)atol(args[0]) * 1024 * 1024 : SORT_DEFAULT_MEMORY;
+    *threads = count == 2 ? atoi(args[1]) : 0;
+    return byGrade;
+}
@@ -0,0 +1,466 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#include "grades.h"
+
+// The index file is an indexHeader followed by slotCount indexSlots, an open addressing table
+// with linear probing kept at most half full. It is a cache of the grades file: lines appended
+// after indexedSize are added when the index is opened for writing, any other change to the
+// grades file (new inode, shrunk, rewritten in place) makes it rebuild from scratch. Its dataStamp
+// tells the two apart, the page and query indexes and serve use the same. Readers never write
+// the index, searching without one scans the file as before.
+
+#define INDEX_MAGIC 0x58444947u     // "GIDX"
+#define INDEX_VERSION 2
+#define INDEX_MIN_SLOTS 1024
+#define INDEX_SCAN_BUFFER (256 * 1024) // Bytes of the grades file read at once while indexing
+
+// FNV-1a
+static uint64_t nameHash(const char *name, size_t len) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Hash of the first and the last STAMP_CHECK_BYTES of the size bytes at the start of the file
+static int stampCheck(int dataFd, uint64_t size, uint64_t *check) {
+    char buffer[2 * STAMP_CHECK_BYTES];
+    size_t first = size < STAMP_CHECK_BYTES ? size : STAMP_CHECK_BYTES;
+    size_t last = size - first < STAMP_CHECK_BYTES ? size - first : STAMP_CHECK_BYTES;
+    if ((first > 0 && pread(dataFd, buffer, first, 0) != (ssize_t)first) ||
+        (last > 0 && pread(dataFd, buffer + first, last, size - last) != (ssize_t)last)) {
+        return -1;
+    }
+    *check = nameHash(buffer, first + last);
+    return 0;
+}
+
+// Record that a cache covers the first indexedSize bytes of the grades file in dataFd as it is now
+int stampRecord(dataStamp *stamp, int dataFd, uint64_t indexedSize) {
+    struct stat st;
+    if (fstat(dataFd, &st) == -1 || stampCheck(dataFd, indexedSize, &stamp->check) == -1) {
+        return -1;
+    }
+    stamp->indexedSize = indexedSize;
+    stamp->dataDev = st.st_dev;
+    stamp->dataIno = st.st_ino;
+    stamp->dataMtimeSec = st.st_mtim.tv_sec;
+    stamp->dataMtimeNsec = st.st_mtim.tv_nsec;
+    return 0;
+}
+
+// 1 when the grades file in dataFd, st its stat, still starts with the bytes stamp covers: the
+// same size and mtime, or larger with the same bytes at both ends of them. Only those ends are
+// hashed, so this is a heuristic: a larger rewrite that keeps both of them is taken for an append.
+int stampIsCurrent(const dataStamp *stamp, int dataFd, const struct stat *st) {
+    if (stamp->dataDev != (uint64_t)st->st_dev || stamp->dataIno != (uint64_t)st->st_ino ||
+        (uint64_t)st->st_size < stamp->indexedSize) {
+        return 0;
+    }
+    if ((uint64_t)st->st_size == stamp->indexedSize) {
+        // Same size but a different mtime: rewritten in place
+        return stamp->dataMtimeSec == st->st_mtim.tv_sec && stamp->dataMtimeNsec == st->st_mtim.tv_nsec;
+    }
+    uint64_t check;
+    return stampCheck(dataFd, stamp->indexedSize, &check) == 0 && check == stamp->check;
+}
+
+static size_t indexFileSize(uint64_t slotCount) {
+    return sizeof(indexHeader) + slotCount * sizeof(indexSlot);
+}
+
+// Map the index file, writable for writers
+static int indexMap(gradeIndex *index) {
+    struct stat st;
+    if (fstat(index->fd, &st) == -1) {
+        return -1;
+    }
+    int protection = index->writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    void *area = mmap(NULL, st.st_size, protection, MAP_SHARED, index->fd, 0);
+    if (area == MAP_FAILED) {
+        return -1;
+    }
+    index->header = area;
+    index->slots = (indexSlot *)((char *)area + sizeof(indexHeader));
+    index->mappedSize = st.st_size;
+    return 0;
+}
+
+static void indexUnmap(gradeIndex *index) {
+    if (index->header != NULL) {
+        munmap(index->header, index->mappedSize);
+        index->header = NULL;
+        index->slots = NULL;
+    }
+}
+
+static void slotInsert(indexSlot *slots, uint64_t slotCount, uint64_t hash, uint64_t offset) {
+    uint64_t i = hash & (slotCount - 1);
+    while (slots[i].offset != 0) {
+        i = (i + 1) & (slotCount - 1);
+    }
+    slots[i].offset = offset + 1;
+    slots[i].hash = hash;
+}
+
+// Write the table to the index file. It goes out with sequential writes under a temporary name
+// and is renamed over the old one, so a crash leaves either version; a table filled in a shared mapping
+// would be written back a page at a time in no order.
+static int indexSave(gradeIndex *index) {
+    size_t tmpLen = strlen(index->path) + 5;
+    char *tmpPath = malloc(tmpLen);
+    if (tmpPath == NULL) {
+        return -1;
+    }
+    snprintf(tmpPath, tmpLen, "%s.tmp", index->path);
+    int fd = open(tmpPath, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    const char *data = (const char *)index->header;
+    size_t left = index->mappedSize;
+    while (fd != -1 && left > 0) {
+        ssize_t written = write(fd, data, left);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written == -1) {
+            break;
+        }
+        data += written;
+        left -= written;
+    }
+    if (fd == -1 || left > 0 || rename(tmpPath, index->path) == -1) {
+        if (fd != -1) {
+            close(fd);
+            unlink(tmpPath);
+        }
+        free(tmpPath);
+        return -1;
+    }
+    free(tmpPath);
+    indexUnmap(index);
+    if (index->fd != -1) {
+        close(index->fd);
+    }
+    index->fd = fd;
+    return indexMap(index);
+}
+
+// Replace the table by an empty one in memory, or with keepRecords by a copy of the current one
+// with slotCount slots. A table that was the index file is saved to it again.
+static int indexReplace(gradeIndex *index, uint64_t slotCount, int keepRecords) {
+    size_t size = indexFileSize(slotCount);
+    void *area = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (area == MAP_FAILED) {
+        return -1;
+    }
+    indexHeader *header = area;
+    indexSlot *slots = (indexSlot *)((char *)area + sizeof(indexHeader));
+    if (keepRecords) {
+        *header = *index->header;
+        for (uint64_t i = 0; i < index->header->slotCount; i++) {
+            if (index->slots[i].offset != 0) {
+                slotInsert(slots, slotCount, index->slots[i].hash, index->slots[i].offset - 1);
+            }
+        }
+    }
+    header->magic = INDEX_MAGIC;
+    header->version = INDEX_VERSION;
+    header->slotCount = slotCount;
+    indexUnmap(index);
+    index->header = header;
+    index->slots = slots;
+    index->mappedSize = size;
+    return index->fd != -1 ? indexSave(index) : 0;
+}
+
+// Read the record at offset into line, returns the name's length or -1 when it is no record
+static ssize_t recordAt(gradeIndex *index, uint64_t offset, char *line, size_t size) {
+    ssize_t len = pread(index->dataFd, line, size - 1, offset);
+    if (len <= 0) {
+        return -1;
+    }
+    line[len] = '\0';
+    char *comma = memchr(line, ',', len);
+    char *newline = memchr(line, '\n', len);
+    if (comma == NULL || (newline != NULL && newline < comma)) {
+        return -1;
+    }
+    return comma - line;
+}
+
+// Offset of the record named name (len bytes), -1 when there is none
+static int64_t indexLookup(gradeIndex *index, const char *name, size_t len, uint64_t hash, char *line, size_t size) {
+    uint64_t mask = index->header->slotCount - 1;
+    for (uint64_t i = hash & mask; index->slots[i].offset != 0; i = (i + 1) & mask) {
+        if (index->slots[i].hash != hash) {
+            continue;
+        }
+        uint64_t offset = index->slots[i].offset - 1;
+        if (recordAt(index, offset, line, size) == (ssize_t)len && memcmp(line, name, len) == 0) {
+            return offset;
+        }
+    }
+    return -1;
+}
+
+static int indexAdd(gradeIndex *index, const char *name, size_t len, uint64_t offset) {
+    char line[MAX_LINE_LENGTH + 1];
+    uint64_t hash = nameHash(name, len);
+    if (indexLookup(index, name, len, hash, line, sizeof(line)) != -1) {
+        return 0; // Names are unique, a search finds the first record of a name
+    }
+    if ((index->header->recordCount + 1) * 2 > index->header->slotCount &&
+        indexReplace(index, index->header->slotCount * 2, 1) == -1) {
+        return -1;
+    }
+    slotInsert(index->slots, index->header->slotCount, hash, offset);
+    index->header->recordCount++;
+    return 0;
+}
+
+// Call visit with each line of the grades file from offset from on that has a comma, with the
+// length of its name and its offset. A last line without its newline is visited as well. Stops
+// when visit returns other than 0 and returns that, returns 0 after the last line and -1 when the
+// file cannot be read. *covered is where the whole lines end.
+static int indexLines(gradeIndex *index, uint64_t from, int (*visit)(gradeIndex *, const char *, size_t, uint64_t, void *),
+                      void *context, uint64_t *covered) {
+    char *buffer = malloc(INDEX_SCAN_BUFFER);
+    if (buffer == NULL) {
+        return -1;
+    }
+    uint64_t offset = from;  // File offset of buffer[0]
+    size_t used = 0;
+    int result = 0;
+    while (result == 0) {
+        ssize_t got = pread(index->dataFd, buffer + used, INDEX_SCAN_BUFFER - used, offset + used);
+        if (got == -1 && errno == EINTR) {
+            continue;
+        }
+        if (got == -1) {
+            result = -1;
+            break;
+        }
+        if (got == 0) {
+            break;
+        }
+        used += got;
+
+        char *line = buffer;
+        char *end = buffer + used;
+        char *newline;
+        while (result == 0 && (newline = memchr(line, '\n', end - line)) != NULL) {
+            char *comma = memchr(line, ',', newline - line);
+            if (comma != NULL) {
+                result = visit(index, line, comma - line, offset + (line - buffer), context);
+            }
+            line = newline + 1;
+        }
+        size_t consumed = line - buffer;
+        if (consumed == 0 && used == INDEX_SCAN_BUFFER) {
+            consumed = used; // Not a grades line, skip it
+        }
+        memmove(buffer, line, used - consumed);
+        offset += consumed;
+        used -= consumed;
+    }
+    char *comma = result == 0 ? memchr(buffer, ',', used) : NULL;
+    if (comma != NULL) {
+        result = visit(index, buffer, comma - buffer, offset, context);
+    }
+    free(buffer);
+    *covered = offset;
+    return result;
+}
+
+static int indexLine(gradeIndex *index, const char *name, size_t len, uint64_t offset, void *context) {
+    (void)context;
+    return indexAdd(index, name, len, offset);
+}
+
+// Index the lines of the grades file from offset from on and stamp the header with what it covers.
+// A last line without its newline is indexed but not covered, the next scan sees it again once it
+// is complete.
+static int indexScan(gradeIndex *index, uint64_t from) {
+    uint64_t covered;
+    if (indexLines(index, from, indexLine, NULL, &covered) == -1) {
+        return -1;
+    }
+    return stampRecord(&index->header->stamp, index->dataFd, covered);
+}
+
+typedef struct {
+    const char *name;
+    size_t len;
+    uint64_t offset;
+} tailMatch;
+
+static int tailLine(gradeIndex *index, const char *name, size_t len, uint64_t offset, void *context) {
+    (void)index;
+    tailMatch *match = context;
+    if (len != match->len || memcmp(name, match->name, len) != 0) {
+        return 0;
+    }
+    match->offset = offset;
+    return 1;
+}
+
+// Offset of the first record named name among the lines a reader found after indexedSize, -1
+// when there is none
+static int64_t tailLookup(gradeIndex *index, const char *name, size_t len) {
+    if (index->writable || index->dataSize <= index->header->stamp.indexedSize) {
+        return -1;  // Writers index them when opening
+    }
+    tailMatch match = {name, len, 0};
+    uint64_t covered;
+    return indexLines(index, index->header->stamp.indexedSize, tailLine, &match, &covered) == 1 ? (int64_t)match.offset
+                                                                                                : -1;
+}
+
+static int indexIsCurrent(gradeIndex *index, const struct stat *st) {
+    indexHeader *header = index->header;
+    if (index->mappedSize < sizeof(indexHeader) || header->magic != INDEX_MAGIC || header->version != INDEX_VERSION ||
+        header->slotCount < INDEX_MIN_SLOTS || (header->slotCount & (header->slotCount - 1)) != 0 ||
+        index->mappedSize != indexFileSize(header->slotCount)) {
+        return 0;
+    }
+    return stampIsCurrent(&header->stamp, index->dataFd, st);
+}
+
+// Open the grades file and its index. forWriting opens the grades file for indexAppend, creating
+// it when missing, brings the index up to date and builds it when it is not current; the grades
+// file stays locked until indexClose, so commands running at the same time see each other's
+// records. Readers share the lock and leave the index file as it is: without a current index
+// there is none to open, the lines appended after it are scanned by indexFind.
+gradeIndex *indexOpen(const char *filename, int forWriting) {
+    gradeIndex *index = calloc(1, sizeof(gradeIndex));
+    if (index == NULL) {
+        return NULL;
+    }
+    index->fd = -1;
+    index->writable = forWriting;
+    index->dataFd = open(filename, forWriting ? O_RDWR | O_CREAT | O_APPEND : O_RDONLY, 0666);
+    size_t pathLen = strlen(filename) + sizeof(INDEX_SUFFIX);
+    index->path = malloc(pathLen);
+    if (index->dataFd == -1 || index->path == NULL || flock(index->dataFd, forWriting ? LOCK_EX : LOCK_SH) == -1) {
+        indexClose(index);
+        return NULL;
+    }
+    snprintf(index->path, pathLen, "%s%s", filename, INDEX_SUFFIX);
+
+    struct stat st;
+    if (fstat(index->dataFd, &st) == -1) {
+        indexClose(index);
+        return NULL;
+    }
+    index->dataSize = st.st_size;
+    index->fd = open(index->path, forWriting ? O_RDWR : O_RDONLY);
+    struct stat indexSt;
+    int usable = index->fd != -1 && fstat(index->fd, &indexSt) == 0 && indexSt.st_size >= (off_t)sizeof(indexHeader) &&
+                 indexMap(index) == 0;
+    if (usable && indexIsCurrent(index, &st)) {
+        if (forWriting && (uint64_t)st.st_size > index->header->stamp.indexedSize &&
+            indexScan(index, index->header->stamp.indexedSize) == -1) {
+            indexClose(index);
+            return NULL;
+        }
+        return index;
+    }
+    if (!forWriting) {
+        indexClose(index);
+        return NULL;
+    }
+
+    // Built in memory and saved once. Room for every line at most half full, a table that
+    // doubles while it is filled is rehashed. Without the count, room for a file of 32 byte lines.
+    indexUnmap(index);
+    if (index->fd != -1) {
+        close(index->fd);
+        index->fd = -1;
+    }
+    uint64_t lines = (uint64_t)st.st_size / 32;
+    mappedGrades map;
+    if (mapOpen(&map, filename) == 0) {
+        lines = mapLineCount(&map);
+        mapClose(&map);
+    }
+    uint64_t slotCount = INDEX_MIN_SLOTS;
+    while (slotCount < (lines + 1) * 2) {
+        slotCount *= 2;
+    }
+    if (indexReplace(index, slotCount, 0) == -1 || indexScan(index, 0) == -1 || indexSave(index) == -1) {
+        indexClose(index);
+        return NULL;
+    }
+    return index;
+}
+
+// 1 and the record's grade when name is in the file, 0 when it is not, -1 on errors
+int indexFind(gradeIndex *index, const char *name, char *grade, size_t gradeSize) {
+    char line[MAX_LINE_LENGTH + 1];
+    size_t len = strlen(name);
+    int64_t offset = indexLookup(index, name, len, nameHash(name, len), line, sizeof(line));
+    if (offset == -1) {
+        offset = tailLookup(index, name, len);
+        if (offset == -1 || recordAt(index, offset, line, sizeof(line)) == -1) {
+            return 0;
+        }
+    }
+    if (grade != NULL && gradeSize > 0) {
+        char *value = line + len + 1;
+        value += strspn(value, " ");
+        size_t valueLen = strcspn(value, "\n");
+        if (valueLen >= gradeSize) {
+            valueLen = gradeSize - 1;
+        }
+        memcpy(grade, value, valueLen);
+        grade[valueLen] = '\0';
+    }
+    return 1;
+}
+
+// Append "name, grade" to the grades file and index it, the caller checked it is not there yet
+int indexAppend(gradeIndex *index, const char *name, const char *grade) {
+    char buffer[MAX_LINE_LENGTH + 50];
+    int len = 0;
+    struct stat st;
+    char last = '\n';
+    if (fstat(index->dataFd, &st) == -1) {
+        return -1;
+    }
+    if (st.st_size > 0 && pread(index->dataFd, &last, 1, st.st_size - 1) != 1) {
+        return -1;
+    }
+    if (last != '\n') {
+        buffer[len++] = '\n'; // Do not run into a last line that lacks its newline
+    }
+    len += snprintf(buffer + len, sizeof(buffer) - len, "%s, %s\n", name, grade);
+    if (len >= (int)sizeof(buffer) || write(index->dataFd, buffer, len) != len) {
+        return -1;
+    }
+    return indexScan(index, index->header->stamp.indexedSize);
+}
+
+void indexClose(gradeIndex *index) {
+    if (index == NULL) {
+        return;
+    }
+    indexUnmap(index);
+    if (index->fd != -1) {
+        close(index->fd);
+    }
+    if (index->dataFd != -1) {
+        close(index->dataFd); // Releases the lock
+    }
+    free(index->path);
+    free(index);
+}
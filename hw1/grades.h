@@ -0,0 +1,226 @@
+#ifndef GRADES_H
+#define GRADES_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+// Definitions shared by main.c, the task log in tasklog.c, the indexes in gradeindex.c and
+// pageindex.c, the record store in gradestore.c, the sort in extsort.c, serve in daemon.c, the
+// import in import.c, the mapped reads in mapread.c, the queries in queryindex.c and the
+// benchmarks in bench.c
+
+#define MAX_NAME_LENGTH 100
+#define MAX_GRADE_LENGTH 3
+#define MAX_LINE_LENGTH (MAX_NAME_LENGTH + MAX_GRADE_LENGTH + 3) // 3 for ", "
+
+// Task log in tasklog.c. GTU_LOG_DURABILITY says when a line reaches LOG_FILE: "batch" (the
+// default) with the next flush, when the buffer fills, a second after its oldest line or at exit;
+// "line" at once; "sync" at once and on the disk.
+#define LOG_FILE "log.txt"
+#define LOG_BATCH 0
+#define LOG_LINE 1
+#define LOG_SYNC 2
+
+void logTaskCompletion(const char *taskName);
+void logSetDurability(int durability);
+void logFlush(void);
+int logFlushDelay(void);
+char **split_command(char *str);
+
+// On-disk hash index of a grades file, kept next to it in "<grades file>.idx".
+// Maps a name to the offset of its record so search and the duplicate check of
+// addStudentGrade read one record instead of the whole file.
+#define INDEX_SUFFIX ".idx"
+
+// What a cache of a grades file knows of the bytes it covers, see gradeindex.c. The file is taken
+// to still start with them when the check of their first and last STAMP_CHECK_BYTES matches, what
+// follows as appended; bytes rewritten between those ends go unnoticed.
+#define STAMP_CHECK_BYTES 4096
+
+typedef struct {
+    uint64_t indexedSize;   // Bytes of the grades file the cache covers
+    uint64_t dataDev;       // Grades file it was built for
+    uint64_t dataIno;
+    int64_t dataMtimeSec;   // Its mtime when indexedSize was last recorded
+    int64_t dataMtimeNsec;
+    uint64_t check;         // Hash of the first and last bytes up to indexedSize
+} dataStamp;
+
+int stampRecord(dataStamp *stamp, int dataFd, uint64_t indexedSize);
+int stampIsCurrent(const dataStamp *stamp, int dataFd, const struct stat *st);
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t slotCount;     // Power of two
+    uint64_t recordCount;
+    dataStamp stamp;        // indexedSize is always whole lines
+} indexHeader;
+
+typedef struct {
+    uint64_t offset;        // Record offset + 1, 0 for an empty slot
+    uint64_t hash;
+} indexSlot;
+
+typedef struct {
+    char *path;             // "<grades file>.idx"
+    int fd;                 // Index file, -1 while a table is built in memory
+    int dataFd;             // Grades file, locked with flock while the index is open
+    int writable;           // Opened for indexAppend, the lock is exclusive
+    indexHeader *header;    // The whole index file, mapped shared, or the table being built
+    indexSlot *slots;
+    size_t mappedSize;
+    uint64_t dataSize;      // Size of the grades file when opened
+} gradeIndex;
+
+gradeIndex *indexOpen(const char *filename, int forWriting);
+int indexFind(gradeIndex *index, const char *name, char *grade, size_t gradeSize);
+int indexAppend(gradeIndex *index, const char *name, const char *grade);
+void indexClose(gradeIndex *index);
+
+// Sparse line index of a grades file, kept next to it in "<grades file>.pages": the offset of
+// every PAGE_STRIDE-th line, so a page of listSome starts with one read instead of skipping the
+// lines before it.
+#define PAGES_SUFFIX ".pages"
+#define PAGE_STRIDE 64
+
+typedef struct {
+    uint32_t magic;
+    uint32_t stride;        // PAGE_STRIDE when it was built
+    uint64_t lineCount;     // Whole lines in indexedSize, the header is followed by the offsets of
+                            // lines 0, stride, 2 * stride, ... up to lineCount
+    dataStamp stamp;
+} pageHeader;
+
+int pagesUpdate(const char *filename, int dataFd);
+int pagesList(const char *filename, int64_t first, int64_t count, int outFd);
+
+// A grades file mapped read only, see mapread.c. Empty files are not mapped, data is NULL.
+typedef struct {
+    int fd;
+    char *data;
+    size_t size;
+} mappedGrades;
+
+int mapOpen(mappedGrades *map, const char *filename);
+void mapClose(mappedGrades *map);
+size_t mapLineCount(const mappedGrades *map);
+int mapFind(const mappedGrades *map, const char *name, char *grade, size_t gradeSize);
+
+// Output gathered as byte ranges, mostly lines of a mapped file, and written with writev. Ranges
+// that follow each other become one.
+#define BATCH_IOVECS 1024
+
+typedef struct {
+    int fd;
+    int count;
+    struct iovec iov[BATCH_IOVECS];
+} lineBatch;
+
+void batchInit(lineBatch *batch, int fd);
+int batchAdd(lineBatch *batch, const char *data, size_t len);
+int batchFlush(lineBatch *batch);
+
+// Query index of a grades file, kept next to it in "<grades file>.qix": the records in name order
+// for prefix and range queries, and a bitmap of the records of each grade. The header is
+// followed by recordCount record offsets (uint64_t) in file order, recordCount record numbers
+// (uint32_t) in name order and gradeCount bitmaps of recordCount bits in uint64_t words.
+#define QUERY_SUFFIX ".qix"
+#define QUERY_MAX_GRADES 64
+#define QUERY_GRADE_LENGTH 16
+
+#define QUERY_PREFIX 0      // Names starting with from
+#define QUERY_RANGE 1       // Names from from up to those starting with to
+#define QUERY_GRADE 2       // Records whose grade is from
+
+typedef struct {
+    uint32_t magic;
+    uint32_t gradeCount;    // 0 when the grades did not fit, grade queries scan then
+    uint64_t recordCount;   // Lines with a comma
+    dataStamp stamp;        // indexedSize is always whole lines
+    char grades[QUERY_MAX_GRADES][QUERY_GRADE_LENGTH];  // Grade of each bitmap, NUL padded
+} queryHeader;
+
+long queryGrades(const char *filename, int kind, const char *from, const char *to, int outFd);
+void queryStudents(const char *filename, int kind, const char *from, const char *to, FILE *out);
+
+// Columnar copy of grade records, see gradestore.c. A tail is the text after a name, ", AA",
+// kept once however many records share it.
+typedef struct {
+    char *text;
+    uint16_t len;
+    uint16_t keyStart;      // Where the grade starts in text
+    uint16_t rank;          // Order of the grade among the store's grades, set by storeRank
+} gradeTail;
+
+typedef struct {
+    char *names;            // Arena, the names back to back without terminators
+    size_t namesUsed;
+    size_t namesCapacity;
+    uint32_t *nameOffset;   // Per record: where its name starts in names,
+    uint16_t *nameLen;      // how long it is
+    uint16_t *tail;         // and which tail follows it
+    size_t count;
+    size_t capacity;
+    size_t prefixLen;       // Bytes all names start with
+    gradeTail *tails;
+    size_t tailCount;
+    size_t tailCapacity;
+    uint32_t *tailSlots;    // Hash table of tail number + 1, 0 for an empty slot
+    size_t tailSlotCount;
+    uint32_t *nameSlots;    // Hash table of record + 1 by name, NULL until storeIndexNames
+    size_t nameSlotCount;
+} gradeStore;
+
+void storeInit(gradeStore *store);
+void storeReset(gradeStore *store);
+void storeFree(gradeStore *store);
+size_t storeBytes(const gradeStore *store);
+long storeAdd(gradeStore *store, const char *line, size_t len);
+long storeRank(gradeStore *store);
+uint64_t storeNameKey(const gradeStore *store, size_t i, size_t offset);
+int storeIndexNames(gradeStore *store);
+long storeFind(const gradeStore *store, const char *name, size_t len);
+
+// sortAll keeps up to this much of the file in memory unless told otherwise, see extsort.c.
+// It sorts on one thread per online CPU by default.
+#define SORT_DEFAULT_MEMORY (64 * 1024 * 1024)
+#define SORT_MAX_THREADS 64
+#define SORT_ASK 2          // sortAll was not told name or grade
+
+long sortGrades(const char *filename, int byGrade, size_t memoryBudget, int threads, FILE *out, int *runCount);
+long sortStore(gradeStore *store, int byGrade, int threads, FILE *out, long *number);
+int storeOrder(gradeStore *store, int byGrade, int threads, uint32_t *order);
+int sortArguments(char **args, int count, size_t *memoryBudget, int *threads);
+
+// serve keeps one grades file in memory and answers commands on stdin and a Unix socket without
+// forking, see daemon.c
+typedef struct {
+    char *filename;
+    int fd;                 // The grades file, appended to
+    dataStamp stamp;        // What it was when last loaded, indexedSize the bytes in the store
+    int partial;            // Its last line has no newline yet
+    gradeStore store;       // Its records, names hashed
+} residentGrades;
+
+int residentOpen(residentGrades *grades, const char *filename);
+void residentClose(residentGrades *grades);
+int residentLock(residentGrades *grades);
+void residentUnlock(residentGrades *grades);
+int residentAppend(residentGrades *grades, const char *data, size_t len);
+int serveCommand(residentGrades *grades, char *line, FILE *out);
+void serveGrades(const char *filename, const char *socketPath);
+int serveUnread(char *c);
+void searchStudent(const char *filename, const char *name);
+
+// importGrades adds the rows of a CSV file of name,grade to a grades file, see import.c
+long importGrades(residentGrades *grades, const char *csvPath, FILE *out);
+void importGradesFile(const char *csvPath, const char *filename);
+
+void runBenchmark(char **args, int numArgs);
+
+#endif
@@ -0,0 +1,327 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "grades.h"
+
+// Columnar copy of grade records. A record is the name, copied into the names arena, and the rest
+// of its line (", AA"), kept once per distinct text in the tails dictionary. The columns hold a
+// 4 byte arena offset, a 2 byte name length and a 2 byte tail number per record, so a record
+// costs 8 bytes plus its name. storeRank gives every tail the rank of its grade, sorting by grade
+// then compares small integers. With storeIndexNames the names are hashed as well, storeFind then
+// finds a record by name.
+
+#define STORE_MIN_RECORDS 1024
+#define STORE_MIN_NAMES (64 * 1024)
+#define STORE_MIN_TAIL_SLOTS 64
+#define STORE_MIN_NAME_SLOTS 1024
+
+static uint32_t textHash(const char *text, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void storeInit(gradeStore *store) {
+    memset(store, 0, sizeof(*store));
+}
+
+// Forget the records, keep the memory and the tails for the next batch
+void storeReset(gradeStore *store) {
+    store->count = 0;
+    store->namesUsed = 0;
+    store->prefixLen = 0;
+    if (store->nameSlots != NULL) {
+        memset(store->nameSlots, 0, store->nameSlotCount * sizeof(uint32_t));
+    }
+}
+
+void storeFree(gradeStore *store) {
+    free(store->names);
+    free(store->nameOffset);
+    free(store->nameLen);
+    free(store->tail);
+    for (size_t i = 0; i < store->tailCount; i++) {
+        free(store->tails[i].text);
+    }
+    free(store->tails);
+    free(store->tailSlots);
+    free(store->nameSlots);
+    storeInit(store);
+}
+
+// Bytes the records take, what sortGrades weighs against its budget
+size_t storeBytes(const gradeStore *store) {
+    return store->namesUsed + store->count * (sizeof(uint32_t) + 2 * sizeof(uint16_t)) +
+           store->tailCount * sizeof(gradeTail) + (store->tailSlotCount + store->nameSlotCount) * sizeof(uint32_t);
+}
+
+static int storeGrowRecords(gradeStore *store) {
+    size_t capacity = store->capacity == 0 ? STORE_MIN_RECORDS : store->capacity * 2;
+    if (capacity > UINT32_MAX) {
+        errno = EFBIG;
+        return -1;
+    }
+    uint32_t *nameOffset = realloc(store->nameOffset, capacity * sizeof(uint32_t));
+    if (nameOffset != NULL) {
+        store->nameOffset = nameOffset;
+    }
+    uint16_t *nameLen = realloc(store->nameLen, capacity * sizeof(uint16_t));
+    if (nameLen != NULL) {
+        store->nameLen = nameLen;
+    }
+    uint16_t *tail = realloc(store->tail, capacity * sizeof(uint16_t));
+    if (tail != NULL) {
+        store->tail = tail;
+    }
+    if (nameOffset == NULL || nameLen == NULL || tail == NULL) {
+        return -1;
+    }
+    store->capacity = capacity;
+    return 0;
+}
+
+static int storeGrowNames(gradeStore *store, size_t needed) {
+    size_t capacity = store->namesCapacity == 0 ? STORE_MIN_NAMES : store->namesCapacity;
+    while (capacity < store->namesUsed + needed) {
+        capacity *= 2;
+    }
+    if (capacity > (size_t)UINT32_MAX + 1) {
+        errno = EFBIG;  // Offsets are 32 bits
+        return -1;
+    }
+    char *names = realloc(store->names, capacity);
+    if (names == NULL) {
+        return -1;
+    }
+    store->names = names;
+    store->namesCapacity = capacity;
+    return 0;
+}
+
+static void tailSlotInsert(gradeStore *store, uint32_t tailIndex) {
+    const gradeTail *tail = &store->tails[tailIndex];
+    size_t mask = store->tailSlotCount - 1;
+    size_t i = textHash(tail->text, tail->len) & mask;
+    while (store->tailSlots[i] != 0) {
+        i = (i + 1) & mask;
+    }
+    store->tailSlots[i] = tailIndex + 1;
+}
+
+// Number of the tail with this text, added when it is new. -1 when the dictionary is full.
+static int storeTail(gradeStore *store, const char *text, size_t len) {
+    if (store->tailSlotCount > 0) {
+        size_t mask = store->tailSlotCount - 1;
+        for (size_t i = textHash(text, len) & mask; store->tailSlots[i] != 0; i = (i + 1) & mask) {
+            const gradeTail *tail = &store->tails[store->tailSlots[i] - 1];
+            if (tail->len == len && memcmp(tail->text, text, len) == 0) {
+                return store->tailSlots[i] - 1;
+            }
+        }
+    }
+    if (store->tailCount > UINT16_MAX) {
+        errno = EFBIG;
+        return -1;
+    }
+    if (store->tailCount == store->tailCapacity) {
+        size_t capacity = store->tailCapacity == 0 ? 16 : store->tailCapacity * 2;
+        gradeTail *tails = realloc(store->tails, capacity * sizeof(gradeTail));
+        if (tails == NULL) {
+            return -1;
+        }
+        store->tails = tails;
+        store->tailCapacity = capacity;
+    }
+    if ((store->tailCount + 1) * 2 > store->tailSlotCount) {
+        size_t slotCount = store->tailSlotCount == 0 ? STORE_MIN_TAIL_SLOTS : store->tailSlotCount * 2;
+        uint32_t *slots = calloc(slotCount, sizeof(uint32_t));
+        if (slots == NULL) {
+            return -1;
+        }
+        free(store->tailSlots);
+        store->tailSlots = slots;
+        store->tailSlotCount = slotCount;
+        for (size_t i = 0; i < store->tailCount; i++) {
+            tailSlotInsert(store, i);
+        }
+    }
+    gradeTail *tail = &store->tails[store->tailCount];
+    tail->text = malloc(len + 1);
+    if (tail->text == NULL) {
+        return -1;
+    }
+    memcpy(tail->text, text, len);
+    tail->text[len] = '\0';
+    tail->len = len;
+    // The grade is what follows the comma and its spaces
+    size_t keyStart = len > 0 ? 1 : 0;
+    while (keyStart < len && text[keyStart] == ' ') {
+        keyStart++;
+    }
+    tail->keyStart = keyStart;
+    tail->rank = 0;
+    tailSlotInsert(store, store->tailCount);
+    return store->tailCount++;
+}
+
+static void nameSlotInsert(uint32_t *slots, size_t slotCount, const gradeStore *store, uint32_t i) {
+    size_t mask = slotCount - 1;
+    size_t slot = textHash(store->names + store->nameOffset[i], store->nameLen[i]) & mask;
+    while (slots[slot] != 0) {
+        slot = (slot + 1) & mask;
+    }
+    slots[slot] = i + 1;
+}
+
+static long nameSlotFind(const uint32_t *slots, size_t slotCount, const gradeStore *store, const char *name,
+                         size_t len) {
+    size_t mask = slotCount - 1;
+    for (size_t slot = textHash(name, len) & mask; slots[slot] != 0; slot = (slot + 1) & mask) {
+        uint32_t i = slots[slot] - 1;
+        if (store->nameLen[i] == len && memcmp(store->names + store->nameOffset[i], name, len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Hash the names of all records again into a table for count records, at most half full
+static int nameSlotsResize(gradeStore *store, size_t count) {
+    size_t slotCount = STORE_MIN_NAME_SLOTS;
+    while (slotCount < count * 2) {
+        slotCount *= 2;
+    }
+    uint32_t *slots = calloc(slotCount, sizeof(uint32_t));
+    if (slots == NULL) {
+        return -1;
+    }
+    // In record order, so the first record of a name is the one hashed
+    for (size_t i = 0; i < store->count; i++) {
+        if (nameSlotFind(slots, slotCount, store, store->names + store->nameOffset[i], store->nameLen[i]) == -1) {
+            nameSlotInsert(slots, slotCount, store, i);
+        }
+    }
+    free(store->nameSlots);
+    store->nameSlots = slots;
+    store->nameSlotCount = slotCount;
+    return 0;
+}
+
+// Hash the names from now on, for storeFind
+int storeIndexNames(gradeStore *store) {
+    return store->nameSlots != NULL ? 0 : nameSlotsResize(store, store->count + 1);
+}
+
+// Index of the first record named name, -1 when there is none or the names are not hashed
+long storeFind(const gradeStore *store, const char *name, size_t len) {
+    if (store->nameSlots == NULL) {
+        return -1;
+    }
+    return nameSlotFind(store->nameSlots, store->nameSlotCount, store, name, len);
+}
+
+// Add the record in line (len bytes, no newline): the name is everything before the first comma.
+// Returns its index or -1 with errno set.
+long storeAdd(gradeStore *store, const char *line, size_t len) {
+    const char *comma = memchr(line, ',', len);
+    size_t nameLen = comma != NULL ? (size_t)(comma - line) : len;
+    if (nameLen > UINT16_MAX || len - nameLen > UINT16_MAX) {
+        errno = EINVAL;  // No grades line
+        return -1;
+    }
+    if (store->count == store->capacity && storeGrowRecords(store) == -1) {
+        return -1;
+    }
+    if (store->namesUsed + nameLen > store->namesCapacity && storeGrowNames(store, nameLen) == -1) {
+        return -1;
+    }
+    int tail = storeTail(store, line + nameLen, len - nameLen);
+    if (tail == -1) {
+        return -1;
+    }
+
+    size_t i = store->count;
+    // Common prefix of all names, name keys start behind it
+    if (i == 0) {
+        store->prefixLen = nameLen;
+    }
+    else {
+        const char *first = store->names + store->nameOffset[0];
+        size_t prefix = 0;
+        while (prefix < store->prefixLen && prefix < nameLen && first[prefix] == line[prefix]) {
+            prefix++;
+        }
+        store->prefixLen = prefix;
+    }
+    memcpy(store->names + store->namesUsed, line, nameLen);
+    store->nameOffset[i] = store->namesUsed;
+    store->nameLen[i] = nameLen;
+    store->tail[i] = tail;
+    store->namesUsed += nameLen;
+    store->count++;
+    if (store->nameSlots != NULL && storeFind(store, line, nameLen) == -1) {
+        if (store->count * 2 <= store->nameSlotCount) {
+            nameSlotInsert(store->nameSlots, store->nameSlotCount, store, i);
+        }
+        else if (nameSlotsResize(store, store->count) == -1) {
+            store->count--;
+            store->namesUsed -= nameLen;
+            return -1;
+        }
+    }
+    return i;
+}
+
+static int tailGradeCompare(const void *x, const void *y, void *context) {
+    const gradeTail *tails = context;
+    const gradeTail *a = &tails[*(const uint16_t *)x];
+    const gradeTail *b = &tails[*(const uint16_t *)y];
+    size_t aLen = a->len - a->keyStart;
+    size_t bLen = b->len - b->keyStart;
+    int result = memcmp(a->text + a->keyStart, b->text + b->keyStart, aLen < bLen ? aLen : bLen);
+    if (result != 0) {
+        return result;
+    }
+    return aLen < bLen ? -1 : aLen > bLen;
+}
+
+// Rank the tails by grade, tails with the same grade share a rank. Returns the number of ranks
+// or -1.
+long storeRank(gradeStore *store) {
+    uint16_t *order = malloc((store->tailCount + 1) * sizeof(uint16_t));
+    if (order == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < store->tailCount; i++) {
+        order[i] = i;
+    }
+    qsort_r(order, store->tailCount, sizeof(uint16_t), tailGradeCompare, store->tails);
+    size_t rank = 0;
+    for (size_t i = 0; i < store->tailCount; i++) {
+        if (i > 0 && tailGradeCompare(&order[i - 1], &order[i], store->tails) != 0) {
+            rank++;
+        }
+        store->tails[order[i]].rank = rank;
+    }
+    free(order);
+    return store->tailCount > 0 ? rank + 1 : 0;
+}
+
+// 8 name bytes from offset on behind the common prefix, big endian and zero padded, so they
+// compare like the names do
+uint64_t storeNameKey(const gradeStore *store, size_t i, size_t offset) {
+    const unsigned char *name = (const unsigned char *)store->names + store->nameOffset[i];
+    size_t len = store->nameLen[i];
+    uint64_t key = 0;
+    for (size_t b = 0; b < 8; b++) {
+        size_t at = store->prefixLen + offset + b;
+        key = key << 8 | (at < len ? name[at] : 0);
+    }
+    return key;
+}
@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "grades.h"
+
+// importGrades "students.csv" "grades.txt": adds every name,grade row of a CSV file whose name is
+// not in the grades file yet. The names of the grades file are loaded into a resident store once,
+// every row is one hash lookup, and the new records go out in large appends. The grades file is
+// locked for the whole import, an addStudentGrade waits for it and sees all of it.
+//
+// Fields may be quoted, "" is a quote inside a quoted field, spaces around fields are dropped. A
+// first row of "name,grade" is a header. Rows that are not two fields of the lengths
+// addStudentGrade accepts are rejected, a name appearing twice is imported once.
+
+#define IMPORT_READ_BUFFER (1024 * 1024)
+#define IMPORT_WRITE_BUFFER (1024 * 1024)
+#define IMPORT_REPORTED_ERRORS 5
+
+typedef struct {
+    long rows;        // Rows with data, the header and empty lines not counted
+    long imported;    // Written to the grades file
+    long pending;     // In buffer
+    long duplicates;
+    long rejected;
+    char *buffer;     // Records not written yet
+    size_t used;
+} importState;
+
+static double importSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Split row into fields, unquoting them in place. Stores up to max of them and returns how many
+// there are, -1 for an unterminated quote.
+static int csvFields(char *row, size_t len, char **fields, size_t *lens, int max) {
+    char *end = row + len;
+    char *at = row;
+    int count = 0;
+    for (;;) {
+        while (at < end && (*at == ' ' || *at == '\t')) {
+            at++;
+        }
+        char *field = at;
+        char *out = at;
+        if (at < end && *at == '"') {
+            at++;
+            for (;;) {
+                if (at == end) {
+                    return -1;
+                }
+                if (*at == '"' && at + 1 < end && at[1] == '"') {
+                    *out++ = '"';
+                    at += 2;
+                }
+                else if (*at == '"') {
+                    at++;
+                    break;
+                }
+                else {
+                    *out++ = *at++;
+                }
+            }
+            while (at < end && (*at == ' ' || *at == '\t')) {
+                at++;
+            }
+        }
+        else {
+            while (at < end && *at != ',') {
+                at++;
+            }
+            out = at;
+            while (out > field && (out[-1] == ' ' || out[-1] == '\t')) {
+                out--;
+            }
+        }
+        if (count < max) {
+            fields[count] = field;
+            lens[count] = out - field;
+        }
+        count++;
+        if (at == end) {
+            return count;
+        }
+        if (*at != ',') {
+            return -1;  // Text after a closing quote
+        }
+        at++;
+    }
+}
+
+// Write the buffered records. When that fails they are dropped, residentAppend left the store to
+// be loaded again.
+static int importFlush(residentGrades *grades, importState *state) {
+    int result = state->used > 0 ? residentAppend(grades, state->buffer, state->used) : 0;
+    if (result == 0) {
+        state->imported += state->pending;
+    }
+    state->used = 0;
+    state->pending = 0;
+    return result;
+}
+
+static void importReject(importState *state, const char *csvPath, long lineNumber, FILE *out) {
+    state->rejected++;
+    if (state->rejected <= IMPORT_REPORTED_ERRORS) {
+        fprintf(out, "Error: Line %ld of %s is not a name and a grade.\n", lineNumber, csvPath);
+    }
+}
+
+static int importRow(residentGrades *grades, importState *state, char *row, size_t len, long lineNumber,
+                     const char *csvPath, FILE *out) {
+    if (len > 0 && row[len - 1] == '\r') {
+        len--;
+    }
+    if (len == 0) {
+        return 0;
+    }
+    char *fields[2];
+    size_t lens[2];
+    int count = csvFields(row, len, fields, lens, 2);
+    if (lineNumber == 1 && count == 2 && lens[0] == 4 && lens[1] == 5 && strncasecmp(fields[0], "name", 4) == 0 &&
+        strncasecmp(fields[1], "grade", 5) == 0) {
+        return 0;  // Header
+    }
+    state->rows++;
+    // The record must read back as one line whose name ends at its first comma
+    if (count != 2 || lens[0] == 0 || lens[0] >= MAX_NAME_LENGTH || lens[1] == 0 || lens[1] >= MAX_GRADE_LENGTH ||
+        memchr(fields[0], ',', lens[0]) != NULL || memchr(fields[0], '\n', lens[0]) != NULL ||
+        memchr(fields[1], '\n', lens[1]) != NULL) {
+        importReject(state, csvPath, lineNumber, out);
+        return 0;
+    }
+    if (storeFind(&grades->store, fields[0], lens[0]) != -1) {
+        state->duplicates++;
+        return 0;
+    }
+
+    if (state->used + MAX_LINE_LENGTH + 1 > IMPORT_WRITE_BUFFER && importFlush(grades, state) == -1) {
+        return -1;
+    }
+    char *record = state->buffer + state->used;
+    memcpy(record, fields[0], lens[0]);
+    memcpy(record + lens[0], ", ", 2);
+    memcpy(record + lens[0] + 2, fields[1], lens[1]);
+    size_t recordLen = lens[0] + 2 + lens[1];
+    // In the store right away, a name further down the file is a duplicate
+    if (storeAdd(&grades->store, record, recordLen) == -1) {
+        return -1;
+    }
+    record[recordLen] = '\n';
+    state->used += recordLen + 1;
+    state->pending++;
+    return 0;
+}
+
+// Import csvPath into the grades file of grades. Prints what it did to out, returns the number of
+// records added or -1.
+long importGrades(residentGrades *grades, const char *csvPath, FILE *out) {
+    double start = importSeconds();
+    int csvFd = open(csvPath, O_RDONLY | O_CLOEXEC);
+    if (csvFd == -1) {
+        fprintf(out, "Error: Unable to open file.\n");
+        logTaskCompletion("Error: Unable to open file.");
+        return -1;
+    }
+    importState state;
+    memset(&state, 0, sizeof(state));
+    char *readBuffer = malloc(IMPORT_READ_BUFFER);
+    state.buffer = malloc(IMPORT_WRITE_BUFFER);
+    if (readBuffer == NULL || state.buffer == NULL || residentLock(grades) == -1) {
+        fprintf(out, "Error: Unable to import students.\n");
+        logTaskCompletion("Error: Unable to import students.");
+        free(readBuffer);
+        free(state.buffer);
+        close(csvFd);
+        return -1;
+    }
+    posix_fadvise(csvFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    int failed = 0;
+    int skipping = 0;  // In the rest of a line longer than the read buffer
+    long lineNumber = 0;
+    size_t filled = 0;
+    for (;;) {
+        ssize_t got = read(csvFd, readBuffer + filled, IMPORT_READ_BUFFER - filled);
+        if (got == -1 && errno == EINTR) {
+            continue;
+        }
+        if (got == -1) {
+            failed = 1;
+            break;
+        }
+        filled += got;
+        char *line = readBuffer;
+        char *end = readBuffer + filled;
+        char *newline;
+        while (!failed && (newline = memchr(line, '\n', end - line)) != NULL) {
+            if (skipping) {
+                skipping = 0;
+            }
+            else if (importRow(grades, &state, line, newline - line, ++lineNumber, csvPath, out) == -1) {
+                failed = 1;
+            }
+            line = newline + 1;
+        }
+        if (failed) {
+            break;
+        }
+        if (got == 0) {
+            // The last line may have no newline
+            if (line < end && !skipping &&
+                importRow(grades, &state, line, end - line, ++lineNumber, csvPath, out) == -1) {
+                failed = 1;
+            }
+            break;
+        }
+        filled = end - line;
+        if (filled == IMPORT_READ_BUFFER) {
+            // No newline in the whole buffer, not a row
+            if (!skipping) {
+                state.rows++;
+                importReject(&state, csvPath, ++lineNumber, out);
+            }
+            skipping = 1;
+            filled = 0;
+        }
+        else {
+            memmove(readBuffer, line, filled);
+        }
+    }
+    if (importFlush(grades, &state) == -1) {
+        failed = 1;
+    }
+    if (failed) {
+        // The store may hold a record of the row that failed, load it from the file again
+        grades->stamp.dataIno = 0;
+    }
+    residentUnlock(grades);
+    close(csvFd);
+    free(readBuffer);
+    free(state.buffer);
+
+    char logline[MAX_LINE_LENGTH + 80];
+    if (failed) {
+        fprintf(out, "Error: Unable to import students, %ld imported before the error.\n", state.imported);
+        snprintf(logline, sizeof(logline), "Error: Import Grades stopped after %ld students.", state.imported);
+        logTaskCompletion(logline);
+        return -1;
+    }
+    double seconds = importSeconds() - start;
+    if (state.rejected > IMPORT_REPORTED_ERRORS) {
+        fprintf(out, "%ld more lines rejected.\n", state.rejected - IMPORT_REPORTED_ERRORS);
+    }
+    fprintf(out, "Imported %ld of %ld rows (%ld duplicates, %ld rejected) in %.3f s, %.0f rows/sec.\n",
+            state.imported, state.rows, state.duplicates, state.rejected, seconds,
+            seconds > 0 ? state.rows / seconds : 0);
+    snprintf(logline, sizeof(logline), "Import Grades: %ld of %ld rows", state.imported, state.rows);
+    logTaskCompletion(logline);
+    return state.imported;
+}
+
+// The importGrades command outside serve, the grades file is loaded for this import only
+void importGradesFile(const char *csvPath, const char *filename) {
+    residentGrades grades;
+    if (residentOpen(&grades, filename) == -1) {
+        printf("Error: Unable to open file.\n");
+        logTaskCompletion("Error: Unable to open file.");
+        return;
+    }
+    importGrades(&grades, csvPath, stdout);
+    residentClose(&grades);
+    fflush(stdout);
+}
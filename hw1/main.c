@@ -8,79 +8,49 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 
-#define MAX_NAME_LENGTH 100
-#define MAX_GRADE_LENGTH 3
-#define MAX_LINE_LENGTH (MAX_NAME_LENGTH + MAX_GRADE_LENGTH + 3) // 3 for ", "
+#include "grades.h"
 
 void addStudentGrade(const char *filename, const char *name, const char *grade);
 void searchStudent(const char *filename, const char *name);
-void sortAll(const char *filename);
+void sortAll(const char *filename, size_t memoryBudget, int threads, int byGrade);
 void showAll(const char *filename);
 void listGrades(const char *filename);
 void listSome(const char *filename, int numEntries, int pageNumber);
 void printUsage();
-void logTaskCompletion(const char *taskName);
 int readInput(char *buffer, size_t size);
 
 void addStudentGrade(const char *filename, const char *name, const char *grade) {
-    int file_desc = open(filename, O_RDWR|O_CREAT, 0666);
+    // The index answers the duplicate check without scanning the file
+    gradeIndex *index = indexOpen(filename, 1);
 
-    if (file_desc == -1) {
+    if (index == NULL) {
         char errorMsg[] = "Error: Unable to open file.\n";
         write(STDOUT_FILENO, errorMsg, sizeof(errorMsg) - 1); // Using write instead of printf
         logTaskCompletion("Error: Unable to open file.");
         return;
     }
 
-    char currentName[MAX_NAME_LENGTH-1];
-    int pos = 0;
-    int bytesRead;
-    char c;
-
-    while ((bytesRead = read(file_desc, &c, 1)) > 0) {
-        if (c == ',') {
-            currentName[pos] = '\0'; // Null-terminate the string
-            if (strcmp(currentName, name) == 0) {
-                char errorMsg[] = "Error: Student already exists.\n";
-                write(STDOUT_FILENO, errorMsg, sizeof(errorMsg) - 1); // Using write instead of printf
-                char logline[MAX_LINE_LENGTH + 50];
-                strcpy(logline, "Error: Student ");
-                strncat(logline, name, MAX_NAME_LENGTH - 1);
-                strcat(logline, " already exists.");
-                logTaskCompletion(logline);
-                close(file_desc);
-                return;
-            }
-            pos = 0; // Reset position for next name
-        } else if (c == '\n') {
-            pos = 0; // Reset position for next name
-            currentName[0] = '\0'; // Reset currentName to an empty string
-        } else {
-            currentName[pos++] = c; // Store character in the name buffer
-        }
-    }
-
-    // Close the file before reopening in write mode
-    close(file_desc);
-
-    // Reopen the file in append mode to add the new student's grade
-    file_desc = open(filename, O_WRONLY | O_APPEND);
-    if (file_desc == -1) {
-        char errorMsg[] = "Error: Unable to open file.\n";
+    if (indexFind(index, name, NULL, 0) == 1) {
+        char errorMsg[] = "Error: Student already exists.\n";
         write(STDOUT_FILENO, errorMsg, sizeof(errorMsg) - 1); // Using write instead of printf
-        logTaskCompletion("Error: Unable to open file.");
+        char logline[MAX_LINE_LENGTH + 50];
+        strcpy(logline, "Error: Student ");
+        strncat(logline, name, MAX_NAME_LENGTH - 1);
+        strcat(logline, " already exists.");
+        logTaskCompletion(logline);
+        indexClose(index);
         return;
     }
 
-    char buffer[MAX_LINE_LENGTH + 50]; // Ensure enough space for the message
-    strcpy(buffer, name);
-    strcat(buffer, ", ");
-    strcat(buffer, grade);
-    strcat(buffer, "\n");
-
-    write(file_desc, buffer, strlen(buffer)); // Using write instead of dprintf
-
-    close(file_desc);
+    if (strlen(name) >= MAX_NAME_LENGTH || strlen(grade) >= MAX_GRADE_LENGTH || indexAppend(index, name, grade) == -1) {
+        char errorMsg[] = "Error: Unable to add student.\n";
+        write(STDOUT_FILENO, errorMsg, sizeof(errorMsg) - 1);
+        logTaskCompletion("Error: Unable to add student.");
+        indexClose(index);
+        return;
+    }
+    pagesUpdate(filename, index->dataFd);  // Still locked, listSome only reads the page file
+    indexClose(index);
 
     char logline[MAX_LINE_LENGTH + 50];
     strcpy(logline, "Add Student Grade: ");
@@ -91,216 +61,108 @@ void addStudentGrade(const char *filename, const char *name, const char *grade)
 }
 
 void searchStudent(const char *filename, const char *inputName) {
-    int file_desc = open(filename, O_RDONLY);
-    if (file_desc == -1) {
-        char errorMsg[] = "Error: Unable to open file.\n";
-        write(STDOUT_FILENO, errorMsg, sizeof(errorMsg) - 1);
-        char logline[] = "Error: file not found.";
-        logTaskCompletion(logline);
-        exit(EXIT_FAILURE);
+    gradeIndex *index = indexOpen(filename, 0);
+    char grade[MAX_GRADE_LENGTH + 1];
+    int found;
+    if (index != NULL) {
+        found = indexFind(index, inputName, grade, sizeof(grade)) == 1;
     }
-
-    char line[MAX_LINE_LENGTH];
-    char name[MAX_NAME_LENGTH];
-    char grade[MAX_GRADE_LENGTH];
-    int nameIndex = 0;
-    int bytesRead;
-    char c;
-
-    while ((bytesRead = read(file_desc, &c, 1)) > 0) {
-        if (c == ',') {
-            name[nameIndex] = '\0'; // Null-terminate the name
-            if (strcmp(name, inputName) == 0) {
-                // Student found, extract and print grade
-                bytesRead = read(file_desc, grade, MAX_GRADE_LENGTH);
-                if (bytesRead > 0) {
-                    grade[bytesRead] = '\0'; // Null-terminate the grade
-                    char studentMsg[MAX_LINE_LENGTH];
-                    int msgLength = snprintf(studentMsg, MAX_LINE_LENGTH, "Student %s's grade: %s\n", name, grade);
-                    write(STDOUT_FILENO, studentMsg, msgLength);
-                    char logline[MAX_LINE_LENGTH];
-                    strcpy(logline, "Student searched");
-                    strncat(logline, studentMsg, msgLength);
-                    logTaskCompletion(logline);
-                    close(file_desc);
-                    return;
-                }
-            }
-            nameIndex = 0; // Reset name index for next name
-        } else if (c == '\n') {
-            // Reset name index and name buffer for the next line
-            nameIndex = 0;
-        } else {
-            // Store character in the name buffer
-            name[nameIndex++] = c;
+    else {
+        // No current index, addStudentGrade builds it: scan the file instead
+        mappedGrades map;
+        if (mapOpen(&map, filename) == -1) {
+            char errorMsg[] = "Error: Unable to open file.\n";
+            write(STDOUT_FILENO, errorMsg, sizeof(errorMsg) - 1);
+            char logline[] = "Error: file not found.";
+            logTaskCompletion(logline);
+            exit(EXIT_FAILURE);
         }
+        found = mapFind(&map, inputName, grade, sizeof(grade)) == 1;
+        mapClose(&map);
+    }
+
+    if (found) {
+        // Student found, print grade
+        char studentMsg[MAX_LINE_LENGTH + 50];
+        int msgLength = snprintf(studentMsg, sizeof(studentMsg), "Student %s's grade: %s\n", inputName, grade);
+        write(STDOUT_FILENO, studentMsg, msgLength);
+        char logline[MAX_LINE_LENGTH + 80];
+        strcpy(logline, "Student searched");
+        strncat(logline, studentMsg, msgLength);
+        logTaskCompletion(logline);
+        indexClose(index);
+        return;
     }
 
     // If execution reaches here, student was not found
-    char notFoundMsg[MAX_LINE_LENGTH];
-    int notFoundMsgLength = snprintf(notFoundMsg, MAX_LINE_LENGTH, "Student %s not found.\n", inputName);
+    char notFoundMsg[MAX_LINE_LENGTH + 50];
+    int notFoundMsgLength = snprintf(notFoundMsg, sizeof(notFoundMsg), "Student %s not found.\n", inputName);
     write(STDOUT_FILENO, notFoundMsg, notFoundMsgLength);
-    char logline[MAX_LINE_LENGTH];
+    char logline[MAX_LINE_LENGTH + 80];
                     strcpy(logline, "Student ");
                     strncat(logline, notFoundMsg, notFoundMsgLength);
                     strcat(logline, " not found. ");
                     logTaskCompletion(logline);
-    close(file_desc);
+    indexClose(index);
 }
-void sortAll(const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) {
+// Sorts with at most memoryBudget bytes of records in memory, larger files are sorted in runs on disk.
+// threads threads share the sorting, 0 means one per CPU.
+void sortAll(const char *filename, size_t memoryBudget, int threads, int byGrade) {
+    if (access(filename, R_OK) == -1) {
         printf("Error: Unable to open file.\n");
         logTaskCompletion("Error: file not found.");
         exit(EXIT_FAILURE);
     }
 
-    write(STDOUT_FILENO, "Write how it will be sorted.(grade or name)\n", strlen("Write how it will be sorted.(grade or name)\n"));
-    char line[MAX_LINE_LENGTH];
-    scanf("%s",line);
-    if(strcmp(line, "grade")==0){
-        // Sorting by grade implementation
-        FILE *file = fopen(filename, "r+");
-        if (file == NULL) {
-            perror("Error opening file");
-            exit(EXIT_FAILURE);
-        }
-
-        char lines[MAX_LINE_LENGTH+100][MAX_LINE_LENGTH+100];
-        char temp[MAX_LINE_LENGTH+100];
-        int count = 0;
-
-        // Read all lines from the file
-        while (fgets(lines[count], sizeof(lines[count]), file)) {
-            count++;
-        }
-
-        // Perform sorting based on student grade
-        for (int i = 0; i < count - 1; i++) {
-            for (int j = 0; j < count - i - 1; j++) {
-                char grade1[MAX_GRADE_LENGTH];
-                char grade2[MAX_GRADE_LENGTH];
-                sscanf(lines[j], "%*[^,], %[^\n]", grade1);
-                sscanf(lines[j + 1], "%*[^,], %[^\n]", grade2);
-                if (strcmp(grade1, grade2) > 0) {
-                    strcpy(temp, lines[j]);
-                    strcpy(lines[j], lines[j + 1]);
-                    strcpy(lines[j + 1], temp);
-                }
-            }
-        }
-
-        for (int i = 0; i < count; i++) {
-            printf("%d. %s",i+1,lines[i]);
-        }
-        logTaskCompletion("Sort All (by Grade)");
-        fclose(file);
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (cpus < SORT_MAX_THREADS ? (int)cpus : SORT_MAX_THREADS) : 1;
     }
-    else if(strcmp(line, "name")==0){
-        // Sorting by name implementation
-        FILE *file = fopen(filename, "r+");
-        if (file == NULL) {
-            perror("Error opening file");
-            exit(EXIT_FAILURE);
-        }
-
-        char lines[MAX_LINE_LENGTH+100][MAX_LINE_LENGTH+100];
-        char temp[MAX_LINE_LENGTH+100];
-        int count = 0;
-
-        // Read all lines from the file
-        while (fgets(lines[count], sizeof(lines[count]), file)) {
-            count++;
-        }
-
-        // Perform sorting based on student name
-        for (int i = 0; i < count - 1; i++) {
-            for (int j = 0; j < count - i - 1; j++) {
-                char name1[MAX_NAME_LENGTH];
-                char name2[MAX_NAME_LENGTH];
-                sscanf(lines[j], "%[^,],", name1);
-                sscanf(lines[j + 1], "%[^,],", name2);
-                if (strcmp(name1, name2) > 0) {
-                    strcpy(temp, lines[j]);
-                    strcpy(lines[j], lines[j + 1]);
-                    strcpy(lines[j + 1], temp);
-                }
-            }
-        }
 
-        for (int i = 0; i < count; i++) {
-            printf("%d. %s",i+1,lines[i]);
-        }
-        logTaskCompletion("Sort All (by Name)");
-        fclose(file);
-    }
-    else{
-        printf("Type error...");
-        return;
+    if (sortGrades(filename, byGrade, memoryBudget, threads, stdout, NULL) == -1) {
+        perror("Error sorting file");
+        logTaskCompletion("Error: sort failed.");
+        exit(EXIT_FAILURE);
     }
-
+    logTaskCompletion(byGrade ? "Sort All (by Grade)" : "Sort All (by Name)");
 }
 
 // Function to display all student grades in the file
 void showAll(const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) {
+    mappedGrades map;
+    if (mapOpen(&map, filename) == -1) {
         printf("Error: Unable to open file.\n");
         logTaskCompletion("Error: file not found.");
         exit(EXIT_FAILURE);
     }
 
-    char line[MAX_LINE_LENGTH];
-    while (fgets(line, sizeof(line), file)) {
-        printf("%s", line);
-    }
+    // The whole file is the output, written straight from the mapping
+    lineBatch batch;
+    batchInit(&batch, STDOUT_FILENO);
+    batchAdd(&batch, map.data, map.size);
+    batchFlush(&batch);
     logTaskCompletion("Show All");
-    fclose(file);
-
+    mapClose(&map);
 }
 
 // Function to list first 5 student grades in the file
 void listGrades(const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) {
+    if (pagesList(filename, 0, 5, STDOUT_FILENO) == -1) {
         printf("Error: Unable to open file.\n");
         logTaskCompletion("Error: file not found.");
         exit(EXIT_FAILURE);
     }
-
-    char line[MAX_LINE_LENGTH];
-    for (int i = 0; i < 5; i++) {
-        if (fgets(line, sizeof(line), file)) {
-            printf("%s", line);
-        } else {
-            break;
-        }
-    }
     logTaskCompletion("List Grades (First 5)");
-    fclose(file);
 }
 
 // Function to list a specific range of student grades in the file
 void listSome(const char *filename, int numEntries, int pageNumber) {
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) {
+    // The page file next to the grades file says where the page starts
+    if (pagesList(filename, (int64_t)(pageNumber - 1) * numEntries, numEntries, STDOUT_FILENO) == -1) {
         printf("Error: Unable to open file.\n");
         logTaskCompletion("Error: file not found.");
         exit(EXIT_FAILURE);
     }
-
-    char line[MAX_LINE_LENGTH];
-    int start = (pageNumber - 1) * numEntries;
-    int end = start + numEntries;
-    for (int i = 0; i < end; i++) {
-        if (fgets(line, sizeof(line), file)) {
-            if (i >= start) {
-                printf("%s", line);
-            }
-        } else {
-            break;
-        }
-    }
     char cnumEntries = numEntries +'0';
     char cpageNumber = pageNumber+'0';
     
@@ -311,7 +173,6 @@ void listSome(const char *filename, int numEntries, int pageNumber) {
         strncat(logline, &cpageNumber, 1);
         strcat(logline, ")");
     logTaskCompletion(logline);
-    fclose(file);
 }
 
 // Function to print usage instructions
@@ -320,30 +181,24 @@ void printUsage() {
     write(STDOUT_FILENO, "Usage: gtuStudentGrades <command>\n", strlen("Usage: gtuStudentGrades <command>\n"));
     write(STDOUT_FILENO, "  addStudentGrade \"Name Surname\" \"Grade\" \"grades.txt\"\n", strlen("  addStudentGrade \"Name Surname\" \"Grade\" \"grades.txt\"\n"));
     write(STDOUT_FILENO, "  searchStudent \"Name Surname\" \"grades.txt\"\n", strlen("  searchStudent \"Name Surname\" \"grades.txt\"\n"));
-    write(STDOUT_FILENO, "  sortAll \"grades.txt\"\n", strlen("  sortAll \"grades.txt\"\n"));
+    write(STDOUT_FILENO, "  sortAll \"grades.txt\" [\"memoryMB\" [\"threads\"]] [name|grade]\n", strlen("  sortAll \"grades.txt\" [\"memoryMB\" [\"threads\"]] [name|grade]\n"));
     write(STDOUT_FILENO, "  showAll \"grades.txt\"\n", strlen("  showAll \"grades.txt\"\n"));
     write(STDOUT_FILENO, "  listGrades \"grades.txt\" \n", strlen("  listGrades \"grades.txt\" \n"));
     write(STDOUT_FILENO, "  listSome \"numofEntries\" \"pageNumber\" \"grades.txt\"\n", strlen("  listSome \"numofEntries\" \"pageNumber\" \"grades.txt\"\n"));
+    write(STDOUT_FILENO, "  importGrades \"students.csv\" \"grades.txt\"\n", strlen("  importGrades \"students.csv\" \"grades.txt\"\n"));
+    write(STDOUT_FILENO, "  searchPrefix \"prefix\" \"grades.txt\"\n", strlen("  searchPrefix \"prefix\" \"grades.txt\"\n"));
+    write(STDOUT_FILENO, "  searchRange \"from\" \"to\" \"grades.txt\"\n", strlen("  searchRange \"from\" \"to\" \"grades.txt\"\n"));
+    write(STDOUT_FILENO, "  listByGrade \"grade\" \"grades.txt\"\n", strlen("  listByGrade \"grade\" \"grades.txt\"\n"));
+    write(STDOUT_FILENO, "  serve \"grades.txt\" [\"socket\"]\n", strlen("  serve \"grades.txt\" [\"socket\"]\n"));
+    write(STDOUT_FILENO, "  bench index|sort|psort|serve|log|read|query \"records\" \"bench.txt\"\n", strlen("  bench index|sort|psort|serve|log|read|query \"records\" \"bench.txt\"\n"));
 }
 
-void logTaskCompletion(const char *taskName) {
-    FILE *logFile = fopen("log.txt", "a");
-    if (logFile == NULL) {
-        perror("Error opening log file");
-        exit(EXIT_FAILURE);
-    }
-    time_t currentTime;
-    time(&currentTime);
-    fprintf(logFile, "[%s] Task completed: %s\n", strtok(ctime(&currentTime), "\n"), taskName);
-    fclose(logFile);
-}
-
-
 int readInput(char *buffer, size_t size) {
     int bytes_read = 0;
     char c;
     while (bytes_read < size - 1) {
-        if (read(STDIN_FILENO, &c, 1) != 1) {
+        // serve may have read ahead of its exit
+        if (!serveUnread(&c) && read(STDIN_FILENO, &c, 1) != 1) {
             perror("read");
             exit(EXIT_FAILURE);
         }
@@ -378,7 +233,7 @@ char** split_command(char* str) {
         tokens[1] = NULL;
         return tokens;
     }
-    tokens = malloc((num_tokens + 1) * sizeof(char*));
+    tokens = malloc((num_tokens + 2) * sizeof(char*)); // num_tokens counted the separators
     if (!tokens) {
         return NULL; 
     }
@@ -440,8 +295,7 @@ char** split_command(char* str) {
 int main(int argc, char* argv[]) {
     char input[MAX_LINE_LENGTH];
     char filename[MAX_LINE_LENGTH];
-    char *args[3]; // Maximum 3 arguments
-    int numArgs;
+    char *args[6]; // Command and at most 5 arguments
     
     int bytes_read;
     int fd = open("grades.txt", O_RDONLY);
@@ -464,6 +318,10 @@ int main(int argc, char* argv[]) {
         while (tokens[numTokens] != NULL) {
             numTokens++;
         }
+        if (numTokens == 0 || numTokens > 5) {
+            printUsage();
+            continue;
+        }
 
         for (int i = 0; i < numTokens; i++) {
             args[i] = tokens[i];
@@ -534,6 +392,59 @@ int main(int argc, char* argv[]) {
                     printf("Child process terminated abnormally.\n");
                 }
             }
+        } else if (strcmp(args[0], "importGrades") == 0 && numTokens == 3) {
+            // Usage: importGrades <csvfile> <filename>
+            char* csvPath = args[1];
+            char* filename = args[2];
+
+            // Create a child process to execute the import
+            int pid = fork();
+            if (pid < 0) {
+                perror("fork");
+                return 1;
+            } else if (pid == 0) {
+                // Child process
+                importGradesFile(csvPath, filename);
+                exit(0); // Child process exits
+            } else {
+                // Parent process
+                int status;
+                waitpid(pid, &status, 0); // Wait for child process to finish
+                if (WIFEXITED(status)) {
+                    printf("Child process exited with status %d.\n", WEXITSTATUS(status));
+                } else {
+                    printf("Child process terminated abnormally.\n");
+                }
+            }
+        } else if ((strcmp(args[0], "searchPrefix") == 0 && numTokens == 3) ||
+                   (strcmp(args[0], "searchRange") == 0 && numTokens == 4) ||
+                   (strcmp(args[0], "listByGrade") == 0 && numTokens == 3)) {
+            // Usage: searchPrefix <prefix> <filename>, searchRange <from> <to> <filename>,
+            // listByGrade <grade> <filename>
+            int kind = strcmp(args[0], "searchPrefix") == 0 ? QUERY_PREFIX :
+                       strcmp(args[0], "searchRange") == 0 ? QUERY_RANGE : QUERY_GRADE;
+            char* filename = args[numTokens - 1];
+
+            // Create a child process to execute the query
+            int pid = fork();
+            if (pid < 0) {
+                perror("fork");
+                return 1;
+            } else if (pid == 0) {
+                // Child process
+                queryStudents(filename, kind, args[1], kind == QUERY_RANGE ? args[2] : NULL, stdout);
+                fflush(stdout);
+                exit(0); // Child process exits
+            } else {
+                // Parent process
+                int status;
+                waitpid(pid, &status, 0); // Wait for child process to finish
+                if (WIFEXITED(status)) {
+                    printf("Child process exited with status %d.\n", WEXITSTATUS(status));
+                } else {
+                    printf("Child process terminated abnormally.\n");
+                }
+            }
         } else if (strcmp(args[0], "searchStudent") == 0 && numTokens == 3) {
             // Ensure there are 2 arguments for searchStudent command
             // Usage: searchStudent <name> <filename>
@@ -566,15 +477,30 @@ int main(int argc, char* argv[]) {
                 }
             }
         } else if (strcmp(args[0], "sortAll") == 0 ) {
-            // Ensure there is 1 argument for sortAll command
-            // Usage: sortAll <filename>
-            if (numTokens != 2) {
-                write(STDOUT_FILENO, "Usage: sortAll <filename>\n", strlen("Usage: sortAll <filename>\n"));
+            // Ensure there is 1 argument for sortAll command, memory limit, threads and key are optional
+            // Usage: sortAll <filename> [memoryMB [threads]] [name|grade]
+            size_t memoryBudget;
+            int threads;
+            int byGrade = numTokens >= 2 ? sortArguments(args + 2, numTokens - 2, &memoryBudget, &threads) : -1;
+            if (byGrade == -1) {
+                write(STDOUT_FILENO, "Usage: sortAll <filename> [memoryMB [threads]] [name|grade]\n", strlen("Usage: sortAll <filename> [memoryMB [threads]] [name|grade]\n"));
                 continue;
             }
             
             // Extract filename from args
             strcpy(filename, args[1]);
+            if (byGrade == SORT_ASK && access(filename, R_OK) == 0) {
+                // Asked here, a child reading stdin through stdio would take the commands after the answer
+                write(STDOUT_FILENO, "Write how it will be sorted.(grade or name)\n", strlen("Write how it will be sorted.(grade or name)\n"));
+                char line[MAX_LINE_LENGTH];
+                readInput(line, sizeof(line));
+                if(strcmp(line, "grade")!=0 && strcmp(line, "name")!=0){
+                    printf("Type error...");
+                    fflush(stdout);
+                    continue;
+                }
+                byGrade = strcmp(line, "grade") == 0;
+            }
 
             // Create a child process to execute the sortAll function
             int pid = fork();
@@ -583,7 +509,7 @@ int main(int argc, char* argv[]) {
                 return 1;
             } else if (pid == 0) {
                 // Child process
-                sortAll(filename);
+                sortAll(filename, memoryBudget, threads, byGrade);
                 exit(0); // Child process exits
             } else {
                 // Parent process
@@ -689,6 +615,40 @@ int main(int argc, char* argv[]) {
                     printf("Child process terminated abnormally.\n");
                 }
             }
+        } else if (strcmp(args[0], "serve") == 0) {
+            // Usage: serve <filename> [socket], answers commands from memory until exit
+            if (numTokens != 2 && numTokens != 3) {
+                write(STDOUT_FILENO, "Usage: serve <filename> [socket]\n", strlen("Usage: serve <filename> [socket]\n"));
+                continue;
+            }
+            // No child: the records stay loaded in this process for every command served
+            serveGrades(args[1], numTokens == 3 ? args[2] : NULL);
+        } else if (strcmp(args[0], "bench") == 0) {
+            // Usage: bench <what> <records> <filename>, fills <filename> with generated records
+            if (numTokens != 4) {
+                write(STDOUT_FILENO, "Usage: bench <what> <records> <filename>\n", strlen("Usage: bench <what> <records> <filename>\n"));
+                continue;
+            }
+
+            // Create a child process to run the benchmark
+            int pid = fork();
+            if (pid < 0) {
+                perror("fork");
+                return 1;
+            } else if (pid == 0) {
+                // Child process
+                runBenchmark(args, numTokens);
+                exit(0); // Child process exits
+            } else {
+                // Parent process
+                int status;
+                waitpid(pid, &status, 0); // Wait for child process to finish
+                if (WIFEXITED(status)) {
+                    printf("Child process exited with status %d.\n", WEXITSTATUS(status));
+                } else {
+                    printf("Child process terminated abnormally.\n");
+                }
+            }
         } else {
             printUsage();
         }
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include "grades.h"
+
+// Reading a grades file through a read only mapping: lines are found with memchr in place and
+// written from the mapping with writev, nothing is copied through stdio. Grades files only grow
+// while mapped, a file cut short under a mapping would fault on the lost pages.
+
+int mapOpen(mappedGrades *map, const char *filename) {
+    map->data = NULL;
+    map->size = 0;
+    map->fd = open(filename, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (map->fd == -1 || fstat(map->fd, &st) == -1) {
+        mapClose(map);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        return 0;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, map->fd, 0);
+    if (data == MAP_FAILED) {
+        mapClose(map);
+        return -1;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    map->data = data;
+    map->size = st.st_size;
+    return 0;
+}
+
+void mapClose(mappedGrades *map) {
+    if (map->data != NULL) {
+        munmap(map->data, map->size);
+    }
+    if (map->fd != -1) {
+        close(map->fd);
+    }
+    map->data = NULL;
+    map->size = 0;
+    map->fd = -1;
+}
+
+// Lines in the file, a last one without its newline included
+size_t mapLineCount(const mappedGrades *map) {
+    size_t count = 0;
+    const char *at = map->data;
+    const char *end = map->data + map->size;
+    const char *newline;
+    while (at < end && (newline = memchr(at, '\n', end - at)) != NULL) {
+        count++;
+        at = newline + 1;
+    }
+    return count + (at < end);
+}
+
+// Like indexFind, without the index: 1 and the record's grade when name is in the file, 0 when
+// it is not
+int mapFind(const mappedGrades *map, const char *name, char *grade, size_t gradeSize) {
+    size_t len = strlen(name);
+    if (map->data == NULL || memchr(name, ',', len) != NULL) {
+        return 0;  // A name ends at the first comma of its line
+    }
+    const char *at = map->data;
+    const char *end = map->data + map->size;
+    while (at < end) {
+        const char *newline = memchr(at, '\n', end - at);
+        const char *lineEnd = newline != NULL ? newline : end;
+        if ((size_t)(lineEnd - at) > len && at[len] == ',' && memcmp(at, name, len) == 0) {
+            if (grade != NULL && gradeSize > 0) {
+                const char *value = at + len + 1;
+                while (value < lineEnd && *value == ' ') {
+                    value++;
+                }
+                size_t valueLen = lineEnd - value;
+                if (valueLen >= gradeSize) {
+                    valueLen = gradeSize - 1;
+                }
+                memcpy(grade, value, valueLen);
+                grade[valueLen] = '\0';
+            }
+            return 1;
+        }
+        at = lineEnd + 1;
+    }
+    return 0;
+}
+
+void batchInit(lineBatch *batch, int fd) {
+    batch->fd = fd;
+    batch->count = 0;
+}
+
+int batchAdd(lineBatch *batch, const char *data, size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    if (batch->count > 0) {
+        struct iovec *last = &batch->iov[batch->count - 1];
+        if ((const char *)last->iov_base + last->iov_len == data) {
+            last->iov_len += len;
+            return 0;
+        }
+    }
+    if (batch->count == BATCH_IOVECS && batchFlush(batch) == -1) {
+        return -1;
+    }
+    batch->iov[batch->count].iov_base = (void *)data;
+    batch->iov[batch->count].iov_len = len;
+    batch->count++;
+    return 0;
+}
+
+int batchFlush(lineBatch *batch) {
+    struct iovec *iov = batch->iov;
+    int count = batch->count;
+    batch->count = 0;
+    while (count > 0) {
+        ssize_t written = writev(batch->fd, iov, count);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written == -1) {
+            return -1;
+        }
+        // Partly written, go on after what was
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "grades.h"
+
+// The page file is a pageHeader followed by the offsets of every PAGE_STRIDE-th line of the grades
+// file. Like the index in gradeindex.c it is a cache kept up to date by the writers: lines appended
+// after indexedSize are added by pagesUpdate, any other change to the grades file makes it rebuild
+// from scratch. The header is written after the offsets it counts, a crash leaves it describing
+// fewer of them. Listing shares the lock and only reads the page file, the lines appended after it
+// are skipped from indexedSize on and without a current one from the start of the file.
+//
+// A page then costs reading one offset, the one of the next stride after the page, and the bytes
+// between them: at most PAGE_STRIDE lines more than the page itself, read with one pread.
+
+#define PAGE_MAGIC 0x32474150u          // "PAG2", headers with a dataStamp
+#define PAGE_SCAN_BUFFER (256 * 1024)   // Bytes of the grades file read at once while indexing
+#define PAGE_READ_BUFFER (1024 * 1024)  // Largest read of a page
+#define PAGE_MIN_READ 4096              // Smallest read when the end of a page is not known
+
+static int pagesIsCurrent(const pageHeader *header, int dataFd, const struct stat *st) {
+    return header->magic == PAGE_MAGIC && header->stride == PAGE_STRIDE && stampIsCurrent(&header->stamp, dataFd, st);
+}
+
+static int pageEntry(int fd, uint64_t i, uint64_t *offset) {
+    return pread(fd, offset, sizeof(*offset), sizeof(pageHeader) + i * sizeof(uint64_t)) == sizeof(*offset) ? 0 : -1;
+}
+
+// Count the lines of the grades file from header->stamp.indexedSize on, append the offsets of the
+// strides that start among them and write the header that covers them.
+static int pagesScan(int dataFd, int fd, pageHeader *header) {
+    char *buffer = malloc(PAGE_SCAN_BUFFER);
+    size_t capacity = 1024;
+    uint64_t *entries = malloc(capacity * sizeof(uint64_t));
+    if (buffer == NULL || entries == NULL) {
+        free(buffer);
+        free(entries);
+        return -1;
+    }
+    size_t count = 0;
+    uint64_t firstEntry = header->lineCount / PAGE_STRIDE + 1;
+    if (header->stamp.indexedSize == 0) {
+        entries[count++] = 0;  // Line 0
+        firstEntry = 0;
+    }
+    uint64_t offset = header->stamp.indexedSize;
+    for (;;) {
+        ssize_t got = pread(dataFd, buffer, PAGE_SCAN_BUFFER, offset);
+        if (got == -1 && errno == EINTR) {
+            continue;
+        }
+        if (got == -1) {
+            free(buffer);
+            free(entries);
+            return -1;
+        }
+        if (got == 0) {
+            break;
+        }
+        char *at = buffer;
+        char *end = buffer + got;
+        char *newline;
+        while ((newline = memchr(at, '\n', end - at)) != NULL) {
+            at = newline + 1;
+            header->lineCount++;
+            header->stamp.indexedSize = offset + (at - buffer);
+            if (header->lineCount % PAGE_STRIDE != 0) {
+                continue;
+            }
+            if (count == capacity) {
+                uint64_t *grown = realloc(entries, capacity * 2 * sizeof(uint64_t));
+                if (grown == NULL) {
+                    free(buffer);
+                    free(entries);
+                    return -1;
+                }
+                entries = grown;
+                capacity *= 2;
+            }
+            entries[count++] = header->stamp.indexedSize;
+        }
+        offset += got;
+    }
+    free(buffer);
+
+    size_t bytes = count * sizeof(uint64_t);
+    ssize_t written = bytes > 0 ? pwrite(fd, entries, bytes, sizeof(pageHeader) + firstEntry * sizeof(uint64_t)) : 0;
+    free(entries);
+    if (written != (ssize_t)bytes || stampRecord(&header->stamp, dataFd, header->stamp.indexedSize) == -1) {
+        return -1;
+    }
+    header->magic = PAGE_MAGIC;
+    header->stride = PAGE_STRIDE;
+    return pwrite(fd, header, sizeof(*header), 0) == sizeof(*header) ? 0 : -1;
+}
+
+static int pagesOpen(const char *filename, int flags) {
+    size_t pathLen = strlen(filename) + sizeof(PAGES_SUFFIX);
+    char *path = malloc(pathLen);
+    if (path == NULL) {
+        return -1;
+    }
+    snprintf(path, pathLen, "%s%s", filename, PAGES_SUFFIX);
+    int fd = open(path, flags | O_CLOEXEC, 0666);
+    free(path);
+    return fd;
+}
+
+// Bring the page file of the grades file in dataFd up to date, building it when it is missing or
+// not current. The caller holds the exclusive lock of dataFd.
+int pagesUpdate(const char *filename, int dataFd) {
+    int fd = pagesOpen(filename, O_RDWR | O_CREAT);
+    struct stat st;
+    if (fd == -1 || fstat(dataFd, &st) == -1) {
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    pageHeader header;
+    if (pread(fd, &header, sizeof(header), 0) == sizeof(header) && pagesIsCurrent(&header, dataFd, &st)) {
+        if ((uint64_t)st.st_size == header.stamp.indexedSize) {
+            close(fd);
+            return 0;
+        }
+    }
+    else {
+        // Rebuild: the header stays zero, so invalid, until the scan is done
+        memset(&header, 0, sizeof(header));
+        if (ftruncate(fd, 0) == -1) {
+            close(fd);
+            return -1;
+        }
+    }
+    int result = pagesScan(dataFd, fd, &header);
+    close(fd);
+    return result;
+}
+
+static int writeAll(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written == -1) {
+            return -1;
+        }
+        data += written;
+        len -= written;
+    }
+    return 0;
+}
+
+// Copy count lines to outFd, skipping skip lines from offset on. end is where the wanted lines end
+// at the latest.
+static int pagesCopy(int dataFd, uint64_t offset, uint64_t end, uint64_t skip, uint64_t count, int outFd) {
+    if (offset >= end) {
+        return 0;
+    }
+    // Without the page file end is the end of the file, read about what the lines take
+    size_t size = PAGE_READ_BUFFER;
+    if (skip + count < PAGE_READ_BUFFER / MAX_LINE_LENGTH) {
+        size = (skip + count) * MAX_LINE_LENGTH < PAGE_MIN_READ ? PAGE_MIN_READ : (skip + count) * MAX_LINE_LENGTH;
+    }
+    if (size > end - offset) {
+        size = end - offset;
+    }
+    char *buffer = malloc(size);
+    if (buffer == NULL) {
+        return -1;
+    }
+    while (offset < end && count > 0) {
+        size_t want = end - offset < size ? end - offset : size;
+        ssize_t got = pread(dataFd, buffer, want, offset);
+        if (got == -1 && errno == EINTR) {
+            continue;
+        }
+        if (got == -1) {
+            free(buffer);
+            return -1;
+        }
+        if (got == 0) {
+            break;
+        }
+        offset += got;
+        char *at = buffer;
+        char *stop = buffer + got;
+        char *newline;
+        while (skip > 0 && (newline = memchr(at, '\n', stop - at)) != NULL) {
+            at = newline + 1;
+            skip--;
+        }
+        if (skip > 0) {
+            continue;
+        }
+        char *from = at;
+        while (count > 0 && at < stop) {
+            newline = memchr(at, '\n', stop - at);
+            if (newline == NULL) {
+                at = stop;  // The line goes on in the next read
+                break;
+            }
+            at = newline + 1;
+            count--;
+        }
+        if (writeAll(outFd, from, at - from) == -1) {
+            free(buffer);
+            return -1;
+        }
+    }
+    free(buffer);
+    return 0;
+}
+
+// Write count lines of the grades file from line first (0 based) on to outFd. Returns -1 when the
+// file cannot be read. Without a usable page file the lines before first are skipped instead.
+int pagesList(const char *filename, int64_t first, int64_t count, int outFd) {
+    int dataFd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (dataFd == -1) {
+        return -1;
+    }
+    int locked = flock(dataFd, LOCK_SH) == 0;
+    struct stat st;
+    if (fstat(dataFd, &st) == -1) {
+        close(dataFd);
+        return -1;
+    }
+    if (first < 0) {
+        count += first;  // There are no lines before the first
+        first = 0;
+    }
+    if (count <= 0) {
+        close(dataFd);
+        return 0;
+    }
+
+    uint64_t offset = 0;
+    uint64_t end = st.st_size;
+    uint64_t skip = first;
+    // The first page starts at offset 0, it needs no page file
+    int fd = first >= PAGE_STRIDE && locked ? pagesOpen(filename, O_RDONLY) : -1;
+    pageHeader header;
+    if (fd != -1 && pread(fd, &header, sizeof(header), 0) == sizeof(header) && pagesIsCurrent(&header, dataFd, &st)) {
+        uint64_t entryCount = header.lineCount / PAGE_STRIDE + 1;
+        uint64_t startEntry = first / PAGE_STRIDE;
+        uint64_t endEntry = (first + count + PAGE_STRIDE - 1) / PAGE_STRIDE;
+        if (startEntry >= entryCount) {
+            // Among the lines appended after the page file
+            offset = header.stamp.indexedSize;
+            skip = first - header.lineCount;
+        }
+        else if (pageEntry(fd, startEntry, &offset) == 0) {
+            skip = first - startEntry * PAGE_STRIDE;
+            if (endEntry < entryCount && pageEntry(fd, endEntry, &end) == -1) {
+                end = st.st_size;
+            }
+        }
+        else {
+            offset = 0;
+        }
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    int result = pagesCopy(dataFd, offset, end, skip, count, outFd);
+    close(dataFd);  // Releases the lock
+    return result;
+}
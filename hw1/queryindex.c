@@ -0,0 +1,505 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#include "grades.h"
+
+// searchPrefix, searchRange and listByGrade. The grades file is mapped and its query index, see
+// grades.h, says which records match: a binary search over the records in name order finds the
+// first name of a prefix or range, the bitmap of a grade lists its records. Only the matching
+// lines are read, and written from the mapping with writev.
+//
+// Like the other indexes the query index is a cache of the grades file, built when it is missing
+// or the file changed other than by appending. Lines appended after indexedSize are scanned by
+// every query and merged with what the index finds, until there are more than QUERY_MIN_DELTA
+// bytes and a sixteenth of the indexed size of them; then the index is built again.
+
+#define QUERY_MAGIC 0x32495147u            // "GQI2", headers with a dataStamp
+#define QUERY_MIN_DELTA (256 * 1024)
+
+typedef struct {
+    int lockFd;                 // Grades file, locked until queryClose, exclusively after a build
+    mappedGrades data;
+    queryHeader *header;        // The query index file mapped read only, NULL without one
+    size_t mappedSize;
+    const uint64_t *offsets;
+    const uint32_t *byName;
+    const uint64_t *bitmaps;
+} queryIndex;
+
+// A line of the grades file: len bytes without the newline, the name is the text before its
+// first comma
+typedef struct {
+    const char *line;
+    size_t len;
+    size_t nameLen;
+} queryRecord;
+
+static int nameCompare(const char *a, size_t aLen, const char *b, size_t bLen) {
+    int result = memcmp(a, b, aLen < bLen ? aLen : bLen);
+    if (result != 0) {
+        return result;
+    }
+    return aLen < bLen ? -1 : aLen > bLen;
+}
+
+static int hasPrefix(const char *name, size_t len, const char *prefix, size_t prefixLen) {
+    return len >= prefixLen && memcmp(name, prefix, prefixLen) == 0;
+}
+
+// The grade of a record, what follows the comma and its spaces
+static const char *recordGrade(const queryRecord *record, size_t *len) {
+    const char *grade = record->line + record->nameLen + 1;
+    const char *end = record->line + record->len;
+    while (grade < end && *grade == ' ') {
+        grade++;
+    }
+    *len = end - grade;
+    return grade;
+}
+
+// The record whose line starts at offset, 0 when the line has no comma
+static int recordAt(const mappedGrades *data, uint64_t offset, queryRecord *record) {
+    record->line = data->data + offset;
+    const char *newline = memchr(record->line, '\n', data->size - offset);
+    record->len = newline != NULL ? (size_t)(newline - record->line) : data->size - offset;
+    const char *comma = memchr(record->line, ',', record->len);
+    record->nameLen = comma != NULL ? (size_t)(comma - record->line) : 0;
+    return comma != NULL;
+}
+
+static int queryIsCurrent(const queryHeader *header, int dataFd, const struct stat *st) {
+    if (header->magic != QUERY_MAGIC || header->gradeCount > QUERY_MAX_GRADES ||
+        (uint64_t)st->st_size < header->stamp.indexedSize) {
+        return 0;
+    }
+    uint64_t appended = st->st_size - header->stamp.indexedSize;
+    if (appended > QUERY_MIN_DELTA && appended > header->stamp.indexedSize / 16) {
+        return 0;  // Scanning what was appended costs more than building again
+    }
+    return stampIsCurrent(&header->stamp, dataFd, st);
+}
+
+static size_t queryFileSize(const queryHeader *header) {
+    size_t words = (header->recordCount + 63) / 64;
+    return sizeof(queryHeader) + header->recordCount * (sizeof(uint64_t) + sizeof(uint32_t)) +
+           header->gradeCount * words * sizeof(uint64_t);
+}
+
+static int writeAt(int fd, const void *data, size_t len, off_t offset) {
+    while (len > 0) {
+        ssize_t written = pwrite(fd, data, len, offset);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written == -1) {
+            return -1;
+        }
+        data = (const char *)data + written;
+        len -= written;
+        offset += written;
+    }
+    return 0;
+}
+
+// Number of grade in the header's grades, added when it is new. -1 when it does not fit, the
+// index then has no bitmaps.
+static int gradeNumber(queryHeader *header, const char *grade, size_t len) {
+    if (len >= QUERY_GRADE_LENGTH || memchr(grade, '\0', len) != NULL) {
+        return -1;
+    }
+    for (uint32_t g = 0; g < header->gradeCount; g++) {
+        if (header->grades[g][len] == '\0' && memcmp(header->grades[g], grade, len) == 0) {
+            return g;
+        }
+    }
+    if (header->gradeCount == QUERY_MAX_GRADES) {
+        return -1;
+    }
+    memcpy(header->grades[header->gradeCount], grade, len);
+    return header->gradeCount++;
+}
+
+// Build the query index of the whole lines of data into fd. The header is written last, a crash
+// leaves a file that is not current.
+static int queryBuild(int fd, const mappedGrades *data) {
+    queryHeader header;
+    memset(&header, 0, sizeof(header));
+    size_t capacity = 1024;
+    uint64_t *offsets = malloc(capacity * sizeof(uint64_t));
+    uint8_t *grades = malloc(capacity);
+    gradeStore store;
+    storeInit(&store);
+    int withGrades = 1;
+    int failed = offsets == NULL || grades == NULL;
+
+    const char *at = data->data;
+    const char *end = data->data + data->size;
+    const char *newline;
+    while (!failed && at < end && (newline = memchr(at, '\n', end - at)) != NULL) {
+        queryRecord record;
+        if (recordAt(data, at - data->data, &record)) {
+            if (header.recordCount == capacity) {
+                uint64_t *grownOffsets = realloc(offsets, capacity * 2 * sizeof(uint64_t));
+                if (grownOffsets != NULL) {
+                    offsets = grownOffsets;
+                }
+                uint8_t *grownGrades = realloc(grades, capacity * 2);
+                if (grownGrades != NULL) {
+                    grades = grownGrades;
+                }
+                if (grownOffsets == NULL || grownGrades == NULL || capacity * 2 > UINT32_MAX) {
+                    failed = 1;
+                    break;
+                }
+                capacity *= 2;
+            }
+            // The store only sorts, it holds the names alone
+            if (storeAdd(&store, record.line, record.nameLen) == -1) {
+                failed = 1;
+                break;
+            }
+            size_t gradeLen;
+            const char *grade = recordGrade(&record, &gradeLen);
+            int number = withGrades ? gradeNumber(&header, grade, gradeLen) : -1;
+            if (number == -1) {
+                withGrades = 0;
+            }
+            offsets[header.recordCount] = at - data->data;
+            grades[header.recordCount] = number;
+            header.recordCount++;
+        }
+        at = newline + 1;
+        header.stamp.indexedSize = at - data->data;
+    }
+    if (!withGrades) {
+        header.gradeCount = 0;
+        memset(header.grades, 0, sizeof(header.grades));
+    }
+
+    size_t count = header.recordCount;
+    size_t words = (count + 63) / 64;
+    uint32_t *byName = failed ? NULL : malloc(count * sizeof(uint32_t) + 1);
+    uint64_t *bitmaps = failed ? NULL : calloc(header.gradeCount * words + 1, sizeof(uint64_t));
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = cpus > 0 ? (cpus < SORT_MAX_THREADS ? (int)cpus : SORT_MAX_THREADS) : 1;
+    if (byName == NULL || bitmaps == NULL || storeOrder(&store, 0, threads, byName) == -1) {
+        failed = 1;
+    }
+    storeFree(&store);
+    if (!failed) {
+        for (size_t i = 0; i < count && header.gradeCount > 0; i++) {
+            bitmaps[grades[i] * words + i / 64] |= 1ULL << (i % 64);
+        }
+        off_t base = sizeof(queryHeader);
+        failed = ftruncate(fd, 0) == -1 || writeAt(fd, offsets, count * sizeof(uint64_t), base) == -1 ||
+                 writeAt(fd, byName, count * sizeof(uint32_t), base + count * sizeof(uint64_t)) == -1 ||
+                 writeAt(fd, bitmaps, header.gradeCount * words * sizeof(uint64_t),
+                         base + count * (sizeof(uint64_t) + sizeof(uint32_t))) == -1;
+    }
+    free(offsets);
+    free(grades);
+    free(byName);
+    free(bitmaps);
+    if (failed || stampRecord(&header.stamp, data->fd, header.stamp.indexedSize) == -1) {
+        return -1;
+    }
+    header.magic = QUERY_MAGIC;
+    return writeAt(fd, &header, sizeof(header), 0);
+}
+
+static void queryClose(queryIndex *index) {
+    if (index->header != NULL) {
+        munmap(index->header, index->mappedSize);
+        index->header = NULL;
+    }
+    mapClose(&index->data);
+    if (index->lockFd != -1) {
+        close(index->lockFd);  // Releases the lock
+        index->lockFd = -1;
+    }
+}
+
+// 1 when fd holds a query index that is current for the grades file in data
+static int queryUsable(int fd, const mappedGrades *data) {
+    queryHeader header;
+    struct stat st;
+    return fd != -1 && fstat(data->fd, &st) == 0 && pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+           queryIsCurrent(&header, data->fd, &st) && header.stamp.indexedSize <= data->size;
+}
+
+// Map the grades file and its query index. Queries share the lock; when the index is missing or
+// not current the lock is taken exclusively instead, the file mapped again and the index built
+// unless another query did that in between. Without an index, when it cannot be written next to
+// the grades file, queries scan the file.
+static int queryOpen(queryIndex *index, const char *filename) {
+    memset(index, 0, sizeof(*index));
+    index->data.fd = -1;
+    index->lockFd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (index->lockFd == -1 || flock(index->lockFd, LOCK_SH) == -1 || mapOpen(&index->data, filename) == -1) {
+        queryClose(index);
+        return -1;
+    }
+    size_t pathLen = strlen(filename) + sizeof(QUERY_SUFFIX);
+    char *path = malloc(pathLen);
+    if (path == NULL) {
+        return 0;
+    }
+    snprintf(path, pathLen, "%s%s", filename, QUERY_SUFFIX);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (!queryUsable(fd, &index->data)) {
+        // flock gives up the shared lock before it waits for the exclusive one, the file may
+        // have changed meanwhile
+        if (fd != -1) {
+            close(fd);
+        }
+        mapClose(&index->data);
+        if (flock(index->lockFd, LOCK_EX) == -1 || mapOpen(&index->data, filename) == -1) {
+            free(path);
+            queryClose(index);
+            return -1;
+        }
+        fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+        if (fd != -1 && !queryUsable(fd, &index->data) && queryBuild(fd, &index->data) == -1) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    free(path);
+    if (fd == -1) {
+        return 0;
+    }
+    // The header is mapped with the rest, what it says is checked against the file's size
+    struct stat indexSt;
+    void *area = MAP_FAILED;
+    if (fstat(fd, &indexSt) == 0 && indexSt.st_size >= (off_t)sizeof(queryHeader)) {
+        area = mmap(NULL, indexSt.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (area == MAP_FAILED) {
+        return 0;
+    }
+    index->header = area;
+    index->mappedSize = indexSt.st_size;
+    if (index->header->magic != QUERY_MAGIC || index->header->stamp.indexedSize > index->data.size ||
+        index->header->gradeCount > QUERY_MAX_GRADES || queryFileSize(index->header) != index->mappedSize) {
+        munmap(area, index->mappedSize);
+        index->header = NULL;
+        return 0;
+    }
+    const char *base = (const char *)area + sizeof(queryHeader);
+    index->offsets = (const uint64_t *)base;
+    index->byName = (const uint32_t *)(base + index->header->recordCount * sizeof(uint64_t));
+    index->bitmaps = (const uint64_t *)(base + index->header->recordCount * (sizeof(uint64_t) + sizeof(uint32_t)));
+    return 0;
+}
+
+typedef struct {
+    int kind;
+    const char *from;
+    size_t fromLen;
+    const char *to;
+    size_t toLen;
+    lineBatch batch;
+    long found;
+} queryState;
+
+static int queryMatches(const queryState *query, const queryRecord *record) {
+    if (query->kind == QUERY_GRADE) {
+        size_t len;
+        const char *grade = recordGrade(record, &len);
+        return len == query->fromLen && memcmp(grade, query->from, len) == 0;
+    }
+    if (query->kind == QUERY_PREFIX) {
+        return hasPrefix(record->line, record->nameLen, query->from, query->fromLen);
+    }
+    return nameCompare(record->line, record->nameLen, query->from, query->fromLen) >= 0 &&
+           (nameCompare(record->line, record->nameLen, query->to, query->toLen) <= 0 ||
+            hasPrefix(record->line, record->nameLen, query->to, query->toLen));
+}
+
+// Names past the prefix or range, every later name in name order is past it as well
+static int queryPast(const queryState *query, const queryRecord *record) {
+    if (query->kind == QUERY_PREFIX) {
+        return nameCompare(record->line, record->nameLen, query->from, query->fromLen) > 0 &&
+               !hasPrefix(record->line, record->nameLen, query->from, query->fromLen);
+    }
+    return nameCompare(record->line, record->nameLen, query->to, query->toLen) > 0 &&
+           !hasPrefix(record->line, record->nameLen, query->to, query->toLen);
+}
+
+static void queryEmit(queryState *query, const queryRecord *record) {
+    // The newline follows the line in the mapping unless it is the last line and lacks it
+    batchAdd(&query->batch, record->line, record->len);
+    batchAdd(&query->batch, record->line[record->len] == '\n' ? record->line + record->len : "\n", 1);
+    query->found++;
+}
+
+static int queryRecordCompare(const void *x, const void *y) {
+    const queryRecord *a = x;
+    const queryRecord *b = y;
+    int result = nameCompare(a->line, a->nameLen, b->line, b->nameLen);
+    return result != 0 ? result : (a->line > b->line) - (a->line < b->line);
+}
+
+// The matching records of the lines from offset from on, in file order
+static queryRecord *queryScan(const queryIndex *index, const queryState *query, uint64_t from, size_t *count) {
+    size_t capacity = 64;
+    queryRecord *matches = malloc(capacity * sizeof(queryRecord));
+    *count = 0;
+    uint64_t offset = from;
+    while (matches != NULL && offset < index->data.size) {
+        queryRecord record;
+        if (recordAt(&index->data, offset, &record) && queryMatches(query, &record)) {
+            if (*count == capacity) {
+                queryRecord *grown = realloc(matches, capacity * 2 * sizeof(queryRecord));
+                if (grown == NULL) {
+                    free(matches);
+                    return NULL;
+                }
+                matches = grown;
+                capacity *= 2;
+            }
+            matches[(*count)++] = record;
+        }
+        offset += record.len + 1;
+    }
+    return matches;
+}
+
+// First position in name order whose name is not below name
+static size_t queryLowerBound(const queryIndex *index, const char *name, size_t len) {
+    size_t low = 0;
+    size_t high = index->header->recordCount;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        queryRecord record;
+        recordAt(&index->data, index->offsets[index->byName[middle]], &record);
+        if (nameCompare(record.line, record.nameLen, name, len) < 0) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+static int queryRun(const queryIndex *index, queryState *query) {
+    uint64_t scanFrom = index->header != NULL ? index->header->stamp.indexedSize : 0;
+    size_t scanCount;
+    queryRecord *scanned = queryScan(index, query, scanFrom, &scanCount);
+    if (scanned == NULL) {
+        return -1;
+    }
+
+    if (query->kind == QUERY_GRADE) {
+        // The index covers the file up to scanFrom, its records come first
+        int number = -1;
+        if (index->header != NULL && index->header->gradeCount > 0) {
+            for (uint32_t g = 0; g < index->header->gradeCount && number == -1; g++) {
+                if (query->fromLen < QUERY_GRADE_LENGTH && index->header->grades[g][query->fromLen] == '\0' &&
+                    memcmp(index->header->grades[g], query->from, query->fromLen) == 0) {
+                    number = g;
+                }
+            }
+            size_t words = (index->header->recordCount + 63) / 64;
+            const uint64_t *bitmap = number != -1 ? index->bitmaps + (size_t)number * words : NULL;
+            for (size_t w = 0; bitmap != NULL && w < words; w++) {
+                for (uint64_t bits = bitmap[w]; bits != 0; bits &= bits - 1) {
+                    queryRecord record;
+                    recordAt(&index->data, index->offsets[w * 64 + __builtin_ctzll(bits)], &record);
+                    queryEmit(query, &record);
+                }
+            }
+        }
+        else if (index->header != NULL) {
+            // No bitmaps, the grades did not fit
+            size_t count;
+            queryRecord *matches = queryScan(index, query, 0, &count);
+            for (size_t i = 0; matches != NULL && i < count && matches[i].line < index->data.data + scanFrom; i++) {
+                queryEmit(query, &matches[i]);
+            }
+            free(matches);
+        }
+        for (size_t i = 0; i < scanCount; i++) {
+            queryEmit(query, &scanned[i]);
+        }
+    }
+    else {
+        // Names in order: the index's run of matching names merged with the scanned ones
+        qsort(scanned, scanCount, sizeof(queryRecord), queryRecordCompare);
+        size_t next = 0;
+        if (index->header != NULL) {
+            for (size_t i = queryLowerBound(index, query->from, query->fromLen); i < index->header->recordCount; i++) {
+                queryRecord record;
+                recordAt(&index->data, index->offsets[index->byName[i]], &record);
+                if (queryPast(query, &record)) {
+                    break;
+                }
+                while (next < scanCount && nameCompare(scanned[next].line, scanned[next].nameLen, record.line,
+                                                       record.nameLen) < 0) {
+                    queryEmit(query, &scanned[next++]);
+                }
+                queryEmit(query, &record);
+            }
+        }
+        while (next < scanCount) {
+            queryEmit(query, &scanned[next++]);
+        }
+    }
+    free(scanned);
+    return batchFlush(&query->batch);
+}
+
+// Write the records a query matches to outFd, a line each. Returns how many or -1 when the file
+// cannot be read.
+long queryGrades(const char *filename, int kind, const char *from, const char *to, int outFd) {
+    queryIndex index;
+    if (queryOpen(&index, filename) == -1) {
+        return -1;
+    }
+    queryState query;
+    query.kind = kind;
+    query.from = from;
+    query.fromLen = strlen(from);
+    query.to = to != NULL ? to : "";
+    query.toLen = strlen(query.to);
+    query.found = 0;
+    batchInit(&query.batch, outFd);
+    int result = queryRun(&index, &query);
+    queryClose(&index);
+    return result == -1 ? -1 : query.found;
+}
+
+// The query commands, for the fork per command path and serve alike
+void queryStudents(const char *filename, int kind, const char *from, const char *to, FILE *out) {
+    fflush(out);
+    long found = queryGrades(filename, kind, from, to, fileno(out));
+    if (found == -1) {
+        fprintf(out, "Error: Unable to open file.\n");
+        logTaskCompletion("Error: file not found.");
+        return;
+    }
+    if (found == 0) {
+        fprintf(out, "No students found.\n");
+    }
+    char logline[3 * MAX_LINE_LENGTH];
+    if (kind == QUERY_PREFIX) {
+        snprintf(logline, sizeof(logline), "Search Prefix %s (%ld found)", from, found);
+    }
+    else if (kind == QUERY_RANGE) {
+        snprintf(logline, sizeof(logline), "Search Range %s - %s (%ld found)", from, to, found);
+    }
+    else {
+        snprintf(logline, sizeof(logline), "List By Grade %s (%ld found)", from, found);
+    }
+    logTaskCompletion(logline);
+}
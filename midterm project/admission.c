@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "protocol.h"
+
+// Cross-process admission queue for Connect/tryConnect, kept in POSIX shared memory
+
+static int futex_wait(uint32_t *word, uint32_t expected, const struct timespec *timeout) {
+    return syscall(SYS_futex, word, FUTEX_WAIT, expected, timeout, NULL, 0);
+}
+
+static void futex_wake(uint32_t *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// Ticket t holds a slot once it is below admitted, compared so that wrap-around is harmless
+static int ticket_admitted(uint32_t ticket, uint32_t admitted) {
+    return (int32_t)(ticket - admitted) < 0;
+}
+
+static admission_queue *admission_map(pid_t serverPid, int flags) {
+    char name[64];
+    snprintf(name, sizeof(name), ADMISSION_SHM_FORMAT, serverPid);
+    int fd = shm_open(name, flags, 0666);
+    if (fd == -1) {
+        return NULL;
+    }
+    if ((flags & O_CREAT) && ftruncate(fd, sizeof(admission_queue)) == -1) {
+        close(fd);
+        return NULL;
+    }
+    admission_queue *q = mmap(NULL, sizeof(admission_queue), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return q == MAP_FAILED ? NULL : q;
+}
+
+// Server side: create the queue with maxClients free slots
+admission_queue *admission_create(pid_t serverPid, int maxClients) {
+    admission_destroy(serverPid);
+    admission_queue *q = admission_map(serverPid, O_RDWR | O_CREAT | O_EXCL);
+    if (q == NULL) {
+        return NULL;
+    }
+    memset(q, 0, sizeof(*q));
+    __atomic_store_n(&q->admitted, (uint32_t)maxClients, __ATOMIC_RELEASE);
+    return q;
+}
+
+admission_queue *admission_open(pid_t serverPid) {
+    return admission_map(serverPid, O_RDWR);
+}
+
+void admission_destroy(pid_t serverPid) {
+    char name[64];
+    snprintf(name, sizeof(name), ADMISSION_SHM_FORMAT, serverPid);
+    shm_unlink(name);
+}
+
+// tryConnect: take a ticket only if it would be admitted right now, never waits
+int admission_try(admission_queue *q) {
+    uint32_t ticket = __atomic_load_n(&q->tickets, __ATOMIC_ACQUIRE);
+    while (ticket_admitted(ticket, __atomic_load_n(&q->admitted, __ATOMIC_ACQUIRE))) {
+        if (__atomic_compare_exchange_n(&q->tickets, &ticket, ticket + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Connect: take the next ticket and sleep until the server frees a slot for it.
+// Returns -1 if the server goes away while we wait.
+int admission_wait(admission_queue *q, pid_t serverPid, int *waited) {
+    uint32_t ticket = __atomic_fetch_add(&q->tickets, 1, __ATOMIC_ACQ_REL);
+    uint32_t *word = &q->wake[ticket % ADMISSION_RING];
+    __atomic_store_n(&q->owner[ticket % ADMISSION_RING], getpid(), __ATOMIC_RELEASE);
+    *waited = 0;
+
+    while (1) {
+        // Read the futex word before checking, so a release in between makes the wait return at once
+        uint32_t seq = __atomic_load_n(word, __ATOMIC_ACQUIRE);
+        if (ticket_admitted(ticket, __atomic_load_n(&q->admitted, __ATOMIC_ACQUIRE))) {
+            // Cleared once admitted, so the server only ever sees owners of tickets still waiting
+            __atomic_store_n(&q->owner[ticket % ADMISSION_RING], 0, __ATOMIC_RELEASE);
+            return 0;
+        }
+        *waited = 1;
+        struct timespec timeout = { 1, 0 };
+        if (futex_wait(word, seq, &timeout) == -1 && errno == ETIMEDOUT && kill(serverPid, 0) == -1) {
+            return -1;
+        }
+    }
+}
+
+// Server side: a client left, admit the next ticket and wake exactly its holder.
+// Tickets whose holder died while waiting are passed over.
+void admission_release(admission_queue *q) {
+    while (1) {
+        uint32_t ticket = __atomic_fetch_add(&q->admitted, 1, __ATOMIC_ACQ_REL);
+        uint32_t *word = &q->wake[ticket % ADMISSION_RING];
+        __atomic_fetch_add(word, 1, __ATOMIC_RELEASE);
+        futex_wake(word);
+
+        if (!ticket_admitted(ticket, __atomic_load_n(&q->tickets, __ATOMIC_ACQUIRE))) {
+            return; // Nobody holds this ticket yet, the slot stays free
+        }
+        pid_t owner = __atomic_load_n(&q->owner[ticket % ADMISSION_RING], __ATOMIC_ACQUIRE);
+        if (owner <= 0 || kill(owner, 0) == 0 || errno != ESRCH) {
+            return;
+        }
+    }
+}
@@ -8,19 +8,37 @@
 #include <errno.h>
 #include <sys/wait.h> // Include the header file for waitpid function
 #include <semaphore.h>
+#include <stdint.h>
+#include <time.h>
+#include <glob.h>
+#include <dirent.h>
+#include <openssl/evp.h>
+
+#include "../protocol.h"
 
 // Function prototypes
 void connect_to_server(int serverPID, char *option);
 void handle_server_response();
 void send_request_to_server(int serverPID, char *request);
+int query_server(const char *request, char *response, size_t size);
+int hash_file(int fd, char *hex);
+int64_t receive_range(const char *request, int fd, range_header *header);
+void upload_file(const char *filename);
+void download_file(const char *filename, int channels);
+void batch_upload(const char *args);
+void batch_download(const char *request);
+void set_transport(const char *mode);
+void set_compress(const char *mode);
+int64_t receive_frames(int pipe_fd, int fromRing, int fd, int64_t offset, int64_t length);
+static int write_all(int fd, const void *data, size_t len);
 
-#define SERVER_PIPE "/tmp/server_pipe"
+#define SERVER_PIPE SERVER_FIFO_PATH
+#define RANGE_STORED 10 // Exit status of a download helper that stored its whole range
 
 char cFIFO[50];
 int serverP;
-
-// Declare semaphore
-sem_t semaphore;
+shm_ring *dataRing = NULL; // Bulk data goes through this ring once the server accepted "transport shm"
+int compressMode = 0;      // Set once the server accepted "compress lz", transfer data is then framed
 
 int is_server_running() {
     // Check if the server process is running
@@ -28,188 +46,143 @@ int is_server_running() {
 }
 
 void connect_to_server(int serverPID, char *option) {
+    int mode;
+    if (strcmp(option, "Connect") == 0) {
+        mode = CONNECT_WAIT;
+    } else if (strcmp(option, "tryConnect") == 0) {
+        mode = CONNECT_TRY;
+    } else {
+        fprintf(stderr, "Invalid option: %s\n", option);
+        exit(EXIT_FAILURE);
+    }
+
+    int get_pid = getpid();
+    snprintf(cFIFO, sizeof(cFIFO), CLIENT_FIFO_FORMAT, get_pid);
+    // Create client-specific FIFO before the server's worker tries to open it
+    unlink(cFIFO);
+    if (mkfifo(cFIFO, 0666) == -1) {
+        perror("mkfifo failed");
+        exit(EXIT_FAILURE);
+    }
+
+    // Take a slot in the server's admission queue: tryConnect fails at once when it is full,
+    // Connect sleeps until the server frees a slot for its ticket
+    admission_queue *queue = admission_open(serverPID);
+    if (queue == NULL) {
+        perror("open admission queue failed");
+        unlink(cFIFO);
+        exit(EXIT_FAILURE);
+    }
+    struct timespec queued, admitted;
+    clock_gettime(CLOCK_MONOTONIC, &queued);
+    if (mode == CONNECT_TRY) {
+        if (admission_try(queue) == -1) {
+            printf("Server queue is full. Exiting...\n");
+            unlink(cFIFO);
+            exit(EXIT_SUCCESS);
+        }
+    } else {
+        int waited = 0;
+        printf("Wait for a spot in the server queue...\n");
+        fflush(stdout);
+        if (admission_wait(queue, serverPID, &waited) == -1) {
+            printf("Server is not running\n");
+            unlink(cFIFO);
+            exit(EXIT_FAILURE);
+        }
+    }
 
-    // Write the clientPID to the server's named pipe
+    clock_gettime(CLOCK_MONOTONIC, &admitted);
+
+    // Block the admission signal so the answer is queued until we wait for it
+    sigset_t admission;
+    sigemptyset(&admission);
+    sigaddset(&admission, ADMISSION_SIGNAL);
+    sigprocmask(SIG_BLOCK, &admission, NULL);
+
+    // Write the connection record to the server's named pipe
     int server_pipe_fd = open(SERVER_PIPE, O_WRONLY);
     if (server_pipe_fd == -1) {
         perror("open server pipe failed");
+        unlink(cFIFO);
         exit(EXIT_FAILURE);
     }
-    // Send the request to the server
-    
-    int get_pid = getpid();
-    if (write(server_pipe_fd, &get_pid, sizeof(pid_t)) == -1) {
+    connection_record record = { get_pid, mode,
+        (admitted.tv_sec - queued.tv_sec) * 1000000000LL + (admitted.tv_nsec - queued.tv_nsec) };
+    if (write(server_pipe_fd, &record, sizeof(record)) == -1) {
         perror("write to server pipe failed");
         close(server_pipe_fd);
+        unlink(cFIFO);
         exit(EXIT_FAILURE);
     }
     close(server_pipe_fd);
 
-    char clientFIFO[50];
-    snprintf(clientFIFO, sizeof(clientFIFO), "/tmp/client_%d_fifo", get_pid);
-
-    strcpy(cFIFO, clientFIFO);
-    // Create client-specific FIFO inside the child process
-    if (mkfifo(clientFIFO, 0666) == -1) {
-        perror("mkfifo failed");
-        exit(EXIT_FAILURE);
-    }
-    //printf("Client FIFO: %s\n", clientFIFO);
-
-    // If option is "connect", wait for a spot in the server queue
-    if (strcmp(option, "Connect") == 0) {
-        printf("Wait for a spot in the server queue...\n");
-        while (1) {
-            if (sem_trywait(&semaphore) == 0) {
-                printf("Connected to the server.\n");
-                break;
-            }
-            else{
-            printf("Server queue is full. Waiting for a spot...\n");
-            sleep(2); // Wait before retrying
+    // Wait for the server to start our worker
+    while (1) {
+        siginfo_t info;
+        struct timespec timeout = { 1, 0 };
+        if (sigtimedwait(&admission, &info, &timeout) == -1) {
+            if (errno == EAGAIN && !is_server_running()) {
+                printf("Server is not running\n");
+                unlink(cFIFO);
+                exit(EXIT_FAILURE);
             }
+            continue;
         }
-    } else if (strcmp(option, "tryConnect") == 0) {
-        // If option is "tryConnect", attempt to connect without waiting
-        if (sem_trywait(&semaphore) != 0) {
+        if (info.si_pid != serverPID) {
+            continue;
+        }
+        if (info.si_value.sival_int == ADMISSION_ADMITTED) {
+            printf("Connected to the server.\n");
+            break;
+        } else {
             printf("Server queue is full. Exiting...\n");
+            unlink(cFIFO);
             exit(EXIT_SUCCESS);
-        } else {
-            printf("Connected to the server.\n");
         }
-    } else {
-        fprintf(stderr, "Invalid option: %s\n", option);
-        exit(EXIT_FAILURE);
     }
-    
 }
 
 // Function to send request to server
 void send_request_to_server(int serverPID, char *request) {
     
+    // Transfers open the FIFO themselves, possibly more than once
+    if (strncmp(request, "upload ", 7) == 0 || strncmp(request, "download ", 9) == 0) {
+        char filename[256];
+        int channels = 1;
+        if (request[0] == 'u') {
+            sscanf(request + 7, "%255s", filename);
+            upload_file(filename);
+        } else {
+            sscanf(request + 9, "%255s %d", filename, &channels);
+            download_file(filename, channels);
+        }
+        return;
+    }
+    else if (strncmp(request, "transport ", 10) == 0) {
+        set_transport(request + 10);
+        return;
+    }
+    else if (strncmp(request, "compress ", 9) == 0) {
+        set_compress(request + 9);
+        return;
+    }
+    else if (strncmp(request, "mupload ", 8) == 0) {
+        batch_upload(request + 8);
+        return;
+    }
+    else if (strncmp(request, "mdownload ", 10) == 0) {
+        batch_download(request);
+        return;
+    }
+
     // Open the named pipe for writing
     int pipe_fd = open(cFIFO, O_WRONLY);
     if (pipe_fd == -1) {
         perror("open failed");
         exit(EXIT_FAILURE);
     }
-    // Check if the request is an upload command
-    if (strncmp(request, "upload ", 7) == 0) {
-        // Wait on semaphore (enter critical section)
-        //sem_wait(&semaphore);
-        // Get the filename from the request
-        char filename[256];
-        sscanf(request + 7, "%s", filename);
-
-        // Open the file for reading
-        FILE *file = fopen(filename, "rb");
-        if (file == NULL) {
-            perror("open file failed");
-            close(pipe_fd);
-            return;
-        }
-        // Send the upload request to the server
-        if (write(pipe_fd, request, strlen(request)) == -1) {
-            perror("write failed");
-            close(pipe_fd);
-            fclose(file);
-            exit(EXIT_FAILURE);
-        }
-
-        // Get the file size
-        fseek(file, 0, SEEK_SET);
-        size_t fileSize = 0;
-        char ch;
-        while (fread(&ch, 1, 1, file) == 1) {
-            fileSize++;
-        }
-        rewind(file);  // Reset the file pointer to the beginning of the file
-
-        // Send the file size to the server
-        if (write(pipe_fd, &fileSize, sizeof(fileSize)) == -1) {
-            perror("Failed to write file size to server");
-            fclose(file);
-            return;
-        }
-
-        // Read the file data and send it to the server
-        char buffer[4096];
-        ssize_t bytes_read;
-        while ((bytes_read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
-            if (write(pipe_fd, buffer, bytes_read) == -1) {
-                perror("write failed");
-                close(pipe_fd);
-                fclose(file);
-                exit(EXIT_FAILURE);
-            }
-        }
-        printf("file transfer request received. Beginning file transfer:\n");
-        printf("%ld bytes transferred\n", fileSize);
-
-        fclose(file);
-        // post on semaphore (exit critical section)
-        //sem_post(&semaphore);
-    } 
-    else if (strncmp(request, "download ", 9) == 0) {
-        // Wait on semaphore (enter critical section)
-        //sem_wait(&semaphore);
-
-        char filename[256];
-        sscanf(request + 9, "%s", filename);
-        // Check if file already exists in the server's directory
-        if (access(filename, F_OK) != -1) {
-            char errorMsg[300];
-            snprintf(errorMsg, sizeof(errorMsg), "Error: File %s already exists on the server.\n", filename);
-            printf("%s", errorMsg);
-            return;
-        }
-        
-        // Send the download request to the client
-        if (write(pipe_fd, request, strlen(request)) == -1) {
-            perror("write failed");
-            close(pipe_fd);
-            exit(EXIT_FAILURE);
-        }
-        close(pipe_fd);
-
-        // Open the file for writing
-        FILE *file = fopen(filename, "wb");
-        if (file == NULL) {
-            printf("Error: Unable to open file %s for writing.\n", filename);
-            return;
-        }
-        // Wait on semaphore (exit critical section)
-        //sem_post(&semaphore);
-
-        int pipe_fd  = open(cFIFO, O_RDONLY);
-        if (pipe_fd  == -1) {
-            perror("open failed");
-            exit(EXIT_FAILURE);
-        }
-        // Wait on semaphore (enter critical section)
-        //sem_wait(&semaphore);
-
-        char buffer[4096]="null";
-        size_t totalBytesRead = 0;
-        ssize_t bytesRead=0;
-        while ((bytesRead=read(pipe_fd , buffer, sizeof(buffer))) > 0){
-            if (fwrite(buffer, 1, bytesRead, file) != bytesRead) {
-                perror("Error writing file data");
-                fclose(file);
-                return;
-            }
-            totalBytesRead += bytesRead;
-        }
-        if (bytesRead == -1) {
-            perror("Error reading file data");
-            printf("errno: %d\n", errno);
-        }
-        printf("%ld bytes transferred\n", totalBytesRead);
-        fclose(file);
-        // Wait on semaphore (exitcritical section)
-        //sem_post(&semaphore);
-    } 
-    else if(strncmp(request,"quit",4)==0){
+    if(strncmp(request,"quit",4)==0){
         if (write(pipe_fd, request, strlen(request)) == -1) {
             perror("write failed");
             close(pipe_fd);
@@ -270,6 +243,19 @@ void send_request_to_server(int serverPID, char *request) {
         char buffer[4096];
         ssize_t bytesRead;
         size_t totalBytesRead = 0;
+        if (dataRing != NULL) {
+            // The archive comes through the ring, the FIFO is only closed afterwards
+            const void *area;
+            int failed = 0;
+            while ((bytesRead = shm_ring_peek(dataRing, &area, serverPID)) > 0) {
+                if (!failed && write(file_fd, area, bytesRead) == -1) {
+                    perror("write failed");
+                    failed = 1;
+                }
+                totalBytesRead += bytesRead;
+                shm_ring_consume(dataRing, bytesRead);
+            }
+        }
         while ((bytesRead = read(pipe_fd , buffer, sizeof(buffer))) > 0) {
             if (write(file_fd, buffer, bytesRead) == -1) {
                 perror("write failed");
@@ -290,18 +276,28 @@ void send_request_to_server(int serverPID, char *request) {
         pclose(tar);
 
         printf("Archiving the current contents of the server...\n");
-        printf("Creating archive directory...\n");
         printf("%d files downloaded ..%ld bytes transferred..\n", file_count, totalBytesRead);
-        printf("Calling tar utility .. child PID %d\n", getpid());
-        printf("Child returned with SUCCESS..\n");
-        printf("Copying the archive file..\n");
-        printf("Removing archive directory...\n");
         printf("SUCCESS Server side files are archived in \"%s\"\n", filename);
 
         // Wait on semaphore (exit critical section)
         //sem_post(&semaphore);
 
     }
+    else if (compressMode && strncmp(request, "readF ", 6) == 0) {
+        // The answer is one compressed stream on the FIFO
+        if (write(pipe_fd, request, strlen(request)) == -1) {
+            perror("write failed");
+            close(pipe_fd);
+            exit(EXIT_FAILURE);
+        }
+        close(pipe_fd);
+        pipe_fd = open(cFIFO, O_RDONLY);
+        if (pipe_fd == -1) {
+            perror("open failed for client FIFO");
+            return;
+        }
+        receive_frames(pipe_fd, 0, STDOUT_FILENO, -1, -1);
+    }
     else if (strncmp(request,"full",4)==0){
         if (write(pipe_fd, request, strlen(request)) == -1) {
             perror("write failed");
@@ -326,6 +322,828 @@ void send_request_to_server(int serverPID, char *request) {
 
 }
 
+// Sends a plain request and collects the whole response in response
+int query_server(const char *request, char *response, size_t size) {
+    int pipe_fd = open(cFIFO, O_WRONLY);
+    if (pipe_fd == -1) {
+        return -1;
+    }
+    if (write(pipe_fd, request, strlen(request)) == -1) {
+        close(pipe_fd);
+        return -1;
+    }
+    close(pipe_fd);
+
+    pipe_fd = open(cFIFO, O_RDONLY);
+    if (pipe_fd == -1) {
+        return -1;
+    }
+    size_t used = 0;
+    ssize_t bytes_read;
+    while ((bytes_read = read(pipe_fd, response + used, size - 1 - used)) > 0) {
+        used += bytes_read;
+        if (used == size - 1) {
+            char rest[256];
+            while (read(pipe_fd, rest, sizeof(rest)) > 0) {
+            }
+            break;
+        }
+    }
+    response[used] = '\0';
+    close(pipe_fd);
+    return 0;
+}
+
+// Fill buf from the ring or from pipe_fd, fewer bytes than asked for only at the end of the data
+static ssize_t data_read(int pipe_fd, int fromRing, void *buf, size_t len) {
+    if (fromRing) {
+        return shm_ring_read(dataRing, buf, len, serverP);
+    }
+    size_t got = 0;
+    while (got < len) {
+        ssize_t bytes = read(pipe_fd, (char *)buf + got, len - got);
+        if (bytes <= 0) {
+            return bytes == -1 && got == 0 ? -1 : (ssize_t)got;
+        }
+        got += bytes;
+    }
+    return got;
+}
+
+// Decode a stream of compressed frames into fd at offset, or append to fd when offset is -1.
+// The stream ends with the ring stream, or after length bytes (-1: at EOF) on the FIFO.
+// Returns the decoded bytes stored.
+int64_t receive_frames(int pipe_fd, int fromRing, int fd, int64_t offset, int64_t length) {
+    char *payload = malloc(CHUNK_RAW_MAX);
+    char *raw = malloc(CHUNK_RAW_MAX);
+    int64_t stored = 0;
+    int failed = payload == NULL || raw == NULL;
+    while (!failed && (fromRing || length == -1 || stored < length)) {
+        chunk_frame frame;
+        ssize_t got = data_read(pipe_fd, fromRing, &frame, sizeof(frame));
+        if (got <= 0) {
+            break;
+        }
+        ssize_t rawLen = -1;
+        if (got == sizeof(frame) && frame.storedLen <= CHUNK_RAW_MAX &&
+            data_read(pipe_fd, fromRing, payload, frame.storedLen) == frame.storedLen) {
+            rawLen = chunk_decode(&frame, payload, raw);
+        }
+        if (rawLen == -1) {
+            fprintf(stderr, "Corrupt compressed data\n");
+            failed = 1;
+            break;
+        }
+        if (length != -1 && rawLen > length - stored) {
+            rawLen = length - stored;
+        }
+        if ((offset == -1 ? write_all(fd, raw, rawLen) : (pwrite(fd, raw, rawLen, offset + stored) == rawLen ? 0 : -1)) == -1) {
+            perror("Error writing file data");
+            failed = 1;
+            break;
+        }
+        stored += rawLen;
+    }
+    if (failed && fromRing) {
+        const void *area;
+        ssize_t available;
+        while ((available = shm_ring_peek(dataRing, &area, serverP)) > 0) {
+            shm_ring_consume(dataRing, available); // Skip the rest of the stream
+        }
+    }
+    free(payload);
+    free(raw);
+    return stored;
+}
+
+// Sends a download request and stores the range it answers with at its offset in fd.
+// Returns the number of bytes stored, which is less than header->length if the transfer broke off.
+int64_t receive_range(const char *request, int fd, range_header *header) {
+    int pipe_fd = open(cFIFO, O_WRONLY);
+    if (pipe_fd == -1) {
+        perror("open failed");
+        return -1;
+    }
+    if (write(pipe_fd, request, strlen(request)) == -1) {
+        perror("write failed");
+        close(pipe_fd);
+        return -1;
+    }
+    close(pipe_fd);
+
+    pipe_fd = open(cFIFO, O_RDONLY);
+    if (pipe_fd == -1) {
+        perror("open failed");
+        return -1;
+    }
+    size_t got = 0;
+    ssize_t bytesRead = 0;
+    while (got < sizeof(*header) && (bytesRead = read(pipe_fd, (char *)header + got, sizeof(*header) - got)) > 0) {
+        got += bytesRead;
+    }
+    if (got < sizeof(*header)) {
+        header->fileSize = -1;
+        close(pipe_fd);
+        return -1;
+    }
+
+    int64_t stored = 0;
+    if (compressMode && header->fileSize != -1) {
+        stored = receive_frames(pipe_fd, dataRing != NULL, fd, header->offset, header->length);
+        close(pipe_fd);
+        return stored;
+    }
+    if (dataRing != NULL && header->fileSize != -1) {
+        // The range follows in the ring, store it straight from there
+        const void *area;
+        int failed = 0;
+        while ((bytesRead = shm_ring_peek(dataRing, &area, serverP)) > 0) {
+            size_t use = header->length - stored < bytesRead ? header->length - stored : (size_t)bytesRead;
+            if (!failed && use > 0 && pwrite(fd, area, use, header->offset + stored) != (ssize_t)use) {
+                perror("Error writing file data");
+                failed = 1;
+            }
+            if (!failed) {
+                stored += use;
+            }
+            shm_ring_consume(dataRing, bytesRead);
+        }
+        close(pipe_fd);
+        return stored;
+    }
+    char buffer[TRANSFER_CHUNK];
+    while (stored < header->length && (bytesRead = read(pipe_fd, buffer, sizeof(buffer))) > 0) {
+        if (pwrite(fd, buffer, bytesRead, header->offset + stored) != bytesRead) {
+            perror("Error writing file data");
+            break;
+        }
+        stored += bytesRead;
+    }
+    close(pipe_fd);
+    return stored;
+}
+
+// SHA-256 of the whole file as lowercase hex, the name of its content in the server's dedup store
+int hash_file(int fd, char *hex) {
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    if (ctx == NULL || EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) != 1) {
+        EVP_MD_CTX_free(ctx);
+        return -1;
+    }
+    char buffer[TRANSFER_CHUNK];
+    off_t offset = 0;
+    ssize_t got;
+    while ((got = pread(fd, buffer, sizeof(buffer), offset)) > 0) {
+        EVP_DigestUpdate(ctx, buffer, got);
+        offset += got;
+    }
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    int result = got == 0 && EVP_DigestFinal_ex(ctx, digest, NULL) == 1 ? 0 : -1;
+    EVP_MD_CTX_free(ctx);
+    for (int i = 0; result == 0 && i < STORE_HASH_HEX / 2; i++) {
+        sprintf(hex + 2 * i, "%02x", digest[i]);
+    }
+    return result;
+}
+
+// Uploads filename, continuing after the bytes the server kept from an interrupted upload
+void upload_file(const char *filename) {
+    // Open the file for reading
+    int file_fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (file_fd == -1 || fstat(file_fd, &st) == -1) {
+        perror("open file failed");
+        if (file_fd != -1) {
+            close(file_fd);
+        }
+        return;
+    }
+    size_t fileSize = st.st_size;
+
+    // Ask the server how much of an earlier attempt it stored
+    char request[300];
+    char response[128];
+    long long size = -1;
+    long long partSize = -1;
+    snprintf(request, sizeof(request), "stat %s", filename);
+    if (query_server(request, response, sizeof(response)) == 0) {
+        sscanf(response, "%lld %lld", &size, &partSize);
+    }
+    long long offset = partSize > 0 && (size_t)partSize <= fileSize ? partSize : 0;
+
+    // A new upload first offers the content's hash, content the server already has is not sent
+    char hex[STORE_HASH_HEX + 1];
+    if (size == -1 && offset == 0 && fileSize > 0 && hash_file(file_fd, hex) == 0) {
+        snprintf(request, sizeof(request), "have %s %zu %s", hex, fileSize, filename);
+        if (query_server(request, response, sizeof(response)) == 0 && strcmp(response, "linked\n") == 0) {
+            printf("File %s uploaded, the server already had its %zu bytes\n", filename, fileSize);
+            close(file_fd);
+            return;
+        }
+    }
+
+    // Send the upload request with its NUL, so the server can tell it apart from the payload
+    int pipe_fd = open(cFIFO, O_WRONLY);
+    if (pipe_fd == -1) {
+        perror("open failed");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(request, sizeof(request), "upload %s %lld", filename, offset);
+    if (write(pipe_fd, request, strlen(request) + 1) == -1 ||
+        write(pipe_fd, &fileSize, sizeof(fileSize)) == -1) {
+        perror("write failed");
+        close(pipe_fd);
+        close(file_fd);
+        exit(EXIT_FAILURE);
+    }
+
+    // Read the file data and send it to the server
+    printf("file transfer request received. Beginning file transfer:\n");
+    if (offset > 0) {
+        printf("resuming at byte %lld\n", offset);
+    }
+    char buffer[TRANSFER_CHUNK];
+    ssize_t bytes_read;
+    size_t sent = 0;
+    if (compressMode) {
+        // Compressed frames, through the ring when there is one
+        chunk_encoder encoder = {0};
+        char *frame = malloc(CHUNK_FRAME_MAX);
+        if (dataRing != NULL) {
+            close(pipe_fd);
+            pipe_fd = -1;
+        }
+        while (frame != NULL && offset + sent < fileSize) {
+            size_t want = fileSize - offset - sent < sizeof(buffer) ? fileSize - offset - sent : sizeof(buffer);
+            if ((bytes_read = pread(file_fd, buffer, want, offset + sent)) <= 0) {
+                break; // File shrank, the server reports the upload as interrupted
+            }
+            size_t len = chunk_encode(&encoder, buffer, bytes_read, frame);
+            if (dataRing != NULL ? shm_ring_write(dataRing, frame, len, serverP) : write_all(pipe_fd, frame, len)) {
+                perror("write failed");
+                break;
+            }
+            sent += bytes_read;
+        }
+        if (dataRing != NULL) {
+            shm_ring_finish(dataRing);
+        }
+        else {
+            close(pipe_fd);
+            pipe_fd = -1;
+        }
+        free(frame);
+        if (encoder.rawBytes > 0) {
+            printf("compressed to %llu bytes (%.1f%%)\n", (unsigned long long)encoder.storedBytes,
+                   100.0 * encoder.storedBytes / encoder.rawBytes);
+        }
+    }
+    else if (dataRing != NULL) {
+        // The FIFO carried the request and size, the data is read straight into the ring
+        close(pipe_fd);
+        pipe_fd = -1;
+        while (offset + sent < fileSize) {
+            void *area;
+            ssize_t room = shm_ring_reserve(dataRing, &area, serverP);
+            if (room == -1) {
+                break;
+            }
+            size_t want = fileSize - offset - sent < (size_t)room ? fileSize - offset - sent : (size_t)room;
+            if ((bytes_read = pread(file_fd, area, want, offset + sent)) <= 0) {
+                break; // File shrank, the server reports the upload as interrupted
+            }
+            shm_ring_commit(dataRing, bytes_read);
+            sent += bytes_read;
+        }
+        shm_ring_finish(dataRing);
+    }
+    while (pipe_fd != -1 && (bytes_read = pread(file_fd, buffer, sizeof(buffer), offset + sent)) > 0 && offset + sent < fileSize) {
+        if (offset + sent + bytes_read > fileSize) {
+            bytes_read = fileSize - offset - sent; // File grew, the server expects the announced size
+        }
+        if (write(pipe_fd, buffer, bytes_read) == -1) {
+            perror("write failed");
+            close(pipe_fd);
+            close(file_fd);
+            exit(EXIT_FAILURE);
+        }
+        sent += bytes_read;
+    }
+    printf("%zu bytes transferred\n", sent);
+
+    close(file_fd);
+    if (pipe_fd != -1) {
+        close(pipe_fd);
+    }
+    // The server confirms once it has stored (or rejected) the file
+    handle_server_response();
+}
+
+// Range of a parallel download fetched over a connection of its own, in a child process.
+// Exits RANGE_STORED only when the whole range was stored, connect_to_server exits otherwise.
+static void download_range_helper(const char *filename, int fd, int64_t offset, int64_t length) {
+    int devnull = open("/dev/null", O_WRONLY);
+    if (devnull != -1) {
+        dup2(devnull, STDOUT_FILENO); // Connection chatter of the helpers is not interesting
+        close(devnull);
+    }
+    dataRing = NULL; // Our own connection uses the FIFO, uncompressed
+    compressMode = 0;
+    connect_to_server(serverP, "tryConnect"); // Exits if the server has no free slot
+
+    char request[300];
+    snprintf(request, sizeof(request), "download %s %lld %lld", filename, (long long)offset, (long long)length);
+    range_header header;
+    int64_t stored = receive_range(request, fd, &header);
+
+    int pipe_fd = open(cFIFO, O_WRONLY);
+    if (pipe_fd != -1) {
+        write(pipe_fd, "quit", 4);
+        close(pipe_fd);
+    }
+    unlink(cFIFO);
+    _exit(stored == length && header.offset == offset ? RANGE_STORED : EXIT_FAILURE);
+}
+
+// Downloads filename into <file>.part and renames it when complete.
+// A sequential download continues an existing .part, channels > 1 splits the file into ranges
+// fetched by helper connections, ranges whose helper failed are fetched again on this connection.
+void download_file(const char *filename, int channels) {
+    char partName[300];
+    char request[300];
+    // Check if file already exists in the client's directory
+    if (access(filename, F_OK) != -1) {
+        printf("Error: File %s already exists on the client side.\n", filename);
+        return;
+    }
+    if (channels < 1) {
+        channels = 1;
+    }
+    if (channels > 16) {
+        channels = 16;
+    }
+
+    long long fileSize = -1;
+    if (channels > 1) {
+        char response[128];
+        long long partSize;
+        snprintf(request, sizeof(request), "stat %s", filename);
+        if (query_server(request, response, sizeof(response)) == 0) {
+            sscanf(response, "%lld %lld", &fileSize, &partSize);
+        }
+        if (fileSize == -1) {
+            printf("Error: File %s not found on the server.\n", filename);
+            return;
+        }
+        if (fileSize < (long long)channels * TRANSFER_CHUNK) {
+            channels = 1; // Not worth extra connections
+        }
+    }
+
+    // Ranges of a parallel download leave holes, so they never go to a file a sequential run resumes
+    snprintf(partName, sizeof(partName), "%s%s", filename, channels > 1 ? ".pdl" : PART_SUFFIX);
+    int fd = open(partName, O_WRONLY | O_CREAT | (channels > 1 ? O_TRUNC : 0), 0666);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        printf("Error: Unable to open file %s for writing.\n", partName);
+        if (fd != -1) {
+            close(fd);
+        }
+        return;
+    }
+
+    range_header header;
+    int64_t stored;
+    if (channels == 1) {
+        if (st.st_size > 0) {
+            printf("resuming at byte %lld\n", (long long)st.st_size);
+        }
+        snprintf(request, sizeof(request), "download %s %lld", filename, (long long)st.st_size);
+        stored = receive_range(request, fd, &header);
+        if (header.fileSize == -1) {
+            printf("Error: File %s not found on the server.\n", filename);
+            close(fd);
+            if (st.st_size == 0) {
+                unlink(partName);
+            }
+            return;
+        }
+        fileSize = header.fileSize;
+        stored += header.offset;
+    }
+    else {
+        // Range i covers [i * step, (i + 1) * step), the last one takes the remainder
+        int64_t step = fileSize / channels;
+        pid_t helpers[16];
+        fflush(stdout);
+        for (int i = 1; i < channels; i++) {
+            helpers[i] = fork();
+            if (helpers[i] == 0) {
+                close(STDIN_FILENO);
+                download_range_helper(filename, fd, i * step, i == channels - 1 ? fileSize - i * step : step);
+            }
+        }
+        stored = 0;
+        int failed = 0;
+        for (int i = 0; i < channels; i++) {
+            int64_t offset = i * step;
+            int64_t length = i == channels - 1 ? fileSize - offset : step;
+            int status = -1;
+            if (i > 0 && (helpers[i] == -1 || waitpid(helpers[i], &status, 0) == -1)) {
+                status = -1;
+            }
+            if (failed) {
+                continue; // Only reap the remaining helpers
+            }
+            if (i == 0 || !WIFEXITED(status) || WEXITSTATUS(status) != RANGE_STORED) {
+                snprintf(request, sizeof(request), "download %s %lld %lld", filename, (long long)offset, (long long)length);
+                if (receive_range(request, fd, &header) != length || header.fileSize != fileSize) {
+                    failed = 1;
+                    continue;
+                }
+            }
+            stored += length;
+        }
+    }
+    close(fd);
+
+    if (stored == fileSize && rename(partName, filename) == 0) {
+        printf("%lld bytes transferred\n", fileSize);
+    }
+    else if (channels == 1) {
+        printf("Download of %s interrupted at byte %lld, run download again to resume\n", filename, (long long)stored);
+    }
+    else {
+        printf("Download of %s failed\n", filename);
+        unlink(partName);
+    }
+}
+
+static double seconds_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+    const char *src = data;
+    while (len > 0) {
+        ssize_t written = write(fd, src, len);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        src += written;
+        len -= written;
+    }
+    return 0;
+}
+
+// Adds path, or the regular files directly inside it when it is a directory
+static int batch_collect(const char *path, char ***paths, size_t *count, size_t *capacity) {
+    struct stat st;
+    if (stat(path, &st) == -1) {
+        printf("%s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        DIR *dir = opendir(path);
+        if (dir == NULL) {
+            printf("%s: %s\n", path, strerror(errno));
+            return 0;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            char child[1024];
+            snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+            if (stat(child, &st) == 0 && S_ISREG(st.st_mode) &&
+                batch_collect(child, paths, count, capacity) == -1) {
+                closedir(dir);
+                return -1;
+            }
+        }
+        closedir(dir);
+        return 0;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        printf("%s: not a regular file\n", path);
+        return 0;
+    }
+    if (*count == *capacity) {
+        size_t grown = *capacity ? *capacity * 2 : 64;
+        char **more = realloc(*paths, grown * sizeof(char *));
+        if (more == NULL) {
+            return -1;
+        }
+        *paths = more;
+        *capacity = grown;
+    }
+    if (((*paths)[*count] = strdup(path)) == NULL) {
+        return -1;
+    }
+    (*count)++;
+    return 0;
+}
+
+// mupload: every file goes to the server in one framed stream, with no round trip per file
+void batch_upload(const char *args) {
+    char argBuffer[256];
+    char **paths = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    snprintf(argBuffer, sizeof(argBuffer), "%s", args);
+    char *save = NULL;
+    for (char *tok = strtok_r(argBuffer, " \t", &save); tok != NULL; tok = strtok_r(NULL, " \t", &save)) {
+        glob_t matches;
+        if (glob(tok, 0, NULL, &matches) != 0) {
+            printf("%s: no such file\n", tok);
+            continue;
+        }
+        for (size_t i = 0; i < matches.gl_pathc; i++) {
+            if (batch_collect(matches.gl_pathv[i], &paths, &count, &capacity) == -1) {
+                perror("batch_collect failed");
+                break;
+            }
+        }
+        globfree(&matches);
+    }
+    if (count == 0) {
+        printf("Nothing to upload\n");
+        free(paths);
+        return;
+    }
+
+    char *out = malloc(TRANSFER_CHUNK);
+    if (out == NULL) {
+        perror("malloc failed");
+        for (size_t i = 0; i < count; i++) {
+            free(paths[i]);
+        }
+        free(paths);
+        return;
+    }
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int pipe_fd = open(cFIFO, O_WRONLY);
+    if (pipe_fd == -1) {
+        perror("open failed");
+        exit(EXIT_FAILURE);
+    }
+    // The request goes with its NUL, the frames follow on the same open
+    memcpy(out, "mupload", 8);
+    size_t used = 8;
+    int64_t bytes = 0;
+    size_t sent = 0;
+    int result = 0;
+    for (size_t i = 0; i < count && result == 0; i++) {
+        const char *name = strrchr(paths[i], '/') ? strrchr(paths[i], '/') + 1 : paths[i];
+        int fd = open(paths[i], O_RDONLY);
+        struct stat st;
+        if (fd == -1 || fstat(fd, &st) == -1) {
+            printf("%s: %s\n", paths[i], strerror(errno));
+            if (fd != -1) {
+                close(fd);
+            }
+            continue;
+        }
+        batch_frame frame = { st.st_size, strlen(name), BATCH_OK };
+        if (used + sizeof(frame) + frame.nameLen > TRANSFER_CHUNK) {
+            result = write_all(pipe_fd, out, used);
+            used = 0;
+        }
+        memcpy(out + used, &frame, sizeof(frame));
+        memcpy(out + used + sizeof(frame), name, frame.nameLen);
+        used += sizeof(frame) + frame.nameLen;
+
+        // Exactly the announced size, zero filled if the file shrank meanwhile
+        int64_t remaining = frame.size;
+        while (remaining > 0 && result == 0) {
+            if (used == TRANSFER_CHUNK) {
+                result = write_all(pipe_fd, out, used);
+                used = 0;
+            }
+            size_t want = TRANSFER_CHUNK - used < (uint64_t)remaining ? TRANSFER_CHUNK - used : (size_t)remaining;
+            ssize_t got = read(fd, out + used, want);
+            if (got <= 0) {
+                memset(out + used, 0, want);
+                got = want;
+            }
+            used += got;
+            remaining -= got;
+        }
+        close(fd);
+        bytes += frame.size;
+        sent++;
+    }
+    batch_frame last = { 0, 0, BATCH_OK };
+    if (result == 0 && used + sizeof(last) > TRANSFER_CHUNK) {
+        result = write_all(pipe_fd, out, used);
+        used = 0;
+    }
+    memcpy(out + used, &last, sizeof(last));
+    used += sizeof(last);
+    if (result == 0) {
+        result = write_all(pipe_fd, out, used);
+    }
+    close(pipe_fd);
+    free(out);
+    for (size_t i = 0; i < count; i++) {
+        free(paths[i]);
+    }
+    free(paths);
+    if (result == -1) {
+        perror("write failed");
+        exit(EXIT_FAILURE);
+    }
+
+    handle_server_response();
+    double seconds = seconds_since(&start);
+    printf("%zu files, %lld bytes sent in %.3f s (%.0f files/s)\n", sent, (long long)bytes, seconds,
+           seconds > 0 ? sent / seconds : 0.0);
+}
+
+// Buffered reads of the batch stream
+typedef struct {
+    int fd;
+    size_t pos;
+    size_t len;
+    char data[TRANSFER_CHUNK];
+} batch_reader;
+
+static int batch_read_full(batch_reader *br, void *buf, size_t len) {
+    char *dst = buf;
+    while (len > 0) {
+        if (br->pos == br->len) {
+            ssize_t got = read(br->fd, br->data, sizeof(br->data));
+            if (got <= 0) {
+                return -1;
+            }
+            br->pos = 0;
+            br->len = got;
+        }
+        size_t chunk = br->len - br->pos < len ? br->len - br->pos : len;
+        memcpy(dst, br->data + br->pos, chunk);
+        br->pos += chunk;
+        dst += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+// mdownload: stores every file of the server's framed stream, files that exist here are skipped
+void batch_download(const char *request) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int pipe_fd = open(cFIFO, O_WRONLY);
+    if (pipe_fd == -1) {
+        perror("open failed");
+        exit(EXIT_FAILURE);
+    }
+    if (write(pipe_fd, request, strlen(request)) == -1) {
+        perror("write failed");
+        close(pipe_fd);
+        exit(EXIT_FAILURE);
+    }
+    close(pipe_fd);
+
+    batch_reader *br = malloc(sizeof(batch_reader));
+    if (br == NULL) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    br->fd = open(cFIFO, O_RDONLY);
+    br->pos = 0;
+    br->len = 0;
+    if (br->fd == -1) {
+        perror("open failed");
+        exit(EXIT_FAILURE);
+    }
+
+    int files = 0;
+    int skipped = 0;
+    int64_t bytes = 0;
+    int complete = 0;
+    char buffer[TRANSFER_CHUNK];
+    while (1) {
+        batch_frame frame;
+        char name[256];
+        char partName[300];
+        if (batch_read_full(br, &frame, sizeof(frame)) == -1) {
+            break;
+        }
+        if (frame.nameLen == 0) {
+            complete = 1;
+            break;
+        }
+        if (frame.nameLen >= sizeof(name) || frame.size < 0 || batch_read_full(br, name, frame.nameLen) == -1) {
+            break;
+        }
+        name[frame.nameLen] = '\0';
+        if (frame.status == BATCH_MISSING) {
+            printf("%s: not found on the server\n", name);
+            skipped++;
+            continue;
+        }
+
+        int fd = -1;
+        if (strchr(name, '/') != NULL || strcmp(name, "..") == 0 || strcmp(name, ".") == 0) {
+            printf("%s: invalid name\n", name);
+        }
+        else if (access(name, F_OK) != -1) {
+            printf("%s: already exists, skipped\n", name);
+        }
+        else {
+            snprintf(partName, sizeof(partName), "%s" PART_SUFFIX, name);
+            if ((fd = open(partName, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1) {
+                printf("%s: %s\n", partName, strerror(errno));
+            }
+        }
+
+        int64_t remaining = frame.size;
+        int broken = 0;
+        while (remaining > 0) {
+            size_t want = remaining < (int64_t)sizeof(buffer) ? remaining : sizeof(buffer);
+            if (batch_read_full(br, buffer, want) == -1) {
+                broken = 1;
+                break;
+            }
+            if (fd != -1 && write_all(fd, buffer, want) == -1) {
+                printf("%s: %s\n", partName, strerror(errno));
+                close(fd);
+                unlink(partName);
+                fd = -1;
+            }
+            remaining -= want;
+        }
+        if (fd != -1) {
+            close(fd);
+            if (!broken && rename(partName, name) == 0) {
+                files++;
+                bytes += frame.size;
+            } else {
+                unlink(partName);
+            }
+        }
+        if (fd == -1 || broken) {
+            skipped++;
+        }
+        if (broken) {
+            break;
+        }
+    }
+    close(br->fd);
+    free(br);
+
+    double seconds = seconds_since(&start);
+    if (!complete) {
+        printf("Batch download interrupted\n");
+    }
+    printf("%d files downloaded, %lld bytes in %.3f s (%.0f files/s), %d skipped\n", files, (long long)bytes,
+           seconds, seconds > 0 ? files / seconds : 0.0, skipped);
+}
+
+// transport shm maps a ring for the server's worker, transport fifo goes back to the FIFO only
+void set_transport(const char *mode) {
+    char response[64] = "";
+    if (strcmp(mode, "shm") == 0) {
+        if (dataRing == NULL) {
+            dataRing = shm_ring_create(getpid());
+        }
+        if (dataRing == NULL || query_server("transport shm", response, sizeof(response)) == -1 ||
+            strcmp(response, "transport shm\n") != 0) {
+            if (dataRing != NULL) {
+                shm_ring_close(dataRing);
+                shm_ring_destroy(getpid());
+                dataRing = NULL;
+            }
+            printf("Transfers use the FIFO\n");
+            return;
+        }
+        // The name stays for the session: a worker that replaces ours maps the ring again.
+        // The server removes it when the session ends, we do on exit.
+        printf("Transfers use shared memory\n");
+        return;
+    }
+    query_server("transport fifo", response, sizeof(response));
+    if (dataRing != NULL) {
+        shm_ring_close(dataRing);
+        shm_ring_destroy(getpid());
+        dataRing = NULL;
+    }
+    printf("Transfers use the FIFO\n");
+}
+
+void set_compress(const char *mode) {
+    char response[64] = "";
+    const char *request = strcmp(mode, "lz") == 0 ? "compress lz" : "compress off";
+    if (query_server(request, response, sizeof(response)) == 0) {
+        compressMode = strcmp(response, "compress lz\n") == 0;
+    }
+    printf(compressMode ? "Transfers are compressed\n" : "Transfers are not compressed\n");
+}
+
 void handle_server_response() {
     // Parse and process server response
     char response[4096] = {0};    
@@ -364,6 +1182,22 @@ void handle_sigint(int sig) {
     exit(EXIT_SUCCESS);
 }
 
+// The server sends SIGTERM once it drained our last request on shutdown
+void handle_sigterm(int sig) {
+    write(STDOUT_FILENO, "\n>> Server shut down. Exiting...\n", 34);
+    unlink(cFIFO);
+    exit(EXIT_SUCCESS);
+}
+
+// Download helpers leave with _exit, only the client itself removes the ring's name
+static pid_t ringOwner = 0;
+
+static void remove_ring_name(void) {
+    if (getpid() == ringOwner) {
+        shm_ring_destroy(ringOwner);
+    }
+}
+
 // Main function
 int main(int argc, char *argv[]) {
     // Parse command line arguments
@@ -383,17 +1217,15 @@ int main(int argc, char *argv[]) {
         write(STDOUT_FILENO, " is not running.\n", 17);
         exit(EXIT_FAILURE);
     }
-        // Initialize semaphore
-    if (sem_init(&semaphore, 0, 1) == -1) {
-        perror("Semaphore initialization failed");
-        exit(EXIT_FAILURE);
-    }
-
     // Connect to server based on the specified option
     connect_to_server(serverPID, option);
+    ringOwner = getpid();
+    atexit(remove_ring_name);
+    set_transport("shm"); // Bulk data through shared memory when the server supports it
 
     // Set up signal handler for SIGINT
     signal(SIGINT, handle_sigint);
+    signal(SIGTERM, handle_sigterm);
 
     // Enter main client loop
     while (1) {
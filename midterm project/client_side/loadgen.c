@@ -0,0 +1,1003 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "../protocol.h"
+
+enum { CMD_LIST, CMD_READF, CMD_WRITET, CMD_UPLOAD, CMD_DOWNLOAD, CMD_COUNT };
+
+static const char *commandNames[CMD_COUNT] = { "list", "readF", "writeT", "upload", "download" };
+
+// writeT target shared by all sessions, NULL to append to each session's own file
+static const char *sharedAppendFile = NULL;
+
+// One timed command, sent from a session to the parent
+typedef struct {
+    int command;
+    int ok;
+    long latencyNs;
+} op_result;
+
+// Benchmark and load generator for the midterm file server
+//   loadgen connect <serverPID> <clients>   connection setup rate for concurrent clients
+//   loadgen run <serverPID> [-c sessions] [-n ops] [-m mix] [-s uploadBytes] [-f appendFile]
+//                                           concurrent sessions running a weighted command mix,
+//                                           reports throughput and p50/p99/p999 per command,
+//                                           with -f every writeT appends to one shared file
+//   loadgen edit <serverPID> [-s fileBytes] [-n edits]
+//                                           writeT inserts and replacements near the head, middle and
+//                                           tail of a large file, an edit costs about the bytes after it
+//   loadgen transfer <serverPID> [-s bytes] [-n rounds]
+//                                           upload and download throughput with the data on the FIFO
+//                                           and through the shared memory ring
+//   loadgen compress <serverPID> [-s bytes] [-n rounds]
+//                                           codec speed and ratio, then download throughput and CPU
+//                                           time with and without compression for text and random data
+
+// What every forked session reports back to the parent through a pipe
+typedef struct {
+    int ok;
+    long latencyNs;
+} session_result;
+
+static long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int compare_long(const void *a, const void *b) {
+    long x = *(const long *)a;
+    long y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+// Value at percentile p (0..100) of an ascending array
+static long percentile(const long *sorted, size_t count, double p) {
+    if (count == 0) {
+        return 0;
+    }
+    size_t index = (size_t)(p / 100.0 * (count - 1) + 0.5);
+    return sorted[index];
+}
+
+// Same handshake as client.c: create our FIFO, pass the admission queue, send a connection record
+// and wait for the server to start our worker
+static int session_connect(pid_t serverPid, int mode, char *fifo, size_t fifoLen) {
+    snprintf(fifo, fifoLen, CLIENT_FIFO_FORMAT, getpid());
+    unlink(fifo);
+    if (mkfifo(fifo, 0666) == -1) {
+        perror("mkfifo failed");
+        return -1;
+    }
+
+    admission_queue *queue = admission_open(serverPid);
+    if (queue == NULL) {
+        unlink(fifo);
+        return -1;
+    }
+    int waited = 0;
+    long queued = now_ns();
+    int admitted = mode == CONNECT_TRY ? admission_try(queue) : admission_wait(queue, serverPid, &waited);
+    munmap(queue, sizeof(admission_queue));
+    if (admitted == -1) {
+        unlink(fifo);
+        return -1;
+    }
+
+    sigset_t admission;
+    sigemptyset(&admission);
+    sigaddset(&admission, ADMISSION_SIGNAL);
+    sigprocmask(SIG_BLOCK, &admission, NULL);
+
+    int serverFd = open(SERVER_FIFO_PATH, O_WRONLY);
+    if (serverFd == -1) {
+        perror("open server pipe failed");
+        unlink(fifo);
+        return -1;
+    }
+    connection_record record = { getpid(), mode, now_ns() - queued };
+    ssize_t written = write(serverFd, &record, sizeof(record));
+    close(serverFd);
+    if (written != sizeof(record)) {
+        unlink(fifo);
+        return -1;
+    }
+
+    while (1) {
+        siginfo_t info;
+        struct timespec timeout = { 1, 0 };
+        if (sigtimedwait(&admission, &info, &timeout) == -1) {
+            if (errno == EAGAIN && kill(serverPid, 0) == -1) {
+                unlink(fifo);
+                return -1;
+            }
+            continue;
+        }
+        if (info.si_pid != serverPid) {
+            continue;
+        }
+        if (info.si_value.sival_int == ADMISSION_ADMITTED) {
+            return 0;
+        }
+        unlink(fifo);
+        return -1;
+    }
+}
+
+static void session_quit(const char *fifo) {
+    int fd = open(fifo, O_WRONLY);
+    if (fd != -1) {
+        write(fd, "quit", 4);
+        close(fd);
+    }
+    unlink(fifo);
+}
+
+// Fork one process per client, release them together and time how long each needs to get admitted
+static int bench_connect(pid_t serverPid, int clients) {
+    int startPipe[2];
+    int resultPipe[2];
+    if (pipe(startPipe) == -1 || pipe(resultPipe) == -1) {
+        perror("pipe failed");
+        return -1;
+    }
+
+    for (int i = 0; i < clients; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork failed");
+            clients = i;
+            break;
+        }
+        if (pid == 0) {
+            close(startPipe[1]);
+            close(resultPipe[0]);
+            char go;
+            read(startPipe[0], &go, 1); // Returns once the parent closes the write end
+
+            char fifo[64];
+            session_result result;
+            long start = now_ns();
+            result.ok = session_connect(serverPid, CONNECT_WAIT, fifo, sizeof(fifo)) == 0;
+            result.latencyNs = now_ns() - start;
+            write(resultPipe[1], &result, sizeof(result));
+            if (result.ok) {
+                session_quit(fifo);
+            }
+            _exit(0);
+        }
+    }
+    close(startPipe[0]);
+    close(resultPipe[1]);
+
+    long start = now_ns();
+    close(startPipe[1]);
+
+    long *latencies = malloc(clients * sizeof(long));
+    int connected = 0;
+    session_result result;
+    while (latencies != NULL && read(resultPipe[0], &result, sizeof(result)) == sizeof(result)) {
+        if (result.ok) {
+            latencies[connected++] = result.latencyNs;
+        }
+    }
+    double seconds = (now_ns() - start) / 1e9;
+    while (wait(NULL) > 0) {
+    }
+    close(resultPipe[0]);
+
+    qsort(latencies, connected, sizeof(long), compare_long);
+    printf("%d/%d clients connected in %.3f s, %.1f connections/s\n",
+           connected, clients, seconds, seconds > 0 ? connected / seconds : 0.0);
+    printf("setup latency p50 %.3f ms  p99 %.3f ms  p999 %.3f ms\n",
+           percentile(latencies, connected, 50) / 1e6,
+           percentile(latencies, connected, 99) / 1e6,
+           percentile(latencies, connected, 99.9) / 1e6);
+    free(latencies);
+    return 0;
+}
+
+// Write the whole buffer, FIFO writes may be partial for large payloads
+static int write_full(int fd, const void *buf, size_t len) {
+    const char *src = buf;
+    while (len > 0) {
+        ssize_t written = write(fd, src, len);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        src += written;
+        len -= written;
+    }
+    return 0;
+}
+
+// Send a request the way client.c does: open, write, close
+static int send_request(const char *fifo, const char *request, size_t len) {
+    int fd = open(fifo, O_WRONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    int result = write_full(fd, request, len);
+    close(fd);
+    return result;
+}
+
+// Read the server's answer until it closes its end, returns the byte count or -1
+static long read_response(const char *fifo) {
+    int fd = open(fifo, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    char buffer[65536];
+    long total = 0;
+    ssize_t got;
+    while ((got = read(fd, buffer, sizeof(buffer))) > 0) {
+        total += got;
+    }
+    close(fd);
+    return got == -1 ? -1 : total;
+}
+
+// Upload from memory: request with its NUL, the size, then the data on the same open
+static int session_upload(const char *fifo, const char *name, const char *data, size_t size) {
+    int fd = open(fifo, O_WRONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    char request[256];
+    int len = snprintf(request, sizeof(request), "upload %s", name);
+    int result = write_full(fd, request, len + 1);
+    if (result == 0) {
+        result = write_full(fd, &size, sizeof(size));
+    }
+    if (result == 0) {
+        result = write_full(fd, data, size);
+    }
+    close(fd);
+    if (result == 0 && read_response(fifo) == -1) {
+        result = -1;
+    }
+    return result;
+}
+
+static int run_command(int command, const char *fifo, const char *ownFile, int seq, const char *data, size_t size) {
+    char request[256];
+    int len;
+    switch (command) {
+    case CMD_LIST:
+        len = snprintf(request, sizeof(request), "list");
+        break;
+    case CMD_READF:
+        len = snprintf(request, sizeof(request), "readF %s", ownFile);
+        break;
+    case CMD_WRITET:
+        len = snprintf(request, sizeof(request), "writeT %s -1 load line %d from %d",
+                       sharedAppendFile != NULL ? sharedAppendFile : ownFile, seq, getpid());
+        break;
+    case CMD_UPLOAD: {
+        char name[64];
+        snprintf(name, sizeof(name), "lg_%d_%d.dat", getpid(), seq);
+        return session_upload(fifo, name, data, size);
+    }
+    default:
+        len = snprintf(request, sizeof(request), "download %s", ownFile);
+        break;
+    }
+    if (send_request(fifo, request, len) == -1) {
+        return -1;
+    }
+    return read_response(fifo) == -1 ? -1 : 0;
+}
+
+// Parse "list=1,readF=4,..." into weights, returns the sum of the weights
+static int parse_mix(const char *mix, int weights[CMD_COUNT]) {
+    char copy[256];
+    snprintf(copy, sizeof(copy), "%s", mix);
+    memset(weights, 0, CMD_COUNT * sizeof(int));
+    int total = 0;
+    for (char *item = strtok(copy, ","); item != NULL; item = strtok(NULL, ",")) {
+        char *eq = strchr(item, '=');
+        if (eq == NULL) {
+            return -1;
+        }
+        *eq = '\0';
+        int command = -1;
+        for (int i = 0; i < CMD_COUNT; i++) {
+            if (strcmp(item, commandNames[i]) == 0) {
+                command = i;
+            }
+        }
+        if (command == -1 || atoi(eq + 1) < 0) {
+            return -1;
+        }
+        weights[command] = atoi(eq + 1);
+        total += weights[command];
+    }
+    return total;
+}
+
+// One client session: connect, upload a working file, run ops random commands, quit
+static void run_session(pid_t serverPid, int ops, const int weights[CMD_COUNT], int totalWeight,
+                        size_t uploadBytes, int resultFd) {
+    char fifo[64];
+    char ownFile[64];
+    snprintf(ownFile, sizeof(ownFile), "lg_%d.txt", getpid());
+    if (session_connect(serverPid, CONNECT_WAIT, fifo, sizeof(fifo)) == -1) {
+        op_result result = { CMD_LIST, 0, 0 };
+        write(resultFd, &result, sizeof(result));
+        return;
+    }
+
+    char *data = malloc(uploadBytes);
+    if (data == NULL) {
+        session_quit(fifo);
+        return;
+    }
+    for (size_t i = 0; i < uploadBytes; i++) {
+        data[i] = 'a' + i % 26;
+        if (i % 64 == 63) {
+            data[i] = '\n';
+        }
+    }
+
+    unsigned int seed = getpid() ^ (unsigned int)now_ns();
+    session_upload(fifo, ownFile, data, uploadBytes);
+    for (int i = 0; i < ops; i++) {
+        int pick = rand_r(&seed) % totalWeight;
+        int command = 0;
+        while (pick >= weights[command]) {
+            pick -= weights[command];
+            command++;
+        }
+        op_result result;
+        long start = now_ns();
+        result.ok = run_command(command, fifo, ownFile, i, data, uploadBytes) == 0;
+        result.latencyNs = now_ns() - start;
+        result.command = command;
+        write(resultFd, &result, sizeof(result));
+    }
+    free(data);
+    session_quit(fifo);
+}
+
+static int bench_run(pid_t serverPid, int sessions, int ops, const char *mix, size_t uploadBytes) {
+    int weights[CMD_COUNT];
+    int totalWeight = parse_mix(mix, weights);
+    if (totalWeight <= 0) {
+        fprintf(stderr, "Invalid mix: %s\n", mix);
+        return -1;
+    }
+
+    int startPipe[2];
+    int resultPipe[2];
+    if (pipe(startPipe) == -1 || pipe(resultPipe) == -1) {
+        perror("pipe failed");
+        return -1;
+    }
+    for (int i = 0; i < sessions; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork failed");
+            sessions = i;
+            break;
+        }
+        if (pid == 0) {
+            close(startPipe[1]);
+            close(resultPipe[0]);
+            char go;
+            read(startPipe[0], &go, 1);
+            run_session(serverPid, ops, weights, totalWeight, uploadBytes, resultPipe[1]);
+            _exit(0);
+        }
+    }
+    close(startPipe[0]);
+    close(resultPipe[1]);
+
+    long start = now_ns();
+    close(startPipe[1]);
+
+    size_t capacity = (size_t)sessions * ops + 1;
+    long *latencies[CMD_COUNT];
+    size_t counts[CMD_COUNT] = {0};
+    size_t failures = 0;
+    for (int i = 0; i < CMD_COUNT; i++) {
+        latencies[i] = malloc(capacity * sizeof(long));
+    }
+    op_result result;
+    while (read(resultPipe[0], &result, sizeof(result)) == sizeof(result)) {
+        if (!result.ok) {
+            failures++;
+        }
+        else if (latencies[result.command] != NULL && counts[result.command] < capacity) {
+            latencies[result.command][counts[result.command]++] = result.latencyNs;
+        }
+    }
+    double seconds = (now_ns() - start) / 1e9;
+    while (wait(NULL) > 0) {
+    }
+    close(resultPipe[0]);
+
+    size_t total = 0;
+    printf("%d sessions x %d ops, mix %s, upload %zu bytes\n", sessions, ops, mix, uploadBytes);
+    printf("%-10s %8s %10s %10s %10s %10s\n", "command", "ops", "ops/s", "p50 ms", "p99 ms", "p999 ms");
+    for (int i = 0; i < CMD_COUNT; i++) {
+        if (counts[i] == 0) {
+            free(latencies[i]);
+            continue;
+        }
+        qsort(latencies[i], counts[i], sizeof(long), compare_long);
+        printf("%-10s %8zu %10.1f %10.3f %10.3f %10.3f\n", commandNames[i], counts[i], counts[i] / seconds,
+               percentile(latencies[i], counts[i], 50) / 1e6,
+               percentile(latencies[i], counts[i], 99) / 1e6,
+               percentile(latencies[i], counts[i], 99.9) / 1e6);
+        total += counts[i];
+        free(latencies[i]);
+    }
+    printf("total      %8zu %10.1f ops/s in %.3f s, %zu failed\n", total, total / seconds, seconds, failures);
+    return 0;
+}
+
+// Line edits on one large file, grouped by where in the file they land
+static int bench_edit(pid_t serverPid, size_t fileBytes, int edits) {
+    char fifo[64];
+    char file[64];
+    snprintf(file, sizeof(file), "lg_edit_%d.txt", getpid());
+    if (session_connect(serverPid, CONNECT_WAIT, fifo, sizeof(fifo)) == -1) {
+        fprintf(stderr, "connect failed\n");
+        return -1;
+    }
+
+    // 64 byte lines, so line numbers translate directly into offsets
+    size_t lines = fileBytes / 64 > 0 ? fileBytes / 64 : 1;
+    char *data = malloc(lines * 64);
+    long *latencies = malloc((edits > 0 ? edits : 1) * sizeof(long));
+    if (data == NULL || latencies == NULL) {
+        free(data);
+        free(latencies);
+        session_quit(fifo);
+        return -1;
+    }
+    for (size_t i = 0; i < lines * 64; i++) {
+        data[i] = i % 64 == 63 ? '\n' : 'a' + i % 26;
+    }
+    if (session_upload(fifo, file, data, lines * 64) == -1) {
+        fprintf(stderr, "upload failed\n");
+        free(data);
+        free(latencies);
+        session_quit(fifo);
+        return -1;
+    }
+    free(data);
+
+    static const char *regions[] = { "head", "middle", "tail" };
+    unsigned int seed = getpid();
+    printf("%d edits per region on a %zu byte file (%zu lines), half inserts, half replacements\n",
+           edits, lines * 64, lines);
+    printf("%-8s %8s %10s %10s %10s %12s\n", "region", "edits", "edits/s", "p50 ms", "p99 ms", "tail KB");
+    size_t failures = 0;
+    for (int region = 0; region < 3; region++) {
+        // Lines within the first, middle or last 1% of the file
+        size_t span = lines / 100 > 0 ? lines / 100 : 1;
+        size_t first = region == 0 ? 1 : region == 1 ? lines / 2 : lines - span + 1;
+        double tailBytes = 0;
+        long start = now_ns();
+        for (int i = 0; i < edits; i++) {
+            size_t line = first + rand_r(&seed) % span;
+            char request[256];
+            int len = snprintf(request, sizeof(request), "writeT %s%s %zu edit %d of %s", i % 2 ? "-r " : "",
+                               file, line, i, regions[region]);
+            long opStart = now_ns();
+            // writeT only answers when something went wrong
+            if (send_request(fifo, request, len) == -1 || read_response(fifo) != 0) {
+                failures++;
+            }
+            latencies[i] = now_ns() - opStart;
+            tailBytes += (double)(lines - line + 1) * 64;
+        }
+        double seconds = (now_ns() - start) / 1e9;
+        qsort(latencies, edits, sizeof(long), compare_long);
+        printf("%-8s %8d %10.1f %10.3f %10.3f %12.1f\n", regions[region], edits, edits / seconds,
+               percentile(latencies, edits, 50) / 1e6, percentile(latencies, edits, 99) / 1e6,
+               tailBytes / edits / 1024);
+    }
+    printf("%zu failed\n", failures);
+    free(latencies);
+    session_quit(fifo);
+    return 0;
+}
+
+// Switch the session's data plane, returns 1 when the server accepted the ring
+static int transfer_mode(const char *fifo, shm_ring **ring, int shm) {
+    if (shm && *ring == NULL) {
+        *ring = shm_ring_create(getpid());
+        if (*ring == NULL) {
+            return 0;
+        }
+    }
+    const char *request = shm ? "transport shm" : "transport fifo";
+    char answer[64] = "";
+    if (send_request(fifo, request, strlen(request)) == 0) {
+        int fd = open(fifo, O_RDONLY);
+        if (fd != -1) {
+            size_t used = 0;
+            ssize_t got;
+            while (used < sizeof(answer) - 1 && (got = read(fd, answer + used, sizeof(answer) - 1 - used)) > 0) {
+                used += got;
+            }
+            close(fd);
+        }
+    }
+    int accepted = shm && strcmp(answer, "transport shm\n") == 0;
+    if (!accepted && *ring != NULL) {
+        shm_ring_close(*ring);
+        shm_ring_destroy(getpid());  // Kept while accepted, a replacement worker maps it by name
+        *ring = NULL;
+    }
+    return accepted;
+}
+
+// Upload from memory through the ring: request and size on the FIFO, the data in the ring
+static int transfer_upload(const char *fifo, shm_ring *ring, pid_t serverPid, const char *name,
+                           const char *data, size_t size) {
+    if (ring == NULL) {
+        return session_upload(fifo, name, data, size);
+    }
+    int fd = open(fifo, O_WRONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    char request[256];
+    int len = snprintf(request, sizeof(request), "upload %s", name);
+    int result = write_full(fd, request, len + 1);
+    if (result == 0) {
+        result = write_full(fd, &size, sizeof(size));
+    }
+    close(fd);
+    if (result == 0) {
+        result = shm_ring_write(ring, data, size, serverPid);
+        shm_ring_finish(ring);
+    }
+    if (result == 0 && read_response(fifo) == -1) {
+        result = -1;
+    }
+    return result;
+}
+
+// Download a whole file and throw the data away, returns the bytes received or -1
+static long transfer_download(const char *fifo, shm_ring *ring, pid_t serverPid, const char *name) {
+    char request[256];
+    int len = snprintf(request, sizeof(request), "download %s", name);
+    if (send_request(fifo, request, len) == -1) {
+        return -1;
+    }
+    int fd = open(fifo, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    range_header header;
+    size_t got = 0;
+    ssize_t bytes;
+    while (got < sizeof(header) && (bytes = read(fd, (char *)&header + got, sizeof(header) - got)) > 0) {
+        got += bytes;
+    }
+    if (got < sizeof(header) || header.fileSize == -1) {
+        close(fd);
+        return -1;
+    }
+    long total = 0;
+    if (ring != NULL) {
+        const void *area;
+        while ((bytes = shm_ring_peek(ring, &area, serverPid)) > 0) {
+            total += bytes;
+            shm_ring_consume(ring, bytes);
+        }
+    } else {
+        static char buffer[TRANSFER_CHUNK];
+        while ((bytes = read(fd, buffer, sizeof(buffer))) > 0) {
+            total += bytes;
+        }
+    }
+    close(fd);
+    return bytes == -1 ? -1 : total;
+}
+
+// The same uploads and downloads once with the data on the FIFO and once through the ring
+static int bench_transfer(pid_t serverPid, size_t bytes, int rounds) {
+    char fifo[64];
+    if (session_connect(serverPid, CONNECT_WAIT, fifo, sizeof(fifo)) == -1) {
+        fprintf(stderr, "connect failed\n");
+        return -1;
+    }
+    char *data = malloc(bytes > 0 ? bytes : 1);
+    if (data == NULL) {
+        session_quit(fifo);
+        return -1;
+    }
+    for (size_t i = 0; i < bytes; i++) {
+        data[i] = (char)(i * 2654435761u >> 13);
+    }
+
+    static const char *modes[] = { "fifo", "shm" };
+    shm_ring *ring = NULL;
+    size_t failures = 0;
+    printf("%d rounds of %zu bytes\n", rounds, bytes);
+    printf("%-6s %14s %14s\n", "data", "upload GB/s", "download GB/s");
+    for (int mode = 0; mode < 2; mode++) {
+        if (transfer_mode(fifo, &ring, mode) != mode) {
+            fprintf(stderr, "server refused transport %s\n", modes[mode]);
+            failures++;
+            continue;
+        }
+        char name[64];
+        long start = now_ns();
+        for (int i = 0; i < rounds; i++) {
+            snprintf(name, sizeof(name), "lg_xfer_%d_%s_%d.dat", getpid(), modes[mode], i);
+            if (transfer_upload(fifo, ring, serverPid, name, data, bytes) == -1) {
+                failures++;
+            }
+        }
+        double uploadSeconds = (now_ns() - start) / 1e9;
+        start = now_ns();
+        for (int i = 0; i < rounds; i++) {
+            snprintf(name, sizeof(name), "lg_xfer_%d_%s_%d.dat", getpid(), modes[mode], i);
+            if (transfer_download(fifo, ring, serverPid, name) != (long)bytes) {
+                failures++;
+            }
+        }
+        double downloadSeconds = (now_ns() - start) / 1e9;
+        double total = (double)bytes * rounds / 1e9;
+        printf("%-6s %14.3f %14.3f\n", modes[mode], total / uploadSeconds, total / downloadSeconds);
+    }
+    printf("%zu failed\n", failures);
+    free(data);
+    if (ring != NULL) {
+        shm_ring_close(ring);
+    }
+    session_quit(fifo);
+    shm_ring_destroy(getpid());
+    return 0;
+}
+
+// Read exactly len bytes unless the writer closes first, returns the bytes read or -1
+static ssize_t read_full(int fd, void *buf, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t bytes = read(fd, (char *)buf + got, len - got);
+        if (bytes <= 0) {
+            return bytes == -1 ? -1 : (ssize_t)got;
+        }
+        got += bytes;
+    }
+    return got;
+}
+
+// Download a whole file over the FIFO as compressed frames and decode it, returns the decoded bytes or -1
+static long compressed_download(const char *fifo, const char *name) {
+    char request[256];
+    int len = snprintf(request, sizeof(request), "download %s", name);
+    if (send_request(fifo, request, len) == -1) {
+        return -1;
+    }
+    int fd = open(fifo, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    static char payload[CHUNK_RAW_MAX];
+    static char raw[CHUNK_RAW_MAX];
+    range_header header;
+    long total = -1;
+    if (read_full(fd, &header, sizeof(header)) == sizeof(header) && header.fileSize != -1) {
+        total = 0;
+        chunk_frame frame;
+        while (total < header.length && read_full(fd, &frame, sizeof(frame)) == sizeof(frame)) {
+            ssize_t rawLen = -1;
+            if (frame.storedLen <= CHUNK_RAW_MAX && read_full(fd, payload, frame.storedLen) == frame.storedLen) {
+                rawLen = chunk_decode(&frame, payload, raw);
+            }
+            if (rawLen == -1) {
+                total = -1;
+                break;
+            }
+            total += rawLen;
+        }
+    }
+    close(fd);
+    return total;
+}
+
+// Answer to "compress <mode>", 1 when the server now compresses
+static int compress_mode(const char *fifo, const char *mode) {
+    char request[64];
+    int len = snprintf(request, sizeof(request), "compress %s", mode);
+    char answer[64] = "";
+    if (send_request(fifo, request, len) == 0) {
+        int fd = open(fifo, O_RDONLY);
+        if (fd != -1) {
+            ssize_t got = read_full(fd, answer, sizeof(answer) - 1);
+            answer[got > 0 ? got : 0] = '\0';
+            close(fd);
+        }
+    }
+    return strcmp(answer, "compress lz\n") == 0;
+}
+
+static double cpu_seconds(const struct rusage *usage) {
+    return usage->ru_utime.tv_sec + usage->ru_stime.tv_sec + (usage->ru_utime.tv_usec + usage->ru_stime.tv_usec) / 1e6;
+}
+
+// CPU time of the server's workers so far, from /proc, -1 when it cannot be read
+static double server_worker_seconds(pid_t serverPid) {
+    char path[128];
+    snprintf(path, sizeof(path), "/proc/%d/task/%d/children", serverPid, serverPid);
+    FILE *children = fopen(path, "r");
+    if (children == NULL) {
+        return -1;
+    }
+    double seconds = 0;
+    int worker;
+    while (fscanf(children, "%d", &worker) == 1) {
+        snprintf(path, sizeof(path), "/proc/%d/stat", worker);
+        FILE *stat = fopen(path, "r");
+        if (stat == NULL) {
+            continue;
+        }
+        unsigned long utime = 0;
+        unsigned long stime = 0;
+        // Fields 14 and 15, after the command name in parentheses
+        if (fscanf(stat, "%*d (%*[^)]) %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) == 2) {
+            seconds += (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+        }
+        fclose(stat);
+    }
+    fclose(children);
+    return seconds;
+}
+
+// Log like text: numbered lines of words from a small vocabulary
+static void fill_text(char *data, size_t size) {
+    static const char *words[] = { "the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog", "server", "client",
+                                   "file", "transfer", "request", "upload", "download", "chunk" };
+    unsigned int seed = 1;
+    size_t used = 0;
+    long line = 0;
+    while (used < size) {
+        char text[256];
+        int len = snprintf(text, sizeof(text), "%ld", line++);
+        for (int i = 0; i < 10; i++) {
+            len += snprintf(text + len, sizeof(text) - len, " %s", words[rand_r(&seed) % 16]);
+        }
+        text[len++] = '\n';
+        size_t chunk = size - used < (size_t)len ? size - used : (size_t)len;
+        memcpy(data + used, text, chunk);
+        used += chunk;
+    }
+}
+
+// Codec speed on this core, then what compression does to downloads of text and of random data
+static int bench_compress(pid_t serverPid, size_t bytes, int rounds) {
+    static const char *kinds[] = { "text", "random" };
+    char *data[2];
+    data[0] = malloc(bytes > 0 ? bytes : 1);
+    data[1] = malloc(bytes > 0 ? bytes : 1);
+    char *frame = malloc(CHUNK_FRAME_MAX);
+    char *raw = malloc(CHUNK_RAW_MAX);
+    if (data[0] == NULL || data[1] == NULL || frame == NULL || raw == NULL) {
+        free(data[0]);
+        free(data[1]);
+        free(frame);
+        free(raw);
+        return -1;
+    }
+    fill_text(data[0], bytes);
+    unsigned int seed = getpid();
+    for (size_t i = 0; i < bytes; i++) {
+        data[1][i] = (char)rand_r(&seed);
+    }
+
+    printf("%-8s %8s %14s %16s\n", "codec", "ratio", "encode MB/s", "decode MB/s");
+    for (int kind = 0; kind < 2; kind++) {
+        chunk_encoder encoder = {0};
+        long start = now_ns();
+        for (size_t off = 0; off < bytes; off += CHUNK_RAW_MAX) {
+            size_t len = bytes - off < CHUNK_RAW_MAX ? bytes - off : CHUNK_RAW_MAX;
+            chunk_encode(&encoder, data[kind] + off, len, frame);
+        }
+        double encodeSeconds = (now_ns() - start) / 1e9;
+        // Decode one frame of each 64 KB of the data again and again, raw frames are a plain copy
+        size_t len = bytes < CHUNK_RAW_MAX ? bytes : CHUNK_RAW_MAX;
+        chunk_encoder fresh = {0};
+        chunk_encode(&fresh, data[kind], len, frame);
+        start = now_ns();
+        for (size_t off = 0; off < bytes; off += CHUNK_RAW_MAX) {
+            chunk_decode((chunk_frame *)frame, frame + sizeof(chunk_frame), raw);
+        }
+        double decodeSeconds = (now_ns() - start) / 1e9;
+        printf("%-8s %7.1f%% %14.0f %16.0f\n", kinds[kind], 100.0 * encoder.storedBytes / (encoder.rawBytes ? encoder.rawBytes : 1),
+               bytes / 1e6 / encodeSeconds, decodeSeconds > 0 ? bytes / 1e6 / decodeSeconds : 0.0);
+    }
+    free(frame);
+    free(raw);
+
+    char fifo[64];
+    if (session_connect(serverPid, CONNECT_WAIT, fifo, sizeof(fifo)) == -1) {
+        fprintf(stderr, "connect failed\n");
+        free(data[0]);
+        free(data[1]);
+        return -1;
+    }
+    char names[2][64];
+    size_t failures = 0;
+    for (int kind = 0; kind < 2; kind++) {
+        snprintf(names[kind], sizeof(names[kind]), "lg_compress_%d_%s.dat", getpid(), kinds[kind]);
+        if (session_upload(fifo, names[kind], data[kind], bytes) == -1) {
+            failures++;
+        }
+    }
+    free(data[0]);
+    free(data[1]);
+
+    printf("\n%d downloads of %zu bytes over the FIFO\n", rounds, bytes);
+    printf("%-8s %-6s %14s %16s %16s\n", "data", "mode", "GB/s", "client CPU s/GB", "server CPU s/GB");
+    for (int kind = 0; kind < 2; kind++) {
+        for (int compressed = 0; compressed < 2; compressed++) {
+            if (compress_mode(fifo, compressed ? "lz" : "off") != compressed) {
+                fprintf(stderr, "server refused compress %s\n", compressed ? "lz" : "off");
+                failures++;
+                continue;
+            }
+            struct rusage before;
+            struct rusage after;
+            getrusage(RUSAGE_SELF, &before);
+            double serverBefore = server_worker_seconds(serverPid);
+            long start = now_ns();
+            for (int i = 0; i < rounds; i++) {
+                long got = compressed ? compressed_download(fifo, names[kind]) : transfer_download(fifo, NULL, serverPid, names[kind]);
+                if (got != (long)bytes) {
+                    failures++;
+                }
+            }
+            double seconds = (now_ns() - start) / 1e9;
+            getrusage(RUSAGE_SELF, &after);
+            double serverAfter = server_worker_seconds(serverPid);
+            double gigabytes = (double)bytes * rounds / 1e9;
+            printf("%-8s %-6s %14.3f %16.3f", kinds[kind], compressed ? "lz" : "raw", gigabytes / seconds,
+                   (cpu_seconds(&after) - cpu_seconds(&before)) / gigabytes);
+            if (serverBefore >= 0 && serverAfter >= 0) {
+                printf(" %16.3f\n", (serverAfter - serverBefore) / gigabytes);
+            }
+            else {
+                printf(" %16s\n", "n/a");
+            }
+        }
+    }
+    compress_mode(fifo, "off");
+    printf("%zu failed\n", failures);
+    session_quit(fifo);
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s connect <ServerPID> <clients>\n", prog);
+    fprintf(stderr, "       %s run <ServerPID> [-c sessions] [-n ops] [-m mix] [-s uploadBytes] [-f appendFile]\n", prog);
+    fprintf(stderr, "       mix defaults to list=1,readF=4,writeT=2,upload=1,download=2\n");
+    fprintf(stderr, "       %s edit <ServerPID> [-s fileBytes] [-n edits]\n", prog);
+    fprintf(stderr, "       %s transfer <ServerPID> [-s bytes] [-n rounds]\n", prog);
+    fprintf(stderr, "       %s compress <ServerPID> [-s bytes] [-n rounds]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (strcmp(argv[1], "connect") == 0 && argc == 4) {
+        pid_t serverPid = atoi(argv[2]);
+        int clients = atoi(argv[3]);
+        if (kill(serverPid, 0) == -1 || clients <= 0) {
+            fprintf(stderr, "Server with PID %d is not running or client count is invalid\n", serverPid);
+            exit(EXIT_FAILURE);
+        }
+        return bench_connect(serverPid, clients) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (strcmp(argv[1], "run") == 0 && argc >= 3) {
+        pid_t serverPid = atoi(argv[2]);
+        int sessions = 10;
+        int ops = 100;
+        const char *mix = "list=1,readF=4,writeT=2,upload=1,download=2";
+        size_t uploadBytes = 4096;
+        int opt;
+        optind = 3;
+        while ((opt = getopt(argc, argv, "c:n:m:s:f:")) != -1) {
+            switch (opt) {
+            case 'c': sessions = atoi(optarg); break;
+            case 'n': ops = atoi(optarg); break;
+            case 'm': mix = optarg; break;
+            case 's': uploadBytes = strtoul(optarg, NULL, 10); break;
+            case 'f': sharedAppendFile = optarg; break;
+            default: usage(argv[0]); exit(EXIT_FAILURE);
+            }
+        }
+        if (kill(serverPid, 0) == -1 || sessions <= 0 || ops <= 0) {
+            fprintf(stderr, "Server with PID %d is not running or session/op count is invalid\n", serverPid);
+            exit(EXIT_FAILURE);
+        }
+        // An upload of an existing name closes the FIFO under us, count it as a failure instead of dying
+        signal(SIGPIPE, SIG_IGN);
+        return bench_run(serverPid, sessions, ops, mix, uploadBytes) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (strcmp(argv[1], "edit") == 0 && argc >= 3) {
+        pid_t serverPid = atoi(argv[2]);
+        size_t fileBytes = 64 * 1024 * 1024;
+        int edits = 50;
+        int opt;
+        optind = 3;
+        while ((opt = getopt(argc, argv, "s:n:")) != -1) {
+            switch (opt) {
+            case 's': fileBytes = strtoul(optarg, NULL, 10); break;
+            case 'n': edits = atoi(optarg); break;
+            default: usage(argv[0]); exit(EXIT_FAILURE);
+            }
+        }
+        if (kill(serverPid, 0) == -1 || edits <= 0) {
+            fprintf(stderr, "Server with PID %d is not running or edit count is invalid\n", serverPid);
+            exit(EXIT_FAILURE);
+        }
+        signal(SIGPIPE, SIG_IGN);
+        return bench_edit(serverPid, fileBytes, edits) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (strcmp(argv[1], "transfer") == 0 && argc >= 3) {
+        pid_t serverPid = atoi(argv[2]);
+        size_t bytes = 64 * 1024 * 1024;
+        int rounds = 8;
+        int opt;
+        optind = 3;
+        while ((opt = getopt(argc, argv, "s:n:")) != -1) {
+            switch (opt) {
+            case 's': bytes = strtoul(optarg, NULL, 10); break;
+            case 'n': rounds = atoi(optarg); break;
+            default: usage(argv[0]); exit(EXIT_FAILURE);
+            }
+        }
+        if (kill(serverPid, 0) == -1 || rounds <= 0) {
+            fprintf(stderr, "Server with PID %d is not running or round count is invalid\n", serverPid);
+            exit(EXIT_FAILURE);
+        }
+        signal(SIGPIPE, SIG_IGN);
+        return bench_transfer(serverPid, bytes, rounds) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (strcmp(argv[1], "compress") == 0 && argc >= 3) {
+        pid_t serverPid = atoi(argv[2]);
+        size_t bytes = 32 * 1024 * 1024;
+        int rounds = 8;
+        int opt;
+        optind = 3;
+        while ((opt = getopt(argc, argv, "s:n:")) != -1) {
+            switch (opt) {
+            case 's': bytes = strtoul(optarg, NULL, 10); break;
+            case 'n': rounds = atoi(optarg); break;
+            default: usage(argv[0]); exit(EXIT_FAILURE);
+            }
+        }
+        if (kill(serverPid, 0) == -1 || rounds <= 0) {
+            fprintf(stderr, "Server with PID %d is not running or round count is invalid\n", serverPid);
+            exit(EXIT_FAILURE);
+        }
+        signal(SIGPIPE, SIG_IGN);
+        return bench_compress(serverPid, bytes, rounds) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+}
@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "protocol.h"
+
+// LZ4 style block codec for compressed transfers, see protocol.h. A block is a run of sequences:
+// a token (high nibble literal count, low nibble match length - 4, 15 means more length bytes
+// follow, each adding up to 255), the literals, a 2 byte little endian match offset and the extra
+// match length bytes. The last sequence has literals only.
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_LAST_LITERALS 5  // A block always ends in at least this many literals
+#define LZ_MATCH_LIMIT 12   // No match starts within this many bytes of the end
+#define LZ_MAX_SKIP 64      // Chunks stored raw without a try after a run of incompressible ones
+
+static uint32_t lz_read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t lz_read64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Copy in 8 byte steps, may write up to 7 bytes past dst + len
+static void lz_wild_copy(unsigned char *dst, const unsigned char *src, size_t len) {
+    unsigned char *end = dst + len;
+    do {
+        memcpy(dst, src, 8);
+        dst += 8;
+        src += 8;
+    } while (dst < end);
+}
+
+// Length of the common prefix of a and b, a stops at end
+static size_t lz_common(const unsigned char *a, const unsigned char *b, const unsigned char *end) {
+    const unsigned char *start = a;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (a + 8 <= end) {
+        uint64_t diff = lz_read64(a) ^ lz_read64(b);
+        if (diff != 0) {
+            return a - start + (__builtin_ctzll(diff) >> 3);
+        }
+        a += 8;
+        b += 8;
+    }
+#endif
+    while (a < end && *a == *b) {
+        a++;
+        b++;
+    }
+    return a - start;
+}
+
+static uint32_t lz_hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Lengths past 15 continue in bytes of up to 255
+static unsigned char *lz_put_length(unsigned char *out, const unsigned char *outEnd, size_t length) {
+    while (length >= 255) {
+        if (out >= outEnd) {
+            return NULL;
+        }
+        *out++ = 255;
+        length -= 255;
+    }
+    if (out >= outEnd) {
+        return NULL;
+    }
+    *out++ = (unsigned char)length;
+    return out;
+}
+
+static unsigned char *lz_put_sequence(unsigned char *out, const unsigned char *outEnd, const unsigned char *literals,
+                                      size_t literalCount, size_t offset, size_t matchLength) {
+    if (out >= outEnd) {
+        return NULL;
+    }
+    unsigned char *token = out++;
+    *token = (unsigned char)((literalCount < 15 ? literalCount : 15) << 4);
+    if (literalCount >= 15 && (out = lz_put_length(out, outEnd, literalCount - 15)) == NULL) {
+        return NULL;
+    }
+    if ((size_t)(outEnd - out) < literalCount) {
+        return NULL;
+    }
+    memcpy(out, literals, literalCount);
+    out += literalCount;
+    if (matchLength == 0) {
+        return out;
+    }
+    if (outEnd - out < 2) {
+        return NULL;
+    }
+    *out++ = (unsigned char)(offset & 0xff);
+    *out++ = (unsigned char)(offset >> 8);
+    matchLength -= LZ_MIN_MATCH;
+    *token |= (unsigned char)(matchLength < 15 ? matchLength : 15);
+    if (matchLength >= 15 && (out = lz_put_length(out, outEnd, matchLength - 15)) == NULL) {
+        return NULL;
+    }
+    return out;
+}
+
+// Compress len bytes (at most 64 KB) into at most capacity bytes, returns 0 when they do not fit.
+// Like LZ4 the search steps faster the longer it goes without a match, so data that does not
+// compress is given up on cheaply.
+size_t chunk_compress(const void *source, size_t len, void *destination, size_t capacity) {
+    const unsigned char *src = source;
+    unsigned char *out = destination;
+    const unsigned char *outEnd = out + capacity;
+    const unsigned char *anchor = src;
+    uint32_t table[1 << LZ_HASH_BITS];
+
+    if (len > LZ_MATCH_LIMIT) {
+        memset(table, 0, sizeof(table));
+        const unsigned char *limit = src + len - LZ_MATCH_LIMIT;
+        const unsigned char *matchEnd = src + len - LZ_LAST_LITERALS;
+        const unsigned char *ip = src + 1;
+        unsigned misses = 1 << 6;
+        while (ip < limit) {
+            uint32_t sequence = lz_read32(ip);
+            uint32_t h = lz_hash(sequence);
+            const unsigned char *candidate = src + table[h];
+            table[h] = (uint32_t)(ip - src);
+            if (candidate >= ip || ip - candidate > 0xffff || lz_read32(candidate) != sequence) {
+                ip += misses++ >> 6;
+                continue;
+            }
+            misses = 1 << 6;
+            // Extend backwards over literals, then forwards up to the end limit
+            while (ip > anchor && candidate > src && ip[-1] == candidate[-1]) {
+                ip--;
+                candidate--;
+            }
+            const unsigned char *matchStart = ip;
+            size_t extra = lz_common(ip + LZ_MIN_MATCH, candidate + LZ_MIN_MATCH, matchEnd);
+            ip += LZ_MIN_MATCH + extra;
+            candidate += LZ_MIN_MATCH + extra;
+            out = lz_put_sequence(out, outEnd, anchor, matchStart - anchor, ip - candidate, ip - matchStart);
+            if (out == NULL) {
+                return 0;
+            }
+            anchor = ip;
+            if (ip < limit) {
+                table[lz_hash(lz_read32(ip - 2))] = (uint32_t)(ip - 2 - src);
+            }
+        }
+    }
+    out = lz_put_sequence(out, outEnd, anchor, src + len - anchor, 0, 0);
+    return out == NULL ? 0 : (size_t)(out - (unsigned char *)destination);
+}
+
+// Returns the decompressed length, or -1 when the block is corrupt or does not fit capacity
+ssize_t chunk_decompress(const void *source, size_t len, void *destination, size_t capacity) {
+    const unsigned char *in = source;
+    const unsigned char *inEnd = in + len;
+    unsigned char *out = destination;
+    unsigned char *outEnd = out + capacity;
+
+    while (in < inEnd) {
+        unsigned token = *in++;
+        size_t literalCount = token >> 4;
+        // Short literals and a short match far from both ends: fixed size copies, no length bytes
+        if (literalCount < 15 && (token & 15) < 15 && inEnd - in >= 16 + 2 && outEnd - out >= 16 + 24) {
+            memcpy(out, in, 16);
+            out += literalCount;
+            in += literalCount;
+            size_t offset = in[0] | (size_t)in[1] << 8;
+            in += 2;
+            size_t matchLength = (token & 15) + LZ_MIN_MATCH;
+            if (offset == 0 || offset > (size_t)(out - (unsigned char *)destination)) {
+                return -1;
+            }
+            const unsigned char *match = out - offset;
+            if (offset >= 8) {
+                memcpy(out, match, 8);
+                memcpy(out + 8, match + 8, 8);
+                memcpy(out + 16, match + 16, 8);
+            }
+            else {
+                for (size_t i = 0; i < matchLength; i++) {
+                    out[i] = match[i];
+                }
+            }
+            out += matchLength;
+            continue;
+        }
+        if (literalCount == 15) {
+            unsigned char more;
+            do {
+                if (in >= inEnd) {
+                    return -1;
+                }
+                more = *in++;
+                literalCount += more;
+            } while (more == 255);
+        }
+        if ((size_t)(inEnd - in) < literalCount || (size_t)(outEnd - out) < literalCount) {
+            return -1;
+        }
+        if ((size_t)(inEnd - in) >= literalCount + 8 && (size_t)(outEnd - out) >= literalCount + 8) {
+            lz_wild_copy(out, in, literalCount);
+        }
+        else {
+            memcpy(out, in, literalCount);
+        }
+        in += literalCount;
+        out += literalCount;
+        if (in == inEnd) {
+            break; // Last sequence
+        }
+
+        if (inEnd - in < 2) {
+            return -1;
+        }
+        size_t offset = in[0] | (size_t)in[1] << 8;
+        in += 2;
+        size_t matchLength = token & 15;
+        if (matchLength == 15) {
+            unsigned char more;
+            do {
+                if (in >= inEnd) {
+                    return -1;
+                }
+                more = *in++;
+                matchLength += more;
+            } while (more == 255);
+        }
+        matchLength += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(out - (unsigned char *)destination) ||
+            (size_t)(outEnd - out) < matchLength) {
+            return -1;
+        }
+        const unsigned char *match = out - offset;
+        if (offset >= 8 && (size_t)(outEnd - out) >= matchLength + 8) {
+            lz_wild_copy(out, match, matchLength);
+            out += matchLength;
+        }
+        else if (offset >= matchLength) {
+            memcpy(out, match, matchLength);
+            out += matchLength;
+        }
+        else {
+            // Overlapping copy repeats the last offset bytes
+            for (size_t i = 0; i < matchLength; i++) {
+                *out++ = *match++;
+            }
+        }
+    }
+    return out - (unsigned char *)destination;
+}
+
+// Frame one chunk of at most CHUNK_RAW_MAX bytes into out (CHUNK_FRAME_MAX bytes), returns the frame size.
+// A chunk that saves less than 1/16 is stored raw, and after that the next chunks are stored raw
+// without a try, twice as many after every further miss.
+size_t chunk_encode(chunk_encoder *encoder, const void *data, size_t len, void *out) {
+    chunk_frame *frame = out;
+    unsigned char *payload = (unsigned char *)out + sizeof(chunk_frame);
+    size_t stored = 0;
+    if (encoder->skip > 0) {
+        encoder->skip--;
+    }
+    else if (len > 0) {
+        stored = chunk_compress(data, len, payload, len - len / 16);
+        if (stored == 0) {
+            encoder->backoff = encoder->backoff == 0 ? 1 : encoder->backoff * 2;
+            if (encoder->backoff > LZ_MAX_SKIP) {
+                encoder->backoff = LZ_MAX_SKIP;
+            }
+            encoder->skip = encoder->backoff;
+        }
+        else {
+            encoder->backoff = 0;
+        }
+    }
+    if (stored == 0) {
+        memcpy(payload, data, len);
+        stored = len;
+    }
+    frame->rawLen = len;
+    frame->storedLen = stored;
+    encoder->rawBytes += len;
+    encoder->storedBytes += stored;
+    return sizeof(chunk_frame) + stored;
+}
+
+// Turn a frame's payload back into its chunk, out holds CHUNK_RAW_MAX bytes. -1 when corrupt.
+ssize_t chunk_decode(const chunk_frame *frame, const void *payload, void *out) {
+    if (frame->rawLen > CHUNK_RAW_MAX || frame->storedLen > frame->rawLen) {
+        return -1;
+    }
+    if (frame->storedLen == frame->rawLen) {
+        memcpy(out, payload, frame->rawLen);
+        return frame->rawLen;
+    }
+    ssize_t len = chunk_decompress(payload, frame->storedLen, out, frame->rawLen);
+    return len == (ssize_t)frame->rawLen ? len : -1;
+}
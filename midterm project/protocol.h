@@ -0,0 +1,143 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <signal.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Definitions shared by server_side/server.c, client_side/client.c and client_side/loadgen.c,
+// the admission queue functions live in admission.c
+
+#define SERVER_FIFO_PATH "/tmp/server_pipe"
+#define CLIENT_FIFO_FORMAT "/tmp/client_%d_fifo"
+
+// Connect waits in the admission queue when the server is full, tryConnect gives up
+#define CONNECT_WAIT 1
+#define CONNECT_TRY 2
+
+// Fixed size record written to the server FIFO, well below PIPE_BUF so writes are atomic
+typedef struct {
+    pid_t pid;
+    int option;
+    int64_t queuedNs; // Time spent waiting in the admission queue, reported in the server's stats
+} connection_record;
+
+// The server answers a connection record with sigqueue(pid, ADMISSION_SIGNAL, status)
+#define ADMISSION_SIGNAL (SIGRTMIN)
+#define ADMISSION_ADMITTED 1
+#define ADMISSION_REJECTED 3
+
+// Shared memory admission queue, created by the server and named after its pid
+#define ADMISSION_SHM_FORMAT "/cse344_admission_%d"
+#define ADMISSION_RING 1024 // Futex words, waiting tickets share one when more than this wait
+
+// Ticket queue sized from maxClients: a ticket t holds a slot once t < admitted.
+// Every freed slot admits exactly the next ticket, so Connect clients get in FIFO.
+typedef struct {
+    uint32_t tickets;                 // Next ticket to hand out
+    uint32_t admitted;                // maxClients + slots freed so far
+    uint32_t wake[ADMISSION_RING];    // Futex word the holder of ticket t sleeps on
+    pid_t owner[ADMISSION_RING];      // Pid holding ticket t, lets the server skip dead waiters
+} admission_queue;
+
+admission_queue *admission_create(pid_t serverPid, int maxClients);
+admission_queue *admission_open(pid_t serverPid);
+void admission_destroy(pid_t serverPid);
+int admission_try(admission_queue *q);
+int admission_wait(admission_queue *q, pid_t serverPid, int *waited);
+void admission_release(admission_queue *q);
+
+// Transfers: upload/download are resumable and download can fetch byte ranges.
+//   stat <file>                      -> "<size> <partSize>\n", -1 when missing
+//   upload <file> [offset]\0 <size_t total> <total - offset bytes>
+//                                    server appends to <file>.part at offset and renames it
+//                                    to <file> once total bytes are stored
+//   download <file> [offset [length]] -> range_header followed by header.length bytes,
+//                                    length 0 means up to the end of the file
+#define PART_SUFFIX ".part"
+#define TRANSFER_CHUNK (64 * 1024)
+
+typedef struct {
+    int64_t fileSize; // Size of the whole file on the server, -1 if it cannot be opened
+    int64_t offset;   // First byte of the range that follows
+    int64_t length;   // Bytes that follow the header
+} range_header;
+
+// Dedup store: the server keeps every uploaded content once and names refer to it.
+//   have <sha256 hex> <size> <file>  -> "linked\n" when the server already stores that content and
+//                                    <file> now refers to it, the upload is then skipped;
+//                                    "missing\n" or "exists\n" when it has to be uploaded as usual
+#define STORE_HASH_HEX 64
+
+// Batch transfers move many files in one stream of frames, a frame with nameLen 0 ends it.
+//   mupload\0 <frames>               -> summary text once every frame is stored
+//   mdownload <pattern>...           -> <frames>, patterns are fnmatch(3) patterns or plain names
+//   mreadF <pattern>...              -> text of every matching file behind "==> name <==" lines
+// Every frame is a batch_frame, nameLen bytes of name and size bytes of data.
+#define BATCH_OK 0
+#define BATCH_MISSING 1 // mdownload: no regular file of that name, the frame carries no data
+#define BATCH_MAX_PATTERNS 32
+
+typedef struct {
+    int64_t size;
+    uint32_t nameLen;
+    int32_t status;
+} batch_frame;
+
+// Bulk data plane: a client may map a ring in POSIX shared memory and send "transport shm".
+// From then on upload, download and archServer data travel through the ring while requests,
+// headers and answers stay on the FIFO. Every stream in the ring ends with shm_ring_finish().
+#define SHM_RING_FORMAT "/cse344_ring_%d" // Named after the client pid
+#define SHM_RING_SIZE (4 * 1024 * 1024)
+#define SHM_RING_HEADER 4096              // Data starts on its own page
+#define SHM_RING_OPEN UINT64_MAX          // eofAt while the current stream lasts
+
+// Single producer, single consumer. The direction changes with the transfer, but only one
+// transfer runs at a time and the FIFO round trip between two transfers orders them.
+typedef struct {
+    uint64_t head;      // Bytes produced so far
+    uint64_t tail;      // Bytes consumed so far
+    uint64_t eofAt;     // head where the current stream ends
+    uint32_t dataSeq;   // Futex word bumped whenever head or eofAt moves
+    uint32_t spaceSeq;  // Futex word bumped whenever tail moves
+} shm_ring;
+
+shm_ring *shm_ring_create(pid_t clientPid);
+shm_ring *shm_ring_open(pid_t clientPid);
+void shm_ring_close(shm_ring *ring);
+void shm_ring_destroy(pid_t clientPid);
+ssize_t shm_ring_reserve(shm_ring *ring, void **area, pid_t peer);
+void shm_ring_commit(shm_ring *ring, size_t len);
+void shm_ring_finish(shm_ring *ring);
+ssize_t shm_ring_peek(shm_ring *ring, const void **area, pid_t peer);
+void shm_ring_consume(shm_ring *ring, size_t len);
+int shm_ring_write(shm_ring *ring, const void *data, size_t len, pid_t peer);
+ssize_t shm_ring_read(shm_ring *ring, void *buf, size_t len, pid_t peer);
+
+// Compressed transfers: after "compress lz" (answered "compress lz\n", "compress off\n" turns it
+// off) upload, download and readF data travel as frames, each a chunk_frame and storedLen bytes.
+// A chunk is compressed with the LZ4 style codec in lzchunk.c, or stored raw (storedLen == rawLen)
+// when it does not compress. Range headers and all other answers are not framed.
+#define CHUNK_RAW_MAX TRANSFER_CHUNK
+
+typedef struct {
+    uint32_t rawLen;
+    uint32_t storedLen;
+} chunk_frame;
+
+#define CHUNK_FRAME_MAX (sizeof(chunk_frame) + CHUNK_RAW_MAX)
+
+// Per stream state of the sender, zero initialized
+typedef struct {
+    int skip;             // Chunks still to be stored raw without trying
+    int backoff;          // skip after the next miss
+    uint64_t rawBytes;
+    uint64_t storedBytes;
+} chunk_encoder;
+
+size_t chunk_compress(const void *source, size_t len, void *destination, size_t capacity);
+ssize_t chunk_decompress(const void *source, size_t len, void *destination, size_t capacity);
+size_t chunk_encode(chunk_encoder *encoder, const void *data, size_t len, void *out);
+ssize_t chunk_decode(const chunk_frame *frame, const void *payload, void *out);
+
+#endif
@@ -1,5 +1,7 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -10,17 +12,236 @@
 #include <sys/wait.h> // Include the header file for waitpid function
 #include <dirent.h>
 #include <semaphore.h>
-
-#define FIFO_PATH "/tmp/server_pipe"
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/inotify.h>
+#include <pthread.h>
+#include <time.h>
+#include <zlib.h>
+#include <fnmatch.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <openssl/evp.h>
+
+#include "../protocol.h"
+
+#define FIFO_PATH SERVER_FIFO_PATH
 #define LOG_FILE_PATH "server.log"
-
-#define MAX_CLIENTS 100
+#define STORE_DIR ".objects" // Dedup store in the server directory, one hard link per stored content
+
+#define CLIENT_TABLE_BUCKETS 1024   // Power of two, connected clients are hashed by pid
+#define CLIENT_NAME_LENGTH 16       // Client names, "client01" on, in clientName and the tables
+#define CONNECTION_BATCH 64         // Connection records read from the server FIFO per read()
+
+#define DRAIN_TIMEOUT 30            // Seconds in-flight requests get to finish once the server drains
+#define STOP_RESEND_INTERVAL 1      // Seconds between stop signals to workers that have not left yet
+#define WORKER_RECYCLE_REQUESTS 10000 // A worker hands its client to a fresh one after this many requests
+
+// Exit status of a worker that left at a request boundary to be replaced, the low bits carry
+// the session state the replacement takes over
+#define WORKER_EXIT_RETIRED 64
+#define WORKER_SESSION_SHM 1
+#define WORKER_SESSION_COMPRESS 2
+
+#define TAR_BLOCK_SIZE 512
+#define TAR_STREAM_BUFFER_SIZE 65536 // Bytes collected before a write to the client FIFO
+
+#define GZ_BLOCK_SIZE (256 * 1024) // Input bytes compressed independently by one worker
+#define GZ_MAX_THREADS 16
+
+enum { GZ_SLOT_EMPTY, GZ_SLOT_FILLED, GZ_SLOT_BUSY, GZ_SLOT_DONE };
+
+// One block of the archive on its way through the compressor threads
+typedef struct {
+    unsigned char *in;
+    size_t inLen;
+    unsigned char *out;
+    size_t outLen;
+    int state;
+    int error;
+} gz_slot;
+
+// Parallel gzip writer: every block becomes its own gzip member, so the
+// concatenation stays a standard stream that gzip -d and tar -xzf accept
+typedef struct {
+    int fd;
+    int threadCount;
+    int slotCount;
+    gz_slot slots[2 * GZ_MAX_THREADS];
+    pthread_t threads[GZ_MAX_THREADS];
+    pthread_mutex_t lock;
+    pthread_cond_t work; // A slot was filled or the pool is shutting down
+    pthread_cond_t done; // A worker finished a slot
+    int fill;            // Slot the producer is filling
+    int oldest;          // Next slot to be written out, keeps member order
+    int shutdown;
+    int failed;
+    size_t inBytes;
+    size_t outBytes;
+} gz_pool;
+
+// Buffered ustar writer used by archServer to stream straight into the client FIFO
+typedef struct {
+    gz_pool *gz;        // Compress through the pool instead of writing fd directly
+    int fd;
+    char buffer[TAR_STREAM_BUFFER_SIZE];
+    size_t used;
+    size_t totalBytes;  // Bytes of file data archived
+    size_t streamBytes; // Bytes written to fd (headers and padding included)
+    int fileCount;
+    int failed;
+} tar_stream;
+
+#define LIST_PAGE_SIZE 100          // Entries per page when list <page> has no size
+#define LIST_BUFFER_SIZE 65536      // Listing output is streamed in chunks of this size
+
+// One file of the cached directory listing
+typedef struct {
+    size_t nameOffset; // Offset of the name inside dir_index.names
+    off_t size;
+    time_t mtime;
+} dir_index_entry;
+
+// Sorted listing of the server directory, rebuilt only when inotify reports a change
+typedef struct {
+    dir_index_entry *entries;
+    size_t count;
+    size_t capacity;
+    char *names;       // Arena holding every file name back to back
+    size_t namesUsed;
+    size_t namesCapacity;
+    int valid;
+    int inotifyFd;     // -1 when inotify is unavailable, the index is then rebuilt every time
+    int watching;
+} dir_index;
+
+#define APPEND_LOG_FILES 32              // Files that can have queued appends at the same time
+#define APPEND_LOG_BUFFER (128 * 1024)   // Appended lines collected for one file before a write
+
+// Appends to one file that are waiting for, or being written by, the current leader
+typedef struct {
+    char name[256];          // "" while the slot is free
+    int users;               // Workers holding the slot
+    int flushing;            // A leader is writing a batch out
+    pid_t leader;
+    uint64_t flushingTo;     // Last append of the batch being written
+    uint64_t nextSeq;        // Sequence number of the last queued append
+    uint64_t writtenSeq;     // Appends up to here are in the file (and synced in sync mode)
+    uint64_t failedFrom;     // Appends failedFrom..failedTo were lost in a failed write
+    uint64_t failedTo;
+    size_t used;
+    pthread_cond_t done;     // A batch was written, or buffer space was freed
+    char buffer[APPEND_LOG_BUFFER];
+} append_log_file;
+
+// writeT appends go through this log shared by all workers: whoever finds no write in flight
+// writes every queued line of the file with one write() (and one fdatasync() in sync mode),
+// appends arriving meanwhile form the next batch, so concurrent appenders share the cost
+typedef struct {
+    pthread_mutex_t lock;
+    int sync;                // fdatasync every batch
+    uint64_t records;
+    uint64_t batches;
+    append_log_file files[APPEND_LOG_FILES];
+} append_log;
+
+// Shared mapping created before the first worker is forked
+append_log *appendLog = NULL;
+
+#define METRIC_BUCKETS 32          // Latency bucket b counts times below 2^b microseconds
+#define METRICS_DUMP_INTERVAL 10   // Seconds between two writes of the stats file
+#define METRICS_FILE "stats.txt"   // Written next to the log file
+
+enum { METRIC_HELP, METRIC_LIST, METRIC_READF, METRIC_WRITET, METRIC_UPLOAD, METRIC_DOWNLOAD, METRIC_ARCHSERVER,
+       METRIC_STAT, METRIC_MUPLOAD, METRIC_MDOWNLOAD, METRIC_MREADF, METRIC_STATS, METRIC_OTHER, METRIC_COMMANDS };
+
+static const char *metricNames[METRIC_COMMANDS] = { "help", "list", "readF", "writeT", "upload", "download",
+    "archServer", "stat", "mupload", "mdownload", "mreadF", "stats", "other" };
+
+typedef struct {
+    uint64_t count;
+    uint64_t totalUs;
+    uint64_t maxUs;
+    uint64_t buckets[METRIC_BUCKETS];
+} latency_histogram;
+
+// Counters of one worker, written only by that worker (and its compressor threads)
+typedef struct {
+    pid_t workerPid;         // 0 while the slot is free
+    pid_t clientPid;
+    char clientName[CLIENT_NAME_LENGTH];
+    time_t connected;
+    uint64_t bytesIn;
+    uint64_t bytesOut;
+    latency_histogram commands[METRIC_COMMANDS];
+} worker_metrics;
+
+// Shared by the acceptor and the workers: every worker updates its own slot without locking,
+// readers add the slots up. The acceptor folds a slot into the retired totals when its worker exits.
+typedef struct {
+    time_t started;
+    uint64_t clientsServed;
+    uint64_t rejected;
+    latency_histogram queueWait;  // Time clients spent in the admission queue
+    uint64_t retiredBytesIn;
+    uint64_t retiredBytesOut;
+    latency_histogram retired[METRIC_COMMANDS];
+    int slotCount;
+    worker_metrics slots[];
+} server_metrics;
+
+server_metrics *metrics = NULL;
+worker_metrics *myMetrics = NULL;  // Slot of this worker, NULL in the acceptor
+
+// Client's shared memory ring once it asked for "transport shm", bulk data then bypasses the FIFO
+shm_ring *dataRing = NULL;
+// Set by "compress lz": upload, download and readF data are sent as compressed chunk frames
+int compressMode = 0;
+char metricsPath[512];
 
 // Global semaphore
 sem_t sem;
 
-// Array to store the PIDs of connected clients
-pid_t connected_clients[MAX_CLIENTS];
+// Created lazily by the child serving the client, so every child owns its inotify fd
+dir_index listIndex = {0};
+
+// A connected client and the worker process serving it, linked into both hash chains
+typedef struct client_entry {
+    pid_t clientPid;
+    pid_t workerPid;
+    char clientName[CLIENT_NAME_LENGTH];
+    unsigned generation;     // workerGeneration when the worker was started
+    struct client_entry *nextByClient;
+    struct client_entry *nextByWorker;
+} client_entry;
+
+// Connected clients, looked up by client pid on connect and by worker pid on SIGCHLD
+typedef struct {
+    client_entry *byClient[CLIENT_TABLE_BUCKETS];
+    client_entry *byWorker[CLIENT_TABLE_BUCKETS];
+} client_table;
+
+client_table connected_clients = {0};
+
+// Shared memory queue that Connect/tryConnect clients pass before sending their record
+admission_queue *admission = NULL;
+
+// Descriptors of the acceptor loop, closed by the forked workers
+int serverFifoFd = -1;
+int serverFifoKeepAlive = -1; // Our own writer, so the FIFO never reports EOF between clients
+int epollFd = -1;
+int signalFd = -1;            // SIGCHLD, SIGINT, SIGTERM and SIGHUP, read by the acceptor loop
+
+// Shutdown and rolling restarts, acceptor side
+int draining = 0;
+uint64_t drainDeadlineUs = 0;
+unsigned workerGeneration = 0;  // Bumped by SIGHUP, workers of older generations get replaced
+pid_t retiringWorker = 0;      // Worker asked to hand its client over, one at a time
+uint64_t stopSentUs = 0;        // Last time stop signals went out
+int sessionFlags = 0;           // Session state the next forked worker starts with
+
+// Worker side: SIGUSR1 (drain) or SIGUSR2 (retire) arrived, acted on at the next request boundary
+volatile sig_atomic_t workerStop = 0;
 
 // Global variables
 int logFile = -1; // File descriptor for the log file
@@ -28,90 +249,723 @@ int maxClients;
 int currentClients = 0;
 int clientPID=-1;
 int client_name_index= 1;
-char clientName[100];
+char clientName[CLIENT_NAME_LENGTH];
 char clientFIFO[100];
 char dirname[1024] ;
 int parentPID = -500;
 
+// Bytes read from the client FIFO together with the request, consumed before the FIFO itself
+char pendingInput[256];
+size_t pendingInputLen = 0;
+
 // Function prototypes
 void initialize_server(char *dirname, int maxClients);
-void handle_client_connection(int clientPID);
+pid_t handle_client_connection(int clientPID);
 void handle_client_request(int clientPID, char *request,char *clientFIFO);
 void handle_kill_signal(int sig);
-void handle_child_termination(int sig);
+void handle_list_command(int clientFifoFd, const char* request);
 void handle_readF_command(int clientFifoFd, const char* request);
 void handle_writeT_command(int clientFifoFd, const char* request);
+static void writeT_recover(const char *filename);
+static int append_log_write(const char *filename, const char *content);
+static append_log *append_log_create(int sync);
 void handle_upload_command(int clientFifoFd, const char* request);
 void handle_download_command(int clientFifoFd, const char* request);
-void handle_download_command2(int clientFifoFd, const char* request);
+void handle_stat_command(int clientFifoFd, const char* request);
+void handle_mupload_command(int clientFifoFd);
+void handle_stats_command(int clientFifoFd);
+void handle_transport_command(int clientFifoFd, const char* request);
+void handle_have_command(int clientFifoFd, const char* request);
+void handle_compress_command(int clientFifoFd, const char* request);
+static void store_sweep(void);
+void handle_batch_send_command(int clientFifoFd, const char* request);
+int tar_stream_directory(tar_stream *ts, int fd, const char *root, const char *exclude, gz_pool *gz);
+gz_pool *gz_pool_create(int fd, int threadCount);
+int gz_pool_finish(gz_pool *pool);
+
+static unsigned int pid_hash(pid_t pid) {
+    return ((unsigned int)pid * 2654435761u) & (CLIENT_TABLE_BUCKETS - 1);
+}
 
 // Function to check if a client PID is already connected
 int is_client_connected(pid_t pid) {
-    for (int i = 0; i < currentClients; i++) {
-        if (connected_clients[i] == pid) {
+    for (client_entry *e = connected_clients.byClient[pid_hash(pid)]; e != NULL; e = e->nextByClient) {
+        if (e->clientPid == pid) {
             return 1;
         }
     }
     return 0;
 }
 
-void handle_child_termination(int sig) {
-    while (waitpid(-1, NULL, WNOHANG) > 0) {
-        sem_wait(&sem);
-        currentClients--; // Decrement current clients count
-        sem_post(&sem);
+static int client_table_add(pid_t clientPid, pid_t workerPid, const char *name) {
+    client_entry *e = malloc(sizeof(client_entry));
+    if (e == NULL) {
+        return -1;
+    }
+    e->clientPid = clientPid;
+    e->workerPid = workerPid;
+    snprintf(e->clientName, sizeof(e->clientName), "%s", name);
+    e->generation = workerGeneration;
+    e->nextByClient = connected_clients.byClient[pid_hash(clientPid)];
+    connected_clients.byClient[pid_hash(clientPid)] = e;
+    e->nextByWorker = connected_clients.byWorker[pid_hash(workerPid)];
+    connected_clients.byWorker[pid_hash(workerPid)] = e;
+    return 0;
+}
+
+// Forget the client served by an exited worker, returns its pid or -1 if unknown.
+// name, when not NULL, receives the client's name (CLIENT_NAME_LENGTH bytes).
+static pid_t client_table_remove_worker(pid_t workerPid, char *name) {
+    client_entry **link = &connected_clients.byWorker[pid_hash(workerPid)];
+    while (*link != NULL && (*link)->workerPid != workerPid) {
+        link = &(*link)->nextByWorker;
+    }
+    client_entry *e = *link;
+    if (e == NULL) {
+        return -1;
+    }
+    *link = e->nextByWorker;
+
+    link = &connected_clients.byClient[pid_hash(e->clientPid)];
+    while (*link != e) {
+        link = &(*link)->nextByClient;
+    }
+    *link = e->nextByClient;
+
+    pid_t clientPid = e->clientPid;
+    if (name != NULL) {
+        memcpy(name, e->clientName, sizeof(e->clientName));
+    }
+    free(e);
+    return clientPid;
+}
+
+// Tell a client whether it was admitted, queued or rejected
+static void notify_client(pid_t pid, int status) {
+    union sigval value;
+    value.sival_int = status;
+    sigqueue(pid, ADMISSION_SIGNAL, value);
+}
+
+// Workers only note a stop request, the request loop acts on it between requests
+static void handle_worker_stop(int sig) {
+    workerStop = sig;
+}
+
+static uint64_t metrics_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void histogram_add(latency_histogram *h, uint64_t us) {
+    int bucket = 0;
+    while (bucket < METRIC_BUCKETS - 1 && us >= (1ULL << bucket)) {
+        bucket++;
+    }
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->totalUs, us, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->buckets[bucket], 1, __ATOMIC_RELAXED);
+    if (us > h->maxUs) {
+        h->maxUs = us;
+    }
+}
+
+static void histogram_merge(latency_histogram *into, const latency_histogram *from) {
+    into->count += from->count;
+    into->totalUs += from->totalUs;
+    if (from->maxUs > into->maxUs) {
+        into->maxUs = from->maxUs;
+    }
+    for (int b = 0; b < METRIC_BUCKETS; b++) {
+        into->buckets[b] += from->buckets[b];
+    }
+}
+
+// Upper bound in ms of the bucket holding the p-th percentile, capped at the largest sample
+static double histogram_percentile(const latency_histogram *h, double p) {
+    uint64_t rank = (uint64_t)(p / 100.0 * h->count + 0.5);
+    uint64_t seen = 0;
+    for (int b = 0; b < METRIC_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen >= rank && seen > 0) {
+            uint64_t bound = 1ULL << b;
+            return (bound < h->maxUs ? bound : h->maxUs) / 1000.0;
+        }
+    }
+    return h->maxUs / 1000.0;
+}
+
+static server_metrics *metrics_create(int slotCount) {
+    size_t size = sizeof(server_metrics) + slotCount * sizeof(worker_metrics);
+    server_metrics *m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (m == MAP_FAILED) {
+        return NULL;
+    }
+    m->started = time(NULL);
+    m->slotCount = slotCount;
+    return m;
+}
+
+// Claimed by the acceptor before forking, the worker inherits myMetrics
+static worker_metrics *metrics_slot_claim(pid_t clientPid, const char *name) {
+    for (int i = 0; metrics != NULL && i < metrics->slotCount; i++) {
+        worker_metrics *slot = &metrics->slots[i];
+        if (slot->workerPid == 0 && slot->clientPid == 0) {
+            memset(slot, 0, sizeof(*slot));
+            slot->clientPid = clientPid;
+            snprintf(slot->clientName, sizeof(slot->clientName), "%s", name);
+            slot->connected = time(NULL);
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+// The worker is gone, keep its counters in the totals and free the slot
+static void metrics_slot_release(pid_t workerPid) {
+    for (int i = 0; metrics != NULL && i < metrics->slotCount; i++) {
+        worker_metrics *slot = &metrics->slots[i];
+        if (slot->workerPid == workerPid) {
+            for (int c = 0; c < METRIC_COMMANDS; c++) {
+                histogram_merge(&metrics->retired[c], &slot->commands[c]);
+            }
+            metrics->retiredBytesIn += slot->bytesIn;
+            metrics->retiredBytesOut += slot->bytesOut;
+            memset(slot, 0, sizeof(*slot));
+            return;
+        }
+    }
+}
+
+static int metrics_command(const char *request) {
+    static const struct { const char *prefix; int command; } prefixes[] = {
+        { "help", METRIC_HELP }, { "list", METRIC_LIST }, { "readF", METRIC_READF }, { "writeT", METRIC_WRITET },
+        { "upload", METRIC_UPLOAD }, { "download", METRIC_DOWNLOAD }, { "archServer", METRIC_ARCHSERVER },
+        { "stats", METRIC_STATS }, { "stat", METRIC_STAT }, { "mupload", METRIC_MUPLOAD },
+        { "mdownload", METRIC_MDOWNLOAD }, { "mreadF", METRIC_MREADF },
+    };
+    for (size_t i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); i++) {
+        if (strncmp(request, prefixes[i].prefix, strlen(prefixes[i].prefix)) == 0) {
+            return prefixes[i].command;
+        }
+    }
+    return METRIC_OTHER;
+}
+
+static void metrics_record(int command, uint64_t startUs) {
+    if (myMetrics != NULL) {
+        histogram_add(&myMetrics->commands[command], metrics_now_us() - startUs);
+    }
+}
+
+static void metrics_bytes(uint64_t *counter, ssize_t bytes) {
+    if (myMetrics != NULL && bytes > 0) {
+        __atomic_fetch_add(counter, (uint64_t)bytes, __ATOMIC_RELAXED);
+    }
+}
+
+// write() towards the client that counts the bytes sent
+static ssize_t client_write(int fd, const void *buf, size_t len) {
+    ssize_t written = write(fd, buf, len);
+    if (myMetrics != NULL) {
+        metrics_bytes(&myMetrics->bytesOut, written);
+    }
+    return written;
+}
+
+// Bulk data towards the client: through the shared ring when the client set one up, else the FIFO
+static ssize_t client_write_data(int fd, const void *buf, size_t len) {
+    if (dataRing == NULL) {
+        return client_write(fd, buf, len);
+    }
+    if (shm_ring_write(dataRing, buf, len, clientPID) == -1) {
+        errno = EPIPE;
+        return -1;
+    }
+    if (myMetrics != NULL) {
+        metrics_bytes(&myMetrics->bytesOut, len);
+    }
+    return len;
+}
+
+// transport shm|fifo: switch the bulk data of this session to the client's ring, or back to the FIFO
+void handle_transport_command(int clientFifoFd, const char* request) {
+    char mode[16] = "";
+    sscanf(request, "transport %15s", mode);
+    char msg[64];
+    if (strcmp(mode, "shm") == 0) {
+        if (dataRing == NULL) {
+            dataRing = shm_ring_open(clientPID);
+        }
+        snprintf(msg, sizeof(msg), dataRing != NULL ? "transport shm\n" : "transport fifo\n");
+    }
+    else {
+        if (dataRing != NULL) {
+            shm_ring_close(dataRing);
+            dataRing = NULL;
+        }
+        snprintf(msg, sizeof(msg), "transport fifo\n");
+    }
+    client_write(clientFifoFd, msg, strlen(msg));
+}
+
+void handle_compress_command(int clientFifoFd, const char* request) {
+    char mode[16] = "";
+    sscanf(request, "compress %15s", mode);
+    compressMode = strcmp(mode, "lz") == 0;
+    const char *msg = compressMode ? "compress lz\n" : "compress off\n";
+    client_write(clientFifoFd, msg, strlen(msg));
+}
+
+// Collects a compressed stream into chunks and sends each as a frame, to the ring when toRing is set
+typedef struct {
+    int fd;
+    int toRing;
+    int failed;
+    size_t used;
+    chunk_encoder encoder;
+    char raw[CHUNK_RAW_MAX];
+    char frame[CHUNK_FRAME_MAX];
+} framed_writer;
+
+static framed_writer *framed_writer_create(int fd, int toRing) {
+    framed_writer *fw = malloc(sizeof(framed_writer));
+    if (fw != NULL) {
+        memset(fw, 0, offsetof(framed_writer, raw));
+        fw->fd = fd;
+        fw->toRing = toRing && dataRing != NULL;
+    }
+    return fw;
+}
+
+static int framed_writer_flush(framed_writer *fw) {
+    if (fw->used == 0 || fw->failed) {
+        return fw->failed ? -1 : 0;
+    }
+    size_t len = chunk_encode(&fw->encoder, fw->raw, fw->used, fw->frame);
+    fw->used = 0;
+    size_t off = 0;
+    while (off < len) {
+        ssize_t written = fw->toRing ? client_write_data(fw->fd, fw->frame + off, len - off)
+                                     : client_write(fw->fd, fw->frame + off, len - off);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fw->failed = 1;
+            return -1;
+        }
+        off += written;
+    }
+    return 0;
+}
+
+static ssize_t framed_writer_write(framed_writer *fw, const void *data, size_t len) {
+    const char *src = data;
+    size_t left = len;
+    while (left > 0) {
+        size_t chunk = CHUNK_RAW_MAX - fw->used < left ? CHUNK_RAW_MAX - fw->used : left;
+        memcpy(fw->raw + fw->used, src, chunk);
+        fw->used += chunk;
+        src += chunk;
+        left -= chunk;
+        if (fw->used == CHUNK_RAW_MAX && framed_writer_flush(fw) == -1) {
+            return -1;
+        }
+    }
+    return len;
+}
+
+// Flushes the last chunk, returns -1 if any part of the stream could not be sent
+static int framed_writer_finish(framed_writer *fw) {
+    int result = framed_writer_flush(fw);
+    if (fw->encoder.rawBytes > 0) {
+        dprintf(logFile, "compress: %llu bytes sent as %llu\n", (unsigned long long)fw->encoder.rawBytes,
+                (unsigned long long)fw->encoder.storedBytes);
+    }
+    free(fw);
+    return result;
+}
+
+// Text report of the shared counters, for the stats command and the stats file. Returns a malloc'ed string.
+static char *metrics_format(size_t *len) {
+    char *text = NULL;
+    FILE *out = open_memstream(&text, len);
+    if (out == NULL) {
+        return NULL;
+    }
+    latency_histogram totals[METRIC_COMMANDS];
+    memcpy(totals, metrics->retired, sizeof(totals));
+    uint64_t bytesIn = metrics->retiredBytesIn;
+    uint64_t bytesOut = metrics->retiredBytesOut;
+    int connected = 0;
+    for (int i = 0; i < metrics->slotCount; i++) {
+        worker_metrics *slot = &metrics->slots[i];
+        if (slot->clientPid == 0) {
+            continue;
+        }
+        connected++;
+        for (int c = 0; c < METRIC_COMMANDS; c++) {
+            histogram_merge(&totals[c], &slot->commands[c]);
+        }
+        bytesIn += slot->bytesIn;
+        bytesOut += slot->bytesOut;
+    }
+
+    time_t now = time(NULL);
+    fprintf(out, "uptime %ld s, %d clients connected, %llu served, %llu rejected\n", (long)(now - metrics->started),
+            connected, (unsigned long long)metrics->clientsServed, (unsigned long long)metrics->rejected);
+    fprintf(out, "%-11s %8s %10s %10s %10s %10s\n", "command", "count", "avg ms", "p50 ms", "p99 ms", "max ms");
+    for (int c = 0; c < METRIC_COMMANDS; c++) {
+        latency_histogram *h = &totals[c];
+        if (h->count == 0) {
+            continue;
+        }
+        fprintf(out, "%-11s %8llu %10.3f %10.3f %10.3f %10.3f\n", metricNames[c], (unsigned long long)h->count,
+                h->totalUs / 1000.0 / h->count, histogram_percentile(h, 50), histogram_percentile(h, 99),
+                h->maxUs / 1000.0);
+    }
+    latency_histogram *q = &metrics->queueWait;
+    if (q->count > 0) {
+        fprintf(out, "admission wait: %llu clients, avg %.3f ms, p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+                (unsigned long long)q->count, q->totalUs / 1000.0 / q->count, histogram_percentile(q, 50),
+                histogram_percentile(q, 99), q->maxUs / 1000.0);
+    }
+    fprintf(out, "bytes in %llu, bytes out %llu\n", (unsigned long long)bytesIn, (unsigned long long)bytesOut);
+    if (appendLog != NULL && appendLog->batches > 0) {
+        fprintf(out, "writeT appends: %llu lines in %llu writes\n", (unsigned long long)appendLog->records,
+                (unsigned long long)appendLog->batches);
+    }
+    if (connected > 0) {
+        fprintf(out, "%-10s %8s %8s %8s %12s %12s\n", "client", "pid", "since s", "cmds", "bytes in", "bytes out");
+        for (int i = 0; i < metrics->slotCount; i++) {
+            worker_metrics *slot = &metrics->slots[i];
+            if (slot->clientPid == 0) {
+                continue;
+            }
+            uint64_t commands = 0;
+            for (int c = 0; c < METRIC_COMMANDS; c++) {
+                commands += slot->commands[c].count;
+            }
+            fprintf(out, "%-10s %8d %8ld %8llu %12llu %12llu\n", slot->clientName, slot->clientPid,
+                    (long)(now - slot->connected), (unsigned long long)commands,
+                    (unsigned long long)slot->bytesIn, (unsigned long long)slot->bytesOut);
+        }
     }
+    fclose(out);
+    return text;
 }
+
+void handle_stats_command(int clientFifoFd) {
+    size_t len;
+    char *text = metrics != NULL ? metrics_format(&len) : NULL;
+    if (text == NULL) {
+        char errorMsg[] = "Error: statistics are not available\n";
+        client_write(clientFifoFd, errorMsg, strlen(errorMsg));
+        return;
+    }
+    size_t off = 0;
+    while (off < len) {
+        ssize_t written = client_write(clientFifoFd, text + off, len - off);
+        if (written <= 0) {
+            break;
+        }
+        off += written;
+    }
+    free(text);
+}
+
+// Replace the stats file, readers never see a half written one
+static void metrics_dump(void) {
+    size_t len;
+    char *text = metrics != NULL ? metrics_format(&len) : NULL;
+    if (text == NULL) {
+        return;
+    }
+    char tmpPath[600];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", metricsPath);
+    int fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd != -1) {
+        int ok = write(fd, text, len) == (ssize_t)len;
+        close(fd);
+        if (!ok || rename(tmpPath, metricsPath) == -1) {
+            unlink(tmpPath);
+        }
+    }
+    free(text);
+}
+
 // Function to handle kill signal
 void handle_kill_signal(int sig) {
+    if (getpid() == parentPID) {
+        metrics_dump();
+    }
+    if (appendLog != NULL && appendLog->batches > 0) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), ">> writeT appends: %llu lines in %llu writes\n",
+                 (unsigned long long)appendLog->records, (unsigned long long)appendLog->batches);
+        write(STDOUT_FILENO, msg, strlen(msg));
+        if (logFile != -1) {
+            write(logFile, msg, strlen(msg));
+        }
+    }
     // Close log file if it's open
     if (logFile != -1) {
         close(logFile);
         logFile = -1;
     }
 
-    // Send kill signals to all child processes
-    for (int i = 0; i < currentClients; i++) {
-        kill(connected_clients[i], SIGTERM);
+    // Send kill signals to all connected clients, waiting ones notice the queue going away
+    for (int i = 0; i < CLIENT_TABLE_BUCKETS; i++) {
+        for (client_entry *e = connected_clients.byClient[i]; e != NULL; e = e->nextByClient) {
+            kill(e->clientPid, SIGTERM);
+        }
     }
+    admission_destroy(parentPID);
     return;
 }
 
-// Function to accept client connection
-int accept_client() {
+// Function to open the well-known FIFO once, it stays open for the lifetime of the server
+int open_server_fifo() {
+    if (mkfifo(FIFO_PATH, 0666) == -1 && errno != EEXIST) {
+        perror("mkfifo failed");
+        return -1;
+    }
+    serverFifoFd = open(FIFO_PATH, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (serverFifoFd == -1) {
+        perror("open failed");
+        return -1;
+    }
+    serverFifoKeepAlive = open(FIFO_PATH, O_WRONLY | O_CLOEXEC);
+    if (serverFifoKeepAlive == -1) {
+        perror("open failed");
+        return -1;
+    }
+    return 0;
+}
+
+// Fork a worker for the client named clientName, it starts with the session state in flags
+static pid_t start_worker(pid_t pid, int flags) {
+    clientPID = pid;
+    sessionFlags = flags;
+    myMetrics = metrics_slot_claim(pid, clientName);     // Inherited by the worker
+    pid_t workerPid = handle_client_connection(pid);    // Handle client connection
+    if (myMetrics != NULL) {
+        myMetrics->workerPid = workerPid;
+        myMetrics = NULL;
+    }
+    sessionFlags = 0;
+    if (client_table_add(pid, workerPid, clientName) == -1) {
+        perror("malloc failed");
+    }
+    return workerPid;
+}
+
+// Start a worker for the client and let it know it is connected
+static void admit_client(pid_t pid) {
+    snprintf(clientName, sizeof(clientName), "client%02d", client_name_index++);
 
-    int server_fd;
-    pid_t client_pid;
+    char msg[256];  // Print client's connection message
+    snprintf(msg, sizeof(msg), ">> Client PID %d connected as \"%s\"\n", pid, clientName);
+    write(STDOUT_FILENO, msg, strlen(msg));
 
-    // Create/open the named pipe (FIFO) only if it hasn't been opened yet
-    if (currentClients==0) {
-        if (mkfifo(FIFO_PATH, 0666) == -1) {
-            if (errno != EEXIST) {
-                perror("mkfifo failed");
-                return -1;
+    start_worker(pid, 0);
+    if (metrics != NULL) {
+        metrics->clientsServed++;
+    }
+    currentClients++;   // Increment current clients count
+    notify_client(pid, ADMISSION_ADMITTED);
+}
+
+// Clients only send a record after taking a slot in the admission queue, so the
+// server is never full here unless a client skipped the queue
+static void handle_connection_record(const connection_record *record) {
+    pid_t pid = record->pid;
+    if (pid <= 0 || is_client_connected(pid)) {
+        return;
+    }
+    if (currentClients < maxClients && !draining) {
+        if (metrics != NULL) {
+            histogram_add(&metrics->queueWait, record->queuedNs > 0 ? record->queuedNs / 1000 : 0);
+        }
+        admit_client(pid);
+        return;
+    }
+    if (metrics != NULL) {
+        metrics->rejected++;
+    }
+
+    char errorMsg[256];
+    snprintf(errorMsg, sizeof(errorMsg), draining ? ">> Connection request PID %d rejected. Shutting down\n"
+                                                   : ">> Connection request PID %d rejected. Queue FULL\n", pid);
+    notify_client(pid, ADMISSION_REJECTED);
+    write(STDOUT_FILENO, errorMsg, strlen(errorMsg));
+    write(logFile, errorMsg, strlen(errorMsg));
+}
+
+// Function to accept client connections: drain every record queued in the server FIFO
+int accept_clients() {
+    static char pending[CONNECTION_BATCH * sizeof(connection_record)];
+    static size_t pendingLen = 0;
+    int accepted = 0;
+
+    while (1) {
+        ssize_t bytes_read = read(serverFifoFd, pending + pendingLen, sizeof(pending) - pendingLen);
+        if (bytes_read == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                break;
             }
+            perror("read failed");
+            return -1;
+        }
+        if (bytes_read == 0) {
+            break;
         }
+        pendingLen += bytes_read;
+
+        size_t off = 0;
+        while (pendingLen - off >= sizeof(connection_record)) {
+            connection_record record;
+            memcpy(&record, pending + off, sizeof(record));
+            handle_connection_record(&record);
+            off += sizeof(record);
+            accepted++;
+        }
+        memmove(pending, pending + off, pendingLen - off);
+        pendingLen -= off;
     }
-    // Open FIFO for reading (blocking until a client writes to it)
-    server_fd = open(FIFO_PATH, O_RDONLY);
-    if (server_fd == -1) {
-        perror("open failed");
-        return -1;
+    return accepted;
+}
+
+// Send sig to every worker, SIGUSR1 asks them to finish their request and leave
+static void signal_workers(int sig) {
+    for (int i = 0; i < CLIENT_TABLE_BUCKETS; i++) {
+        for (client_entry *e = connected_clients.byClient[i]; e != NULL; e = e->nextByClient) {
+            kill(e->workerPid, sig);
+        }
     }
+    stopSentUs = metrics_now_us();
+}
 
-    // Read client's PID from the FIFO
-    if (read(server_fd, &client_pid, sizeof(client_pid)) == -1) {
-        perror("read failed");
-        close(server_fd);
-        return -1;
+// Stop accepting and let the workers finish what they are doing, the acceptor loop exits once
+// they are gone or the deadline passed
+static void start_drain(const char *reason) {
+    if (draining) {
+        return;
+    }
+    draining = 1;
+    drainDeadlineUs = metrics_now_us() + DRAIN_TIMEOUT * 1000000ULL;
+    char msg[256];
+    snprintf(msg, sizeof(msg), ">> %s, draining %d clients (at most %d seconds)...\n", reason, currentClients, DRAIN_TIMEOUT);
+    write(STDOUT_FILENO, msg, strlen(msg));
+    write(logFile, msg, strlen(msg));
+    signal_workers(SIGUSR1);
+}
+
+// Last step of a drain: whoever is still busy at the deadline is killed, the client
+// can resume an interrupted upload or download against the next server
+static void shutdown_server(void) {
+    if (currentClients > 0) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), ">> Stopping %d workers still busy\n", currentClients);
+        write(STDOUT_FILENO, msg, strlen(msg));
+        write(logFile, msg, strlen(msg));
+        signal_workers(SIGKILL);
+        pid_t workerPid;
+        while ((workerPid = waitpid(-1, NULL, 0)) > 0) {
+            metrics_slot_release(workerPid);
+            pid_t clientPid = client_table_remove_worker(workerPid, NULL);
+            if (clientPid != -1) {
+                shm_ring_destroy(clientPid);
+                kill(clientPid, SIGTERM);
+            }
+        }
+        currentClients = 0;
     }
-    // Close the FIFO after reading client's PID
-    close(server_fd);
+    handle_kill_signal(SIGTERM);
+    sem_destroy(&sem);
+    write(STDOUT_FILENO, ">> bye\n", 7);
+    exit(EXIT_SUCCESS);
+}
 
-    // Return the client's PID
-    clientPID = client_pid;
-    return client_pid;
-    
+// SIGHUP and recycling: ask the next worker of an older generation to hand its client over.
+// It leaves between two requests and reap_workers starts the replacement.
+static void retire_next_worker(void) {
+    if (draining || retiringWorker != 0) {
+        return;
+    }
+    for (int i = 0; i < CLIENT_TABLE_BUCKETS; i++) {
+        for (client_entry *e = connected_clients.byClient[i]; e != NULL; e = e->nextByClient) {
+            if (e->generation != workerGeneration) {
+                retiringWorker = e->workerPid;
+                stopSentUs = metrics_now_us();
+                kill(e->workerPid, SIGUSR2);
+                return;
+            }
+        }
+    }
+}
+
+// Reap finished workers: retired ones are replaced for the same client, for the others the
+// slot goes to the next ticket in the admission queue
+void reap_workers() {
+    int status;
+    pid_t workerPid;
+    while ((workerPid = waitpid(-1, &status, WNOHANG)) > 0) {
+        metrics_slot_release(workerPid);
+        if (workerPid == retiringWorker) {
+            retiringWorker = 0;
+        }
+        pid_t clientPid = client_table_remove_worker(workerPid, clientName);
+        if (clientPid == -1) {
+            continue;
+        }
+        int code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+        if (!draining && (code & ~(WORKER_SESSION_SHM | WORKER_SESSION_COMPRESS)) == WORKER_EXIT_RETIRED &&
+            kill(clientPid, 0) == 0) {
+            pid_t replacement = start_worker(clientPid, code & (WORKER_SESSION_SHM | WORKER_SESSION_COMPRESS));
+            dprintf(logFile, "%s moved from worker %d to worker %d\n", clientName, (int)workerPid, (int)replacement);
+            continue;
+        }
+        currentClients--; // Decrement current clients count
+        admission_release(admission);
+        shm_ring_destroy(clientPid);  // The client's ring outlives single workers, not the session
+        if (draining) {
+            kill(clientPid, SIGTERM);  // Its request is done, tell it the server is going away
+        }
+    }
+    retire_next_worker();
+}
+
+// Signals of the acceptor arrive through signalFd: a first SIGINT or SIGTERM (killServer sends
+// one) drains, a second SIGINT stops right away, SIGHUP restarts every worker one by one
+static void handle_server_signals(void) {
+    struct signalfd_siginfo info;
+    while (read(signalFd, &info, sizeof(info)) == sizeof(info)) {
+        switch (info.ssi_signo) {
+        case SIGCHLD:
+            reap_workers();
+            break;
+        case SIGINT:
+            if (draining) {
+                drainDeadlineUs = 0;
+            }
+            start_drain("Ctrl+C signal received");
+            break;
+        case SIGTERM:
+            start_drain("Shutdown requested");
+            break;
+        case SIGHUP:
+            workerGeneration++;
+            write(STDOUT_FILENO, ">> Restarting workers...\n", 25);
+            retire_next_worker();
+            break;
+        }
+    }
 }
 
 // Function to initialize server
@@ -155,8 +1009,8 @@ void initialize_server(char *dirname, int maxClients) {
     write(STDOUT_FILENO, msg, strlen(msg));
 }
 
-// Function to handle client connection
-void handle_client_connection(int clientPID) {
+// Function to handle client connection, returns the pid of the worker process
+pid_t handle_client_connection(int clientPID) {
     // Fork new process to handle client's requests
     pid_t pid = fork();
     if (pid < 0) {
@@ -164,34 +1018,110 @@ void handle_client_connection(int clientPID) {
         exit(EXIT_FAILURE);
     }
     if (pid == 0) {
-        // Child process
-        snprintf(clientFIFO, sizeof(clientFIFO), "/tmp/client_%d_fifo", clientPID);//!!!!!
+        // Child process, the acceptor's descriptors and signals belong to the parent.
+        // Ctrl+C reaches the whole process group, the acceptor decides what it means.
+        close(epollFd);
+        close(serverFifoFd);
+        close(serverFifoKeepAlive);
+        close(signalFd);
+        signal(SIGINT, SIG_IGN);
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = handle_worker_stop;  // No SA_RESTART, a stop interrupts the wait for a request
+        sigaction(SIGUSR1, &sa, NULL);
+        sigaction(SIGUSR2, &sa, NULL);
+        sigset_t stopSignals;
+        sigemptyset(&stopSignals);
+        sigaddset(&stopSignals, SIGUSR1);
+        sigaddset(&stopSignals, SIGUSR2);
+        sigset_t mask;
+        sigprocmask(SIG_SETMASK, NULL, &mask);
+        sigdelset(&mask, SIGCHLD);
+        sigdelset(&mask, SIGTERM);
+        sigdelset(&mask, SIGHUP);
+        sigaddset(&mask, SIGUSR1);  // Requests are never cut short, stops wait for the boundary
+        sigaddset(&mask, SIGUSR2);
+        sigprocmask(SIG_SETMASK, &mask, NULL);
+        snprintf(clientFIFO, sizeof(clientFIFO), CLIENT_FIFO_FORMAT, clientPID);
+
+        // A replacement worker continues the session of the worker it replaces
+        if (sessionFlags & WORKER_SESSION_SHM) {
+            dataRing = shm_ring_open(clientPID);
+        }
+        compressMode = (sessionFlags & WORKER_SESSION_COMPRESS) != 0;
+        long requestsServed = 0;
 
         while (1) {
             sleep(0.2);   // Sleep for 1 second
-    
-            int client_pipe_fd = open(clientFIFO, O_RDONLY); /*!!!!!*/
 
+            // Stops are only taken while waiting for the next request: SIGUSR1 ends the session
+            // (the acceptor drains), SIGUSR2 hands the client to a fresh worker
+            sigprocmask(SIG_UNBLOCK, &stopSignals, NULL);
+            int client_pipe_fd = -1;
+            if (!workerStop && requestsServed < WORKER_RECYCLE_REQUESTS) {
+                client_pipe_fd = open(clientFIFO, O_RDONLY); /*!!!!!*/
+            }
+            sigprocmask(SIG_BLOCK, &stopSignals, NULL);
+            if (client_pipe_fd == -1 && (workerStop || requestsServed >= WORKER_RECYCLE_REQUESTS)) {
+                if (workerStop == SIGUSR1) {
+                    exit(EXIT_SUCCESS);
+                }
+                exit(WORKER_EXIT_RETIRED | (dataRing != NULL ? WORKER_SESSION_SHM : 0) |
+                     (compressMode ? WORKER_SESSION_COMPRESS : 0));
+            }
+            if (client_pipe_fd == -1 && errno == EINTR) {
+                continue;
+            }
             if (client_pipe_fd == -1) {
                 perror("open failed for client FIFO");
                 exit(EXIT_FAILURE);
             }
+            requestsServed++;
             char request[256]={0};
-            ssize_t bytes_read = read(client_pipe_fd, request, sizeof(request));
+            ssize_t bytes_read = read(client_pipe_fd, request, sizeof(request) - 1);
             if (bytes_read == -1) {
                 perror("read failed from client FIFO");
                 close(client_pipe_fd);
                 exit(EXIT_FAILURE);
             }
+            if (bytes_read == 0) {
+                close(client_pipe_fd); // Writer came and went without a request
+                continue;
+            }
             request[bytes_read] = '\0';  // Null-terminate the request string
+            if (myMetrics != NULL) {
+                metrics_bytes(&myMetrics->bytesIn, bytes_read);
+            }
+            int command = metrics_command(request);
+            uint64_t startUs = metrics_now_us();
+
+            // An upload request is sent with its terminating NUL and may arrive in the same read
+            // as the start of the payload, keep those bytes for handle_upload_command and
+            // handle_mupload_command
+            size_t requestLen = strlen(request);
+            pendingInputLen = 0;
+            if ((size_t)bytes_read > requestLen + 1) {
+                pendingInputLen = bytes_read - requestLen - 1;
+                memcpy(pendingInput, request + requestLen + 1, pendingInputLen);
+            }
 
             if (strncmp(request, "upload ", 7) == 0) {
                 dprintf(logFile, "Client PID %d requested: %s\n", clientPID, request);
-                handle_upload_command(client_pipe_fd, request);
+                handle_upload_command(client_pipe_fd, request);   // Closes client_pipe_fd
+                metrics_record(command, startUs);
+                continue;
+            }
+            else if (strcmp(request, "mupload") == 0) {
+                dprintf(logFile, "Client PID %d requested: %s\n", clientPID, request);
+                handle_mupload_command(client_pipe_fd);   // Closes client_pipe_fd
+                metrics_record(command, startUs);
+                continue;
             }
             else if (strncmp(request, "download ", 9) == 0) {
                 dprintf(logFile, "Client PID %d requested: %s\n", clientPID, request);
-                handle_download_command(client_pipe_fd, request);
+                handle_download_command(client_pipe_fd, request);   // Closes client_pipe_fd
+                metrics_record(command, startUs);
+                continue;
             }
             else if (strncmp(request, "quit", 4) == 0) {
                 dprintf(logFile, "Client PID %d requested: %s\n", clientPID, request);
@@ -202,13 +1132,19 @@ void handle_client_connection(int clientPID) {
                 unlink(clientFIFO);
             }
             else{
+                // Drop our read end first, so opening the FIFO for the response waits until
+                // the client is reading and the response can never be discarded unread
+                close(client_pipe_fd);
                 handle_client_request(clientPID, request,clientFIFO);   // Handle client's request
+                metrics_record(command, startUs);
+                continue;
             }
             close(client_pipe_fd);
         }
         // Kill the child process
         kill(getpid(), SIGTERM);
     }
+    return pid;
 }
 
 // Function to handle client request
@@ -223,147 +1159,201 @@ void handle_client_request(int clientPID, char *request,char *clientFIFO) {
 
     // Parse client's request
     if (strcmp(request, "help") == 0) {
-        char helpMsg[] = "Available commands are:\n help, list, readF, writeT, upload, download, archServer, quit, killServer\n";
-        write(clientFifoFd, helpMsg, strlen(helpMsg));
+        char helpMsg[] = "Available commands are:\n help, list, readF, writeT, upload, download, stat, have, mupload, mdownload, mreadF, archServer, stats, transport, compress, quit, killServer\n";
+        client_write(clientFifoFd, helpMsg, strlen(helpMsg));
         //dprintf(logFile, "%s", helpMsg);
     }
     else if(strcmp(request, "help list") == 0){
-        write(clientFifoFd, "list\n    sends a request to display the list of files in Servers directory(also displays the list received from the Server)\n", 125);
+        char listHelp[] = "list [page] [pageSize]\n    sends a request to display the list of files in Servers directory with their sizes and modification times(also displays the list received from the Server)\n"
+                          "    with a page number only that page of the sorted listing is sent (default page size 100)\n";
+        client_write(clientFifoFd, listHelp, strlen(listHelp));
     }
     else if(strcmp(request, "help readF") == 0){
-        write(clientFifoFd, "readF <file> <line #>\n    requests to display the # line of the <file>, if no line number is given the whole contents of the file is requested (and displayed on the client side)\n", 179);
+        client_write(clientFifoFd, "readF <file> <line #>\n    requests to display the # line of the <file>, if no line number is given the whole contents of the file is requested (and displayed on the client side)\n", 179);
     }
     else if(strcmp(request, "help writeT") == 0){
-        write(clientFifoFd, "writeT <file> <line #> <string>\n    request to write the content of “string” to the #th line the <file>, if the line # is not given writes to the end of file. If the file does not exists in Servers directory creates and edits the file at the same time\n", 257);
+        char writeTHelp[] = "writeT [-r] <file> <line #> <string>\n    request to write the content of “string” to the #th line the <file>, if the line # is not given writes to the end of file. If the file does not exists in Servers directory creates and edits the file at the same time\n"
+                            "    the string is inserted before the current #th line, -r replaces that line instead\n";
+        client_write(clientFifoFd, writeTHelp, strlen(writeTHelp));
     }
     else if(strcmp(request, "help upload") == 0){
-        write(clientFifoFd, "upload <file>\n    uploads the file from the current working directory of client to the Servers directory(beware of the cases no file in clients current working directory and file with the same name on Servers side)\n", 216);
+        char uploadHelp[] = "upload <file>\n    uploads the file from the current working directory of client to the Servers directory(beware of the cases no file in clients current working directory and file with the same name on Servers side)\n"
+                            "    an interrupted upload is resumed from the bytes the server already stored,\n"
+                            "    content the server already has is not sent again\n";
+        client_write(clientFifoFd, uploadHelp, strlen(uploadHelp));
     }
     else if(strcmp(request, "help download") == 0){
-        write(clientFifoFd, "download <file>\n    request to receive <file> from Servers directory to client side\n", 85);
+        char downloadHelp[] = "download <file> [channels]\n    request to receive <file> from Servers directory to client side\n"
+                              "    an interrupted download is resumed, with channels > 1 ranges of the file are fetched in parallel\n";
+        client_write(clientFifoFd, downloadHelp, strlen(downloadHelp));
+    }
+    else if(strcmp(request, "help mupload") == 0){
+        char batchHelp[] = "mupload <file|dir|pattern>...\n    uploads many files in one stream, a directory uploads the regular files in it\n";
+        client_write(clientFifoFd, batchHelp, strlen(batchHelp));
+    }
+    else if(strcmp(request, "help mdownload") == 0){
+        char batchHelp[] = "mdownload <pattern>...\n    downloads every server file matching one of the patterns (*, ? and [] wildcards) in one stream\n";
+        client_write(clientFifoFd, batchHelp, strlen(batchHelp));
+    }
+    else if(strcmp(request, "help mreadF") == 0){
+        char batchHelp[] = "mreadF <pattern>...\n    display every server file matching one of the patterns, each behind a ==> name <== line\n";
+        client_write(clientFifoFd, batchHelp, strlen(batchHelp));
+    }
+    else if(strcmp(request, "help transport") == 0){
+        char transportHelp[] = "transport <shm|fifo>\n    carry upload, download and archServer data through shared memory, or through the FIFO (default)\n";
+        client_write(clientFifoFd, transportHelp, strlen(transportHelp));
+    }
+    else if(strcmp(request, "help compress") == 0){
+        char compressHelp[] = "compress <lz|off>\n    send upload, download and readF data compressed chunk by chunk, chunks that do not compress go raw\n";
+        client_write(clientFifoFd, compressHelp, strlen(compressHelp));
+    }
+    else if(strcmp(request, "help stats") == 0){
+        char statsHelp[] = "stats\n    request counts and latencies per command, admission queue waits and bytes per client\n";
+        client_write(clientFifoFd, statsHelp, strlen(statsHelp));
+    }
+    else if(strcmp(request, "help have") == 0){
+        char haveHelp[] = "have <sha256> <size> <file>\n    store <file> from content the server already has, answers linked or missing\n";
+        client_write(clientFifoFd, haveHelp, strlen(haveHelp));
+    }
+    else if(strcmp(request, "help stat") == 0){
+        char statHelp[] = "stat <file>\n    size of <file> on the server and of its unfinished upload (-1 if there is none)\n";
+        client_write(clientFifoFd, statHelp, strlen(statHelp));
     }
     else if(strcmp(request, "help archServer") == 0){
-        write(clientFifoFd, "archServer <fileName>.tar\n    Using fork, exec and tar utilities create a child process that will collect all the files currently available on the the Server side and store them in the <filename>.tar archive\n", 209);
+        char archHelp[] = "archServer <fileName>.tar\n    collect all the files currently available on the the Server side and stream them to the client as the <filename>.tar archive\n"
+                          "    use <fileName>.tar.gz (or .tgz) to get a gzip archive compressed on multiple threads\n";
+        client_write(clientFifoFd, archHelp, strlen(archHelp));
     }
     else if(strcmp(request, "help killServer") == 0){
-        write(clientFifoFd, "killServer\n   Send a kill request to the server\n", 49);
+        char helpMsg[] = "killServer\n   Shut the server down, requests already running finish first\n";
+        client_write(clientFifoFd, helpMsg, strlen(helpMsg));
     }
     else if(strcmp(request, "help quit") == 0){
-        write(clientFifoFd, "quit: Send write request to server side log file and quit\n", 59);
+        client_write(clientFifoFd, "quit: Send write request to server side log file and quit\n", 59);
     }
     else if(strcmp(request, "help help") == 0){
-        write(clientFifoFd, "display the list of possible client requests\n", 46);
+        client_write(clientFifoFd, "display the list of possible client requests\n", 46);
     }
-    else if (strcmp(request, "list") == 0) {
-        // TODO: Implement list command
-        char msg[2048]= {0};
-        DIR *dir = opendir(dirname);
-        if (dir == NULL) {
-            perror("opendir failed");
-            return;
-        }
-        // Read the directory entries
-        struct dirent *entry;
-        while ((entry = readdir(dir)) != NULL) {
-            // Skip "." and ".." entries
-            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-                continue;
-            }
-            // Concatenate the file name to the client message
-            strcat(msg, entry->d_name);
-            strcat(msg, "\n");
-        }
-        // Close the directory
-        closedir(dir);
-        write(clientFifoFd, msg, strlen(msg));
-
+    else if (strcmp(request, "list") == 0 || strncmp(request, "list ", 5) == 0) {
+        handle_list_command(clientFifoFd, request);
+    } else if (strncmp(request, "mdownload ", 10) == 0 || strncmp(request, "mreadF ", 7) == 0) {
+        handle_batch_send_command(clientFifoFd, request);
     } else if (strncmp(request, "readF", 5) == 0) {
         handle_readF_command(clientFifoFd, request);
     } else if (strncmp(request, "writeT", 6) == 0) {
         handle_writeT_command(clientFifoFd, request);
+    } else if (strncmp(request, "transport ", 10) == 0) {
+        handle_transport_command(clientFifoFd, request);
+    } else if (strcmp(request, "stats") == 0) {
+        handle_stats_command(clientFifoFd);
+    } else if (strncmp(request, "stat ", 5) == 0) {
+        handle_stat_command(clientFifoFd, request);
+    } else if (strncmp(request, "have ", 5) == 0) {
+        handle_have_command(clientFifoFd, request);
+    } else if (strncmp(request, "compress ", 9) == 0) {
+        handle_compress_command(clientFifoFd, request);
     } else if (strncmp(request, "upload", 6) == 0) {
     } else if (strncmp(request, "download", 8) == 0) {
     } else if (strncmp(request,"archServer", 10) == 0){
         char archive_name[1024];
         sscanf(request, "archServer %s", archive_name);
-        pid_t pid = fork();
-
-        if (pid < 0) {
-            perror("fork");
-            exit(-1);
-        } else if (pid == 0) {
-            //char *args[] = {"tar", "--exclude", archive_name, "-cf", archive_name, dirname, NULL};
-            char *args[] = {"tar", "-C", dirname, "--exclude", archive_name, "-cf", archive_name, ".", NULL};
-            execvp("tar", args);
-            perror("execvp");
-            exit(1);
+
+        // <name>.tar.gz / <name>.tgz selects the parallel compressed mode
+        size_t nameLen = strlen(archive_name);
+        int compress = (nameLen > 7 && strcmp(archive_name + nameLen - 7, ".tar.gz") == 0) ||
+                       (nameLen > 4 && strcmp(archive_name + nameLen - 4, ".tgz") == 0);
+
+        // Stream the archive directly into the client FIFO, no temporary tar file or child process
+        tar_stream *ts = malloc(sizeof(tar_stream));
+        if (ts == NULL) {
+            perror("malloc failed");
+            if (dataRing != NULL) {
+                shm_ring_finish(dataRing);
+            }
+            close(clientFifoFd);
+            return;
         }
-        else {
-            int status;
-            wait(&status);
-            char send_buffer[2000] = {0};
-            if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
-                DIR *dir = opendir(dirname);
-                struct dirent *entry;
-                int file_count = 0;
-                long total_bytes = 0;
-                struct stat st;
-
-                while ((entry = readdir(dir)) != NULL) {
-                    if (entry->d_type == DT_REG) { // If the entry is a regular file
-                        file_count++;
-                        stat(entry->d_name, &st);
-                        total_bytes += st.st_size;
-                    }
+        gz_pool *gz = NULL;
+        if (compress) {
+            long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+            gz = gz_pool_create(clientFifoFd, cpus > 0 ? (int)cpus : 1);
+            if (gz == NULL) {
+                perror("gz_pool_create failed");
+                free(ts);
+                if (dataRing != NULL) {
+                    shm_ring_finish(dataRing);
                 }
-                closedir(dir);
+                close(clientFifoFd);
+                return;
+            }
+        }
 
-                snprintf(send_buffer, sizeof(send_buffer), 
-                        "Archiving the current contents of the server...\n"
-                        "Creating archive directory...\n"
-                        "%d files downloaded ..%ld bytes transferred..\n"
-                        "Calling tar utility .. child PID %d\n"
-                        "Child returned with SUCCESS..\n"
-                        "Copying the archive file..\n"
-                        "Removing archive directory...\n"
-                        "SUCCESS Server side files are archived in \"%s\"\n", 
-                        file_count, total_bytes, getpid(), archive_name);
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int result = tar_stream_directory(ts, clientFifoFd, dirname, archive_name, gz);
+        int threads = gz != NULL ? gz->threadCount : 0;
+        size_t sentBytes = ts->streamBytes;
+        if (gz != NULL) {
+            if (gz_pool_finish(gz) == -1) {
+                result = -1;
+            }
+            sentBytes = gz->outBytes;
+        }
+        if (dataRing != NULL) {
+            shm_ring_finish(dataRing); // The client reads the ring up to here, then the FIFO
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        double mbPerSec = seconds > 0 ? ts->streamBytes / (1024.0 * 1024.0) / seconds : 0;
+
+        char send_buffer[2000] = {0};
+        if (result == 0) {
+            int len = snprintf(send_buffer, sizeof(send_buffer),
+                    "Archiving the current contents of the server...\n"
+                    "%d files archived ..%ld bytes transferred..\n"
+                    "Streaming tar archive from server PID %d\n",
+                    ts->fileCount, sentBytes, getpid());
+            if (compress) {
+                len += snprintf(send_buffer + len, sizeof(send_buffer) - len,
+                        "Compressed %ld -> %ld bytes (ratio %.2f) on %d threads, %.1f MB/s\n",
+                        ts->streamBytes, sentBytes,
+                        sentBytes > 0 ? (double)ts->streamBytes / sentBytes : 0.0, threads, mbPerSec);
             }
             else {
-                snprintf(send_buffer,sizeof(send_buffer),"Error creating archive (status: %d)\n", status);
+                len += snprintf(send_buffer + len, sizeof(send_buffer) - len, "%.1f MB/s\n", mbPerSec);
             }
-            //write(clientFifoFd,send_buffer,strlen(send_buffer));
-            write(STDOUT_FILENO,send_buffer,strlen(send_buffer));
-            // Use handle_download_command to send the file
-            char download_request[1200];
-            snprintf(download_request, sizeof(download_request), "download %s", archive_name);
-            handle_download_command2(clientFifoFd, download_request);
+            snprintf(send_buffer + len, sizeof(send_buffer) - len,
+                    "SUCCESS Server side files are archived in \"%s\"\n", archive_name);
         }
+        else {
+            snprintf(send_buffer, sizeof(send_buffer), "Error creating archive after %ld bytes\n", sentBytes);
+        }
+        write(STDOUT_FILENO, send_buffer, strlen(send_buffer));
+        dprintf(logFile, "%s", send_buffer);
+        free(gz);
+        free(ts);
         close(clientFifoFd);
     } else if (strncmp(request, "killServer", 10) == 0) {
         // Handle killServer request
         char msg[256];
         snprintf(msg, sizeof(msg), ">> killServer request received from client PID %d. Terminating...\n", clientPID);
         
-        write(clientFifoFd, "quit", 4);
+        client_write(clientFifoFd, "quit", 4);
         unlink(clientFIFO);
         write(logFile, msg, strlen(msg));
         write(STDOUT_FILENO, ">> kill signal from ", 20);
         write(STDOUT_FILENO, clientName, strlen(clientName));
         write(STDOUT_FILENO, ".. terminating...\n", 18);
-        write(STDOUT_FILENO, ">> bye\n", 7);
-        handle_kill_signal(SIGTERM);
-        kill(getppid(), SIGTERM);  // Send SIGTERM signal to parent process (the server)
-        // Clean up resources
-        sem_destroy(&sem);
+        close(clientFifoFd);
+        // The acceptor drains: other clients' requests finish before the server goes away
+        kill(getppid(), SIGTERM);
         exit(EXIT_SUCCESS);
 
     } else if (strcmp(request, "quit") == 0) {
         // Handle quit request
-        write(clientFifoFd, "quit", 4);
+        client_write(clientFifoFd, "quit", 4);
         printf(">> %s disconnected\n", clientName);
         dprintf(logFile, "%s disconnected..\n", clientName);
-        handle_child_termination(SIGTERM);
         unlink(clientFIFO);
     } else {
         // Invalid command
@@ -371,24 +1361,196 @@ void handle_client_request(int clientPID, char *request,char *clientFIFO) {
         snprintf(msg, sizeof(msg), "Invalid command from %s: %s\n", clientName, request);
         write(logFile, msg, strlen(msg));
         snprintf(msg, sizeof(msg), "   Invalid command: %s\n", request);
-        write(clientFifoFd, msg, strlen(msg));
+        client_write(clientFifoFd, msg, strlen(msg));
     }
     close(clientFifoFd);
 }
 
+static int dir_entry_compare(const void *a, const void *b) {
+    const dir_index_entry *ea = a;
+    const dir_index_entry *eb = b;
+    return strcmp(listIndex.names + ea->nameOffset, listIndex.names + eb->nameOffset);
+}
+
+// Drop the cached listing if anything changed in the directory since it was built
+static void dir_index_check(dir_index *index) {
+    if (!index->watching) {
+        index->watching = 1;
+        index->inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (index->inotifyFd != -1 &&
+            inotify_add_watch(index->inotifyFd, dirname, IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB |
+                              IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF) == -1) {
+            close(index->inotifyFd);
+            index->inotifyFd = -1;
+        }
+        index->valid = 0;
+        return;
+    }
+    if (index->inotifyFd == -1) {
+        index->valid = 0;
+        return;
+    }
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (read(index->inotifyFd, events, sizeof(events)) > 0) {
+        index->valid = 0; // Any event (including IN_Q_OVERFLOW) means rebuild
+    }
+}
+
+static int dir_index_rebuild(dir_index *index) {
+    DIR *dir = opendir(dirname);
+    if (dir == NULL) {
+        perror("opendir failed");
+        return -1;
+    }
+    index->count = 0;
+    index->namesUsed = 0;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        // Skip "." and ".." entries and the dedup store, its objects are listed under their names
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
+            strcmp(entry->d_name, STORE_DIR) == 0) {
+            continue;
+        }
+        size_t nameLen = strlen(entry->d_name) + 1;
+        if (index->count == index->capacity) {
+            size_t capacity = index->capacity ? index->capacity * 2 : 256;
+            dir_index_entry *entries = realloc(index->entries, capacity * sizeof(dir_index_entry));
+            if (entries == NULL) {
+                closedir(dir);
+                return -1;
+            }
+            index->entries = entries;
+            index->capacity = capacity;
+        }
+        if (index->namesUsed + nameLen > index->namesCapacity) {
+            size_t capacity = index->namesCapacity ? index->namesCapacity * 2 : 8192;
+            while (capacity < index->namesUsed + nameLen) {
+                capacity *= 2;
+            }
+            char *names = realloc(index->names, capacity);
+            if (names == NULL) {
+                closedir(dir);
+                return -1;
+            }
+            index->names = names;
+            index->namesCapacity = capacity;
+        }
+
+        dir_index_entry *e = &index->entries[index->count];
+        struct stat st;
+        if (fstatat(dirfd(dir), entry->d_name, &st, 0) == -1) {
+            memset(&st, 0, sizeof(st));
+        }
+        e->nameOffset = index->namesUsed;
+        e->size = st.st_size;
+        e->mtime = st.st_mtime;
+        memcpy(index->names + index->namesUsed, entry->d_name, nameLen);
+        index->namesUsed += nameLen;
+        index->count++;
+    }
+    closedir(dir);
+
+    qsort(index->entries, index->count, sizeof(dir_index_entry), dir_entry_compare);
+    index->valid = 1;
+    return 0;
+}
+
+// Write out a listing chunk, returns -1 when the client went away
+static int list_flush(int clientFifoFd, char *buffer, size_t *used) {
+    size_t off = 0;
+    while (off < *used) {
+        ssize_t written = client_write(clientFifoFd, buffer + off, *used - off);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        off += written;
+    }
+    *used = 0;
+    return 0;
+}
+
+// list streams every entry; list <page> [pageSize] sends one page of the sorted listing
+void handle_list_command(int clientFifoFd, const char* request) {
+    long page = 0;
+    long pageSize = LIST_PAGE_SIZE;
+    sscanf(request, "list %ld %ld", &page, &pageSize);
+    if (pageSize <= 0) {
+        pageSize = LIST_PAGE_SIZE;
+    }
+
+    dir_index_check(&listIndex);
+    if (!listIndex.valid && dir_index_rebuild(&listIndex) == -1) {
+        char errorMsg[] = "Error: Unable to list the server directory\n";
+        client_write(clientFifoFd, errorMsg, strlen(errorMsg));
+        return;
+    }
+
+    size_t first = 0;
+    size_t last = listIndex.count;
+    size_t pages = (listIndex.count + pageSize - 1) / pageSize;
+    if (page > 0) {
+        first = (page - 1) * pageSize;
+        if (first > listIndex.count) {
+            first = listIndex.count;
+        }
+        last = first + pageSize < listIndex.count ? first + pageSize : listIndex.count;
+    }
+
+    char *buffer = malloc(LIST_BUFFER_SIZE);
+    if (buffer == NULL) {
+        perror("malloc failed");
+        return;
+    }
+    size_t used = 0;
+    for (size_t i = first; i < last; i++) {
+        const dir_index_entry *e = &listIndex.entries[i];
+        char timeStr[32];
+        struct tm tmBuf;
+        strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M", localtime_r(&e->mtime, &tmBuf));
+
+        // Names are bounded by NAME_MAX so a line always fits after a flush
+        if (LIST_BUFFER_SIZE - used < NAME_MAX + 64 && list_flush(clientFifoFd, buffer, &used) == -1) {
+            free(buffer);
+            return;
+        }
+        used += snprintf(buffer + used, LIST_BUFFER_SIZE - used, "%-30s %12lld  %s\n",
+                         listIndex.names + e->nameOffset, (long long)e->size, timeStr);
+    }
+    if (page > 0) {
+        used += snprintf(buffer + used, LIST_BUFFER_SIZE - used, "-- page %ld/%zu (%zu files) --\n",
+                         page, pages, listIndex.count);
+    }
+    list_flush(clientFifoFd, buffer, &used);
+    free(buffer);
+}
+
+static ssize_t readF_write(framed_writer *fw, int clientFifoFd, const void *data, size_t len) {
+    return fw != NULL ? framed_writer_write(fw, data, len) : client_write(clientFifoFd, data, len);
+}
+
 void handle_readF_command(int clientFifoFd, const char* request) {
     char filename[256];
     int lineNum = -1;
     sscanf(request, "readF %s %d", filename, &lineNum);
+    // After "compress lz" the whole answer is one compressed stream
+    framed_writer *fw = compressMode ? framed_writer_create(clientFifoFd, 0) : NULL;
 
     // Acquire semaphore before opening the file
     sem_wait(&sem);
 
+    writeT_recover(filename); // Finish a line edit that was cut off, if any
     FILE *file = fopen(filename, "r");
     if (file == NULL) {
         char errorMsg[512];
         snprintf(errorMsg, sizeof(errorMsg), "Error opening file: %s\n", filename);
-        write(clientFifoFd, errorMsg, strlen(errorMsg));
+        readF_write(fw, clientFifoFd, errorMsg, strlen(errorMsg));
+        if (fw != NULL) {
+            framed_writer_finish(fw);
+        }
 
         // Release semaphore on error
         sem_post(&sem);
@@ -405,9 +1567,12 @@ void handle_readF_command(int clientFifoFd, const char* request) {
             if (currentLine == lineNum) {
                 // Write the line to the client FIFO
                 size_t len = strlen(lineBuffer);
-                if (write(clientFifoFd, lineBuffer, len) != len) {
+                if (readF_write(fw, clientFifoFd, lineBuffer, len) != len) {
                     perror("write failed");
                     fclose(file);
+                    if (fw != NULL) {
+                        framed_writer_finish(fw);
+                    }
 
                     // Release semaphore on error
                     sem_post(&sem);
@@ -422,16 +1587,19 @@ void handle_readF_command(int clientFifoFd, const char* request) {
             // If the specified line number is out of range, report an error
             char errorMsg[512];
             snprintf(errorMsg, sizeof(errorMsg), "Line %d not found in file: %s\n", lineNum, filename);
-            write(clientFifoFd, errorMsg, strlen(errorMsg));
+            readF_write(fw, clientFifoFd, errorMsg, strlen(errorMsg));
         }
     } else {
         // Read and send the entire file in chunks
-        char buffer[4096];
+        char buffer[TRANSFER_CHUNK];
         ssize_t bytes_read;
         while ((bytes_read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
-            if (write(clientFifoFd, buffer, bytes_read) != bytes_read) {
+            if (readF_write(fw, clientFifoFd, buffer, bytes_read) != bytes_read) {
                 perror("write failed");
                 fclose(file);
+                if (fw != NULL) {
+                    framed_writer_finish(fw);
+                }
                 // Release semaphore on error
                 sem_post(&sem);
                 return;
@@ -440,261 +1608,1726 @@ void handle_readF_command(int clientFifoFd, const char* request) {
     }
 
     fclose(file);
+    if (fw != NULL) {
+        framed_writer_finish(fw);
+    }
     // Release semaphore after finishing file operations
     sem_post(&sem);
 }
-// got error doesnt work for first line
-void handle_writeT_command(int clientFifoFd, const char* request) {
-    char filename[1000];
-    int lineNum = -1;
-    char content[1000];
 
-    //if linenum entered -1 it means write to the end of the file
-    sscanf(request, "writeT %s %d %[^\n]", filename, &lineNum, content);
+// Line edits rewrite only the file from the edited line on. The new tail is first written to a
+// redo journal next to the file (.<name>.wtj), so an edit cut off during the in-place rewrite is
+// finished by the next writeT or readF of the file. Workers serialize on flock() of the file.
+typedef struct {
+    char magic[4];
+    int32_t reserved;
+    int64_t offset; // Where the journaled bytes go, the file ends right after them
+    int64_t length;
+} writeT_journal;
+
+#define WRITET_JOURNAL_MAGIC "WTJ1"
+
+static void writeT_journal_path(const char *filename, char *path, size_t size, const char *suffix) {
+    const char *base = strrchr(filename, '/');
+    base = base ? base + 1 : filename;
+    snprintf(path, size, "%.*s.%s.wtj%s", (int)(base - filename), filename, base, suffix);
+}
 
-    // Acquire semaphore before opening or modifying the file
-    sem_wait(&sem);
-    FILE *file = fopen(filename, "r+");
-    if (file == NULL) {
-        // If the file does not exist, create it
-        file = fopen(filename, "w");
-        if (file == NULL) {
-            char errorMsg[1024];
-            snprintf(errorMsg, sizeof(errorMsg), "Error opening file: %s\n", filename);
-            write(clientFifoFd, errorMsg, strlen(errorMsg));
-
-            // Release semaphore on error
-            sem_post(&sem);
-            return;
-        }
+// Make a rename in the file's directory durable
+static void writeT_sync_dir(const char *filename) {
+    char dir[1024];
+    const char *base = strrchr(filename, '/');
+    snprintf(dir, sizeof(dir), "%.*s", base ? (int)(base - filename) + 1 : 1, base ? filename : ".");
+    int dirFd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (dirFd != -1) {
+        fsync(dirFd);
+        close(dirFd);
     }
+}
 
-    if (lineNum == -1) {
-        // If -1 number is given, append the string to the end of the file
-        fseek(file, 0, SEEK_END);
-    } else {
-        // If a line number is given, loop through the file line by line until you reach the specified line
-        char line[256];
-        int currentLineNum = -1;
-        while (fgets(line, sizeof(line), file) != NULL) {
-            currentLineNum++;
-            if (currentLineNum == lineNum-1) {
-                break;
-            }
+// Copy length bytes between two descriptors at the given offsets
+static int writeT_copy(int from, off_t fromOffset, int to, off_t toOffset, int64_t length) {
+    char buffer[TRANSFER_CHUNK];
+    while (length > 0) {
+        size_t want = length < (int64_t)sizeof(buffer) ? length : sizeof(buffer);
+        ssize_t got = pread(from, buffer, want, fromOffset);
+        if (got <= 0 || pwrite(to, buffer, got, toOffset) != got) {
+            return -1;
         }
+        fromOffset += got;
+        toOffset += got;
+        length -= got;
     }
-    // Write the string to the file
-    fputs(content, file);
-    fputs("\n", file);
-
-    fclose(file);
-
-    // Release semaphore after finishing file operations
-    sem_post(&sem);
+    return 0;
 }
 
-void handle_upload_command(int clientFifoFd, const char* request) {
-    char filename[256];
-    sscanf(request, "upload %s", filename); // Extract filename from the request
-
-    // Acquire semaphore before file operations
-    sem_wait(&sem);
-
-    // Check if file already exists in the server's directory
-    if (access(filename, F_OK) != -1) {
-        char errorMsg[300];
-        snprintf(errorMsg, sizeof(errorMsg), "Error: File %s already exists on the server.\n", filename);
-        write(clientFifoFd, errorMsg, strlen(errorMsg));
-        // Release semaphore on error
-        sem_post(&sem);
-        return;
+// Apply a committed journal to fd (locked by the caller), then drop it. Applying twice is harmless.
+static int writeT_replay(const char *filename, int fd) {
+    char journalPath[1100];
+    writeT_journal_path(filename, journalPath, sizeof(journalPath), "");
+    int journalFd = open(journalPath, O_RDONLY);
+    if (journalFd == -1) {
+        return errno == ENOENT ? 0 : -1;
     }
+    writeT_journal header;
+    struct stat st;
+    int result = -1;
+    if (pread(journalFd, &header, sizeof(header), 0) == sizeof(header) && fstat(journalFd, &st) == 0 &&
+        memcmp(header.magic, WRITET_JOURNAL_MAGIC, 4) == 0 &&
+        st.st_size == (off_t)sizeof(header) + header.length &&
+        writeT_copy(journalFd, sizeof(header), fd, header.offset, header.length) == 0 &&
+        ftruncate(fd, header.offset + header.length) == 0 && fdatasync(fd) == 0) {
+        result = 0;
+    }
+    close(journalFd);
+    if (result == 0) {
+        unlink(journalPath);
+    }
+    return result;
+}
 
-    // Open the file for writing on the server
-    FILE *file = fopen(filename, "wb");
-    if (file == NULL) {
-        char errorMsg[300];
-        snprintf(errorMsg, sizeof(errorMsg), "Error opening file: %s\n", filename);
-        write(clientFifoFd, errorMsg, strlen(errorMsg));
-        // Release semaphore on error
-        sem_post(&sem);
+// Finish a cut off edit of filename, used before reading a file
+static void writeT_recover(const char *filename) {
+    char journalPath[1100];
+    writeT_journal_path(filename, journalPath, sizeof(journalPath), "");
+    if (access(journalPath, F_OK) == -1) {
         return;
     }
+    int fd = open(filename, O_RDWR);
+    if (fd != -1) {
+        flock(fd, LOCK_EX);
+        writeT_replay(filename, fd);
+        close(fd); // Releases the lock
+    }
+}
 
-    // Read the file size from the client
-    size_t fileSize;
-    if (read(clientFifoFd, &fileSize, sizeof(fileSize)) != sizeof(fileSize)) {
-        char errorMsg[300];
-        snprintf(errorMsg, sizeof(errorMsg), "Error reading file size from client FIFO\n");
-        write(clientFifoFd, errorMsg, strlen(errorMsg));
-        fclose(file);
-        // Release semaphore on error
-        sem_post(&sem);
-        return;
+// Give filename its own copy of data it shares with other names through the dedup store
+static int writeT_unshare(const char *filename, int fd, off_t size) {
+    char tmpPath[1100];
+    writeT_journal_path(filename, tmpPath, sizeof(tmpPath), ".cow");
+    int copyFd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (copyFd == -1) {
+        return -1;
+    }
+    int result = writeT_copy(fd, 0, copyFd, 0, size);
+    close(copyFd);
+    if (result == -1 || rename(tmpPath, filename) == -1) {
+        unlink(tmpPath);
+        return -1;
     }
+    return 0;
+}
 
-    // Read the file data from the client and write it to the file
-    char buffer[4096];
-    size_t totalBytesRead = 0;
-    while (totalBytesRead < fileSize) {
-        ssize_t bytesRead = read(clientFifoFd, buffer, sizeof(buffer));
-        if (bytesRead <= 0) {
-            perror("Error reading file data from client FIFO");
-            fclose(file);
-            // Release semaphore on error
-            sem_post(&sem);
-            return;
+// Open filename for an edit and lock it, finishing a cut off edit first. An edit never goes
+// through to data shared with other names, and the locked inode is still the one the name refers to.
+static int writeT_open_locked(const char *filename) {
+    while (1) {
+        int fd = open(filename, O_RDWR | O_CREAT, 0666);
+        if (fd == -1) {
+            return -1;
         }
-        if (fwrite(buffer, 1, bytesRead, file) != bytesRead) {
-            perror("Error writing file data");
-            fclose(file);
-            // Release semaphore on error
-            sem_post(&sem);
-            return;
+        struct stat st;
+        struct stat named;
+        if (flock(fd, LOCK_EX) == -1 || fstat(fd, &st) == -1) {
+            close(fd);
+            return -1;
         }
-        totalBytesRead += bytesRead;
+        if (stat(filename, &named) == -1 || named.st_ino != st.st_ino || named.st_dev != st.st_dev) {
+            close(fd); // Another worker gave the name a private copy while we waited for the lock
+            continue;
+        }
+        if (st.st_nlink > 1) {
+            int result = writeT_unshare(filename, fd, st.st_size);
+            close(fd);
+            if (result == -1) {
+                return -1;
+            }
+            continue;
+        }
+        if (writeT_replay(filename, fd) == -1) {
+            close(fd);
+            return -1;
+        }
+        return fd;
     }
+}
 
-    // Close the file and inform the client of successful upload
-    fclose(file);
-    // Release semaphore after file operations
-    sem_post(&sem);
+// Byte offsets where line lineNum (1 based) starts and where the line after it starts.
+// Returns 0 when the file has fewer than lineNum lines.
+static int writeT_find_line(int fd, off_t fileSize, long lineNum, off_t *lineStart, off_t *nextLine) {
+    char buffer[TRANSFER_CHUNK];
+    long line = 1;
+    off_t offset = 0;
+    *lineStart = lineNum == 1 ? 0 : -1;
+    while (offset < fileSize) {
+        ssize_t got = pread(fd, buffer, sizeof(buffer), offset);
+        if (got <= 0) {
+            break;
+        }
+        char *p = buffer;
+        char *end = buffer + got;
+        while ((p = memchr(p, '\n', end - p)) != NULL) {
+            p++;
+            if (line == lineNum) {
+                *nextLine = offset + (p - buffer);
+                return 1;
+            }
+            line++;
+            if (line == lineNum) {
+                *lineStart = offset + (p - buffer);
+            }
+        }
+        offset += got;
+    }
+    if (*lineStart != -1 && *lineStart < fileSize) {
+        *nextLine = fileSize; // Last line without a newline
+        return 1;
+    }
+    return 0;
 }
 
-void handle_download_command(int clientFifoFd, const char* request) {
-    char filename[256];
-    sscanf(request, "download %s", filename); // Extract filename from the request
-    // Acquire semaphore before file operations
-    sem_wait(&sem);
-    // Open the file for reading
-    FILE *file = fopen(filename, "rb");
-    if (file == NULL) {
-        char errorMsg[300];
-        snprintf(errorMsg, sizeof(errorMsg), "Error opening file: %s\n", filename);
-        write(clientFifoFd, errorMsg, strlen(errorMsg));
-        // Release semaphore on error
-        sem_post(&sem);
-        return;
+// Replace the bytes from offset to the end of fd with content + '\n' + the file's bytes from tail on,
+// through the journal so the file is either the old or the new version after a crash
+static int writeT_rewrite(const char *filename, int fd, off_t offset, const char *content, off_t tail, off_t fileSize) {
+    char tmpPath[1100];
+    char journalPath[1100];
+    writeT_journal_path(filename, tmpPath, sizeof(tmpPath), ".tmp");
+    writeT_journal_path(filename, journalPath, sizeof(journalPath), "");
+    size_t contentLen = strlen(content);
+
+    int journalFd = open(tmpPath, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (journalFd == -1) {
+        return -1;
     }
-    close(clientFifoFd);
-    // Release semaphore on error
-    sem_post(&sem);
+    writeT_journal header = { WRITET_JOURNAL_MAGIC, 0, offset, (int64_t)contentLen + 1 + (fileSize - tail) };
+    int result = -1;
+    if (pwrite(journalFd, &header, sizeof(header), 0) == sizeof(header) &&
+        pwrite(journalFd, content, contentLen, sizeof(header)) == (ssize_t)contentLen &&
+        pwrite(journalFd, "\n", 1, sizeof(header) + contentLen) == 1 &&
+        writeT_copy(fd, tail, journalFd, sizeof(header) + contentLen + 1, fileSize - tail) == 0 &&
+        fdatasync(journalFd) == 0 && rename(tmpPath, journalPath) == 0) {
+        result = 0;
+    }
+    close(journalFd);
+    if (result == -1) {
+        unlink(tmpPath);
+        return -1;
+    }
+    // The journal is committed once its rename is durable, from here on the edit always completes
+    writeT_sync_dir(filename);
+    return writeT_replay(filename, fd);
+}
 
-    clientFifoFd = open(clientFIFO, O_WRONLY);
-    if(clientFifoFd == -1){
-        perror("open failed for client FIFO");
-        return;
+// Lock the log, taking over from a worker that died while holding it
+static void append_log_lock(void) {
+    if (pthread_mutex_lock(&appendLog->lock) == EOWNERDEAD) {
+        pthread_mutex_consistent(&appendLog->lock);
     }
+}
 
-    // Acquire semaphore before file operations
-    sem_wait(&sem);
+static int append_log_wait(append_log_file *slot) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 1;
+    int result = pthread_cond_timedwait(&slot->done, &appendLog->lock, &deadline);
+    if (result == EOWNERDEAD) {
+        pthread_mutex_consistent(&appendLog->lock);
+    }
+    // A leader killed mid write leaves its batch behind, count it as failed and carry on
+    if (slot->flushing && kill(slot->leader, 0) == -1 && errno == ESRCH) {
+        slot->flushing = 0;
+        slot->failedFrom = slot->writtenSeq + 1;
+        slot->failedTo = slot->flushingTo;
+        slot->writtenSeq = slot->flushingTo;
+        pthread_cond_broadcast(&slot->done);
+    }
+    return result;
+}
 
-    // Get the file sizes
-    fseek(file, 0, SEEK_SET);
-    size_t fileSize = 0;
-    char ch;
-    while (fread(&ch, 1, 1, file) == 1) {
-        fileSize++;
+// Write one batch of lines to filename, with the same lock and journal rules as writeT edits
+static int append_log_flush(const char *filename, const char *batch, size_t len, int sync) {
+    int fd = writeT_open_locked(filename);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat st;
+    int result = -1;
+    if (fstat(fd, &st) == 0) {
+        char last = '\n';
+        if (st.st_size > 0) {
+            pread(fd, &last, 1, st.st_size - 1);
+        }
+        off_t offset = st.st_size;
+        if (last != '\n' && pwrite(fd, "\n", 1, offset++) != 1) {
+            close(fd);
+            return -1;
+        }
+        if (pwrite(fd, batch, len, offset) == (ssize_t)len && (!sync || fdatasync(fd) == 0)) {
+            result = 0;
+        }
     }
-    rewind(file);  // Reset the file pointer to the beginning of the file
+    close(fd);
+    return result;
+}
 
-    // Read the file data and send it to the client
-    char buffer[4096]={0};
-    ssize_t bytes_read=0;
-    size_t totalBytesRead = 0;
-    while ((bytes_read = fread(buffer, 1, sizeof(buffer), file)) > 0 ) {
-        if (write(clientFifoFd, buffer, bytes_read) == -1) {
-            perror("write failed");
-            close(clientFifoFd);
-            fclose(file);
-            // Release semaphore on error
-            sem_post(&sem);
-            exit(EXIT_FAILURE);
+// Append content as a line of filename through the shared log, returns once the line is written
+static int append_log_write(const char *filename, const char *content) {
+    size_t len = strlen(content) + 1;
+    append_log_lock();
+
+    // Find the file's slot, or claim a free one
+    append_log_file *slot = NULL;
+    append_log_file *freeSlot = NULL;
+    for (int i = 0; i < APPEND_LOG_FILES && slot == NULL; i++) {
+        if (strcmp(appendLog->files[i].name, filename) == 0) {
+            slot = &appendLog->files[i];
+        } else if (freeSlot == NULL && appendLog->files[i].name[0] == '\0') {
+            freeSlot = &appendLog->files[i];
         }
-        totalBytesRead += bytes_read;
     }
-    //printf("totalBytesRead: %ld\n", totalBytesRead);
+    if (slot == NULL && (freeSlot == NULL || strlen(filename) >= sizeof(freeSlot->name))) {
+        pthread_mutex_unlock(&appendLog->lock);
+        char *line = malloc(len);
+        if (line == NULL) {
+            return -1;
+        }
+        memcpy(line, content, len - 1);
+        line[len - 1] = '\n';
+        int result = append_log_flush(filename, line, len, appendLog->sync);
+        free(line);
+        return result;
+    }
+    if (slot == NULL) {
+        slot = freeSlot;
+        snprintf(slot->name, sizeof(slot->name), "%s", filename);
+        slot->used = 0;
+    }
+    slot->users++;
 
-    fclose(file);
+    // Queue the line, waiting for the leader to take the buffer if it is full
+    while (slot->used + len > APPEND_LOG_BUFFER) {
+        if (!slot->flushing) {
+            break; // Nobody is draining it, becoming the leader below writes it out
+        }
+        append_log_wait(slot);
+    }
+    uint64_t seq = 0;
+    if (slot->used + len <= APPEND_LOG_BUFFER) {
+        memcpy(slot->buffer + slot->used, content, len - 1);
+        slot->buffer[slot->used + len - 1] = '\n';
+        slot->used += len;
+        seq = ++slot->nextSeq;
+    }
 
-    close(clientFifoFd);
-    // Release semaphore after file operations
-    sem_post(&sem);
+    int result = 0;
+    char *batch = NULL;
+    while (seq == 0 || slot->writtenSeq < seq) {
+        if (slot->flushing) {
+            append_log_wait(slot);
+            continue;
+        }
+        // Leader: take every queued line and write them together
+        if (batch == NULL && (batch = malloc(APPEND_LOG_BUFFER)) == NULL) {
+            result = -1;
+            break;
+        }
+        size_t batchLen = slot->used;
+        uint64_t batchFirst = slot->writtenSeq + 1;
+        uint64_t batchLast = slot->nextSeq;
+        memcpy(batch, slot->buffer, batchLen);
+        slot->used = 0;
+        slot->flushing = 1;
+        slot->leader = getpid();
+        slot->flushingTo = batchLast;
+        int sync = appendLog->sync;
+        pthread_mutex_unlock(&appendLog->lock);
+
+        int flushed = append_log_flush(filename, batch, batchLen, sync);
+
+        append_log_lock();
+        if (flushed == -1) {
+            slot->failedFrom = batchFirst;
+            slot->failedTo = batchLast;
+        }
+        appendLog->records += batchLast - batchFirst + 1;
+        appendLog->batches++;
+        slot->writtenSeq = batchLast;
+        slot->flushing = 0;
+        pthread_cond_broadcast(&slot->done);
+        if (seq == 0) {
+            // Our line did not fit before, there is room now
+            memcpy(slot->buffer + slot->used, content, len - 1);
+            slot->buffer[slot->used + len - 1] = '\n';
+            slot->used += len;
+            seq = ++slot->nextSeq;
+        }
+    }
+    if (seq != 0 && seq >= slot->failedFrom && seq <= slot->failedTo) {
+        result = -1;
+    }
+    if (--slot->users == 0 && slot->used == 0 && !slot->flushing) {
+        slot->name[0] = '\0';
+    }
+    pthread_mutex_unlock(&appendLog->lock);
+    free(batch);
+    return result;
 }
 
-void handle_download_command2(int clientFifoFd, const char* request) {
-    char filename[256];
-    sscanf(request, "download %s", filename); // Extract filename from the request
-
-    // Acquire semaphore before file operations
-    sem_wait(&sem);
-    // Open the file for reading
-    FILE *file = fopen(filename, "rb");
-    if (file == NULL) {
-        char errorMsg[300];
-        snprintf(errorMsg, sizeof(errorMsg), "Error opening file: %s\n", filename);
-        write(clientFifoFd, errorMsg, strlen(errorMsg));
-        // Release semaphore on error
-        sem_post(&sem);
-        return;
+// Shared between the acceptor and every worker it forks
+static append_log *append_log_create(int sync) {
+    append_log *log = mmap(NULL, sizeof(append_log), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (log == MAP_FAILED) {
+        return NULL;
     }
-    close(clientFifoFd);
-    // Release semaphore on error
-    sem_post(&sem);
+    pthread_mutexattr_t mutexAttr;
+    pthread_mutexattr_init(&mutexAttr);
+    pthread_mutexattr_setpshared(&mutexAttr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mutexAttr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&log->lock, &mutexAttr);
+    pthread_mutexattr_destroy(&mutexAttr);
+    pthread_condattr_t condAttr;
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setpshared(&condAttr, PTHREAD_PROCESS_SHARED);
+    for (int i = 0; i < APPEND_LOG_FILES; i++) {
+        pthread_cond_init(&log->files[i].done, &condAttr);
+    }
+    pthread_condattr_destroy(&condAttr);
+    log->sync = sync;
+    return log;
+}
 
-    FILE *fifo = fopen(clientFIFO, "wb");
-    if(fifo == NULL){
-        perror("fopen failed for client FIFO");
+// writeT [-r] <file> [<line #>] <string>: inserts string as line #, or replaces line # with -r.
+// Without a line number (or with -1) the string is appended as the last line.
+void handle_writeT_command(int clientFifoFd, const char* request) {
+    char filename[1000];
+    long lineNum = -1;
+    int replace = 0;
+    const char *p = request + 6;
+    p += strspn(p, " ");
+    if (strncmp(p, "-r ", 3) == 0) {
+        replace = 1;
+        p += 3 + strspn(p + 3, " ");
+    }
+    size_t nameLen = strcspn(p, " ");
+    if (nameLen == 0 || nameLen >= sizeof(filename)) {
+        char errorMsg[] = "Usage: writeT [-r] <file> [<line #>] <string>\n";
+        client_write(clientFifoFd, errorMsg, strlen(errorMsg));
         return;
     }
+    memcpy(filename, p, nameLen);
+    filename[nameLen] = '\0';
+    p += nameLen;
+    p += strspn(p, " ");
+    char *end;
+    long parsed = strtol(p, &end, 10);
+    if (end != p && (*end == ' ' || *end == '\0')) {
+        lineNum = parsed;
+        p = end + strspn(end, " ");
+    }
+    const char *content = p;
 
-    // Acquire semaphore before file operations
+    // Acquire semaphore before opening or modifying the file
     sem_wait(&sem);
-
-    // Read the file data and send it to the client
-    char buffer[4096]={0};
-    size_t bytes_read=0;
-    size_t totalBytesRead = 0;
-    while ((bytes_read = fread(buffer, 1, sizeof(buffer), file)) > 0 ) {
-        if (fwrite(buffer, 1, bytes_read, fifo) != bytes_read) {
-            perror("fwrite failed");
-            fclose(fifo);
-            fclose(file);
-            // Release semaphore on error
-            sem_post(&sem);
-            exit(EXIT_FAILURE);
+    // If the file does not exist, create it
+    int fd = writeT_open_locked(filename);
+    struct stat st;
+    char errorMsg[1200] = "";
+    if (fd == -1) {
+        snprintf(errorMsg, sizeof(errorMsg), "Error opening file: %s\n", filename);
+    }
+    else if (fstat(fd, &st) == -1) {
+        snprintf(errorMsg, sizeof(errorMsg), "Error: Unable to edit file: %s\n", filename);
+    }
+    else {
+        off_t lineStart = st.st_size;
+        off_t nextLine = st.st_size;
+        int found = lineNum > 0 && writeT_find_line(fd, st.st_size, lineNum, &lineStart, &nextLine);
+        if (replace && !found) {
+            snprintf(errorMsg, sizeof(errorMsg), "Line %ld not found in file: %s\n", lineNum, filename);
+        }
+        else if (!found && appendLog != NULL && strlen(content) < APPEND_LOG_BUFFER / 4) {
+            // Appends are batched with those of other workers, the log takes the lock itself
+            close(fd);
+            fd = -1;
+            if (append_log_write(filename, content) == -1) {
+                snprintf(errorMsg, sizeof(errorMsg), "Error writing file: %s\n", filename);
+            }
+        }
+        else if (!found) {
+            // Append: a single write of the new line, after a newline if the last line has none
+            char last = '\n';
+            if (st.st_size > 0) {
+                pread(fd, &last, 1, st.st_size - 1);
+            }
+            size_t contentLen = strlen(content);
+            char *line = malloc(contentLen + 2);
+            if (line == NULL) {
+                snprintf(errorMsg, sizeof(errorMsg), "Error: Unable to edit file: %s\n", filename);
+            }
+            else {
+                size_t len = 0;
+                if (last != '\n') {
+                    line[len++] = '\n';
+                }
+                memcpy(line + len, content, contentLen);
+                len += contentLen;
+                line[len++] = '\n';
+                if (pwrite(fd, line, len, st.st_size) != (ssize_t)len) {
+                    snprintf(errorMsg, sizeof(errorMsg), "Error writing file: %s\n", filename);
+                }
+                free(line);
+            }
+        }
+        else if (writeT_rewrite(filename, fd, lineStart, content, replace ? nextLine : lineStart, st.st_size) == -1) {
+            snprintf(errorMsg, sizeof(errorMsg), "Error writing file: %s\n", filename);
         }
-        totalBytesRead += bytes_read;
     }
-    //printf("totalBytesRead: %ld\n", totalBytesRead);
+    if (fd != -1) {
+        close(fd); // Releases the lock
+    }
+    if (errorMsg[0] != '\0') {
+        client_write(clientFifoFd, errorMsg, strlen(errorMsg));
+    }
 
-    fclose(file);
-    fclose(fifo);
-    // Release semaphore after file operations
+    // Release semaphore after finishing file operations
     sem_post(&sem);
 }
 
-void handle_sigint(int sig) {
-    // Log the received signal
-    if (getpid() == parentPID) {
-        // Log the received signal
-        write(STDOUT_FILENO, ">> Ctrl+C signal received. Exiting...\n", 39);
+// read() on the client FIFO that first hands out the bytes left over from the request read
+static ssize_t read_client(int fd, void *buf, size_t len) {
+    if (pendingInputLen > 0) {
+        size_t chunk = len < pendingInputLen ? len : pendingInputLen;
+        memcpy(buf, pendingInput, chunk);
+        memmove(pendingInput, pendingInput + chunk, pendingInputLen - chunk);
+        pendingInputLen -= chunk;
+        return chunk;
+    }
+    ssize_t got = read(fd, buf, len);
+    if (myMetrics != NULL) {
+        metrics_bytes(&myMetrics->bytesIn, got);
+    }
+    return got;
+}
 
-        char msg[256];
-        snprintf(msg, sizeof(msg), ">>Ctrl+C signal received. Exiting...\n");
+// Read exactly len bytes from the client FIFO
+static int read_client_full(int fd, void *buf, size_t len) {
+    char *dst = buf;
+    while (len > 0) {
+        ssize_t got = read_client(fd, dst, len);
+        if (got <= 0) {
+            return -1;
+        }
+        dst += got;
+        len -= got;
+    }
+    return 0;
+}
 
-        unlink(clientFIFO);
-        write(logFile, msg, strlen(msg));
+// Fill buf from the ring when the client uses one, else from the FIFO. Fewer bytes than asked
+// for only at the end of the data, -1 on errors.
+static ssize_t read_data(int fd, void *buf, size_t len) {
+    if (dataRing != NULL) {
+        ssize_t got = shm_ring_read(dataRing, buf, len, clientPID);
+        if (got > 0 && myMetrics != NULL) {
+            metrics_bytes(&myMetrics->bytesIn, got);
+        }
+        return got;
+    }
+    size_t got = 0;
+    while (got < len) {
+        ssize_t bytes = read_client(fd, (char *)buf + got, len - got);
+        if (bytes <= 0) {
+            return bytes == -1 && got == 0 ? -1 : (ssize_t)got;
+        }
+        got += bytes;
+    }
+    return got;
+}
 
-        handle_kill_signal(SIGTERM);
-            // Clean up resources
-        sem_destroy(&sem);
-        // Other cleanup code...
-        exit(EXIT_SUCCESS);
+// Answer the client on a fresh write end once our read end is closed, the open waits until
+// the client is reading so the message cannot be discarded
+static void send_response(int clientFifoFd, const char *msg) {
+    close(clientFifoFd);
+    int responseFd = open(clientFIFO, O_WRONLY);
+    if (responseFd == -1) {
+        perror("open failed for client FIFO");
+        return;
     }
+    client_write(responseFd, msg, strlen(msg));
+    close(responseFd);
 }
 
-// Main function
+// Content addressed store: every uploaded file is hashed while it is received and kept once in
+// STORE_DIR under its SHA-256. A name is a hard link to its object, so readers never see the store,
+// writeT gives a name a private copy before editing it, and objects no name links to any more are
+// removed when the server starts.
+static void store_object_path(const unsigned char *digest, char *path, size_t size) {
+    static const char hex[] = "0123456789abcdef";
+    char name[STORE_HASH_HEX + 1];
+    for (int i = 0; i < STORE_HASH_HEX / 2; i++) {
+        name[2 * i] = hex[digest[i] >> 4];
+        name[2 * i + 1] = hex[digest[i] & 15];
+    }
+    name[STORE_HASH_HEX] = '\0';
+    snprintf(path, size, "%s/%s", STORE_DIR, name);
+}
+
+static EVP_MD_CTX *store_hash_begin(void) {
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    if (ctx != NULL && EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) != 1) {
+        EVP_MD_CTX_free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+// Hash the first length bytes of fd, the part a resumed upload already stored
+static int store_hash_prefix(EVP_MD_CTX *ctx, int fd, off_t length) {
+    char buffer[TRANSFER_CHUNK];
+    off_t offset = 0;
+    while (offset < length) {
+        size_t want = length - offset < (off_t)sizeof(buffer) ? length - offset : sizeof(buffer);
+        ssize_t got = pread(fd, buffer, want, offset);
+        if (got <= 0) {
+            return -1;
+        }
+        EVP_DigestUpdate(ctx, buffer, got);
+        offset += got;
+    }
+    return 0;
+}
+
+// Publish a complete part file as name. Returns 1 when the content was already stored and name
+// now links to the existing object, 0 when the part file became name (and the object), -1 on error.
+static int store_commit(const char *partName, const char *name, EVP_MD_CTX *ctx) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    char objectPath[128];
+    if (ctx == NULL || EVP_DigestFinal_ex(ctx, digest, NULL) != 1) {
+        return rename(partName, name) == 0 ? 0 : -1;
+    }
+    store_object_path(digest, objectPath, sizeof(objectPath));
+    mkdir(STORE_DIR, 0700);
+    if (link(objectPath, name) == 0) {
+        unlink(partName);
+        return 1;
+    }
+    link(partName, objectPath); // Without the object the file is only not deduplicated
+    return rename(partName, name) == 0 ? 0 : -1;
+}
+
+// have <sha256> <size> <file>: link file to a stored object of that content, the client then
+// skips the upload
+void handle_have_command(int clientFifoFd, const char* request) {
+    char hash[STORE_HASH_HEX + 2];
+    char filename[256];
+    long long size;
+    const char *answer = "missing\n";
+    if (sscanf(request, "have %65s %lld %255s", hash, &size, filename) != 3 || strlen(hash) != STORE_HASH_HEX ||
+        strspn(hash, "0123456789abcdef") != STORE_HASH_HEX) {
+        answer = "Usage: have <sha256> <size> <file>\n";
+    }
+    else if (strchr(filename, '/') != NULL || access(filename, F_OK) == 0) {
+        answer = "exists\n"; // The upload itself reports why it cannot store the file
+    }
+    else {
+        char objectPath[128];
+        struct stat st;
+        snprintf(objectPath, sizeof(objectPath), "%s/%s", STORE_DIR, hash);
+        sem_wait(&sem);
+        if (stat(objectPath, &st) == 0 && S_ISREG(st.st_mode) && st.st_size == size && link(objectPath, filename) == 0) {
+            answer = "linked\n";
+            dprintf(logFile, "have: %s stored from %s, %lld bytes not transferred\n", filename, hash, size);
+        }
+        sem_post(&sem);
+    }
+    client_write(clientFifoFd, answer, strlen(answer));
+}
+
+// Drop objects that no name refers to any more
+static void store_sweep(void) {
+    DIR *dir = opendir(STORE_DIR);
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    int removed = 0;
+    while ((entry = readdir(dir)) != NULL) {
+        struct stat st;
+        if (entry->d_name[0] != '.' && fstatat(dirfd(dir), entry->d_name, &st, 0) == 0 && st.st_nlink == 1 &&
+            unlinkat(dirfd(dir), entry->d_name, 0) == 0) {
+            removed++;
+        }
+    }
+    closedir(dir);
+    if (removed > 0) {
+        dprintf(logFile, "store: removed %d unreferenced objects\n", removed);
+    }
+}
+
+// Takes ownership of clientFifoFd: the payload is always consumed, then the result is sent back.
+// Data goes to <file>.part, whose size is the acknowledged resume point if the client goes away.
+void handle_upload_command(int clientFifoFd, const char* request) {
+    char filename[256];
+    char partName[300];
+    char msg[600];
+    long long offset = 0;
+    sscanf(request, "upload %255s %lld", filename, &offset); // Extract filename from the request
+    snprintf(partName, sizeof(partName), "%s" PART_SUFFIX, filename);
+
+    // Read the file size from the client
+    size_t fileSize;
+    if (read_client_full(clientFifoFd, &fileSize, sizeof(fileSize)) == -1) {
+        send_response(clientFifoFd, "Error reading file size from client FIFO\n");
+        return;
+    }
+
+    // Acquire semaphore before file operations
+    sem_wait(&sem);
+
+    int fd = -1;
+    struct stat st;
+    // Check if file already exists in the server's directory
+    if (access(filename, F_OK) != -1) {
+        snprintf(msg, sizeof(msg), "Error: File %s already exists on the server.\n", filename);
+    }
+    else if (offset < 0 || (size_t)offset > fileSize) {
+        snprintf(msg, sizeof(msg), "Error: invalid upload offset %lld for %s\n", offset, filename);
+    }
+    // Open the partial file, a resumed upload has to continue exactly where the stored data ends
+    else if ((fd = open(partName, O_RDWR | O_CREAT | (offset == 0 ? O_TRUNC : 0), 0666)) == -1) {
+        snprintf(msg, sizeof(msg), "Error opening file: %s\n", filename);
+    }
+    else if (fstat(fd, &st) == -1 || st.st_size != offset) {
+        snprintf(msg, sizeof(msg), "Error: upload of %s must resume at byte %lld\n", filename,
+                 fstat(fd, &st) == -1 ? 0LL : (long long)st.st_size);
+        close(fd);
+        fd = -1;
+    }
+    // The content is hashed on its way in, for the dedup store
+    EVP_MD_CTX *hash = NULL;
+    if (fd != -1 && (hash = store_hash_begin()) != NULL && offset > 0 && store_hash_prefix(hash, fd, offset) == -1) {
+        EVP_MD_CTX_free(hash);
+        hash = NULL;
+    }
+
+    // Read the file data from the client and append it to the part file, or just drain it on error
+    char buffer[TRANSFER_CHUNK];
+    size_t remaining = fileSize - (offset > 0 && (size_t)offset <= fileSize ? (size_t)offset : 0);
+    size_t totalBytesRead = 0;
+    if (compressMode) {
+        // Compressed frames from the ring until the client ends its stream, or remaining bytes from the FIFO
+        char *raw = malloc(CHUNK_RAW_MAX);
+        int complete = 0;
+        while (raw != NULL && (dataRing != NULL || totalBytesRead < remaining)) {
+            chunk_frame frame;
+            ssize_t got = read_data(clientFifoFd, &frame, sizeof(frame));
+            if (got == 0 && dataRing != NULL) {
+                complete = 1;
+                break;
+            }
+            ssize_t rawLen = -1;
+            if (got == sizeof(frame) && frame.storedLen <= sizeof(buffer) &&
+                read_data(clientFifoFd, buffer, frame.storedLen) == frame.storedLen) {
+                rawLen = chunk_decode(&frame, buffer, raw);
+            }
+            if (rawLen == -1) {
+                perror("Error reading file data from client");
+                break;
+            }
+            size_t use = remaining - totalBytesRead < (size_t)rawLen ? remaining - totalBytesRead : (size_t)rawLen;
+            if (use > 0 && fd != -1 && pwrite(fd, raw, use, offset + totalBytesRead) != (ssize_t)use) {
+                perror("Error writing file data");
+                snprintf(msg, sizeof(msg), "Error writing file: %s\n", filename);
+                close(fd);
+                fd = -1;
+            }
+            if (use > 0 && hash != NULL) {
+                EVP_DigestUpdate(hash, raw, use);
+            }
+            totalBytesRead += use;
+        }
+        if (!complete && dataRing != NULL) {
+            const void *area;
+            ssize_t available;
+            while ((available = shm_ring_peek(dataRing, &area, clientPID)) > 0) {
+                shm_ring_consume(dataRing, available); // Skip the rest of a broken stream
+            }
+        }
+        free(raw);
+        if (totalBytesRead < remaining) {
+            snprintf(msg, sizeof(msg), "Upload of %s interrupted, %lld bytes stored\n", filename,
+                     offset + (long long)totalBytesRead);
+        }
+    }
+    else if (dataRing != NULL) {
+        // Store straight out of the shared ring until the client ends its stream
+        const void *area;
+        ssize_t available;
+        while ((available = shm_ring_peek(dataRing, &area, clientPID)) > 0) {
+            size_t use = remaining - totalBytesRead < (size_t)available ? remaining - totalBytesRead : (size_t)available;
+            if (use > 0 && fd != -1 && pwrite(fd, area, use, offset + totalBytesRead) != (ssize_t)use) {
+                perror("Error writing file data");
+                snprintf(msg, sizeof(msg), "Error writing file: %s\n", filename);
+                close(fd);
+                fd = -1;
+            }
+            if (use > 0 && hash != NULL) {
+                EVP_DigestUpdate(hash, area, use);
+            }
+            totalBytesRead += use;
+            shm_ring_consume(dataRing, available);
+            if (myMetrics != NULL) {
+                metrics_bytes(&myMetrics->bytesIn, available);
+            }
+        }
+        if (totalBytesRead < remaining) {
+            snprintf(msg, sizeof(msg), "Upload of %s interrupted, %lld bytes stored\n", filename,
+                     offset + (long long)totalBytesRead);
+        }
+    }
+    while (!compressMode && dataRing == NULL && totalBytesRead < remaining) {
+        size_t want = remaining - totalBytesRead < sizeof(buffer) ? remaining - totalBytesRead : sizeof(buffer);
+        ssize_t bytesRead = read_client(clientFifoFd, buffer, want);
+        if (bytesRead <= 0) {
+            perror("Error reading file data from client FIFO");
+            snprintf(msg, sizeof(msg), "Upload of %s interrupted, %lld bytes stored\n", filename,
+                     offset + (long long)totalBytesRead);
+            break;
+        }
+        // Plain write(), not stdio, so the part file never holds less than what was received
+        if (fd != -1 && pwrite(fd, buffer, bytesRead, offset + totalBytesRead) != bytesRead) {
+            perror("Error writing file data");
+            snprintf(msg, sizeof(msg), "Error writing file: %s\n", filename);
+            close(fd);
+            fd = -1;
+        }
+        if (hash != NULL) {
+            EVP_DigestUpdate(hash, buffer, bytesRead);
+        }
+        totalBytesRead += bytesRead;
+    }
+
+    // Close the file and inform the client of successful upload
+    if (fd != -1) {
+        close(fd);
+        if (totalBytesRead == remaining) {
+            int stored = store_commit(partName, filename, hash);
+            if (stored == 1) {
+                snprintf(msg, sizeof(msg), "File %s uploaded, %zu bytes received, content already stored once\n",
+                         filename, totalBytesRead);
+            }
+            else if (stored == 0) {
+                snprintf(msg, sizeof(msg), "File %s uploaded, %zu bytes received\n", filename, totalBytesRead);
+            }
+            else {
+                snprintf(msg, sizeof(msg), "Error storing file: %s\n", filename);
+            }
+        }
+    }
+    EVP_MD_CTX_free(hash);
+    // Release semaphore after file operations
+    sem_post(&sem);
+    send_response(clientFifoFd, msg);
+}
+
+// stat <file>: sizes of the stored file and of an unfinished upload, -1 when absent
+void handle_stat_command(int clientFifoFd, const char* request) {
+    char filename[256];
+    char partName[300];
+    if (sscanf(request, "stat %255s", filename) != 1) {
+        char errorMsg[] = "Usage: stat <file>\n";
+        client_write(clientFifoFd, errorMsg, strlen(errorMsg));
+        return;
+    }
+    snprintf(partName, sizeof(partName), "%s" PART_SUFFIX, filename);
+
+    struct stat st;
+    long long size = stat(filename, &st) == 0 ? (long long)st.st_size : -1;
+    long long partSize = stat(partName, &st) == 0 ? (long long)st.st_size : -1;
+    char msg[64];
+    snprintf(msg, sizeof(msg), "%lld %lld\n", size, partSize);
+    client_write(clientFifoFd, msg, strlen(msg));
+}
+
+// Buffered reads for batch streams, so a run of small files costs a few large FIFO reads
+typedef struct {
+    int fd;
+    size_t pos;
+    size_t len;
+    char data[TRANSFER_CHUNK];
+} batch_reader;
+
+static int batch_read_full(batch_reader *br, void *buf, size_t len) {
+    char *dst = buf;
+    while (len > 0) {
+        if (br->pos == br->len) {
+            ssize_t got = read_client(br->fd, br->data, sizeof(br->data));
+            if (got <= 0) {
+                return -1;
+            }
+            br->pos = 0;
+            br->len = got;
+        }
+        size_t chunk = br->len - br->pos < len ? br->len - br->pos : len;
+        memcpy(dst, br->data + br->pos, chunk);
+        br->pos += chunk;
+        dst += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+// Append one line to a summary, once it is full only the count of dropped lines grows
+static void batch_note(char *summary, size_t size, size_t *used, int *dropped, const char *name, const char *reason) {
+    int len = snprintf(summary + *used, size - *used, "  skipped %s: %s\n", name, reason);
+    if (len < 0 || (size_t)len >= size - *used - 64) {
+        summary[*used] = '\0';
+        (*dropped)++;
+        return;
+    }
+    *used += len;
+}
+
+// Takes ownership of clientFifoFd. Reads frames until the terminating one; the client does not
+// wait between files, so the whole batch is one FIFO open and a stream of large reads.
+void handle_mupload_command(int clientFifoFd) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    batch_reader *br = malloc(sizeof(batch_reader));
+    char *summary = malloc(8192);
+    if (br == NULL || summary == NULL) {
+        free(br);
+        free(summary);
+        send_response(clientFifoFd, "Error: out of memory\n");
+        return;
+    }
+    br->fd = clientFifoFd;
+    br->pos = 0;
+    br->len = 0;
+    size_t used = 0;
+    int dropped = 0;
+    int stored = 0;
+    int skipped = 0;
+    int64_t bytes = 0;
+    summary[0] = '\0';
+
+    sem_wait(&sem);
+    char buffer[TRANSFER_CHUNK];
+    int broken = 0;
+    while (!broken) {
+        batch_frame frame;
+        char name[256];
+        char partName[300];
+        if (batch_read_full(br, &frame, sizeof(frame)) == -1) {
+            broken = 1;
+            break;
+        }
+        if (frame.nameLen == 0) {
+            break;
+        }
+        // A name that cannot be right means the stream is out of sync, give up on the rest
+        if (frame.nameLen >= sizeof(name) || frame.size < 0 || batch_read_full(br, name, frame.nameLen) == -1) {
+            broken = 1;
+            break;
+        }
+        name[frame.nameLen] = '\0';
+
+        const char *reason = NULL;
+        int fd = -1;
+        if (strchr(name, '/') != NULL || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            reason = "invalid name";
+        }
+        else if (access(name, F_OK) != -1) {
+            reason = "already exists on the server";
+        }
+        else {
+            snprintf(partName, sizeof(partName), "%s" PART_SUFFIX, name);
+            fd = open(partName, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            if (fd == -1) {
+                reason = "cannot create file";
+            }
+        }
+        EVP_MD_CTX *hash = fd != -1 ? store_hash_begin() : NULL;
+
+        // Consume the data even for skipped files, the next frame follows it
+        int64_t remaining = frame.size;
+        while (remaining > 0) {
+            size_t want = remaining < (int64_t)sizeof(buffer) ? remaining : sizeof(buffer);
+            if (batch_read_full(br, buffer, want) == -1) {
+                broken = 1;
+                break;
+            }
+            if (fd != -1 && write(fd, buffer, want) != (ssize_t)want) {
+                reason = "write failed";
+                close(fd);
+                unlink(partName);
+                fd = -1;
+            }
+            if (hash != NULL) {
+                EVP_DigestUpdate(hash, buffer, want);
+            }
+            remaining -= want;
+        }
+        if (fd != -1) {
+            close(fd);
+            if (broken) {
+                unlink(partName);
+            }
+            else if (store_commit(partName, name, hash) != -1) {
+                EVP_MD_CTX_free(hash);
+                stored++;
+                bytes += frame.size;
+                continue;
+            }
+            else {
+                reason = "cannot store file";
+                unlink(partName);
+            }
+        }
+        EVP_MD_CTX_free(hash);
+        if (reason != NULL) {
+            skipped++;
+            batch_note(summary, 8192, &used, &dropped, name, reason);
+        }
+    }
+    sem_post(&sem);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    char *response = malloc(8192 + 256);
+    if (response == NULL) {
+        send_response(clientFifoFd, "Error: out of memory\n");
+    }
+    else {
+        snprintf(response, 8192 + 256, "%s%s%d files uploaded, %lld bytes received, %d skipped (%.0f files/s)\n",
+                 broken ? "Batch upload interrupted\n" : "", summary, stored, (long long)bytes, skipped,
+                 seconds > 0 ? stored / seconds : 0.0);
+        if (dropped > 0) {
+            size_t len = strlen(response);
+            snprintf(response + len, 8192 + 256 - len, "  (%d more skipped files not listed)\n", dropped);
+        }
+        dprintf(logFile, "%s", response);
+        send_response(clientFifoFd, response);
+        free(response);
+    }
+    free(summary);
+    free(br);
+}
+
+// Sorted listing entry for a name, or NULL
+static dir_index_entry *dir_index_find(dir_index *index, const char *name) {
+    size_t lo = 0;
+    size_t hi = index->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(index->names + index->entries[mid].nameOffset, name);
+        if (cmp == 0) {
+            return &index->entries[mid];
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+// Send one file of a batch into out, returns -1 when the client went away.
+// A file that shrinks after its frame went out is padded with zeros so the stream stays in sync.
+static int batch_send_file(int clientFifoFd, char *out, size_t *used, const char *name, int text, int64_t *bytes) {
+    int fd = open(name, O_RDONLY);
+    struct stat st;
+    if (fd != -1 && (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))) {
+        close(fd);
+        fd = -1;
+    }
+    if (text) {
+        if (*used + 300 > TRANSFER_CHUNK && list_flush(clientFifoFd, out, used) == -1) {
+            if (fd != -1) {
+                close(fd);
+            }
+            return -1;
+        }
+        *used += snprintf(out + *used, TRANSFER_CHUNK - *used, fd == -1 ? "==> %s: no such file <==\n" : "==> %s <==\n", name);
+        if (fd == -1) {
+            return 1;
+        }
+    }
+    else {
+        batch_frame frame = { fd == -1 ? 0 : st.st_size, strlen(name), fd == -1 ? BATCH_MISSING : BATCH_OK };
+        if (*used + sizeof(frame) + frame.nameLen > TRANSFER_CHUNK && list_flush(clientFifoFd, out, used) == -1) {
+            if (fd != -1) {
+                close(fd);
+            }
+            return -1;
+        }
+        memcpy(out + *used, &frame, sizeof(frame));
+        memcpy(out + *used + sizeof(frame), name, frame.nameLen);
+        *used += sizeof(frame) + frame.nameLen;
+        if (fd == -1) {
+            return 1;
+        }
+    }
+
+    int64_t remaining = text ? INT64_MAX : st.st_size;
+    while (remaining > 0) {
+        if (*used == TRANSFER_CHUNK && list_flush(clientFifoFd, out, used) == -1) {
+            close(fd);
+            return -1;
+        }
+        size_t want = TRANSFER_CHUNK - *used;
+        if ((int64_t)want > remaining) {
+            want = remaining;
+        }
+        ssize_t got = read(fd, out + *used, want);
+        if (got <= 0) {
+            if (text) {
+                break;
+            }
+            memset(out + *used, 0, want);
+            got = want;
+        }
+        *used += got;
+        *bytes += got;
+        remaining -= got;
+    }
+    close(fd);
+    if (text && *used > 0 && out[*used - 1] != '\n') {
+        if (*used == TRANSFER_CHUNK && list_flush(clientFifoFd, out, used) == -1) {
+            return -1;
+        }
+        out[(*used)++] = '\n';
+    }
+    return 0;
+}
+
+// mdownload / mreadF <pattern>...: every regular file matching a pattern, in name order.
+// Small files are packed into shared 64 KB writes instead of one open/write/close each.
+void handle_batch_send_command(int clientFifoFd, const char* request) {
+    int text = strncmp(request, "mreadF ", 7) == 0;
+    char patternBuffer[256];
+    char *patterns[BATCH_MAX_PATTERNS];
+    int literal[BATCH_MAX_PATTERNS];
+    int patternCount = 0;
+    snprintf(patternBuffer, sizeof(patternBuffer), "%s", strchr(request, ' ') + 1);
+    char *save = NULL;
+    for (char *tok = strtok_r(patternBuffer, " \t", &save); tok != NULL && patternCount < BATCH_MAX_PATTERNS;
+         tok = strtok_r(NULL, " \t", &save)) {
+        literal[patternCount] = strpbrk(tok, "*?[") == NULL;
+        patterns[patternCount++] = tok;
+    }
+
+    dir_index_check(&listIndex);
+    char *out = malloc(TRANSFER_CHUNK);
+    if (out == NULL || (!listIndex.valid && dir_index_rebuild(&listIndex) == -1)) {
+        free(out);
+        if (text) {
+            char errorMsg[] = "Error: Unable to list the server directory\n";
+            client_write(clientFifoFd, errorMsg, strlen(errorMsg));
+        }
+        return; // mdownload: no terminating frame, the client reports a broken batch
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t used = 0;
+    int files = 0;
+    int missing = 0;
+    int64_t bytes = 0;
+    int result = 0;
+
+    // Plain names that are not in the directory are reported first
+    for (int i = 0; i < patternCount && result != -1; i++) {
+        if (literal[i] && dir_index_find(&listIndex, patterns[i]) == NULL) {
+            result = batch_send_file(clientFifoFd, out, &used, patterns[i], text, &bytes);
+            missing++;
+        }
+    }
+    for (size_t e = 0; e < listIndex.count && result != -1; e++) {
+        const char *name = listIndex.names + listIndex.entries[e].nameOffset;
+        int i = 0;
+        while (i < patternCount && fnmatch(patterns[i], name, 0) != 0) {
+            i++;
+        }
+        if (i == patternCount) {
+            continue;
+        }
+        result = batch_send_file(clientFifoFd, out, &used, name, text, &bytes);
+        if (result == 0) {
+            files++;
+        } else if (result == 1) {
+            missing++;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    if (result != -1) {
+        if (text) {
+            if (used + 128 > TRANSFER_CHUNK) {
+                result = list_flush(clientFifoFd, out, &used);
+            }
+            used += snprintf(out + used, TRANSFER_CHUNK - used, "-- %d files, %lld bytes, %d missing (%.0f files/s) --\n",
+                             files, (long long)bytes, missing, seconds > 0 ? files / seconds : 0.0);
+        }
+        else {
+            batch_frame last = { 0, 0, BATCH_OK };
+            if (used + sizeof(last) > TRANSFER_CHUNK) {
+                result = list_flush(clientFifoFd, out, &used);
+            }
+            memcpy(out + used, &last, sizeof(last));
+            used += sizeof(last);
+        }
+        if (result != -1) {
+            list_flush(clientFifoFd, out, &used);
+        }
+    }
+    dprintf(logFile, "%s: %d files, %lld bytes sent\n", text ? "mreadF" : "mdownload", files, (long long)bytes);
+    free(out);
+}
+
+// download <file> [offset [length]]: a range_header, then the requested bytes of the file
+void handle_download_command(int clientFifoFd, const char* request) {
+    char filename[256];
+    long long offset = 0;
+    long long length = 0;
+    sscanf(request, "download %255s %lld %lld", filename, &offset, &length); // Extract filename and range
+
+    // Open the file for reading
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    range_header header = { -1, 0, 0 };
+    if (fd != -1 && fstat(fd, &st) == 0) {
+        header.fileSize = st.st_size;
+        header.offset = offset < 0 ? 0 : (offset > st.st_size ? st.st_size : offset);
+        header.length = st.st_size - header.offset;
+        if (length > 0 && length < header.length) {
+            header.length = length;
+        }
+    }
+
+    // The client is waiting to read, so answer on a write end instead of our read end
+    close(clientFifoFd);
+    clientFifoFd = open(clientFIFO, O_WRONLY);
+    if(clientFifoFd == -1){
+        perror("open failed for client FIFO");
+        if (fd != -1) {
+            close(fd);
+        }
+        return;
+    }
+    if (client_write(clientFifoFd, &header, sizeof(header)) != sizeof(header) || header.fileSize == -1) {
+        if (fd != -1) {
+            close(fd);
+        }
+        close(clientFifoFd);
+        return;
+    }
+
+    long long sent = 0;
+    if (compressMode) {
+        // Compressed frames, through the ring when there is one
+        framed_writer *fw = framed_writer_create(clientFifoFd, 1);
+        char buffer[TRANSFER_CHUNK];
+        while (fw != NULL && sent < header.length) {
+            size_t want = header.length - sent < (long long)sizeof(buffer) ? header.length - sent : sizeof(buffer);
+            ssize_t bytes_read = pread(fd, buffer, want, header.offset + sent);
+            if (bytes_read <= 0 || framed_writer_write(fw, buffer, bytes_read) == -1) {
+                break; // File shrank or the client went away, it resumes from what it stored
+            }
+            sent += bytes_read;
+        }
+        if (fw != NULL) {
+            framed_writer_finish(fw);
+        }
+        if (dataRing != NULL) {
+            shm_ring_finish(dataRing);
+        }
+        close(fd);
+        close(clientFifoFd);
+        return;
+    }
+    if (dataRing != NULL) {
+        // Read the range straight into the shared ring, the FIFO only carried the header
+        while (sent < header.length) {
+            void *area;
+            ssize_t room = shm_ring_reserve(dataRing, &area, clientPID);
+            if (room == -1) {
+                break;
+            }
+            size_t want = header.length - sent < room ? header.length - sent : (size_t)room;
+            ssize_t bytes_read = pread(fd, area, want, header.offset + sent);
+            if (bytes_read <= 0) {
+                break; // File shrank, the client sees a short range and can retry from there
+            }
+            shm_ring_commit(dataRing, bytes_read);
+            if (myMetrics != NULL) {
+                metrics_bytes(&myMetrics->bytesOut, bytes_read);
+            }
+            sent += bytes_read;
+        }
+        shm_ring_finish(dataRing);
+        close(fd);
+        close(clientFifoFd);
+        return;
+    }
+
+    // Read the range and send it to the client chunk by chunk
+    char buffer[TRANSFER_CHUNK];
+    while (sent < header.length) {
+        size_t want = header.length - sent < (long long)sizeof(buffer) ? header.length - sent : sizeof(buffer);
+        ssize_t bytes_read = pread(fd, buffer, want, header.offset + sent);
+        if (bytes_read <= 0) {
+            break; // File shrank, the client sees a short range and can retry from there
+        }
+        ssize_t off = 0;
+        while (off < bytes_read) {
+            ssize_t written = client_write(clientFifoFd, buffer + off, bytes_read - off);
+            if (written == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                perror("write failed"); // Client went away, it resumes from what it stored
+                close(fd);
+                close(clientFifoFd);
+                return;
+            }
+            off += written;
+        }
+        sent += bytes_read;
+    }
+
+    close(fd);
+    close(clientFifoFd);
+}
+
+static int gz_pool_write(gz_pool *pool, const void *data, size_t len);
+
+static void tar_stream_flush(tar_stream *ts) {
+    if (ts->gz != NULL) {
+        if (!ts->failed && gz_pool_write(ts->gz, ts->buffer, ts->used) == -1) {
+            ts->failed = 1;
+        }
+        ts->streamBytes += ts->used;
+        ts->used = 0;
+        return;
+    }
+    size_t off = 0;
+    while (off < ts->used && !ts->failed) {
+        ssize_t written = client_write_data(ts->fd, ts->buffer + off, ts->used - off);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("write failed");
+            ts->failed = 1;
+            return;
+        }
+        off += written;
+    }
+    ts->streamBytes += ts->used;
+    ts->used = 0;
+}
+
+// Write bytes through the tar buffer, flushing to the client FIFO when it fills up
+static void tar_stream_write(tar_stream *ts, const void *data, size_t len) {
+    const char *src = data;
+    while (len > 0 && !ts->failed) {
+        size_t space = sizeof(ts->buffer) - ts->used;
+        size_t chunk = len < space ? len : space;
+        memcpy(ts->buffer + ts->used, src, chunk);
+        ts->used += chunk;
+        src += chunk;
+        len -= chunk;
+        if (ts->used == sizeof(ts->buffer)) {
+            tar_stream_flush(ts);
+        }
+    }
+}
+
+// Pad the current entry up to the next 512 byte tar block
+static void tar_stream_pad(tar_stream *ts, size_t len) {
+    static const char zeros[TAR_BLOCK_SIZE] = {0};
+    size_t rem = len % TAR_BLOCK_SIZE;
+    if (rem != 0) {
+        tar_stream_write(ts, zeros, TAR_BLOCK_SIZE - rem);
+    }
+}
+
+// Store a numeric header field as octal, or base-256 when it does not fit (e.g. files over 8 GB)
+static void tar_put_number(char *field, size_t width, unsigned long long value) {
+    unsigned long long limit = 1ULL << (3 * (width - 1));
+    if (value < limit) {
+        snprintf(field, width, "%0*llo", (int)(width - 1), value);
+        return;
+    }
+    memset(field, 0, width);
+    field[0] = (char)0x80;
+    for (size_t i = width - 1; i > 0 && value > 0; i--) {
+        field[i] = (char)(value & 0xff);
+        value >>= 8;
+    }
+}
+
+static void tar_write_raw_header(tar_stream *ts, const char *name, const char *prefix, const struct stat *st,
+                                 char type, unsigned long long size, const char *linkname) {
+    char header[TAR_BLOCK_SIZE] = {0};
+    strncpy(header, name, 100);
+    tar_put_number(header + 100, 8, st->st_mode & 07777);
+    tar_put_number(header + 108, 8, st->st_uid);
+    tar_put_number(header + 116, 8, st->st_gid);
+    tar_put_number(header + 124, 12, size);
+    tar_put_number(header + 136, 12, st->st_mtime);
+    header[156] = type;
+    if (linkname != NULL) {
+        strncpy(header + 157, linkname, 100);
+    }
+    memcpy(header + 257, "ustar", 6);
+    memcpy(header + 263, "00", 2);
+    if (prefix != NULL) {
+        strncpy(header + 345, prefix, 155);
+    }
+
+    // Checksum is computed with the checksum field itself filled with spaces
+    memset(header + 148, ' ', 8);
+    unsigned int sum = 0;
+    for (int i = 0; i < TAR_BLOCK_SIZE; i++) {
+        sum += (unsigned char)header[i];
+    }
+    snprintf(header + 148, 8, "%06o", sum);
+    header[155] = ' ';
+
+    tar_stream_write(ts, header, sizeof(header));
+}
+
+// GNU record holding a name too long for its header field, 'L' for the entry's path and 'K' for
+// its link target, read by tar in place of the field that follows
+static void tar_write_long_record(tar_stream *ts, const struct stat *st, char type, const char *text) {
+    size_t len = strlen(text);
+    struct stat longStat = *st;
+    longStat.st_mode = 0644;
+    tar_write_raw_header(ts, "././@LongLink", NULL, &longStat, type, len + 1, NULL);
+    tar_stream_write(ts, text, len + 1);
+    tar_stream_pad(ts, len + 1);
+}
+
+// Write the header of one entry, splitting long paths into prefix/name or using a GNU long name record.
+// Link targets over 100 bytes go in a GNU long link record.
+static void tar_write_header(tar_stream *ts, const char *path, const struct stat *st, char type,
+                             unsigned long long size, const char *linkname) {
+    if (linkname != NULL && strlen(linkname) > 100) {
+        tar_write_long_record(ts, st, 'K', linkname);
+    }
+    size_t len = strlen(path);
+    if (len <= 100) {
+        tar_write_raw_header(ts, path, NULL, st, type, size, linkname);
+        return;
+    }
+
+    // ustar allows a 155 byte prefix and a 100 byte name split on a '/'
+    for (const char *slash = strchr(path, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        size_t prefixLen = slash - path;
+        if (prefixLen <= 155 && len - prefixLen - 1 <= 100 && len - prefixLen - 1 > 0) {
+            char prefix[156];
+            memcpy(prefix, path, prefixLen);
+            prefix[prefixLen] = '\0';
+            tar_write_raw_header(ts, slash + 1, prefix, st, type, size, linkname);
+            return;
+        }
+    }
+
+    tar_write_long_record(ts, st, 'L', path);
+    tar_write_raw_header(ts, path, NULL, st, type, size, linkname);
+}
+
+// Copy exactly st_size bytes of a regular file, zero filling if it shrank while being read
+static void tar_write_file_data(tar_stream *ts, const char *fsPath, const struct stat *st) {
+    int fd = open(fsPath, O_RDONLY);
+    unsigned long long remaining = st->st_size;
+    char buffer[TAR_STREAM_BUFFER_SIZE];
+
+    while (fd != -1 && remaining > 0 && !ts->failed) {
+        size_t want = remaining < sizeof(buffer) ? remaining : sizeof(buffer);
+        ssize_t got = read(fd, buffer, want);
+        if (got == -1 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            break;
+        }
+        tar_stream_write(ts, buffer, got);
+        remaining -= got;
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+
+    memset(buffer, 0, sizeof(buffer));
+    while (remaining > 0 && !ts->failed) {
+        size_t chunk = remaining < sizeof(buffer) ? remaining : sizeof(buffer);
+        tar_stream_write(ts, buffer, chunk);
+        remaining -= chunk;
+    }
+    tar_stream_pad(ts, st->st_size);
+    ts->totalBytes += st->st_size;
+}
+
+// Archive one path; directories are walked recursively, FIFOs and other special files are skipped
+static void tar_add_path(tar_stream *ts, const char *fsPath, const char *archivePath, const char *exclude) {
+    struct stat st;
+    if (lstat(fsPath, &st) == -1) {
+        return;
+    }
+
+    if (S_ISREG(st.st_mode)) {
+        tar_write_header(ts, archivePath, &st, '0', st.st_size, NULL);
+        tar_write_file_data(ts, fsPath, &st);
+        ts->fileCount++;
+    }
+    else if (S_ISLNK(st.st_mode)) {
+        // A target that fills the buffer may be cut short, it is left out rather than pointing elsewhere
+        char target[4096];
+        ssize_t len = readlink(fsPath, target, sizeof(target));
+        if (len > 0 && len < (ssize_t)sizeof(target)) {
+            target[len] = '\0';
+            tar_write_header(ts, archivePath, &st, '2', 0, target);
+            ts->fileCount++;
+        }
+    }
+    else if (S_ISDIR(st.st_mode)) {
+        char dirPath[4096];
+        snprintf(dirPath, sizeof(dirPath), "%s/", archivePath);
+        tar_write_header(ts, dirPath, &st, '5', 0, NULL);
+
+        DIR *dir = opendir(fsPath);
+        if (dir == NULL) {
+            return;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL && !ts->failed) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                continue;
+            }
+            // Same semantics as tar --exclude <archive>: skip that name at any depth
+            if (exclude != NULL && strcmp(entry->d_name, exclude) == 0) {
+                continue;
+            }
+            // Stored contents are archived under their names
+            if (strcmp(archivePath, ".") == 0 && strcmp(entry->d_name, STORE_DIR) == 0) {
+                continue;
+            }
+            char childFs[4096];
+            char childArchive[4096];
+            snprintf(childFs, sizeof(childFs), "%s/%s", fsPath, entry->d_name);
+            snprintf(childArchive, sizeof(childArchive), "%s/%s", archivePath, entry->d_name);
+            tar_add_path(ts, childFs, childArchive, exclude);
+        }
+        closedir(dir);
+    }
+}
+
+// Stream root as a ustar archive into fd, members are named "./..." like tar -C root -cf - .
+int tar_stream_directory(tar_stream *ts, int fd, const char *root, const char *exclude, gz_pool *gz) {
+    memset(ts, 0, sizeof(*ts));
+    ts->fd = fd;
+    ts->gz = gz;
+
+    tar_add_path(ts, root, ".", exclude);
+
+    // End of archive marker is two zero filled blocks
+    static const char zeros[2 * TAR_BLOCK_SIZE] = {0};
+    tar_stream_write(ts, zeros, sizeof(zeros));
+    tar_stream_flush(ts);
+    return ts->failed ? -1 : 0;
+}
+
+// Compress one block as a complete gzip member
+static void gz_compress_slot(gz_slot *slot) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    // windowBits 15 + 16 asks zlib for a gzip header and trailer
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        slot->error = 1;
+        return;
+    }
+    zs.next_in = slot->in;
+    zs.avail_in = slot->inLen;
+    zs.next_out = slot->out;
+    zs.avail_out = deflateBound(&zs, GZ_BLOCK_SIZE) + 32;
+    if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+        slot->error = 1;
+    }
+    slot->outLen = zs.total_out;
+    deflateEnd(&zs);
+}
+
+static void *gz_worker(void *arg) {
+    gz_pool *pool = arg;
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        gz_slot *slot = NULL;
+        for (int i = 0; i < pool->slotCount; i++) {
+            gz_slot *candidate = &pool->slots[(pool->oldest + i) % pool->slotCount];
+            if (candidate->state == GZ_SLOT_FILLED) {
+                slot = candidate;
+                break;
+            }
+        }
+        if (slot == NULL) {
+            if (pool->shutdown) {
+                break;
+            }
+            pthread_cond_wait(&pool->work, &pool->lock);
+            continue;
+        }
+        slot->state = GZ_SLOT_BUSY;
+        pthread_mutex_unlock(&pool->lock);
+
+        gz_compress_slot(slot);
+
+        pthread_mutex_lock(&pool->lock);
+        slot->state = GZ_SLOT_DONE;
+        pthread_cond_broadcast(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+gz_pool *gz_pool_create(int fd, int threadCount) {
+    gz_pool *pool = calloc(1, sizeof(gz_pool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    if (threadCount > GZ_MAX_THREADS) {
+        threadCount = GZ_MAX_THREADS;
+    }
+    pool->fd = fd;
+    pool->slotCount = 2 * threadCount; // Producer fills ahead while workers compress
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    size_t outCap = compressBound(GZ_BLOCK_SIZE) + 64;
+    for (int i = 0; i < pool->slotCount; i++) {
+        pool->slots[i].in = malloc(GZ_BLOCK_SIZE);
+        pool->slots[i].out = malloc(outCap);
+        if (pool->slots[i].in == NULL || pool->slots[i].out == NULL) {
+            pool->failed = 1;
+        }
+    }
+    for (int i = 0; i < threadCount && !pool->failed; i++) {
+        if (pthread_create(&pool->threads[i], NULL, gz_worker, pool) != 0) {
+            break;
+        }
+        pool->threadCount++;
+    }
+    if (pool->threadCount == 0) {
+        pool->failed = 1;
+    }
+    return pool;
+}
+
+// Write the oldest slot once its worker is done; called with the lock held
+static void gz_pool_drain_oldest(gz_pool *pool) {
+    gz_slot *slot = &pool->slots[pool->oldest];
+    while (slot->state != GZ_SLOT_DONE) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (slot->error) {
+        pool->failed = 1;
+    }
+    size_t off = 0;
+    while (off < slot->outLen && !pool->failed) {
+        ssize_t written = client_write_data(pool->fd, slot->out + off, slot->outLen - off);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("write failed");
+            pool->failed = 1;
+            break;
+        }
+        off += written;
+    }
+    pool->outBytes += off;
+
+    pthread_mutex_lock(&pool->lock);
+    slot->state = GZ_SLOT_EMPTY;
+    slot->inLen = 0;
+    pool->oldest = (pool->oldest + 1) % pool->slotCount;
+}
+
+// Hand the block being filled to the workers and move to the next free slot
+static void gz_pool_dispatch(gz_pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->slots[pool->fill].state = GZ_SLOT_FILLED;
+    pthread_cond_signal(&pool->work);
+    pool->fill = (pool->fill + 1) % pool->slotCount;
+    // All slots in flight: write out members in order until the next one frees up
+    while (pool->slots[pool->fill].state != GZ_SLOT_EMPTY) {
+        gz_pool_drain_oldest(pool);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static int gz_pool_write(gz_pool *pool, const void *data, size_t len) {
+    if (pool == NULL || pool->failed) {
+        return -1;
+    }
+    const unsigned char *src = data;
+    pool->inBytes += len;
+    while (len > 0) {
+        gz_slot *slot = &pool->slots[pool->fill];
+        size_t chunk = GZ_BLOCK_SIZE - slot->inLen;
+        if (chunk > len) {
+            chunk = len;
+        }
+        memcpy(slot->in + slot->inLen, src, chunk);
+        slot->inLen += chunk;
+        src += chunk;
+        len -= chunk;
+        if (slot->inLen == GZ_BLOCK_SIZE) {
+            gz_pool_dispatch(pool);
+        }
+    }
+    return pool->failed ? -1 : 0;
+}
+
+// Compress the final partial block, write every member in order and stop the workers
+int gz_pool_finish(gz_pool *pool) {
+    if (pool == NULL) {
+        return -1;
+    }
+    if (!pool->failed && pool->slots[pool->fill].inLen > 0) {
+        gz_pool_dispatch(pool);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->slots[pool->oldest].state != GZ_SLOT_EMPTY) {
+        gz_pool_drain_oldest(pool);
+    }
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->threadCount; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    for (int i = 0; i < pool->slotCount; i++) {
+        free(pool->slots[i].in);
+        free(pool->slots[i].out);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->done);
+    return pool->failed ? -1 : 0;
+}
+
+// Main function
 int main(int argc, char *argv[]) {
     
     parentPID = getpid();
@@ -705,56 +3338,104 @@ int main(int argc, char *argv[]) {
 
     unlink(FIFO_PATH);
 
-    // Set up signal handler for SIGINT
-    signal(SIGINT, handle_sigint);
-
-    if (argc != 3) {
-        char msg[] = "Usage: <dirname> <maxClients>\n";
+    // The acceptor takes its signals from signalFd in the event loop, workers unblock them again
+    sigset_t acceptorSignals;
+    sigemptyset(&acceptorSignals);
+    sigaddset(&acceptorSignals, SIGCHLD);
+    sigaddset(&acceptorSignals, SIGINT);
+    sigaddset(&acceptorSignals, SIGTERM);
+    sigaddset(&acceptorSignals, SIGHUP);
+    sigprocmask(SIG_BLOCK, &acceptorSignals, NULL);
+
+    if (argc != 3 && (argc != 4 || strcmp(argv[3], "sync") != 0)) {
+        char msg[] = "Usage: <dirname> <maxClients> [sync]\n";
         write(STDERR_FILENO, msg, strlen(msg));
         exit(EXIT_FAILURE);
     }
 
     char *dirname = argv[1];    // Parse command line arguments
     maxClients = atoi(argv[2]);
-    char clientFIF[maxClients][50];
 
     initialize_server(dirname, maxClients);     // Initialize server
-    
-    signal(SIGCHLD, handle_child_termination);    // Set up signal handler for kill signal
+    store_sweep();
+
+    // sync: writeT appends are on disk (fdatasync) before the client gets its answer
+    appendLog = append_log_create(argc == 4);
+    metrics = metrics_create(maxClients);
+    snprintf(metricsPath, sizeof(metricsPath), "%s/%s", dirname, METRICS_FILE);
+    admission = admission_create(getpid(), maxClients);
+    if (appendLog == NULL || metrics == NULL || admission == NULL || open_server_fifo() == -1 ||
+        (signalFd = signalfd(-1, &acceptorSignals, SFD_NONBLOCK | SFD_CLOEXEC)) == -1) {
+        perror("server setup failed");
+        exit(EXIT_FAILURE);
+    }
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = serverFifoFd;
+    if (epollFd == -1 || epoll_ctl(epollFd, EPOLL_CTL_ADD, serverFifoFd, &ev) == -1) {
+        perror("epoll setup failed");
+        exit(EXIT_FAILURE);
+    }
+    ev.data.fd = signalFd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, signalFd, &ev) == -1) {
+        perror("epoll setup failed");
+        exit(EXIT_FAILURE);
+    }
 
     write(STDOUT_FILENO, ">> waiting for clients...\n", strlen(">> waiting for clients...\n"));
 
+    // The stats file is rewritten every METRICS_DUMP_INTERVAL seconds between events. While
+    // workers are asked to stop, the request is repeated every STOP_RESEND_INTERVAL seconds:
+    // one that arrived just before the worker started waiting for a request only set its flag.
+    uint64_t nextDumpUs = metrics_now_us() + METRICS_DUMP_INTERVAL * 1000000ULL;
     while (1) {
-        clientPID = accept_client(); 
-
-        if (clientPID == -1 ) {
-            char msg[] = "Error accepting client connection\n";
-            write(STDERR_FILENO, msg, strlen(msg));
-            continue; // Handle error and continue accepting connections
+        struct epoll_event events[8];
+        uint64_t nowUs = metrics_now_us();
+        if (nowUs >= nextDumpUs) {
+            metrics_dump();
+            nextDumpUs = nowUs + METRICS_DUMP_INTERVAL * 1000000ULL;
         }
-        if (is_client_connected(clientPID)) {
-            continue; // Handle error and continue accepting connections
+        if (draining && (currentClients == 0 || nowUs >= drainDeadlineUs)) {
+            shutdown_server();
         }
-        if (currentClients >= maxClients) {
-            char errorMsg[256];
-            snprintf(errorMsg, sizeof(errorMsg), ">> Connection request PID %d rejected. Queue FULL\n", clientPID);
-            write(STDOUT_FILENO, errorMsg, strlen(errorMsg));
-            write(logFile, errorMsg, strlen(errorMsg));
-            continue;
+        uint64_t wakeUs = nextDumpUs;
+        if (draining || retiringWorker != 0) {
+            uint64_t resendUs = stopSentUs + STOP_RESEND_INTERVAL * 1000000ULL;
+            if (nowUs >= resendUs) {
+                if (draining) {
+                    signal_workers(SIGUSR1);
+                }
+                else {
+                    kill(retiringWorker, SIGUSR2);
+                    stopSentUs = nowUs;
+                }
+                resendUs = nowUs + STOP_RESEND_INTERVAL * 1000000ULL;
+            }
+            wakeUs = resendUs < wakeUs ? resendUs : wakeUs;
+            if (draining && drainDeadlineUs < wakeUs) {
+                wakeUs = drainDeadlineUs;
+            }
+        }
+        int ready = epoll_wait(epollFd, events, 8, wakeUs > nowUs ? (int)((wakeUs - nowUs) / 1000) + 1 : 0);
+        if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait failed");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < ready; i++) {
+            if (events[i].data.fd == signalFd) {
+                handle_server_signals();
+            }
+            else if (accept_clients() == -1) {
+                char msg[] = "Error accepting client connection\n";
+                write(STDERR_FILENO, msg, strlen(msg));
+            }
         }
-        // Add the new client's PID to the array of connected clients
-        connected_clients[currentClients] = clientPID;
-
-        snprintf(clientName, 10, "client%02d", client_name_index++);
-
-        char msg[256];  // Print client's connection message
-        snprintf(msg, sizeof(msg), ">> Client PID %d connected as \"%s\"\n", clientPID, clientName);
-        write(STDOUT_FILENO, msg, strlen(msg));
-
-        handle_client_connection(clientPID);    // Handle client connection
-
-        currentClients++;   // Increment current clients count
-        
     }
 
     return 0;
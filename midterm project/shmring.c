@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "protocol.h"
+
+// Shared memory ring carrying the bulk data of a client's transfers, see protocol.h
+
+static int futex_wait(uint32_t *word, uint32_t expected, const struct timespec *timeout) {
+    return syscall(SYS_futex, word, FUTEX_WAIT, expected, timeout, NULL, 0);
+}
+
+static void futex_wake(uint32_t *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static char *ring_data(shm_ring *ring) {
+    return (char *)ring + SHM_RING_HEADER;
+}
+
+// Sleep until *word moves away from seen, checking every 100 ms that the other side is alive
+static int ring_wait(uint32_t *word, uint32_t seen, pid_t peer) {
+    struct timespec timeout = { 0, 100 * 1000 * 1000 };
+    if (futex_wait(word, seen, &timeout) == -1 && errno == ETIMEDOUT && kill(peer, 0) == -1 && errno == ESRCH) {
+        return -1;
+    }
+    return 0;
+}
+
+static shm_ring *ring_map(pid_t clientPid, int flags) {
+    char name[64];
+    snprintf(name, sizeof(name), SHM_RING_FORMAT, clientPid);
+    int fd = shm_open(name, flags, 0600);
+    if (fd == -1) {
+        return NULL;
+    }
+    if ((flags & O_CREAT) && ftruncate(fd, SHM_RING_HEADER + SHM_RING_SIZE) == -1) {
+        close(fd);
+        return NULL;
+    }
+    shm_ring *ring = mmap(NULL, SHM_RING_HEADER + SHM_RING_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return ring == MAP_FAILED ? NULL : ring;
+}
+
+// Client side: create an empty ring, the server's worker maps it on "transport shm"
+shm_ring *shm_ring_create(pid_t clientPid) {
+    shm_ring_destroy(clientPid);
+    shm_ring *ring = ring_map(clientPid, O_RDWR | O_CREAT | O_EXCL);
+    if (ring == NULL) {
+        return NULL;
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->eofAt = SHM_RING_OPEN;
+    return ring;
+}
+
+shm_ring *shm_ring_open(pid_t clientPid) {
+    return ring_map(clientPid, O_RDWR);
+}
+
+void shm_ring_close(shm_ring *ring) {
+    munmap(ring, SHM_RING_HEADER + SHM_RING_SIZE);
+}
+
+void shm_ring_destroy(pid_t clientPid) {
+    char name[64];
+    snprintf(name, sizeof(name), SHM_RING_FORMAT, clientPid);
+    shm_unlink(name);
+}
+
+// Producer: wait for free space, *area gets the contiguous part of it. -1 if the peer died.
+ssize_t shm_ring_reserve(shm_ring *ring, void **area, pid_t peer) {
+    while (1) {
+        uint32_t seen = __atomic_load_n(&ring->spaceSeq, __ATOMIC_ACQUIRE);
+        uint64_t head = ring->head;
+        uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (head - tail < SHM_RING_SIZE) {
+            size_t offset = head % SHM_RING_SIZE;
+            size_t free = SHM_RING_SIZE - (head - tail);
+            *area = ring_data(ring) + offset;
+            return free < SHM_RING_SIZE - offset ? free : SHM_RING_SIZE - offset;
+        }
+        if (ring_wait(&ring->spaceSeq, seen, peer) == -1) {
+            return -1;
+        }
+    }
+}
+
+void shm_ring_commit(shm_ring *ring, size_t len) {
+    __atomic_store_n(&ring->head, ring->head + len, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&ring->dataSeq, 1, __ATOMIC_RELEASE);
+    futex_wake(&ring->dataSeq);
+}
+
+// Producer: the current stream is complete
+void shm_ring_finish(shm_ring *ring) {
+    __atomic_store_n(&ring->eofAt, ring->head, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&ring->dataSeq, 1, __ATOMIC_RELEASE);
+    futex_wake(&ring->dataSeq);
+}
+
+// Consumer: wait for data, *area gets the contiguous part of it. Returns 0 at the end of the stream,
+// which also rearms the ring for the next one, and -1 if the peer died.
+ssize_t shm_ring_peek(shm_ring *ring, const void **area, pid_t peer) {
+    while (1) {
+        uint32_t seen = __atomic_load_n(&ring->dataSeq, __ATOMIC_ACQUIRE);
+        uint64_t tail = ring->tail;
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (head != tail) {
+            size_t offset = tail % SHM_RING_SIZE;
+            size_t available = head - tail;
+            *area = ring_data(ring) + offset;
+            return available < SHM_RING_SIZE - offset ? available : SHM_RING_SIZE - offset;
+        }
+        if (__atomic_load_n(&ring->eofAt, __ATOMIC_ACQUIRE) == tail) {
+            __atomic_store_n(&ring->eofAt, SHM_RING_OPEN, __ATOMIC_RELEASE);
+            return 0;
+        }
+        if (ring_wait(&ring->dataSeq, seen, peer) == -1) {
+            return -1;
+        }
+    }
+}
+
+void shm_ring_consume(shm_ring *ring, size_t len) {
+    __atomic_store_n(&ring->tail, ring->tail + len, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&ring->spaceSeq, 1, __ATOMIC_RELEASE);
+    futex_wake(&ring->spaceSeq);
+}
+
+// Copy a buffer into the ring, for producers that do not fill the ring in place
+int shm_ring_write(shm_ring *ring, const void *data, size_t len, pid_t peer) {
+    const char *src = data;
+    while (len > 0) {
+        void *area;
+        ssize_t room = shm_ring_reserve(ring, &area, peer);
+        if (room == -1) {
+            return -1;
+        }
+        // Commit cache sized pieces so the consumer copies them out while they are still warm
+        size_t chunk = (size_t)room < len ? (size_t)room : len;
+        chunk = chunk < TRANSFER_CHUNK ? chunk : TRANSFER_CHUNK;
+        memcpy(area, src, chunk);
+        shm_ring_commit(ring, chunk);
+        src += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+// Copy len bytes out of the ring, for consumers that need whole records. Returns fewer bytes only
+// at the end of the stream, which is then consumed, and -1 if the peer died.
+ssize_t shm_ring_read(shm_ring *ring, void *buf, size_t len, pid_t peer) {
+    char *dst = buf;
+    size_t got = 0;
+    while (got < len) {
+        const void *area;
+        ssize_t available = shm_ring_peek(ring, &area, peer);
+        if (available <= 0) {
+            return available == -1 ? -1 : (ssize_t)got;
+        }
+        size_t chunk = (size_t)available < len - got ? (size_t)available : len - got;
+        memcpy(dst + got, area, chunk);
+        shm_ring_consume(ring, chunk);
+        got += chunk;
+    }
+    return got;
+}